@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_TAG "Secril-Client-Mock"
+#include <cutils/log.h>
+
+/*
+ * Stand-in for libsecril-client: the client ABI used by the audio HAL,
+ * without rild. Calls take a scripted latency (in ms) and the first calls
+ * may be scripted to fail. The next ones may be scripted to drop the
+ * connection midway, as when rild restarts: they fail and the client stays
+ * disconnected until the next connect. The script is read at open, one
+ * call per line:
+ *
+ *   <call> <latency> <failures> <drops>
+ *   wb_amr <0|1>
+ *
+ * Calls are: open, connect, disconnect, close, volume, path, clock,
+ * twomic and wb_amr_get. Drops only apply to the last five. Lines starting
+ * with # are ignored.
+ *
+ * A hook set with secril_client_mock_hook_set() is called after each call,
+ * from the calling thread, so that test programs can tell which calls the
+ * HAL makes and with which of its locks held.
+ */
+
+#define SECRIL_CLIENT_MOCK_CONFIG_FILE	"/data/misc/audio/secril-client-mock.conf"
+#define SECRIL_CLIENT_MOCK_CONFIG_ENV	"SECRIL_CLIENT_MOCK_CONFIG"
+
+#define RIL_CLIENT_ERR_SUCCESS		0
+#define RIL_CLIENT_ERR_INIT		2
+#define RIL_CLIENT_ERR_CONNECT		4
+#define RIL_CLIENT_ERR_IO		5
+
+#define RIL_UNSOL_WB_AMR_STATE		11017
+
+#define SECRIL_CLIENT_MOCK_FAILED	1
+#define SECRIL_CLIENT_MOCK_DROPPED	2
+
+typedef int (*secril_client_mock_handler)(void *client, const void *data, size_t length);
+typedef void (*secril_client_mock_hook)(const char *call, int rc, void *data);
+
+enum secril_client_mock_call_type {
+	SECRIL_CLIENT_MOCK_OPEN,
+	SECRIL_CLIENT_MOCK_CONNECT,
+	SECRIL_CLIENT_MOCK_DISCONNECT,
+	SECRIL_CLIENT_MOCK_CLOSE,
+	SECRIL_CLIENT_MOCK_VOLUME,
+	SECRIL_CLIENT_MOCK_PATH,
+	SECRIL_CLIENT_MOCK_CLOCK,
+	SECRIL_CLIENT_MOCK_TWOMIC,
+	SECRIL_CLIENT_MOCK_WB_AMR_GET,
+	SECRIL_CLIENT_MOCK_CALL_MAX
+};
+
+struct secril_client_mock_call {
+	char *name;
+	int latency;
+	int failures;
+	int drops;
+
+	unsigned int count;
+	unsigned int failed;
+	unsigned int dropped;
+	int64_t time;
+};
+
+struct secril_client_mock {
+	struct secril_client_mock_call calls[SECRIL_CLIENT_MOCK_CALL_MAX];
+
+	int connected;
+	int wb_amr;
+	secril_client_mock_handler wb_amr_handler;
+
+	pthread_mutex_t lock;
+};
+
+static char *secril_client_mock_call_names[SECRIL_CLIENT_MOCK_CALL_MAX] = {
+	"open",
+	"connect",
+	"disconnect",
+	"close",
+	"volume",
+	"path",
+	"clock",
+	"twomic",
+	"wb_amr_get",
+};
+
+static secril_client_mock_hook secril_client_mock_hook_func = NULL;
+static void *secril_client_mock_hook_data = NULL;
+static pthread_mutex_t secril_client_mock_hook_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Script
+ */
+
+static int64_t secril_client_mock_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void secril_client_mock_script_load(struct secril_client_mock *mock)
+{
+	char line[128];
+	char name[32];
+	char *path;
+	FILE *f;
+	int latency;
+	int failures;
+	int drops;
+	int count;
+	int i;
+
+	path = getenv(SECRIL_CLIENT_MOCK_CONFIG_ENV);
+	if(path == NULL)
+		path = SECRIL_CLIENT_MOCK_CONFIG_FILE;
+
+	f = fopen(path, "r");
+	if(f == NULL) {
+		ALOGD("No script at %s, calls succeed immediately", path);
+		return;
+	}
+
+	while(fgets(line, sizeof(line), f) != NULL) {
+		if(line[0] == '#' || line[0] == '\n')
+			continue;
+
+		latency = 0;
+		failures = 0;
+		drops = 0;
+
+		count = sscanf(line, "%31s %d %d %d", name, &latency, &failures, &drops);
+		if(count < 2) {
+			ALOGE("Invalid script line: %s", line);
+			continue;
+		}
+
+		if(strcmp(name, "wb_amr") == 0) {
+			mock->wb_amr = latency;
+			continue;
+		}
+
+		for(i=0 ; i < SECRIL_CLIENT_MOCK_CALL_MAX ; i++) {
+			if(strcmp(name, mock->calls[i].name) == 0) {
+				mock->calls[i].latency = latency;
+				mock->calls[i].failures = failures;
+				mock->calls[i].drops = drops;
+				break;
+			}
+		}
+
+		if(i == SECRIL_CLIENT_MOCK_CALL_MAX)
+			ALOGE("Unknown call in script: %s", name);
+	}
+
+	fclose(f);
+}
+
+/*
+ * Calls are serialized, as with a single rild socket. Returns non-zero
+ * when the call is scripted to fail or to drop the connection.
+ */
+static int secril_client_mock_call(struct secril_client_mock *mock,
+	enum secril_client_mock_call_type type)
+{
+	struct secril_client_mock_call *call;
+	int64_t time;
+	int failed = 0;
+
+	call = &mock->calls[type];
+
+	time = secril_client_mock_time();
+
+	if(call->latency > 0)
+		usleep(call->latency * 1000);
+
+	call->count++;
+	call->time += secril_client_mock_time() - time;
+
+	if(call->failures > 0) {
+		call->failures--;
+		call->failed++;
+		failed = SECRIL_CLIENT_MOCK_FAILED;
+	} else if(call->drops > 0) {
+		call->drops--;
+		call->dropped++;
+		failed = SECRIL_CLIENT_MOCK_DROPPED;
+	}
+
+	return failed;
+}
+
+static void secril_client_mock_hook_call(enum secril_client_mock_call_type type, int rc)
+{
+	pthread_mutex_lock(&secril_client_mock_hook_lock);
+
+	if(secril_client_mock_hook_func != NULL)
+		secril_client_mock_hook_func(secril_client_mock_call_names[type], rc,
+			secril_client_mock_hook_data);
+
+	pthread_mutex_unlock(&secril_client_mock_hook_lock);
+}
+
+static void secril_client_mock_report(struct secril_client_mock *mock)
+{
+	struct secril_client_mock_call *call;
+	int i;
+
+	for(i=0 ; i < SECRIL_CLIENT_MOCK_CALL_MAX ; i++) {
+		call = &mock->calls[i];
+		if(call->count == 0)
+			continue;
+
+		ALOGD("%s: %u calls, %u failed, %u dropped, %lld us total, %lld us average",
+			call->name, call->count, call->failed, call->dropped, (long long) call->time,
+			(long long) (call->time / call->count));
+	}
+}
+
+/*
+ * Test hook
+ */
+
+void secril_client_mock_hook_set(secril_client_mock_hook hook, void *data)
+{
+	pthread_mutex_lock(&secril_client_mock_hook_lock);
+	secril_client_mock_hook_func = hook;
+	secril_client_mock_hook_data = data;
+	pthread_mutex_unlock(&secril_client_mock_hook_lock);
+}
+
+/*
+ * Client ABI
+ */
+
+void *OpenClient_RILD(void)
+{
+	struct secril_client_mock *mock;
+	int i;
+
+	mock = calloc(1, sizeof(struct secril_client_mock));
+	if(mock == NULL)
+		return NULL;
+
+	for(i=0 ; i < SECRIL_CLIENT_MOCK_CALL_MAX ; i++)
+		mock->calls[i].name = secril_client_mock_call_names[i];
+
+	pthread_mutex_init(&mock->lock, NULL);
+
+	secril_client_mock_script_load(mock);
+
+	if(secril_client_mock_call(mock, SECRIL_CLIENT_MOCK_OPEN)) {
+		secril_client_mock_hook_call(SECRIL_CLIENT_MOCK_OPEN, RIL_CLIENT_ERR_INIT);
+		pthread_mutex_destroy(&mock->lock);
+		free(mock);
+		return NULL;
+	}
+
+	secril_client_mock_hook_call(SECRIL_CLIENT_MOCK_OPEN, RIL_CLIENT_ERR_SUCCESS);
+
+	return mock;
+}
+
+int CloseClient_RILD(void *client)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+
+	if(mock == NULL)
+		return RIL_CLIENT_ERR_INIT;
+
+	pthread_mutex_lock(&mock->lock);
+	secril_client_mock_call(mock, SECRIL_CLIENT_MOCK_CLOSE);
+	secril_client_mock_report(mock);
+	pthread_mutex_unlock(&mock->lock);
+
+	secril_client_mock_hook_call(SECRIL_CLIENT_MOCK_CLOSE, RIL_CLIENT_ERR_SUCCESS);
+
+	pthread_mutex_destroy(&mock->lock);
+	free(mock);
+
+	return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int Connect_RILD(void *client)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+	int rc = RIL_CLIENT_ERR_SUCCESS;
+
+	if(mock == NULL)
+		return RIL_CLIENT_ERR_INIT;
+
+	pthread_mutex_lock(&mock->lock);
+
+	if(secril_client_mock_call(mock, SECRIL_CLIENT_MOCK_CONNECT))
+		rc = RIL_CLIENT_ERR_CONNECT;
+	else
+		mock->connected = 1;
+
+	pthread_mutex_unlock(&mock->lock);
+
+	secril_client_mock_hook_call(SECRIL_CLIENT_MOCK_CONNECT, rc);
+
+	return rc;
+}
+
+int isConnected_RILD(void *client)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+	int connected;
+
+	if(mock == NULL)
+		return 0;
+
+	pthread_mutex_lock(&mock->lock);
+	connected = mock->connected;
+	pthread_mutex_unlock(&mock->lock);
+
+	return connected;
+}
+
+int Disconnect_RILD(void *client)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+
+	if(mock == NULL)
+		return RIL_CLIENT_ERR_INIT;
+
+	pthread_mutex_lock(&mock->lock);
+	secril_client_mock_call(mock, SECRIL_CLIENT_MOCK_DISCONNECT);
+	mock->connected = 0;
+	pthread_mutex_unlock(&mock->lock);
+
+	secril_client_mock_hook_call(SECRIL_CLIENT_MOCK_DISCONNECT, RIL_CLIENT_ERR_SUCCESS);
+
+	return RIL_CLIENT_ERR_SUCCESS;
+}
+
+static int secril_client_mock_command(void *client,
+	enum secril_client_mock_call_type type)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+	int rc = RIL_CLIENT_ERR_SUCCESS;
+	int failed;
+
+	if(mock == NULL)
+		return RIL_CLIENT_ERR_INIT;
+
+	pthread_mutex_lock(&mock->lock);
+
+	if(!mock->connected) {
+		rc = RIL_CLIENT_ERR_CONNECT;
+	} else {
+		failed = secril_client_mock_call(mock, type);
+		if(failed)
+			rc = RIL_CLIENT_ERR_IO;
+
+		// The socket is gone until the client connects again
+		if(failed == SECRIL_CLIENT_MOCK_DROPPED)
+			mock->connected = 0;
+	}
+
+	pthread_mutex_unlock(&mock->lock);
+
+	secril_client_mock_hook_call(type, rc);
+
+	return rc;
+}
+
+int SetCallVolume(void *client, int sound_type, int volume)
+{
+	ALOGD("%s(%d, %d)", __func__, sound_type, volume);
+
+	return secril_client_mock_command(client, SECRIL_CLIENT_MOCK_VOLUME);
+}
+
+int SetCallAudioPath(void *client, int path)
+{
+	ALOGD("%s(%d)", __func__, path);
+
+	return secril_client_mock_command(client, SECRIL_CLIENT_MOCK_PATH);
+}
+
+int SetCallClockSync(void *client, int state)
+{
+	ALOGD("%s(%d)", __func__, state);
+
+	return secril_client_mock_command(client, SECRIL_CLIENT_MOCK_CLOCK);
+}
+
+int SetTwoMicControl(void *client, int device, int report)
+{
+	ALOGD("%s(%d, %d)", __func__, device, report);
+
+	return secril_client_mock_command(client, SECRIL_CLIENT_MOCK_TWOMIC);
+}
+
+int RegisterUnsolicitedHandler(void *client, uint32_t id, secril_client_mock_handler handler)
+{
+	struct secril_client_mock *mock = (struct secril_client_mock *) client;
+
+	if(mock == NULL)
+		return RIL_CLIENT_ERR_INIT;
+
+	if(id != RIL_UNSOL_WB_AMR_STATE)
+		return RIL_CLIENT_ERR_SUCCESS;
+
+	pthread_mutex_lock(&mock->lock);
+	mock->wb_amr_handler = handler;
+	pthread_mutex_unlock(&mock->lock);
+
+	return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int GetWB_AMR(void *client, secril_client_mock_handler handler)
+{
+	int wb_amr;
+	int rc;
+
+	rc = secril_client_mock_command(client, SECRIL_CLIENT_MOCK_WB_AMR_GET);
+	if(rc != RIL_CLIENT_ERR_SUCCESS)
+		return rc;
+
+	wb_amr = ((struct secril_client_mock *) client)->wb_amr;
+
+	// Handlers are called out of the lock, as from the rild reader thread
+	if(handler != NULL)
+		handler(client, &wb_amr, sizeof(wb_amr));
+
+	return RIL_CLIENT_ERR_SUCCESS;
+}
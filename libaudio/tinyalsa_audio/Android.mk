@@ -24,6 +24,11 @@ LOCAL_SRC_FILES := \
 	audio_out.c \
 	audio_in.c \
 	audio_ril_interface.c \
+	audio_route.c \
+	audio_lock.c \
+	audio_voice_bridge.c \
+	audio_mix.c \
+	audio_hdmi.c \
 	mixer.c
 
 LOCAL_C_INCLUDES += \
@@ -59,4 +64,6 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(LOCAL_PATH)/tests/Android.mk
+
 endif
@@ -0,0 +1,754 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "TinyALSA-Audio HDMI"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <cutils/log.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#define EFFECT_UUID_NULL EFFECT_UUID_NULL_HDMI
+#define EFFECT_UUID_NULL_STR EFFECT_UUID_NULL_STR_HDMI
+#include "audio_hw.h"
+#include "audio_hdmi.h"
+#include "mixer.h"
+
+/*
+ * Probe
+ */
+
+static audio_channel_mask_t audio_hdmi_channel_masks[] = {
+	AUDIO_CHANNEL_OUT_STEREO,
+	AUDIO_CHANNEL_OUT_5POINT1,
+	AUDIO_CHANNEL_OUT_7POINT1,
+};
+
+static char *audio_hdmi_channel_mask_names[] = {
+	"AUDIO_CHANNEL_OUT_STEREO",
+	"AUDIO_CHANNEL_OUT_5POINT1",
+	"AUDIO_CHANNEL_OUT_7POINT1",
+};
+
+static int audio_hdmi_rates[] = {
+	48000, 44100, 32000, 96000, 88200, 192000, 176400,
+};
+
+static int audio_hdmi_probe_config(struct tinyalsa_audio_hdmi *hdmi,
+	int channels, int rate)
+{
+	struct pcm_config pcm_config;
+	struct pcm *pcm;
+	int ready;
+
+	memset(&pcm_config, 0, sizeof(pcm_config));
+	pcm_config.channels = channels;
+	pcm_config.rate = rate;
+	pcm_config.format = PCM_FORMAT_S16_LE;
+	pcm_config.period_size = hdmi->mixer_props->period_size;
+	pcm_config.period_count = hdmi->mixer_props->period_count;
+
+	pcm = pcm_open(hdmi->mixer_props->card, hdmi->mixer_props->device, PCM_OUT, &pcm_config);
+	ready = pcm != NULL && pcm_is_ready(pcm);
+
+	if(pcm != NULL)
+		pcm_close(pcm);
+
+	return ready;
+}
+
+/*
+ * Rates are probed in stereo and channel counts at the first rate found,
+ * the previous results are kept while a stream holds the pcm.
+ */
+int audio_hdmi_probe(struct tinyalsa_audio_hdmi *hdmi)
+{
+	audio_channel_mask_t channel_masks[TINYALSA_AUDIO_HDMI_CHANNEL_MASKS_MAX];
+	int rates[TINYALSA_AUDIO_HDMI_RATES_MAX];
+	int channel_masks_count = 0;
+	int rates_count = 0;
+	int64_t time_start;
+	int busy;
+	int i;
+
+	if(hdmi == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+	busy = hdmi->data != NULL;
+	pthread_mutex_unlock(&hdmi->lock);
+
+	if(busy)
+		return 0;
+
+	time_start = audio_hw_time();
+
+	for(i=0 ; i < (int) (sizeof(audio_hdmi_rates) / sizeof(int)) ; i++) {
+		if(rates_count == TINYALSA_AUDIO_HDMI_RATES_MAX)
+			break;
+
+		if(audio_hdmi_probe_config(hdmi, 2, audio_hdmi_rates[i]))
+			rates[rates_count++] = audio_hdmi_rates[i];
+	}
+
+	if(rates_count == 0) {
+		ALOGE("No HDMI sink, or no rate accepted");
+		goto complete;
+	}
+
+	for(i=0 ; i < TINYALSA_AUDIO_HDMI_CHANNEL_MASKS_MAX ; i++) {
+		if(audio_hdmi_channel_masks[i] == AUDIO_CHANNEL_OUT_STEREO ||
+			audio_hdmi_probe_config(hdmi, popcount(audio_hdmi_channel_masks[i]), rates[0]))
+			channel_masks[channel_masks_count++] = audio_hdmi_channel_masks[i];
+	}
+
+complete:
+	pthread_mutex_lock(&hdmi->lock);
+
+	memcpy(hdmi->channel_masks, channel_masks, channel_masks_count * sizeof(audio_channel_mask_t));
+	hdmi->channel_masks_count = channel_masks_count;
+	memcpy(hdmi->rates, rates, rates_count * sizeof(int));
+	hdmi->rates_count = rates_count;
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	ALOGD("Probed %d channel masks and %d rates in %lld us", channel_masks_count,
+		rates_count, (long long) (audio_hw_time() - time_start));
+
+	return rates_count > 0 ? 0 : -1;
+}
+
+int audio_hdmi_supported(struct tinyalsa_audio_hdmi *hdmi,
+	audio_channel_mask_t channel_mask, int rate)
+{
+	int channel_mask_found = 0;
+	int rate_found = 0;
+	int i;
+
+	if(hdmi == NULL)
+		return 0;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	for(i=0 ; i < hdmi->channel_masks_count ; i++)
+		if(hdmi->channel_masks[i] == channel_mask)
+			channel_mask_found = 1;
+
+	for(i=0 ; i < hdmi->rates_count ; i++)
+		if(hdmi->rates[i] == rate)
+			rate_found = 1;
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return channel_mask_found && rate_found;
+}
+
+/*
+ * Stereo at the preferred rate the sink takes, for outputs opened without a
+ * config or with one the sink does not take.
+ */
+int audio_hdmi_get_default_config(struct tinyalsa_audio_hdmi *hdmi,
+	audio_channel_mask_t *channel_mask, int *rate)
+{
+	int rc = -1;
+
+	if(hdmi == NULL || channel_mask == NULL || rate == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	if(hdmi->rates_count > 0) {
+		*channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+		*rate = hdmi->rates[0];
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return rc;
+}
+
+static char *audio_hdmi_channel_mask_name(audio_channel_mask_t channel_mask)
+{
+	int i;
+
+	for(i=0 ; i < TINYALSA_AUDIO_HDMI_CHANNEL_MASKS_MAX ; i++)
+		if(audio_hdmi_channel_masks[i] == channel_mask)
+			return audio_hdmi_channel_mask_names[i];
+
+	return "";
+}
+
+/*
+ * Answers the supported channels and rates queries of dynamic output
+ * profiles, as "key=value|value" pairs.
+ */
+char *audio_hdmi_get_parameters(struct tinyalsa_audio_hdmi *hdmi, const char *keys)
+{
+	char buffer[256] = { 0 };
+	int length = 0;
+	int i;
+
+	if(hdmi == NULL || keys == NULL)
+		return strdup("");
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	if(strstr(keys, AUDIO_PARAMETER_STREAM_SUP_CHANNELS) != NULL) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%s=",
+			AUDIO_PARAMETER_STREAM_SUP_CHANNELS);
+
+		for(i=0 ; i < hdmi->channel_masks_count && length < (int) sizeof(buffer) ; i++)
+			length += snprintf(buffer + length, sizeof(buffer) - length, "%s%s",
+				i > 0 ? "|" : "", audio_hdmi_channel_mask_name(hdmi->channel_masks[i]));
+	}
+
+	if(strstr(keys, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES) != NULL && length < (int) sizeof(buffer)) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%s%s=",
+			length > 0 ? ";" : "", AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES);
+
+		for(i=0 ; i < hdmi->rates_count && length < (int) sizeof(buffer) ; i++)
+			length += snprintf(buffer + length, sizeof(buffer) - length, "%s%d",
+				i > 0 ? "|" : "", hdmi->rates[i]);
+	}
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return strdup(buffer);
+}
+
+/*
+ * Writer
+ */
+
+/*
+ * A pcm that failed to open is opened again on a later period, with a delay
+ * in us doubled after each failure.
+ */
+static int audio_hdmi_pcm_open(struct tinyalsa_audio_hdmi *hdmi)
+{
+	struct pcm_config pcm_config;
+	struct pcm *pcm;
+
+	memset(&pcm_config, 0, sizeof(pcm_config));
+	pcm_config.channels = hdmi->channels;
+	pcm_config.rate = hdmi->mixer_props->rate;
+	pcm_config.format = PCM_FORMAT_S16_LE;
+	pcm_config.period_size = hdmi->mixer_props->period_size;
+	pcm_config.period_count = hdmi->mixer_props->period_count;
+
+	pcm = pcm_open(hdmi->mixer_props->card, hdmi->mixer_props->device, PCM_OUT, &pcm_config);
+	if(pcm == NULL || !pcm_is_ready(pcm)) {
+		ALOGE("Unable to open pcm device: %s", pcm_get_error(pcm));
+		if(pcm != NULL)
+			pcm_close(pcm);
+
+		if(hdmi->pcm_retry_delay == 0)
+			hdmi->pcm_retry_delay = TINYALSA_AUDIO_HDMI_PCM_RETRY_MIN;
+		else if(hdmi->pcm_retry_delay < TINYALSA_AUDIO_HDMI_PCM_RETRY_MAX / 2)
+			hdmi->pcm_retry_delay *= 2;
+		else
+			hdmi->pcm_retry_delay = TINYALSA_AUDIO_HDMI_PCM_RETRY_MAX;
+
+		hdmi->pcm_retry_time = audio_hw_time() + hdmi->pcm_retry_delay;
+		return -1;
+	}
+
+	hdmi->pcm = pcm;
+	hdmi->pcm_retry_delay = 0;
+
+	return 0;
+}
+
+static void audio_hdmi_pcm_write(struct tinyalsa_audio_hdmi *hdmi, int channels)
+{
+	int period_size;
+	int rc;
+
+	period_size = hdmi->mixer_props->period_size;
+
+	if(hdmi->pcm == NULL && audio_hw_time() >= hdmi->pcm_retry_time)
+		audio_hdmi_pcm_open(hdmi);
+
+	// The stream is still paced at the hardware rate without a pcm
+	if(hdmi->pcm == NULL) {
+		hdmi->write_errors++;
+		usleep(period_size * 1000000LL / hdmi->mixer_props->rate);
+		return;
+	}
+
+	rc = pcm_write(hdmi->pcm, hdmi->buffer_out, period_size * channels * sizeof(int16_t));
+	if(rc != 0) {
+		ALOGE("pcm write failed!");
+		hdmi->write_errors++;
+	}
+
+	hdmi->periods++;
+}
+
+static void *audio_hdmi_thread(void *data)
+{
+	struct tinyalsa_audio_hdmi *hdmi;
+	int period_size;
+	int channels;
+	int startup;
+	int chunk;
+
+	hdmi = (struct tinyalsa_audio_hdmi *) data;
+	period_size = hdmi->mixer_props->period_size;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	while(1) {
+		if(!hdmi->active || hdmi->fill < period_size) {
+			if(!hdmi->running && hdmi->standby)
+				break;
+
+			if(!hdmi->standby && (!hdmi->active || !hdmi->running)) {
+				pthread_mutex_unlock(&hdmi->lock);
+
+				if(hdmi->pcm != NULL) {
+					pcm_close(hdmi->pcm);
+					hdmi->pcm = NULL;
+				}
+
+				hdmi->pcm_retry_delay = 0;
+
+				pthread_mutex_lock(&hdmi->lock);
+
+				hdmi->standby = 1;
+				pthread_cond_broadcast(&hdmi->space_cond);
+				continue;
+			}
+
+			pthread_cond_wait(&hdmi->cond, &hdmi->lock);
+			continue;
+		}
+
+		channels = hdmi->channels;
+
+		chunk = hdmi->size - hdmi->read;
+		if(chunk > period_size)
+			chunk = period_size;
+
+		memcpy(hdmi->buffer_out, hdmi->buffer + hdmi->read * channels,
+			chunk * channels * sizeof(int16_t));
+		memcpy(hdmi->buffer_out + chunk * channels, hdmi->buffer,
+			(period_size - chunk) * channels * sizeof(int16_t));
+
+		hdmi->read = (hdmi->read + period_size) % hdmi->size;
+		hdmi->fill -= period_size;
+
+		pthread_cond_broadcast(&hdmi->space_cond);
+
+		startup = hdmi->standby;
+		hdmi->standby = 0;
+
+		pthread_mutex_unlock(&hdmi->lock);
+
+		if(startup)
+			audio_hdmi_pcm_open(hdmi);
+
+		audio_hdmi_pcm_write(hdmi, channels);
+
+		pthread_mutex_lock(&hdmi->lock);
+	}
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return NULL;
+}
+
+/*
+ * Stream
+ */
+
+/*
+ * The gain goes by step from the one given, in Q(GAIN_SHIFT + 16), and is
+ * left where the ramp stopped. Gains are at most unity, no saturation is
+ * needed.
+ */
+static void audio_hdmi_gain(int16_t *samples_out, int16_t *samples_in, int frames,
+	int channels, int32_t *gain, int32_t step)
+{
+	int i, c;
+
+	for(i=0 ; i < frames ; i++) {
+		for(c=0 ; c < channels ; c++)
+			samples_out[i * channels + c] = (int16_t) (((int32_t) samples_in[i * channels + c] *
+				(*gain >> 16)) >> TINYALSA_AUDIO_MIX_GAIN_SHIFT);
+
+		*gain += step;
+	}
+}
+
+/*
+ * Blocks until the frames are in the ring, as a write to the pcm would.
+ * Returns the number of frames written, that is short when the stream is
+ * stopped meanwhile.
+ */
+int audio_hdmi_write(struct tinyalsa_audio_hdmi *hdmi, int16_t *buffer, int frames)
+{
+	int32_t gain;
+	int32_t step;
+	int target;
+	int channels;
+	int written = 0;
+	int index;
+	int count;
+	int chunk;
+
+	if(hdmi == NULL || buffer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	channels = hdmi->channels;
+
+	// Ramped over the frames written, from the gain the last write reached
+	target = hdmi->gain;
+	gain = hdmi->gain_current * 65536;
+	step = frames > 0 ? (target - hdmi->gain_current) * 65536 / frames : 0;
+
+	while(written < frames) {
+		while(hdmi->running && hdmi->active && hdmi->fill == hdmi->size)
+			pthread_cond_wait(&hdmi->space_cond, &hdmi->lock);
+
+		if(!hdmi->running || !hdmi->active)
+			break;
+
+		count = hdmi->size - hdmi->fill;
+		if(count > frames - written)
+			count = frames - written;
+
+		index = (hdmi->read + hdmi->fill) % hdmi->size;
+
+		chunk = hdmi->size - index;
+		if(chunk > count)
+			chunk = count;
+
+		if(step == 0 && target == TINYALSA_AUDIO_MIX_GAIN_UNITY) {
+			memcpy(hdmi->buffer + index * channels, buffer + written * channels,
+				chunk * channels * sizeof(int16_t));
+			memcpy(hdmi->buffer, buffer + (written + chunk) * channels,
+				(count - chunk) * channels * sizeof(int16_t));
+		} else {
+			audio_hdmi_gain(hdmi->buffer + index * channels, buffer + written * channels,
+				chunk, channels, &gain, step);
+			audio_hdmi_gain(hdmi->buffer, buffer + (written + chunk) * channels,
+				count - chunk, channels, &gain, step);
+		}
+
+		hdmi->fill += count;
+		written += count;
+
+		pthread_cond_signal(&hdmi->cond);
+	}
+
+	if(written == frames)
+		hdmi->gain_current = target;
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return written;
+}
+
+int audio_hdmi_start(struct tinyalsa_audio_hdmi *hdmi)
+{
+	if(hdmi == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	if(hdmi->data == NULL) {
+		pthread_mutex_unlock(&hdmi->lock);
+		return -1;
+	}
+
+	if(!hdmi->active) {
+		hdmi->active = 1;
+		hdmi->read = 0;
+		hdmi->fill = 0;
+
+		// Nothing was played since, there is nothing to ramp from
+		hdmi->gain_current = hdmi->gain;
+	}
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return 0;
+}
+
+/*
+ * Frames left in the ring are dropped.
+ */
+int audio_hdmi_stop(struct tinyalsa_audio_hdmi *hdmi)
+{
+	if(hdmi == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	hdmi->active = 0;
+	hdmi->fill = 0;
+
+	pthread_cond_broadcast(&hdmi->space_cond);
+	pthread_cond_signal(&hdmi->cond);
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return 0;
+}
+
+int audio_hdmi_set_gain(struct tinyalsa_audio_hdmi *hdmi, float gain)
+{
+	int value;
+
+	if(hdmi == NULL)
+		return -1;
+
+	if(gain < 0.0f)
+		gain = 0.0f;
+	else if(gain > 1.0f)
+		gain = 1.0f;
+
+	value = (int) (gain * TINYALSA_AUDIO_MIX_GAIN_UNITY + 0.5f);
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	if(hdmi->gain != value) {
+		hdmi->gain = value;
+		hdmi->gain_changes++;
+	}
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return 0;
+}
+
+/*
+ * Waits for the writer to close the pcm, so that the next stream may open
+ * it with another config.
+ */
+int audio_hdmi_release(struct tinyalsa_audio_hdmi *hdmi)
+{
+	if(hdmi == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	hdmi->active = 0;
+	hdmi->fill = 0;
+
+	pthread_cond_broadcast(&hdmi->space_cond);
+	pthread_cond_signal(&hdmi->cond);
+
+	while(!hdmi->standby)
+		pthread_cond_wait(&hdmi->space_cond, &hdmi->lock);
+
+	if(hdmi->buffer != NULL) {
+		free(hdmi->buffer);
+		hdmi->buffer = NULL;
+	}
+
+	hdmi->data = NULL;
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return 0;
+}
+
+/*
+ * Binds the HDMI pcm to a stream, with a probed config. Only one stream
+ * holds it at a time.
+ */
+int audio_hdmi_acquire(struct tinyalsa_audio_hdmi *hdmi, void *data,
+	audio_channel_mask_t channel_mask, int rate)
+{
+	int16_t *buffer;
+	int size;
+
+	if(hdmi == NULL || data == NULL)
+		return -1;
+
+	if(!audio_hdmi_supported(hdmi, channel_mask, rate)) {
+		ALOGE("Unsupported HDMI config: 0x%x at %d Hz", channel_mask, rate);
+		return -1;
+	}
+
+	size = hdmi->mixer_props->period_size * TINYALSA_AUDIO_HDMI_RING_PERIODS;
+
+	buffer = calloc(size * popcount(channel_mask), sizeof(int16_t));
+	if(buffer == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	if(hdmi->data != NULL) {
+		pthread_mutex_unlock(&hdmi->lock);
+		free(buffer);
+		return -1;
+	}
+
+	hdmi->data = data;
+	hdmi->channels = popcount(channel_mask);
+	hdmi->gain = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+	hdmi->gain_current = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+
+	hdmi->mixer_props->rate = rate;
+	hdmi->mixer_props->channel_mask = channel_mask;
+	hdmi->mixer_props->format = AUDIO_FORMAT_PCM_16_BIT;
+
+	hdmi->buffer = buffer;
+	hdmi->size = size;
+	hdmi->read = 0;
+	hdmi->fill = 0;
+	hdmi->active = 0;
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	return 0;
+}
+
+int audio_hdmi_dump(struct tinyalsa_audio_hdmi *hdmi, int fd)
+{
+	char buffer[256];
+	int length;
+
+	if(hdmi == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hdmi->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "HDMI: %d channel masks, %d rates, %s, %d channels at %d Hz, gain %d/%d, %u gain changes, %u periods, %u write errors\n",
+		hdmi->channel_masks_count, hdmi->rates_count,
+		hdmi->data == NULL ? "unused" : hdmi->standby ? "standby" : "running",
+		hdmi->channels, hdmi->mixer_props->rate, hdmi->gain, TINYALSA_AUDIO_MIX_GAIN_UNITY,
+		hdmi->gain_changes, hdmi->periods, hdmi->write_errors);
+
+	pthread_mutex_unlock(&hdmi->lock);
+
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	return 0;
+}
+
+/*
+ * Interface
+ */
+
+void audio_hdmi_close(struct tinyalsa_audio_hdmi *hdmi)
+{
+	ALOGD("%s(%p)", __func__, hdmi);
+
+	if(hdmi == NULL)
+		return;
+
+	pthread_mutex_lock(&hdmi->lock);
+	hdmi->running = 0;
+	pthread_cond_broadcast(&hdmi->space_cond);
+	pthread_cond_signal(&hdmi->cond);
+	pthread_mutex_unlock(&hdmi->lock);
+
+	pthread_join(hdmi->thread, NULL);
+
+	pthread_cond_destroy(&hdmi->space_cond);
+	pthread_cond_destroy(&hdmi->cond);
+	pthread_mutex_destroy(&hdmi->lock);
+
+	if(hdmi->buffer != NULL)
+		free(hdmi->buffer);
+
+	free(hdmi->buffer_out);
+	free(hdmi);
+}
+
+int audio_hdmi_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_hdmi **hdmi_p)
+{
+	struct tinyalsa_mixer_io_props *mixer_props;
+	struct tinyalsa_audio_hdmi *hdmi;
+	int rc;
+
+	ALOGD("%s(%p, %p)", __func__, device, hdmi_p);
+
+	if(device == NULL || device->mixer == NULL || hdmi_p == NULL)
+		return -1;
+
+	*hdmi_p = NULL;
+
+	mixer_props = tinyalsa_mixer_get_hdmi_props(device->mixer);
+	if(mixer_props == NULL) {
+		ALOGD("No HDMI pcm in the mixer config");
+		return 0;
+	}
+
+	// Default values
+	if(mixer_props->period_size == 0)
+		mixer_props->period_size = TINYALSA_AUDIO_HDMI_PERIOD_SIZE_DEFAULT;
+	if(mixer_props->period_count == 0)
+		mixer_props->period_count = TINYALSA_AUDIO_HDMI_PERIOD_COUNT_DEFAULT;
+
+	hdmi = calloc(1, sizeof(struct tinyalsa_audio_hdmi));
+	if(hdmi == NULL)
+		return -ENOMEM;
+
+	hdmi->device = device;
+	hdmi->mixer_props = mixer_props;
+	hdmi->standby = 1;
+	hdmi->running = 1;
+
+	// Room for the widest probed layout
+	hdmi->buffer_out = calloc(mixer_props->period_size * popcount(AUDIO_CHANNEL_OUT_7POINT1),
+		sizeof(int16_t));
+	if(hdmi->buffer_out == NULL)
+		goto error_hdmi;
+
+	pthread_mutex_init(&hdmi->lock, NULL);
+	pthread_cond_init(&hdmi->cond, NULL);
+	pthread_cond_init(&hdmi->space_cond, NULL);
+
+	rc = pthread_create(&hdmi->thread, NULL, audio_hdmi_thread, hdmi);
+	if(rc != 0) {
+		ALOGE("Unable to create HDMI thread");
+		goto error_thread;
+	}
+
+	*hdmi_p = hdmi;
+
+	return 0;
+
+error_thread:
+	pthread_cond_destroy(&hdmi->space_cond);
+	pthread_cond_destroy(&hdmi->cond);
+	pthread_mutex_destroy(&hdmi->lock);
+
+	free(hdmi->buffer_out);
+
+error_hdmi:
+	free(hdmi);
+
+	return -1;
+}
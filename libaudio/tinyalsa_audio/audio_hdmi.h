@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TINYALSA_AUDIO_HDMI_H
+#define TINYALSA_AUDIO_HDMI_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#include <system/audio.h>
+
+#define TINYALSA_AUDIO_HDMI_PERIOD_SIZE_DEFAULT		1024
+#define TINYALSA_AUDIO_HDMI_PERIOD_COUNT_DEFAULT	4
+#define TINYALSA_AUDIO_HDMI_RING_PERIODS		2
+
+#define TINYALSA_AUDIO_HDMI_PCM_RETRY_MIN		20000
+#define TINYALSA_AUDIO_HDMI_PCM_RETRY_MAX		1000000
+
+#define TINYALSA_AUDIO_HDMI_CHANNEL_MASKS_MAX		3
+#define TINYALSA_AUDIO_HDMI_RATES_MAX			8
+
+#ifndef AUDIO_PARAMETER_STREAM_SUP_CHANNELS
+#define AUDIO_PARAMETER_STREAM_SUP_CHANNELS		"sup_channels"
+#endif
+#ifndef AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES
+#define AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES	"sup_sampling_rates"
+#endif
+
+/*
+ * Output to the HDMI pcm, for a single stream at a time. Channel counts and
+ * rates the sink takes are probed with pcm_open when an HDMI output is
+ * opened, so that multichannel PCM is passed through without downmixing.
+ *
+ * The stream writes into a ring that a writer thread drains into the pcm,
+ * the HDMI link never holds up the mix and the primary output.
+ */
+struct tinyalsa_audio_hdmi {
+	struct tinyalsa_audio_device *device;
+	struct tinyalsa_mixer_io_props *mixer_props;
+
+	audio_channel_mask_t channel_masks[TINYALSA_AUDIO_HDMI_CHANNEL_MASKS_MAX];
+	int channel_masks_count;
+	int rates[TINYALSA_AUDIO_HDMI_RATES_MAX];
+	int rates_count;
+
+	void *data;
+	int channels;
+	int gain;
+	int gain_current;
+	unsigned int gain_changes;
+
+	struct pcm *pcm;
+	int64_t pcm_retry_time;
+	int pcm_retry_delay;
+	int standby;
+
+	int16_t *buffer;
+	int size;
+	int read;
+	int fill;
+	int active;
+
+	int16_t *buffer_out;
+
+	unsigned int periods;
+	unsigned int write_errors;
+
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t space_cond;
+};
+
+int audio_hdmi_probe(struct tinyalsa_audio_hdmi *hdmi);
+int audio_hdmi_supported(struct tinyalsa_audio_hdmi *hdmi,
+	audio_channel_mask_t channel_mask, int rate);
+int audio_hdmi_get_default_config(struct tinyalsa_audio_hdmi *hdmi,
+	audio_channel_mask_t *channel_mask, int *rate);
+char *audio_hdmi_get_parameters(struct tinyalsa_audio_hdmi *hdmi, const char *keys);
+
+int audio_hdmi_write(struct tinyalsa_audio_hdmi *hdmi, int16_t *buffer, int frames);
+int audio_hdmi_start(struct tinyalsa_audio_hdmi *hdmi);
+int audio_hdmi_stop(struct tinyalsa_audio_hdmi *hdmi);
+int audio_hdmi_set_gain(struct tinyalsa_audio_hdmi *hdmi, float gain);
+int audio_hdmi_release(struct tinyalsa_audio_hdmi *hdmi);
+int audio_hdmi_acquire(struct tinyalsa_audio_hdmi *hdmi, void *data,
+	audio_channel_mask_t channel_mask, int rate);
+
+int audio_hdmi_dump(struct tinyalsa_audio_hdmi *hdmi, int fd);
+
+void audio_hdmi_close(struct tinyalsa_audio_hdmi *hdmi);
+int audio_hdmi_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_hdmi **hdmi_p);
+
+#endif
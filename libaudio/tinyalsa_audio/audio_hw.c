@@ -20,11 +20,14 @@
 
 #define LOG_TAG "TinyALSA-Audio Hardware"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <cutils/str_parms.h>
 #include <cutils/log.h>
@@ -40,6 +43,15 @@
  * Functions
  */
 
+int64_t audio_hw_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static int audio_hw_init_check(const struct audio_hw_device *dev)
 {
 	struct tinyalsa_audio_device *device;
@@ -57,10 +69,24 @@ static int audio_hw_init_check(const struct audio_hw_device *dev)
 	return 0;
 }
 
+/*
+ * Called with the device lock held.
+ */
+static audio_devices_t audio_hw_device_modem(struct tinyalsa_audio_device *device)
+{
+	if(device->ril_interface != NULL)
+		return device->ril_interface->device_current;
+	else if(device->stream_out != NULL)
+		return device->stream_out->device_current;
+	else
+		return AUDIO_DEVICE_OUT_EARPIECE;
+}
+
 static int audio_hw_set_voice_volume(struct audio_hw_device *dev, float volume)
 {
 	struct tinyalsa_audio_device *device;
 	audio_devices_t device_modem;
+	int in_call;
 
 	ALOGD("%s(%p, %f)++", __func__, dev, volume);
 
@@ -73,16 +99,15 @@ static int audio_hw_set_voice_volume(struct audio_hw_device *dev, float volume)
 		return -1;
 
 	if(volume != device->voice_volume) {
-		pthread_mutex_lock(&device->lock);
+		audio_lock_lock(&device->hw_lock);
 
-		if(device->mode == AUDIO_MODE_IN_CALL) {
-			if(device->ril_interface != NULL)
-				device_modem = device->ril_interface->device_current;
-			else if(device->stream_out != NULL)
-				device_modem = device->stream_out->device_current;
-			else
-				device_modem = AUDIO_DEVICE_OUT_EARPIECE;
+		audio_lock_lock(&device->lock);
+		in_call = device->mode == AUDIO_MODE_IN_CALL;
+		device_modem = audio_hw_device_modem(device);
+		device->voice_volume = volume;
+		audio_lock_unlock(&device->lock);
 
+		if(in_call) {
 			tinyalsa_mixer_set_voice_volume(device->mixer,
 				device_modem, volume);
 
@@ -90,9 +115,7 @@ static int audio_hw_set_voice_volume(struct audio_hw_device *dev, float volume)
 				audio_ril_interface_set_voice_volume(device->ril_interface, device_modem, volume);
 		}
 
-		device->voice_volume = volume;
-
-		pthread_mutex_unlock(&device->lock);
+		audio_lock_unlock(&device->hw_lock);
 	}
 
 	ALOGD("%s(%p, %f)--", __func__, dev, volume);
@@ -114,9 +137,7 @@ static int audio_hw_set_master_volume(struct audio_hw_device *dev, float volume)
 	if(device->mixer == NULL)
 		return -1;
 
-	pthread_mutex_lock(&device->lock);
 	tinyalsa_mixer_set_master_volume(device->mixer, volume);
-	pthread_mutex_unlock(&device->lock);
 
 	ALOGD("%s(%p, %f)--", __func__, dev, volume);
 
@@ -128,6 +149,9 @@ static int audio_hw_set_mode(struct audio_hw_device *dev, int mode)
 	struct tinyalsa_audio_ril_interface *ril_interface;
 	struct tinyalsa_audio_device *device;
 	audio_devices_t device_modem;
+	audio_mode_t mode_previous;
+	float voice_volume;
+	int64_t time_start;
 	int rc;
 
 	ALOGD("%s(%p, %d)++", __func__, dev, mode);
@@ -138,40 +162,58 @@ static int audio_hw_set_mode(struct audio_hw_device *dev, int mode)
 	device = (struct tinyalsa_audio_device *) dev;
 
 	if(mode != device->mode) {
-		pthread_mutex_lock(&device->lock);
+		audio_lock_lock(&device->hw_lock);
 
-		if(mode == AUDIO_MODE_IN_CALL) {
-			tinyalsa_mixer_set_modem_state(device->mixer, 1);
+		time_start = audio_hw_time();
 
-			if(device->stream_out != NULL)
-				device_modem = device->stream_out->device_current;
-			else
-				device_modem = AUDIO_DEVICE_OUT_EARPIECE;
+		audio_lock_lock(&device->lock);
+
+		mode_previous = device->mode;
+		voice_volume = device->voice_volume;
+
+		if(device->stream_out != NULL)
+			device_modem = device->stream_out->device_current;
+		else
+			device_modem = AUDIO_DEVICE_OUT_EARPIECE;
 
+		audio_lock_unlock(&device->lock);
+
+		if(mode == AUDIO_MODE_IN_CALL) {
+			// Calls start narrowband until the modem reports WB-AMR
+			tinyalsa_mixer_set_modem_rate(device->mixer, TINYALSA_AUDIO_RIL_RATE_NB);
+			tinyalsa_mixer_set_modem_state(device->mixer, 1);
 			tinyalsa_mixer_set_device(device->mixer, device_modem);
 
 #ifdef YAMAHA_MC1N2_AUDIO
+			yamaha_mc1n2_audio_set_modem_rate(device->mc1n2_pdata, TINYALSA_AUDIO_RIL_RATE_NB);
+
 			rc = yamaha_mc1n2_audio_modem_start(device->mc1n2_pdata);
 			if(rc < 0) {
 				ALOGE("Failed to set Yamaha-MC1N2-Audio route");
 			}
 #endif
 
-			rc = audio_ril_interface_open((struct audio_hw_device *) device, device_modem, &ril_interface);
-			if(rc < 0 || ril_interface == NULL) {
-				ALOGE("Failed to open RIL interface");
-				device->ril_interface = NULL;
-			} else {
-				device->ril_interface = ril_interface;
+			if(device->voice_bridge != NULL)
+				audio_voice_bridge_update(device->voice_bridge, 1, device_modem,
+					TINYALSA_AUDIO_RIL_RATE_NB);
+
+			// The RIL session is kept open, calls only need the commands
+			ril_interface = device->ril_interface;
+			if(ril_interface != NULL) {
+				audio_ril_interface_set_route(ril_interface, device_modem);
+				audio_ril_interface_query_wb_amr(ril_interface);
 
 				//Only enable dualmic for earpiece.
 				if(device_modem == AUDIO_DEVICE_OUT_EARPIECE)
 				  audio_ril_interface_set_twomic(ril_interface,TWO_MIC_SOLUTION_ON);
 
-				if(device->voice_volume)
-					audio_ril_interface_set_voice_volume(ril_interface, device_modem, device->voice_volume);
+				if(voice_volume)
+					audio_ril_interface_set_voice_volume(ril_interface, device_modem, voice_volume);
 			}
-		} else if(device->mode == AUDIO_MODE_IN_CALL) {
+		} else if(mode_previous == AUDIO_MODE_IN_CALL) {
+			if(device->voice_bridge != NULL)
+				audio_voice_bridge_update(device->voice_bridge, 0, 0, 0);
+
 			tinyalsa_mixer_set_modem_state(device->mixer, 0);
 
 			/* 
@@ -189,15 +231,17 @@ static int audio_hw_set_mode(struct audio_hw_device *dev, int mode)
 				ALOGE("Failed to set Yamaha-MC1N2-Audio route");
 			}
 #endif
-
-			if(device->ril_interface != NULL) {
-				audio_ril_interface_close((struct audio_hw_device *) device, device->ril_interface);
-			}
 		}
 
+		audio_lock_lock(&device->lock);
 		device->mode = mode;
+		audio_lock_unlock(&device->lock);
+
+		// RIL commands are queued, this only accounts for the codec and mixer
+		ALOGD("Mode %d set in %lld us", mode,
+			(long long) (audio_hw_time() - time_start));
 
-		pthread_mutex_unlock(&device->lock);
+		audio_lock_unlock(&device->hw_lock);
 	}
 
 	ALOGD("%s(%p, %d)--", __func__, dev, mode);
@@ -209,6 +253,8 @@ static int audio_hw_set_mic_mute(struct audio_hw_device *dev, bool state)
 {
 	struct tinyalsa_audio_device *device;
 	audio_devices_t device_modem;
+	audio_devices_t device_in;
+	int in_call;
 
 	ALOGD("%s(%p, %d)++", __func__, dev, state);
 
@@ -221,31 +267,29 @@ static int audio_hw_set_mic_mute(struct audio_hw_device *dev, bool state)
 		return -1;
 
 	if(device->mic_mute != state) {
-		pthread_mutex_lock(&device->lock);
+		audio_lock_lock(&device->hw_lock);
 
-		if(device->mode == AUDIO_MODE_IN_CALL) {
-			if(device->ril_interface != NULL)
-				device_modem = device->ril_interface->device_current;
-			else if(device->stream_out != NULL)
-				device_modem = device->stream_out->device_current;
-			else
-				device_modem = AUDIO_DEVICE_OUT_EARPIECE;
+		audio_lock_lock(&device->lock);
+		in_call = device->mode == AUDIO_MODE_IN_CALL;
+		device_modem = audio_hw_device_modem(device);
+		device_in = device->stream_in != NULL ? device->stream_in->device_current : 0;
+		device->mic_mute = state;
+		audio_lock_unlock(&device->lock);
 
+		if(in_call) {
 			tinyalsa_mixer_set_mic_mute(device->mixer,
 				device_modem, state);
 
 			if(device->ril_interface != NULL)
 				audio_ril_interface_set_mic_mute(device->ril_interface, state);
 		} else {
-			if(device->stream_in != NULL) {
+			if(device_in != 0) {
 				tinyalsa_mixer_set_mic_mute(device->mixer,
-					device->stream_in->device_current, state);
+					device_in, state);
 			}
 		}
 
-		device->mic_mute = state;
-
-		pthread_mutex_unlock(&device->lock);
+		audio_lock_unlock(&device->hw_lock);
 	}
 
 	ALOGD("%s(%p, %d)--", __func__, dev, state);
@@ -272,9 +316,12 @@ static int audio_hw_get_mic_mute(const struct audio_hw_device *dev, bool *state)
 static int audio_hw_set_parameters(struct audio_hw_device *dev,
 	const char *kvpairs)
 {
+	struct tinyalsa_audio_stream_out *stream_out;
+	struct tinyalsa_audio_stream_in *stream_in;
 	struct tinyalsa_audio_device *device;
 	struct str_parms *parms;
 	char value_string[32] = { 0 };
+	int handled = 0;
 	int value;
 	int rc;
 
@@ -292,33 +339,74 @@ static int audio_hw_set_parameters(struct audio_hw_device *dev,
 	if(parms == NULL)
 		return -1;
 
+#ifdef YAMAHA_MC1N2_AUDIO
+	rc = str_parms_get_str(parms, YAMAHA_MC1N2_AUDIO_AE_PRESET_RELOAD_KEY, value_string, sizeof(value_string));
+	if(rc >= 0) {
+		rc = yamaha_mc1n2_audio_ae_presets_reload(device->mc1n2_pdata);
+		if(rc < 0)
+			ALOGE("Failed to reload Yamaha-MC1N2-Audio AE presets");
+
+		handled = 1;
+	}
+
+	rc = str_parms_get_str(parms, YAMAHA_MC1N2_AUDIO_AE_PRESET_KEY, value_string, sizeof(value_string));
+	if(rc >= 0) {
+		rc = yamaha_mc1n2_audio_ae_preset_set(device->mc1n2_pdata, value_string);
+		if(rc < 0)
+			ALOGE("Failed to set Yamaha-MC1N2-Audio AE preset: %s", value_string);
+
+		handled = 1;
+	}
+#endif
+
+	// Larger periods with the screen off, switched at a standby or silence
+	rc = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_SCREEN_STATE, value_string, sizeof(value_string));
+	if(rc >= 0) {
+		if(strcmp(value_string, AUDIO_PARAMETER_VALUE_OFF) == 0)
+			audio_mix_set_profile(device->mix, TINYALSA_AUDIO_MIX_PROFILE_SCREEN_OFF);
+		else
+			audio_mix_set_profile(device->mix, TINYALSA_AUDIO_MIX_PROFILE_SCREEN_ON);
+
+		handled = 1;
+	}
+
 	rc = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value_string, sizeof(value_string));
-	if(rc < 0)
+	if(rc < 0) {
+		if(handled)
+			goto complete;
+
 		goto error_params;
+	}
 
 	value = atoi(value_string);
 
-	pthread_mutex_lock(&device->lock);
-
-	if(audio_is_output_device((audio_devices_t) value)) {
-		if(device->stream_out != NULL && device->stream_out->device_current != (audio_devices_t) value) {
-			pthread_mutex_lock(&device->stream_out->lock);
-			audio_out_set_route(device->stream_out, (audio_devices_t) value);
-			pthread_mutex_unlock(&device->stream_out->lock);
+	// The streams are not freed until the streams lock is released
+	audio_lock_lock(&device->streams_lock);
+
+	audio_lock_lock(&device->lock);
+	stream_out = device->stream_out;
+	stream_in = device->stream_in;
+	audio_lock_unlock(&device->lock);
+
+	if(tinyalsa_mixer_is_output_device((audio_devices_t) value)) {
+		if(stream_out != NULL && stream_out->device_current != (audio_devices_t) value) {
+			audio_lock_lock(&stream_out->lock);
+			audio_out_set_route(stream_out, (audio_devices_t) value, NULL);
+			audio_lock_unlock(&stream_out->lock);
+		} else if(device->ril_interface != NULL && device->ril_interface->device_current != (audio_devices_t) value) {
+			audio_route_queue(device->route, (audio_devices_t) value, NULL);
 		}
-		if(device->ril_interface != NULL && device->ril_interface->device_current != (audio_devices_t) value) {
-			audio_ril_interface_set_route(device->ril_interface, (audio_devices_t) value);
-		}
-	} else if(audio_is_input_device((audio_devices_t) value)) {
-		if(device->stream_in != NULL && device->stream_in->device_current != (audio_devices_t) value) {
-			pthread_mutex_lock(&device->stream_in->lock);
-			audio_in_set_route(device->stream_in, (audio_devices_t) value);
-			pthread_mutex_unlock(&device->stream_in->lock);
+	} else if(tinyalsa_mixer_is_input_device((audio_devices_t) value)) {
+		if(stream_in != NULL && stream_in->device_current != (audio_devices_t) value) {
+			audio_lock_lock(&stream_in->lock);
+			audio_in_set_route(stream_in, (audio_devices_t) value, NULL);
+			audio_lock_unlock(&stream_in->lock);
 		}
 	}
 
-	pthread_mutex_unlock(&device->lock);
+	audio_lock_unlock(&device->streams_lock);
 
+complete:
 	str_parms_destroy(parms);
 
 	ALOGD("%s(%p, %s)--", __func__, dev, kvpairs);
@@ -333,6 +421,88 @@ error_params:
 	return -1;
 }
 
+/*
+ * Reads the latency keys over the current geometry, given in period_size
+ * and period_count. Returns 1 when a valid geometry is asked for, 0 without
+ * latency keys and -1 when out of bounds.
+ */
+int audio_hw_period_parse(struct str_parms *parms, int rate,
+	int *period_size, int *period_count)
+{
+	char value_string[32] = { 0 };
+	int handled = 0;
+	int latency;
+	int rc;
+
+	if(parms == NULL || rate <= 0 || period_size == NULL || period_count == NULL)
+		return -1;
+
+	rc = str_parms_get_str(parms, TINYALSA_AUDIO_PARAMETER_PERIOD_COUNT, value_string, sizeof(value_string));
+	if(rc >= 0) {
+		*period_count = atoi(value_string);
+		handled = 1;
+	}
+
+	rc = str_parms_get_str(parms, TINYALSA_AUDIO_PARAMETER_PERIOD_SIZE, value_string, sizeof(value_string));
+	if(rc >= 0) {
+		*period_size = atoi(value_string);
+		handled = 1;
+	} else {
+		rc = str_parms_get_str(parms, TINYALSA_AUDIO_PARAMETER_LATENCY, value_string, sizeof(value_string));
+		if(rc >= 0) {
+			latency = atoi(value_string);
+			if(latency > 0 && latency <= 10000 && *period_count > 0)
+				*period_size = (int) (((int64_t) latency * rate) /
+					(1000 * *period_count));
+			else
+				*period_size = 0;
+
+			handled = 1;
+		}
+	}
+
+	if(!handled)
+		return 0;
+
+	// Periods are resampled and mixed by chunks of 16 frames
+	*period_size &= ~15;
+
+	if(*period_size < TINYALSA_AUDIO_PERIOD_SIZE_MIN || *period_size > TINYALSA_AUDIO_PERIOD_SIZE_MAX ||
+		*period_count < TINYALSA_AUDIO_PERIOD_COUNT_MIN || *period_count > TINYALSA_AUDIO_PERIOD_COUNT_MAX) {
+		ALOGE("Invalid period geometry: %d frames, %d periods", *period_size, *period_count);
+		return -1;
+	}
+
+	return 1;
+}
+
+char *audio_hw_period_get_parameters(int rate, int period_size, int period_count,
+	const char *keys)
+{
+	char buffer[128] = { 0 };
+	int length = 0;
+
+	if(keys == NULL || rate <= 0)
+		return strdup("");
+
+	if(strstr(keys, TINYALSA_AUDIO_PARAMETER_PERIOD_SIZE) != NULL)
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%s%s=%d",
+			length > 0 ? ";" : "", TINYALSA_AUDIO_PARAMETER_PERIOD_SIZE,
+			period_size);
+
+	if(strstr(keys, TINYALSA_AUDIO_PARAMETER_PERIOD_COUNT) != NULL && length < (int) sizeof(buffer))
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%s%s=%d",
+			length > 0 ? ";" : "", TINYALSA_AUDIO_PARAMETER_PERIOD_COUNT,
+			period_count);
+
+	if(strstr(keys, TINYALSA_AUDIO_PARAMETER_LATENCY) != NULL && length < (int) sizeof(buffer))
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%s%s=%d",
+			length > 0 ? ";" : "", TINYALSA_AUDIO_PARAMETER_LATENCY,
+			period_size * period_count * 1000 / rate);
+
+	return strdup(buffer);
+}
+
 static char *audio_hw_get_parameters(const struct audio_hw_device *dev,
 	const char *keys)
 {
@@ -379,8 +549,55 @@ static size_t audio_hw_get_input_buffer_size(const struct audio_hw_device *dev,
 
 static int audio_hw_dump(const audio_hw_device_t *device, int fd)
 {
+	struct tinyalsa_audio_device *tinyalsa_audio_device;
+	struct tinyalsa_audio_stream_out *stream_out;
+	struct tinyalsa_audio_stream_in *stream_in;
+
 	ALOGD("%s(%p, %d)", __func__, device, fd);
 
+	if(device == NULL)
+		return -1;
+
+	tinyalsa_audio_device = (struct tinyalsa_audio_device *) device;
+
+	if(tinyalsa_audio_device->mixer != NULL)
+		tinyalsa_mixer_dump(tinyalsa_audio_device->mixer, fd);
+
+	if(tinyalsa_audio_device->route != NULL)
+		audio_route_dump(tinyalsa_audio_device->route, fd);
+
+	if(tinyalsa_audio_device->voice_bridge != NULL)
+		audio_voice_bridge_dump(tinyalsa_audio_device->voice_bridge, fd);
+
+	if(tinyalsa_audio_device->mix != NULL)
+		audio_mix_dump(tinyalsa_audio_device->mix, fd);
+
+	if(tinyalsa_audio_device->hdmi != NULL)
+		audio_hdmi_dump(tinyalsa_audio_device->hdmi, fd);
+
+	audio_lock_dump(&tinyalsa_audio_device->lock, fd);
+	audio_lock_dump(&tinyalsa_audio_device->hw_lock, fd);
+	audio_lock_dump(&tinyalsa_audio_device->streams_lock, fd);
+
+	audio_lock_lock(&tinyalsa_audio_device->streams_lock);
+
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	stream_out = tinyalsa_audio_device->stream_out;
+	stream_in = tinyalsa_audio_device->stream_in;
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
+
+	if(stream_out != NULL)
+		audio_lock_dump(&stream_out->lock, fd);
+	if(stream_in != NULL)
+		audio_lock_dump(&stream_in->lock, fd);
+
+	audio_lock_unlock(&tinyalsa_audio_device->streams_lock);
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	if(tinyalsa_audio_device->mc1n2_pdata != NULL)
+		yamaha_mc1n2_audio_dump(tinyalsa_audio_device->mc1n2_pdata, fd);
+#endif
+
 	return 0;
 }
 
@@ -397,6 +614,31 @@ int audio_hw_close(hw_device_t *device)
 	if(device != NULL) {
 		tinyalsa_audio_device = (struct tinyalsa_audio_device *) device;
 
+		// Closed first, WB-AMR reports are queued to the route worker
+		if(tinyalsa_audio_device->ril_interface != NULL)
+			audio_ril_interface_close((struct audio_hw_device *) tinyalsa_audio_device,
+				tinyalsa_audio_device->ril_interface);
+
+		if(tinyalsa_audio_device->route != NULL) {
+			audio_route_close(tinyalsa_audio_device->route);
+			tinyalsa_audio_device->route = NULL;
+		}
+
+		if(tinyalsa_audio_device->voice_bridge != NULL) {
+			audio_voice_bridge_close(tinyalsa_audio_device->voice_bridge);
+			tinyalsa_audio_device->voice_bridge = NULL;
+		}
+
+		if(tinyalsa_audio_device->hdmi != NULL) {
+			audio_hdmi_close(tinyalsa_audio_device->hdmi);
+			tinyalsa_audio_device->hdmi = NULL;
+		}
+
+		if(tinyalsa_audio_device->mix != NULL) {
+			audio_mix_close(tinyalsa_audio_device->mix);
+			tinyalsa_audio_device->mix = NULL;
+		}
+
 		if(tinyalsa_audio_device->mixer != NULL) {
 			tinyalsa_mixer_close(tinyalsa_audio_device->mixer);
 			tinyalsa_audio_device->mixer = NULL;
@@ -409,6 +651,10 @@ int audio_hw_close(hw_device_t *device)
 		}
 #endif
 
+		audio_lock_destroy(&tinyalsa_audio_device->streams_lock);
+		audio_lock_destroy(&tinyalsa_audio_device->hw_lock);
+		audio_lock_destroy(&tinyalsa_audio_device->lock);
+
 		free(device);
 	}
 
@@ -437,6 +683,10 @@ int audio_hw_open(const hw_module_t *module, const char *name,
 	if(tinyalsa_audio_device == NULL)
 		return -ENOMEM;
 
+	audio_lock_init(&tinyalsa_audio_device->lock, "device");
+	audio_lock_init(&tinyalsa_audio_device->hw_lock, "hw");
+	audio_lock_init(&tinyalsa_audio_device->streams_lock, "streams");
+
 	dev = &(tinyalsa_audio_device->device);
 
 	dev->common.tag = HARDWARE_DEVICE_TAG;
@@ -467,7 +717,7 @@ int audio_hw_open(const hw_module_t *module, const char *name,
 		YAMAHA_MC1N2_AUDIO_DEVICE);
 	if(rc < 0) {
 		ALOGE("Failed to open Yamaha-MC1N2-Audio");
-		goto error_device;
+		goto error_mc1n2;
 	}
 
 	rc = yamaha_mc1n2_audio_init(tinyalsa_audio_device->mc1n2_pdata);
@@ -479,19 +729,79 @@ int audio_hw_open(const hw_module_t *module, const char *name,
 	rc = tinyalsa_mixer_open(&tinyalsa_mixer, TINYALSA_MIXER_CONFIG_FILE);
 	if(rc < 0 || tinyalsa_mixer == NULL) {
 		ALOGE("Failed to open mixer!");
-		goto error_device;
+		goto error_mc1n2;
 	}
 
 	tinyalsa_audio_device->mixer = tinyalsa_mixer;
 
+	// Output streams are mixed into the single hardware pcm
+	rc = audio_mix_open(tinyalsa_audio_device, &tinyalsa_audio_device->mix);
+	if(rc < 0 || tinyalsa_audio_device->mix == NULL) {
+		ALOGE("Failed to open mix!");
+		goto error_mixer;
+	}
+
+	// Only opened with an HDMI pcm in the mixer config
+	rc = audio_hdmi_open(tinyalsa_audio_device, &tinyalsa_audio_device->hdmi);
+	if(rc < 0)
+		ALOGE("Failed to open HDMI output");
+
+	// Only opened when enabled, BT SCO calls use the codec paths otherwise
+	rc = audio_voice_bridge_open(tinyalsa_audio_device, &tinyalsa_audio_device->voice_bridge);
+	if(rc < 0)
+		ALOGE("Failed to open voice bridge");
+
+	rc = audio_route_open(tinyalsa_audio_device, &tinyalsa_audio_device->route);
+	if(rc < 0 || tinyalsa_audio_device->route == NULL) {
+		ALOGE("Failed to open route worker!");
+		goto error_mix;
+	}
+
+	// Loaded and connected in the background, ahead of the first call
+	rc = audio_ril_interface_open(dev, 0, &tinyalsa_audio_device->ril_interface);
+	if(rc < 0 || tinyalsa_audio_device->ril_interface == NULL)
+		ALOGE("Failed to open RIL interface");
+
 	*device = &(dev->common);
 
 	ALOGD("%s(%p, %s, %p)--", __func__, module, name, device);
 
 	return 0;
 
-error_device:
+error_mix:
+	if(tinyalsa_audio_device->voice_bridge != NULL) {
+		audio_voice_bridge_close(tinyalsa_audio_device->voice_bridge);
+		tinyalsa_audio_device->voice_bridge = NULL;
+	}
+
+	if(tinyalsa_audio_device->hdmi != NULL) {
+		audio_hdmi_close(tinyalsa_audio_device->hdmi);
+		tinyalsa_audio_device->hdmi = NULL;
+	}
+
+	audio_mix_close(tinyalsa_audio_device->mix);
+	tinyalsa_audio_device->mix = NULL;
+
+error_mixer:
+
+	tinyalsa_mixer_close(tinyalsa_mixer);
+	tinyalsa_audio_device->mixer = NULL;
+
+error_mc1n2:
+#ifdef YAMAHA_MC1N2_AUDIO
+	// The codec worker thread is running once the codec is started
+	if(tinyalsa_audio_device->mc1n2_pdata != NULL) {
+		yamaha_mc1n2_audio_stop(tinyalsa_audio_device->mc1n2_pdata);
+		tinyalsa_audio_device->mc1n2_pdata = NULL;
+	}
+#endif
+
 	*device = NULL;
+
+	audio_lock_destroy(&tinyalsa_audio_device->streams_lock);
+	audio_lock_destroy(&tinyalsa_audio_device->hw_lock);
+	audio_lock_destroy(&tinyalsa_audio_device->lock);
+
 	free(tinyalsa_audio_device);
 
 	ALOGD("%s(%p, %s, %p)-- (DEVICE ERROR)", __func__, module, name, device);
@@ -24,12 +24,40 @@
 
 #include <audio_utils/resampler.h>
 
+#include <cutils/str_parms.h>
+
 #ifdef YAMAHA_MC1N2_AUDIO
 #include <yamaha-mc1n2-audio.h>
 #endif
 
 #include "mixer.h"
+#include "audio_hdmi.h"
+#include "audio_lock.h"
+#include "audio_mix.h"
 #include "audio_ril_interface.h"
+#include "audio_route.h"
+#include "audio_voice_bridge.h"
+
+/*
+ * Stream parameters setting the pcm period geometry, applied at the next
+ * standby. A latency target in ms picks the period size for the period count.
+ * Outputs set the geometry of the profile for the current screen state.
+ */
+#define TINYALSA_AUDIO_PARAMETER_PERIOD_SIZE	"tinyalsa_period_size"
+#define TINYALSA_AUDIO_PARAMETER_PERIOD_COUNT	"tinyalsa_period_count"
+#define TINYALSA_AUDIO_PARAMETER_LATENCY	"tinyalsa_latency"
+
+#ifndef AUDIO_PARAMETER_KEY_SCREEN_STATE
+#define AUDIO_PARAMETER_KEY_SCREEN_STATE	"screen_state"
+#endif
+#ifndef AUDIO_PARAMETER_VALUE_OFF
+#define AUDIO_PARAMETER_VALUE_OFF		"off"
+#endif
+
+#define TINYALSA_AUDIO_PERIOD_SIZE_MIN		64
+#define TINYALSA_AUDIO_PERIOD_SIZE_MAX		8192
+#define TINYALSA_AUDIO_PERIOD_COUNT_MIN		2
+#define TINYALSA_AUDIO_PERIOD_COUNT_MAX		16
 
 struct tinyalsa_audio_stream_out {
 	struct audio_stream_out stream;
@@ -39,15 +67,17 @@ struct tinyalsa_audio_stream_out {
 	int rate;
         audio_channel_mask_t channel_mask;
 	audio_format_t format;
+	size_t buffer_size;
 
 	audio_devices_t device_current;
 
 	struct resampler_itfe *resampler;
 
-	struct pcm *pcm;
+	struct tinyalsa_audio_mix_stream mix_stream;
+	struct tinyalsa_audio_hdmi *hdmi;
 	int standby;
 
-	pthread_mutex_t lock;
+	struct tinyalsa_audio_lock lock;
 };
 
 struct tinyalsa_audio_stream_in {
@@ -70,15 +100,42 @@ struct tinyalsa_audio_stream_in {
 	struct pcm *pcm;
 	int standby;
 
-	pthread_mutex_t lock;
+	int period_size_pending;
+	int period_count_pending;
+
+	struct tinyalsa_audio_lock lock;
 };
 
+/*
+ * Locks are taken in this order, never the other way around:
+ * - streams lock: keeps the published streams from being freed, held by
+ *   device paths using a stream out of the device lock and by stream close
+ * - stream lock: stream fields and the input pcm, held across writes and reads
+ * - mix lock, HDMI lock: output rings and writer state, nothing else is
+ *   taken with either held
+ * - hw_lock: serializes sequences touching several of mixer, codec and RIL
+ *   (mode changes and route or modem rate transitions on the route worker)
+ * - mixer lock, Yamaha-MC1N2-Audio lock: each serializes its own hardware
+ * - lock: device state fields only (streams, mode, voice volume and mic
+ *   mute), no hardware access or blocking call is made with it held
+ * - route and RIL queue locks: only held to queue or dequeue requests
+ *
+ * RIL IPC only happens on the RIL worker, with no HAL lock held. The mixer,
+ * codec, route, voice bridge and RIL interface are set at open and constant
+ * until close, as are the software mix and HDMI output. The output stream is
+ * the first one opened among the mixed outputs, standing for them in routing
+ * and mode. An output bound to HDMI is never mixed nor routed.
+ */
 struct tinyalsa_audio_device {
 	struct audio_hw_device device;
 
 	struct tinyalsa_audio_stream_out *stream_out;
 	struct tinyalsa_audio_stream_in *stream_in;
 	struct tinyalsa_audio_ril_interface *ril_interface;
+	struct tinyalsa_audio_route *route;
+	struct tinyalsa_audio_voice_bridge *voice_bridge;
+	struct tinyalsa_audio_mix *mix;
+	struct tinyalsa_audio_hdmi *hdmi;
 
 #ifdef YAMAHA_MC1N2_AUDIO
 	struct yamaha_mc1n2_audio_pdata *mc1n2_pdata;
@@ -90,11 +147,20 @@ struct tinyalsa_audio_device {
 	float voice_volume;
 	int mic_mute;
 
-	pthread_mutex_t lock;
+	struct tinyalsa_audio_lock streams_lock;
+	struct tinyalsa_audio_lock hw_lock;
+	struct tinyalsa_audio_lock lock;
 };
 
+int64_t audio_hw_time(void);
+
+int audio_hw_period_parse(struct str_parms *parms, int rate,
+	int *period_size, int *period_count);
+char *audio_hw_period_get_parameters(int rate, int period_size, int period_count,
+	const char *keys);
+
 int audio_out_set_route(struct tinyalsa_audio_stream_out *stream_out,
-	audio_devices_t device);
+	audio_devices_t device, unsigned int *token);
 
 void audio_hw_close_output_stream(struct audio_hw_device *dev,
 	struct audio_stream_out *stream);
@@ -106,7 +172,7 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
                                 struct audio_stream_out **stream_out);
 
 int audio_in_set_route(struct tinyalsa_audio_stream_in *stream_in,
-	audio_devices_t device);
+	audio_devices_t device, unsigned int *token);
 
 void audio_hw_close_input_stream(struct audio_hw_device *dev,
 	struct audio_stream_in *stream);
@@ -69,6 +69,8 @@ int audio_in_pcm_open(struct tinyalsa_audio_stream_in *stream_in)
 
 	if(pcm == NULL || !pcm_is_ready(pcm)) {
 		ALOGE("Unable to open pcm device: %s", pcm_get_error(pcm));
+		if(pcm != NULL)
+			pcm_close(pcm);
 		return -1;
 	}
 
@@ -80,39 +82,132 @@ int audio_in_pcm_open(struct tinyalsa_audio_stream_in *stream_in)
 	return 0;
 }
 
-void audio_in_pcm_close(struct tinyalsa_audio_stream_in *stream_in)
+/*
+ * Called with the stream lock held, in standby.
+ */
+int audio_in_period_set(struct tinyalsa_audio_stream_in *stream_in,
+	int period_size, int period_count)
 {
-	if(stream_in->pcm == NULL)
-		return;
+	void *buffer;
 
-	pcm_close(stream_in->pcm);
-	stream_in->pcm = NULL;
+	if(stream_in == NULL)
+		return -1;
+
+	// The resampler is fed a period at a time
+	if(stream_in->buffer != NULL) {
+		buffer = realloc(stream_in->buffer, period_size *
+			popcount(stream_in->mixer_props->channel_mask) *
+			audio_bytes_per_sample(stream_in->mixer_props->format));
+		if(buffer == NULL)
+			return -1;
+
+		stream_in->buffer = buffer;
+	}
+
+	stream_in->frames_left = 0;
+
+	stream_in->mixer_props->period_size = period_size;
+	stream_in->mixer_props->period_count = period_count;
+
+	return 0;
 }
 
-int audio_in_set_route(struct tinyalsa_audio_stream_in *stream_in,
-	audio_devices_t device)
+/*
+ * Called with the stream lock held, in standby. The pending geometry is
+ * only kept if the pcm takes it.
+ */
+int audio_in_pcm_open_pending(struct tinyalsa_audio_stream_in *stream_in)
 {
+	int period_size;
+	int period_count;
 	int rc;
 
 	if(stream_in == NULL)
 		return -1;
 
-	stream_in->device_current = device;
+	if(stream_in->period_size_pending == 0)
+		return audio_in_pcm_open(stream_in);
+
+	period_size = stream_in->mixer_props->period_size;
+	period_count = stream_in->mixer_props->period_count;
 
-	if(device == 0) {
-		pthread_mutex_unlock(&stream_in->lock);
-		return stream_in->stream.common.standby((struct audio_stream *) stream_in);
+	rc = audio_in_period_set(stream_in, stream_in->period_size_pending,
+		stream_in->period_count_pending);
+
+	stream_in->period_size_pending = 0;
+	stream_in->period_count_pending = 0;
+
+	if(rc < 0)
+		return audio_in_pcm_open(stream_in);
+
+	rc = audio_in_pcm_open(stream_in);
+	if(rc >= 0) {
+		ALOGD("Period geometry set: %d frames, %d periods",
+			stream_in->mixer_props->period_size, stream_in->mixer_props->period_count);
+		return 0;
 	}
 
-	tinyalsa_mixer_set_device(stream_in->device->mixer, stream_in->device_current);
+	ALOGE("Period geometry refused by the pcm: %d frames, %d periods",
+		stream_in->mixer_props->period_size, stream_in->mixer_props->period_count);
+
+	rc = audio_in_period_set(stream_in, period_size, period_count);
+	if(rc < 0)
+		return -1;
+
+	return audio_in_pcm_open(stream_in);
+}
+
+void audio_in_pcm_close(struct tinyalsa_audio_stream_in *stream_in)
+{
+	if(stream_in->pcm == NULL)
+		return;
+
+	pcm_close(stream_in->pcm);
+	stream_in->pcm = NULL;
+}
+
+/*
+ * Called with the stream lock held.
+ */
+int audio_in_standby_locked(struct tinyalsa_audio_stream_in *stream_in)
+{
+	int rc;
+
+	if(stream_in->pcm != NULL)
+		audio_in_pcm_close(stream_in);
 
 #ifdef YAMAHA_MC1N2_AUDIO
-	yamaha_mc1n2_audio_set_route(stream_in->device->mc1n2_pdata, device);
+	if(!stream_in->standby) {
+		rc = yamaha_mc1n2_audio_input_stop(stream_in->device->mc1n2_pdata);
+		if(rc < 0) {
+			ALOGE("Failed to set Yamaha-MC1N2-Audio route");
+		}
+	}
 #endif
 
+	stream_in->standby = 1;
+
 	return 0;
 }
 
+/*
+ * Called with the stream lock held, no token is given for the null device.
+ */
+int audio_in_set_route(struct tinyalsa_audio_stream_in *stream_in,
+	audio_devices_t device, unsigned int *token)
+{
+	if(stream_in == NULL)
+		return -1;
+
+	stream_in->device_current = device;
+
+	if(device == 0)
+		return audio_in_standby_locked(stream_in);
+
+	// The route worker applies mixer and codec changes
+	return audio_route_queue(stream_in->device->route, device, token);
+}
+
 int audio_in_resampler_open(struct tinyalsa_audio_stream_in *stream_in)
 {
 	int rc;
@@ -364,7 +459,7 @@ static int audio_in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 	stream_in = (struct tinyalsa_audio_stream_in *) stream;
 
 	if(stream_in->rate != (int) rate) {
-		pthread_mutex_lock(&stream_in->lock);
+		audio_lock_lock(&stream_in->lock);
 
 		stream_in->rate = rate;
 
@@ -375,7 +470,7 @@ static int audio_in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 			stream_in->standby = 1;
 		}
 
-		pthread_mutex_unlock(&stream_in->lock);
+		audio_lock_unlock(&stream_in->lock);
 	}
 
 	return 0;
@@ -435,14 +530,14 @@ static int audio_in_set_format(struct audio_stream *stream, audio_format_t forma
 	stream_in = (struct tinyalsa_audio_stream_in *) stream;
 
 	if(stream_in->format != (audio_format_t) format) {
-		pthread_mutex_lock(&stream_in->lock);
+		audio_lock_lock(&stream_in->lock);
 
 		stream_in->format = format;
 
 		if(stream_in->format != stream_in->mixer_props->format)
 			stream_in->standby = 1;
 
-		pthread_mutex_unlock(&stream_in->lock);
+		audio_lock_unlock(&stream_in->lock);
 	}
 
 	return 0;
@@ -460,25 +555,11 @@ static int audio_in_standby(struct audio_stream *stream)
 
 	stream_in = (struct tinyalsa_audio_stream_in *) stream;
 
-	pthread_mutex_lock(&stream_in->lock);
-
-	if(stream_in->pcm != NULL)
-		audio_in_pcm_close(stream_in);
-
-#ifdef YAMAHA_MC1N2_AUDIO
-	if(!stream_in->standby) {
-		rc = yamaha_mc1n2_audio_input_stop(stream_in->device->mc1n2_pdata);
-		if(rc < 0) {
-			ALOGE("Failed to set Yamaha-MC1N2-Audio route");
-		}
-	}
-#endif
-
-	stream_in->standby = 1;
-
-	pthread_mutex_unlock(&stream_in->lock);
+	audio_lock_lock(&stream_in->lock);
+	rc = audio_in_standby_locked(stream_in);
+	audio_lock_unlock(&stream_in->lock);
 
-	return 0;
+	return rc;
 }
 
 static int audio_in_dump(const struct audio_stream *stream, int fd)
@@ -493,6 +574,9 @@ static int audio_in_set_parameters(struct audio_stream *stream, const char *kvpa
 	struct tinyalsa_audio_stream_in *stream_in;
 	struct str_parms *parms;
 	char value_string[32] = { 0 };
+	int period_size;
+	int period_count;
+	int handled = 0;
 	int value;
 	int rc;
 
@@ -510,22 +594,48 @@ static int audio_in_set_parameters(struct audio_stream *stream, const char *kvpa
 	if(parms == NULL)
 		return -1;
 
-	rc = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value_string, sizeof(value_string));
+	period_size = stream_in->mixer_props->period_size;
+	period_count = stream_in->mixer_props->period_count;
+
+	rc = audio_hw_period_parse(parms, stream_in->mixer_props->rate, &period_size, &period_count);
 	if(rc < 0)
 		goto error_params;
 
-	value = atoi(value_string);
+	// Applied when the pcm is next opened
+	if(rc > 0) {
+		audio_lock_lock(&stream_in->lock);
+
+		if(period_size == stream_in->mixer_props->period_size &&
+			period_count == stream_in->mixer_props->period_count) {
+			stream_in->period_size_pending = 0;
+			stream_in->period_count_pending = 0;
+		} else {
+			stream_in->period_size_pending = period_size;
+			stream_in->period_count_pending = period_count;
+		}
 
-	pthread_mutex_lock(&stream_in->device->lock);
+		audio_lock_unlock(&stream_in->lock);
 
-	if(stream_in->device_current != (audio_devices_t) value) {
-		pthread_mutex_lock(&stream_in->lock);
-		audio_in_set_route(stream_in, (audio_devices_t) value);
-		pthread_mutex_unlock(&stream_in->lock);
+		handled = 1;
+	}
+
+	rc = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value_string, sizeof(value_string));
+	if(rc < 0) {
+		if(handled)
+			goto complete;
+
+		goto error_params;
 	}
 
-	pthread_mutex_unlock(&stream_in->device->lock);
+	value = atoi(value_string);
+
+	if(stream_in->device_current != (audio_devices_t) value) {
+		audio_lock_lock(&stream_in->lock);
+		audio_in_set_route(stream_in, (audio_devices_t) value, NULL);
+		audio_lock_unlock(&stream_in->lock);
+	}
 
+complete:
 	str_parms_destroy(parms);
 
 	return 0;
@@ -539,9 +649,17 @@ error_params:
 static char *audio_in_get_parameters(const struct audio_stream *stream,
 	const char *keys)
 {
+	struct tinyalsa_audio_stream_in *stream_in;
+
 	ALOGD("%s(%p, %s)", __func__, stream, keys);
 
-	return strdup("");
+	if(stream == NULL)
+		return strdup("");
+
+	stream_in = (struct tinyalsa_audio_stream_in *) stream;
+
+	return audio_hw_period_get_parameters(stream_in->mixer_props->rate,
+		stream_in->mixer_props->period_size, stream_in->mixer_props->period_count, keys);
 }
 
 static int audio_in_set_gain(struct audio_stream_in *stream, float gain)
@@ -558,10 +676,9 @@ static int audio_in_set_gain(struct audio_stream_in *stream, float gain)
 	if(stream_in->device == NULL || stream_in->device->mixer == NULL)
 		return -1;
 
-	pthread_mutex_lock(&stream_in->device->lock);
+	// Serialized by the mixer lock, the stream lock may be held by a read
 	tinyalsa_mixer_set_input_gain(stream_in->device->mixer,
 		stream_in->device_current, gain);
-	pthread_mutex_unlock(&stream_in->device->lock);
 
 	return 0;
 }
@@ -580,7 +697,7 @@ static ssize_t audio_in_read(struct audio_stream_in *stream,
 	if(stream_in->device == NULL)
 		return -1;
 
-	pthread_mutex_lock(&stream_in->lock);
+	audio_lock_lock(&stream_in->lock);
 
 	if(stream_in->standby) {
 #ifdef YAMAHA_MC1N2_AUDIO
@@ -590,7 +707,7 @@ static ssize_t audio_in_read(struct audio_stream_in *stream,
 		}
 #endif
 
-		rc = audio_in_pcm_open(stream_in);
+		rc = audio_in_pcm_open_pending(stream_in);
 		if(rc < 0) {
 			ALOGE("Unable to open pcm device");
 			goto error;
@@ -608,12 +725,12 @@ static ssize_t audio_in_read(struct audio_stream_in *stream,
 	if(stream_in->device != NULL && stream_in->device->mic_mute)
 		memset(buffer, 0, bytes);
 
-	pthread_mutex_unlock(&stream_in->lock);
+	audio_lock_unlock(&stream_in->lock);
 
 	return bytes;
 
 error:
-	pthread_mutex_unlock(&stream_in->lock);
+	audio_lock_unlock(&stream_in->lock);
 
 	return -1;
 }
@@ -650,6 +767,19 @@ void audio_hw_close_input_stream(struct audio_hw_device *dev,
 	ALOGD("%s(%p)", __func__, stream);
 
 	stream_in = (struct tinyalsa_audio_stream_in *) stream;
+	tinyalsa_audio_device = (struct tinyalsa_audio_device *) dev;
+
+	// Unpublished first, so that no other path picks the stream up, and
+	// with the streams lock, so that paths that did are done with it
+	if(tinyalsa_audio_device != NULL) {
+		audio_lock_lock(&tinyalsa_audio_device->streams_lock);
+
+		audio_lock_lock(&tinyalsa_audio_device->lock);
+		tinyalsa_audio_device->stream_in = NULL;
+		audio_lock_unlock(&tinyalsa_audio_device->lock);
+
+		audio_lock_unlock(&tinyalsa_audio_device->streams_lock);
+	}
 
 	if(stream_in != NULL && stream_in->resampler != NULL)
 		audio_in_resampler_close(stream_in);
@@ -659,20 +789,13 @@ void audio_hw_close_input_stream(struct audio_hw_device *dev,
 		yamaha_mc1n2_audio_input_stop(stream_in->device->mc1n2_pdata);
 #endif
 
-	if(stream != NULL)
-		free(stream);
-
-	if(dev == NULL)
-		return;
-
-	tinyalsa_audio_device = (struct tinyalsa_audio_device *) dev;
-
-	pthread_mutex_lock(&tinyalsa_audio_device->lock);
-
-	tinyalsa_mixer_set_input_state(tinyalsa_audio_device->mixer, 0);
-	tinyalsa_audio_device->stream_in = NULL;
+	if(stream_in != NULL) {
+		audio_lock_destroy(&stream_in->lock);
+		free(stream_in);
+	}
 
-	pthread_mutex_unlock(&tinyalsa_audio_device->lock);
+	if(tinyalsa_audio_device != NULL)
+		tinyalsa_mixer_set_input_state(tinyalsa_audio_device->mixer, 0);
 }
 
 int audio_hw_open_input_stream(struct audio_hw_device *dev,
@@ -684,6 +807,7 @@ int audio_hw_open_input_stream(struct audio_hw_device *dev,
 	struct tinyalsa_audio_device *tinyalsa_audio_device;
 	struct tinyalsa_audio_stream_in *tinyalsa_audio_stream_in;
 	struct audio_stream_in *stream;
+	unsigned int token;
 	int rc;
 
 	ALOGD("%s(%p, %d, %p, %p)",
@@ -701,7 +825,7 @@ int audio_hw_open_input_stream(struct audio_hw_device *dev,
 		return -ENOMEM;
 
 	tinyalsa_audio_stream_in->device = tinyalsa_audio_device;
-	tinyalsa_audio_device->stream_in = tinyalsa_audio_stream_in;
+	audio_lock_init(&tinyalsa_audio_stream_in->lock, "input");
 	stream = &(tinyalsa_audio_stream_in->stream);
 
 	stream->common.get_sample_rate = audio_in_get_sample_rate;
@@ -770,43 +894,49 @@ int audio_hw_open_input_stream(struct audio_hw_device *dev,
 	config->channel_mask = tinyalsa_audio_stream_in->channel_mask;
 	config->format = tinyalsa_audio_stream_in->format;
 
-	pthread_mutex_lock(&tinyalsa_audio_device->lock);
-
 	rc = tinyalsa_mixer_set_input_state(tinyalsa_audio_device->mixer, 1);
 	if(rc < 0) {
 		ALOGE("Unable to set input state");
-		pthread_mutex_unlock(&tinyalsa_audio_device->lock);
 		goto error_stream;
 	}
 
-	pthread_mutex_lock(&tinyalsa_audio_stream_in->lock);
+	audio_lock_lock(&tinyalsa_audio_stream_in->lock);
 
-	audio_in_set_route(tinyalsa_audio_stream_in, devices);
+	rc = audio_in_set_route(tinyalsa_audio_stream_in, devices, &token);
 
-	pthread_mutex_unlock(&tinyalsa_audio_device->lock);
+	// The initial route has to be in place before opening the pcm
+	if(rc >= 0 && devices != 0)
+		audio_route_wait(tinyalsa_audio_device->route, token);
 
 	rc = audio_in_pcm_open(tinyalsa_audio_stream_in);
 	if(rc < 0) {
 		ALOGE("Unable to open pcm device");
-		pthread_mutex_unlock(&tinyalsa_audio_stream_in->lock);
-		goto error_stream;
+		audio_lock_unlock(&tinyalsa_audio_stream_in->lock);
+		goto error_state;
 	}
 
 	audio_in_pcm_close(tinyalsa_audio_stream_in);
 
 	tinyalsa_audio_stream_in->standby = 1;
 
-	pthread_mutex_unlock(&tinyalsa_audio_stream_in->lock);
+	audio_lock_unlock(&tinyalsa_audio_stream_in->lock);
+
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	tinyalsa_audio_device->stream_in = tinyalsa_audio_stream_in;
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
 
 	*stream_in = stream;
 
 	return 0;
 
+error_state:
+	tinyalsa_mixer_set_input_state(tinyalsa_audio_device->mixer, 0);
+
 error_stream:
 	if(tinyalsa_audio_stream_in->resampler != NULL)
 		audio_in_resampler_close(tinyalsa_audio_stream_in);
+	audio_lock_destroy(&tinyalsa_audio_stream_in->lock);
 	free(tinyalsa_audio_stream_in);
-	tinyalsa_audio_device->stream_in = NULL;
 
 	return -1;
 }
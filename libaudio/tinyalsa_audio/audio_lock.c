@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "TinyALSA-Audio Lock"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "audio_lock.h"
+
+/*
+ * Functions
+ */
+
+void audio_lock_lock(struct tinyalsa_audio_lock *lock)
+{
+	int64_t time_wait;
+	int64_t time;
+
+	if(!lock->profile) {
+		pthread_mutex_lock(&lock->mutex);
+		goto complete;
+	}
+
+	if(pthread_mutex_trylock(&lock->mutex) != 0) {
+		time_wait = audio_hw_time();
+		pthread_mutex_lock(&lock->mutex);
+		time = audio_hw_time();
+
+		// Stats are only updated with the lock held
+		time_wait = time - time_wait;
+		lock->contended++;
+		lock->wait_time += time_wait;
+		if(time_wait > lock->wait_time_max)
+			lock->wait_time_max = time_wait;
+	} else {
+		time = audio_hw_time();
+	}
+
+	lock->count++;
+	lock->time_locked = time;
+
+complete:
+	lock->owner = pthread_self();
+	lock->owned = 1;
+}
+
+void audio_lock_unlock(struct tinyalsa_audio_lock *lock)
+{
+	int64_t time_hold;
+
+	if(lock->profile) {
+		time_hold = audio_hw_time() - lock->time_locked;
+		lock->hold_time += time_hold;
+		if(time_hold > lock->hold_time_max)
+			lock->hold_time_max = time_hold;
+	}
+
+	lock->owned = 0;
+
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+// Only meaningful for the calling thread, that alone sets the owner to itself
+int audio_lock_held(struct tinyalsa_audio_lock *lock)
+{
+	return lock->owned && pthread_equal(lock->owner, pthread_self());
+}
+
+int audio_lock_dump(struct tinyalsa_audio_lock *lock, int fd)
+{
+	char buffer[256];
+	int length;
+
+	if(lock == NULL || !lock->profile)
+		return -1;
+
+	// Not taken: a stream lock may be held across a blocking write
+	length = snprintf(buffer, sizeof(buffer), "Lock %s: %u locks, %u contended, wait %lld us total, %lld us max, hold %lld us total, %lld us max\n",
+		lock->name, lock->count, lock->contended,
+		(long long) lock->wait_time, (long long) lock->wait_time_max,
+		(long long) lock->hold_time, (long long) lock->hold_time_max);
+
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	return 0;
+}
+
+/*
+ * Interface
+ */
+
+void audio_lock_destroy(struct tinyalsa_audio_lock *lock)
+{
+	if(lock == NULL)
+		return;
+
+	if(lock->profile && lock->count > 0)
+		ALOGD("Lock %s: %u locks, %u contended, wait %lld us max, hold %lld us max",
+			lock->name, lock->count, lock->contended,
+			(long long) lock->wait_time_max, (long long) lock->hold_time_max);
+
+	pthread_mutex_destroy(&lock->mutex);
+}
+
+void audio_lock_init(struct tinyalsa_audio_lock *lock, char *name)
+{
+	char property[PROPERTY_VALUE_MAX];
+
+	if(lock == NULL)
+		return;
+
+	memset(lock, 0, sizeof(struct tinyalsa_audio_lock));
+
+	pthread_mutex_init(&lock->mutex, NULL);
+	lock->name = name;
+
+	property_get(TINYALSA_AUDIO_LOCK_PROFILE_PROPERTY, property, "0");
+	lock->profile = atoi(property) != 0;
+}
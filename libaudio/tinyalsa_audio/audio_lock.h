@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TINYALSA_AUDIO_LOCK_H
+#define TINYALSA_AUDIO_LOCK_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define TINYALSA_AUDIO_LOCK_PROFILE_PROPERTY	"persist.audio.lock.profile"
+
+/*
+ * Mutex with optional contention profiling, enabled by the profile property
+ * when the lock is initialized. Wait times only account for contended
+ * acquisitions, hold times for all of them. Times are in us. The owner is
+ * always tracked, so that a thread can tell whether it holds the lock.
+ */
+struct tinyalsa_audio_lock {
+	pthread_mutex_t mutex;
+	char *name;
+	int profile;
+
+	pthread_t owner;
+	int owned;
+
+	int64_t time_locked;
+	unsigned int count;
+	unsigned int contended;
+	int64_t wait_time;
+	int64_t wait_time_max;
+	int64_t hold_time;
+	int64_t hold_time_max;
+};
+
+void audio_lock_lock(struct tinyalsa_audio_lock *lock);
+void audio_lock_unlock(struct tinyalsa_audio_lock *lock);
+int audio_lock_held(struct tinyalsa_audio_lock *lock);
+int audio_lock_dump(struct tinyalsa_audio_lock *lock, int fd);
+
+void audio_lock_destroy(struct tinyalsa_audio_lock *lock);
+void audio_lock_init(struct tinyalsa_audio_lock *lock, char *name);
+
+#endif
@@ -0,0 +1,1259 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "TinyALSA-Audio Mix"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#ifdef YAMAHA_MC1N2_AUDIO
+#include <yamaha-mc1n2-audio.h>
+#endif
+
+#define EFFECT_UUID_NULL EFFECT_UUID_NULL_MIX
+#define EFFECT_UUID_NULL_STR EFFECT_UUID_NULL_STR_MIX
+#include "audio_hw.h"
+#include "audio_mix.h"
+#include "mixer.h"
+
+/*
+ * Processing
+ */
+
+static void audio_mix_accumulate(int32_t *mix, int16_t *buffer, int samples, int gain)
+{
+	int i = 0;
+
+#ifdef __ARM_NEON__
+	int16x4_t gain_vector;
+	int16x8_t in;
+	int32x4_t low;
+	int32x4_t high;
+
+	gain_vector = vdup_n_s16((int16_t) gain);
+
+	for( ; i + 8 <= samples ; i += 8) {
+		in = vld1q_s16(buffer + i);
+		low = vld1q_s32(mix + i);
+		high = vld1q_s32(mix + i + 4);
+
+		low = vmlal_s16(low, vget_low_s16(in), gain_vector);
+		high = vmlal_s16(high, vget_high_s16(in), gain_vector);
+
+		vst1q_s32(mix + i, low);
+		vst1q_s32(mix + i + 4, high);
+	}
+#endif
+
+	for( ; i < samples ; i++)
+		mix[i] += (int32_t) buffer[i] * gain;
+}
+
+/*
+ * Gains go by step from the ones given, in Q(GAIN_SHIFT + 16) per channel,
+ * left for even channels and right for odd ones. They are left where the
+ * ramp stopped, for the next chunk.
+ */
+static void audio_mix_accumulate_ramp(int32_t *mix, int16_t *buffer, int frames,
+	int channels, int32_t *gains, int32_t *steps)
+{
+	int i = 0;
+	int c;
+
+#ifdef __ARM_NEON__
+	int32x4_t gain_low;
+	int32x4_t gain_high;
+	int32x4_t step;
+	int16x8_t in;
+	int32x4_t low;
+	int32x4_t high;
+
+	// Four stereo frames at a time, with the gains of each frame
+	if(channels == 2 && frames >= 4) {
+		gain_low = vsetq_lane_s32(gains[0], vdupq_n_s32(0), 0);
+		gain_low = vsetq_lane_s32(gains[1], gain_low, 1);
+		gain_low = vsetq_lane_s32(gains[0] + steps[0], gain_low, 2);
+		gain_low = vsetq_lane_s32(gains[1] + steps[1], gain_low, 3);
+
+		step = vsetq_lane_s32(steps[0] * 2, vdupq_n_s32(0), 0);
+		step = vsetq_lane_s32(steps[1] * 2, step, 1);
+		step = vsetq_lane_s32(steps[0] * 2, step, 2);
+		step = vsetq_lane_s32(steps[1] * 2, step, 3);
+
+		gain_high = vaddq_s32(gain_low, step);
+		step = vshlq_n_s32(step, 1);
+
+		for( ; i + 4 <= frames ; i += 4) {
+			in = vld1q_s16(buffer + i * 2);
+			low = vld1q_s32(mix + i * 2);
+			high = vld1q_s32(mix + i * 2 + 4);
+
+			low = vmlal_s16(low, vget_low_s16(in), vshrn_n_s32(gain_low, 16));
+			high = vmlal_s16(high, vget_high_s16(in), vshrn_n_s32(gain_high, 16));
+
+			vst1q_s32(mix + i * 2, low);
+			vst1q_s32(mix + i * 2 + 4, high);
+
+			gain_low = vaddq_s32(gain_low, step);
+			gain_high = vaddq_s32(gain_high, step);
+		}
+
+		gains[0] = vgetq_lane_s32(gain_low, 0);
+		gains[1] = vgetq_lane_s32(gain_low, 1);
+	}
+#endif
+
+	for( ; i < frames ; i++) {
+		for(c=0 ; c < channels ; c++)
+			mix[i * channels + c] += (int32_t) buffer[i * channels + c] * (gains[c & 1] >> 16);
+
+		gains[0] += steps[0];
+		gains[1] += steps[1];
+	}
+}
+
+static void audio_mix_saturate(int16_t *buffer, int32_t *mix, int samples)
+{
+	int32_t sample;
+	int i = 0;
+
+#ifdef __ARM_NEON__
+	int16x4_t low;
+	int16x4_t high;
+
+	// Saturating narrowing shift, back to 16-bit samples
+	for( ; i + 8 <= samples ; i += 8) {
+		low = vqshrn_n_s32(vld1q_s32(mix + i), TINYALSA_AUDIO_MIX_GAIN_SHIFT);
+		high = vqshrn_n_s32(vld1q_s32(mix + i + 4), TINYALSA_AUDIO_MIX_GAIN_SHIFT);
+
+		vst1q_s16(buffer + i, vcombine_s16(low, high));
+	}
+#endif
+
+	for( ; i < samples ; i++) {
+		sample = mix[i] >> TINYALSA_AUDIO_MIX_GAIN_SHIFT;
+
+		if(sample > INT16_MAX)
+			sample = INT16_MAX;
+		else if(sample < INT16_MIN)
+			sample = INT16_MIN;
+
+		buffer[i] = (int16_t) sample;
+	}
+}
+
+static int audio_mix_silent(int16_t *buffer, int samples)
+{
+	int i;
+
+	for(i=0 ; i < samples ; i++)
+		if(buffer[i] != 0)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Called with the mix lock held.
+ */
+static int audio_mix_ready(struct tinyalsa_audio_mix *mix)
+{
+	int i;
+
+	for(i=0 ; i < mix->streams_count ; i++)
+		if(mix->streams[i]->active && mix->streams[i]->fill >= mix->period_size)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Called with the mix lock held.
+ */
+static int audio_mix_active(struct tinyalsa_audio_mix *mix)
+{
+	int i;
+
+	for(i=0 ; i < mix->streams_count ; i++)
+		if(mix->streams[i]->active)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Called with the mix lock held. Streams short of a period are padded with
+ * silence.
+ */
+static void audio_mix_period(struct tinyalsa_audio_mix *mix)
+{
+	struct tinyalsa_audio_mix_stream *stream;
+	int32_t gains[2];
+	int32_t steps[2];
+	int period_size;
+	int channels;
+	int frames;
+	int chunk;
+	int i;
+
+	period_size = mix->period_size;
+	channels = mix->channels;
+
+	memset(mix->buffer_mix, 0, period_size * channels * sizeof(int32_t));
+
+	for(i=0 ; i < mix->streams_count ; i++) {
+		stream = mix->streams[i];
+		if(!stream->active)
+			continue;
+
+		frames = stream->fill < period_size ? stream->fill : period_size;
+		if(frames < period_size)
+			stream->underruns++;
+
+		chunk = stream->size - stream->read;
+		if(chunk > frames)
+			chunk = frames;
+
+		if(stream->gain_current[0] == stream->gain[0] && stream->gain_current[1] == stream->gain[1] &&
+			(stream->gain[0] == stream->gain[1] || channels == 1)) {
+			audio_mix_accumulate(mix->buffer_mix, stream->buffer + stream->read * channels,
+				chunk * channels, stream->gain[0]);
+			audio_mix_accumulate(mix->buffer_mix + chunk * channels, stream->buffer,
+				(frames - chunk) * channels, stream->gain[0]);
+		} else if(frames > 0) {
+			// Ramped over the frames mixed, from the gains the last period reached
+			gains[0] = stream->gain_current[0] << 16;
+			gains[1] = stream->gain_current[1] << 16;
+			steps[0] = (stream->gain[0] - stream->gain_current[0]) * 65536 / frames;
+			steps[1] = (stream->gain[1] - stream->gain_current[1]) * 65536 / frames;
+
+			audio_mix_accumulate_ramp(mix->buffer_mix, stream->buffer + stream->read * channels,
+				chunk, channels, gains, steps);
+			audio_mix_accumulate_ramp(mix->buffer_mix + chunk * channels, stream->buffer,
+				frames - chunk, channels, gains, steps);
+
+			stream->gain_current[0] = stream->gain[0];
+			stream->gain_current[1] = stream->gain[1];
+		}
+
+		stream->read = (stream->read + frames) % stream->size;
+		stream->fill -= frames;
+	}
+
+	audio_mix_saturate(mix->buffer_out, mix->buffer_mix, period_size * channels);
+
+	// Silence is only looked for while a new geometry is pending
+	if(mix->reconfigure) {
+		if(audio_mix_silent(mix->buffer_out, period_size * channels))
+			mix->silent_periods++;
+		else
+			mix->silent_periods = 0;
+	}
+
+	pthread_cond_broadcast(&mix->space_cond);
+}
+
+/*
+ * PCM
+ */
+
+static void audio_mix_startup_report(struct tinyalsa_audio_mix *mix)
+{
+	struct tinyalsa_audio_mix_startup *startup;
+
+	startup = &mix->startup;
+
+	ALOGD("Time to first sample: %d us (process: %d us, pcm open: %d us, codec: %d us, barrier: %d us, write: %d us)",
+		(int) (startup->time_write - startup->time_start),
+		(int) (startup->time_process - startup->time_start),
+		(int) (startup->time_pcm_open - startup->time_process),
+		(int) (startup->time_codec_done - startup->time_codec_started),
+		(int) (startup->time_barrier - startup->time_pcm_open),
+		(int) (startup->time_write - startup->time_barrier));
+}
+
+static struct pcm *audio_mix_pcm_open(struct tinyalsa_audio_mix *mix,
+	int period_size, int period_count)
+{
+	struct pcm_config pcm_config;
+	struct pcm *pcm;
+
+	memset(&pcm_config, 0, sizeof(pcm_config));
+	pcm_config.channels = mix->channels;
+	pcm_config.rate = mix->mixer_props->rate;
+	pcm_config.format = PCM_FORMAT_S16_LE;
+	pcm_config.period_size = period_size;
+	pcm_config.period_count = period_count;
+
+	pcm = pcm_open(mix->mixer_props->card, mix->mixer_props->device, PCM_OUT, &pcm_config);
+	if(pcm == NULL || !pcm_is_ready(pcm)) {
+		ALOGE("Unable to open pcm device: %s", pcm_get_error(pcm));
+		if(pcm != NULL)
+			pcm_close(pcm);
+		return NULL;
+	}
+
+	return pcm;
+}
+
+/*
+ * A pcm that failed to open is opened again on a later period, with a delay
+ * in us doubled after each failure.
+ */
+static void audio_mix_pcm_set(struct tinyalsa_audio_mix *mix, struct pcm *pcm)
+{
+	mix->pcm = pcm;
+
+	if(pcm != NULL) {
+		mix->pcm_retry_delay = 0;
+		return;
+	}
+
+	if(mix->pcm_retry_delay == 0)
+		mix->pcm_retry_delay = TINYALSA_AUDIO_MIX_PCM_RETRY_MIN;
+	else if(mix->pcm_retry_delay < TINYALSA_AUDIO_MIX_PCM_RETRY_MAX / 2)
+		mix->pcm_retry_delay *= 2;
+	else
+		mix->pcm_retry_delay = TINYALSA_AUDIO_MIX_PCM_RETRY_MAX;
+
+	mix->pcm_retry_time = audio_hw_time() + mix->pcm_retry_delay;
+}
+
+static int audio_mix_pcm_start(struct tinyalsa_audio_mix *mix)
+{
+	struct pcm *pcm;
+	int codec_pending = 0;
+	int rc;
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	// Codec bring-up runs meanwhile pcm open
+	rc = yamaha_mc1n2_audio_output_start_async(mix->device->mc1n2_pdata);
+	if(rc < 0)
+		ALOGE("Failed to set Yamaha-MC1N2-Audio route");
+	else
+		codec_pending = 1;
+#endif
+
+	pcm = audio_mix_pcm_open(mix, mix->period_size,
+		mix->period_count);
+
+	mix->startup.time_pcm_open = audio_hw_time();
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	// The codec has to be powered up before the first sample
+	if(codec_pending) {
+		rc = yamaha_mc1n2_audio_output_start_wait(mix->device->mc1n2_pdata,
+			&mix->startup.time_codec_started, &mix->startup.time_codec_done);
+		if(rc < 0)
+			ALOGE("Failed to set Yamaha-MC1N2-Audio route");
+	}
+#endif
+
+	mix->startup.time_barrier = audio_hw_time();
+
+	audio_mix_pcm_set(mix, pcm);
+	mix->standby = 0;
+
+	return pcm != NULL ? 0 : -1;
+}
+
+static void audio_mix_pcm_standby(struct tinyalsa_audio_mix *mix)
+{
+	int rc;
+
+	ALOGD("%s(%p)", __func__, mix);
+
+	if(mix->pcm != NULL) {
+		pcm_close(mix->pcm);
+		mix->pcm = NULL;
+	}
+
+	mix->pcm_retry_delay = 0;
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	rc = yamaha_mc1n2_audio_output_stop(mix->device->mc1n2_pdata);
+	if(rc < 0)
+		ALOGE("Failed to set Yamaha-MC1N2-Audio route");
+#endif
+
+	mix->standby = 1;
+}
+
+static void audio_mix_pcm_write(struct tinyalsa_audio_mix *mix)
+{
+	int period_size;
+	int rc;
+
+	period_size = mix->period_size;
+
+	if(mix->pcm == NULL && audio_hw_time() >= mix->pcm_retry_time)
+		audio_mix_pcm_set(mix, audio_mix_pcm_open(mix, period_size,
+			mix->period_count));
+
+	// Streams are still paced at the hardware rate without a pcm
+	if(mix->pcm == NULL) {
+		mix->write_errors++;
+		usleep(period_size * 1000000LL / mix->mixer_props->rate);
+		return;
+	}
+
+	rc = pcm_write(mix->pcm, mix->buffer_out, period_size * mix->channels * sizeof(int16_t));
+	if(rc != 0) {
+		ALOGE("pcm write failed!");
+		mix->write_errors++;
+	}
+
+	mix->periods++;
+	mix->profiles[mix->profile].periods++;
+}
+
+/*
+ * Profiles
+ */
+
+static char *audio_mix_profile_names[] = {
+	"screen on",
+	"screen off",
+};
+
+/*
+ * Called with the mix lock held.
+ */
+static int audio_mix_geometry_changed(struct tinyalsa_audio_mix *mix)
+{
+	struct tinyalsa_audio_mix_profile *profile;
+
+	profile = &mix->profiles[mix->profile_target];
+
+	return profile->period_size != mix->period_size ||
+		profile->period_count != mix->period_count;
+}
+
+/*
+ * Called with the mix lock held. Returns whether the periods queued to the
+ * pcm are all silent while a new geometry is pending.
+ */
+static int audio_mix_silent_pending(struct tinyalsa_audio_mix *mix)
+{
+	return mix->reconfigure && mix->silent_periods >= mix->period_count;
+}
+
+/*
+ * Called with the mix lock held. Returns whether the frames queued to every
+ * ring fit in the ring size of the target geometry.
+ */
+static int audio_mix_rings_fit(struct tinyalsa_audio_mix *mix)
+{
+	int size;
+	int i;
+
+	size = mix->profiles[mix->profile_target].period_size * TINYALSA_AUDIO_MIX_RING_PERIODS;
+
+	for(i=0 ; i < mix->streams_count ; i++)
+		if(mix->streams[i]->fill > size)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Called with the mix lock held and the pcm closed. The lock is dropped
+ * meanwhile the pcm is probed, streams may keep writing to their rings: the
+ * switch is left pending if their frames no longer fit in the new rings.
+ */
+static void audio_mix_reconfigure(struct tinyalsa_audio_mix *mix)
+{
+	int16_t *buffers[TINYALSA_AUDIO_MIX_STREAMS_MAX] = { NULL };
+	struct tinyalsa_audio_mix_stream *stream;
+	struct pcm *pcm;
+	int32_t *buffer_mix = NULL;
+	int16_t *buffer_out = NULL;
+	int period_size;
+	int period_count;
+	int channels;
+	int target;
+	int size;
+	int fill;
+	int read;
+	int chunk;
+	int64_t time;
+	int i;
+
+	target = mix->profile_target;
+	period_size = mix->profiles[target].period_size;
+	period_count = mix->profiles[target].period_count;
+	channels = mix->channels;
+
+	mix->reconfigure = 0;
+	mix->silent_periods = 0;
+
+	if(!audio_mix_geometry_changed(mix))
+		goto complete;
+
+	pthread_mutex_unlock(&mix->lock);
+
+	pcm = audio_mix_pcm_open(mix, period_size, period_count);
+	if(pcm != NULL)
+		pcm_close(pcm);
+
+	buffer_mix = calloc(period_size * channels, sizeof(int32_t));
+	buffer_out = calloc(period_size * channels, sizeof(int16_t));
+
+	pthread_mutex_lock(&mix->lock);
+
+	if(pcm == NULL) {
+		ALOGE("Period geometry refused by the pcm: %d frames, %d periods", period_size, period_count);
+
+		// The profile keeps the geometry in use
+		mix->profiles[target].period_size = mix->period_size;
+		mix->profiles[target].period_count = mix->period_count;
+		goto complete;
+	}
+
+	if(buffer_mix == NULL || buffer_out == NULL)
+		goto complete;
+
+	size = period_size * TINYALSA_AUDIO_MIX_RING_PERIODS;
+
+	if(target != mix->profile_target || !audio_mix_rings_fit(mix)) {
+		mix->reconfigure = 1;
+		goto release;
+	}
+
+	for(i=0 ; i < mix->streams_count ; i++) {
+		buffers[i] = calloc(size * channels, sizeof(int16_t));
+		if(buffers[i] == NULL)
+			goto complete;
+	}
+
+	// Queued frames are moved to the start of the new rings
+	for(i=0 ; i < mix->streams_count ; i++) {
+		stream = mix->streams[i];
+
+		fill = stream->fill;
+		read = stream->read;
+
+		chunk = stream->size - read;
+		if(chunk > fill)
+			chunk = fill;
+
+		memcpy(buffers[i], stream->buffer + read * channels,
+			chunk * channels * sizeof(int16_t));
+		memcpy(buffers[i] + chunk * channels, stream->buffer,
+			(fill - chunk) * channels * sizeof(int16_t));
+
+		free(stream->buffer);
+		stream->buffer = buffers[i];
+		stream->size = size;
+		stream->read = 0;
+		stream->fill = fill;
+		buffers[i] = NULL;
+	}
+
+	free(mix->buffer_mix);
+	mix->buffer_mix = buffer_mix;
+	buffer_mix = NULL;
+
+	free(mix->buffer_out);
+	mix->buffer_out = buffer_out;
+	buffer_out = NULL;
+
+	mix->period_size = period_size;
+	mix->period_count = period_count;
+
+	pthread_cond_broadcast(&mix->space_cond);
+
+	ALOGD("Period geometry set: %d frames, %d periods", period_size, period_count);
+
+complete:
+	if(target != mix->profile) {
+		time = audio_hw_time();
+		mix->profiles[mix->profile].time += time - mix->profile_time;
+		mix->profile_time = time;
+		mix->profile = target;
+	}
+
+release:
+	for(i=0 ; i < TINYALSA_AUDIO_MIX_STREAMS_MAX ; i++)
+		if(buffers[i] != NULL)
+			free(buffers[i]);
+
+	if(buffer_mix != NULL)
+		free(buffer_mix);
+	if(buffer_out != NULL)
+		free(buffer_out);
+}
+
+/*
+ * Called with the mix lock held, once the periods queued to the pcm are all
+ * silent and the rings fit in the new geometry. Streams stay active, so
+ * that their resamplers keep their phase.
+ */
+static void audio_mix_switch(struct tinyalsa_audio_mix *mix)
+{
+	if(!audio_mix_geometry_changed(mix)) {
+		audio_mix_reconfigure(mix);
+		return;
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	if(mix->pcm != NULL) {
+		pcm_close(mix->pcm);
+		mix->pcm = NULL;
+	}
+
+	pthread_mutex_lock(&mix->lock);
+
+	audio_mix_reconfigure(mix);
+
+	pthread_mutex_unlock(&mix->lock);
+
+	audio_mix_pcm_set(mix, audio_mix_pcm_open(mix, mix->period_size,
+		mix->period_count));
+
+	pthread_mutex_lock(&mix->lock);
+}
+
+static void *audio_mix_thread(void *data)
+{
+	struct tinyalsa_audio_mix *mix;
+	int startup;
+
+	mix = (struct tinyalsa_audio_mix *) data;
+
+	pthread_mutex_lock(&mix->lock);
+
+	while(1) {
+		if(!audio_mix_ready(mix)) {
+			if(!mix->running)
+				break;
+
+			if(!mix->standby && !audio_mix_active(mix)) {
+				pthread_mutex_unlock(&mix->lock);
+				audio_mix_pcm_standby(mix);
+				pthread_mutex_lock(&mix->lock);
+				continue;
+			}
+
+			// Streams short of a period do not hold the switch back
+			if(!mix->standby && audio_mix_silent_pending(mix) && audio_mix_rings_fit(mix)) {
+				audio_mix_switch(mix);
+				continue;
+			}
+
+			if(mix->standby && mix->reconfigure && audio_mix_rings_fit(mix)) {
+				audio_mix_reconfigure(mix);
+				continue;
+			}
+
+			pthread_cond_wait(&mix->cond, &mix->lock);
+			continue;
+		}
+
+		audio_mix_period(mix);
+
+		startup = mix->standby;
+
+		pthread_mutex_unlock(&mix->lock);
+
+		if(startup) {
+			mix->startup.time_process = audio_hw_time();
+			audio_mix_pcm_start(mix);
+		}
+
+		audio_mix_pcm_write(mix);
+
+		if(startup) {
+			mix->startup.time_write = audio_hw_time();
+			audio_mix_startup_report(mix);
+		}
+
+		pthread_mutex_lock(&mix->lock);
+
+		// Only the profile changes without a new geometry
+		if(mix->reconfigure && (!audio_mix_geometry_changed(mix) ||
+			(audio_mix_silent_pending(mix) && audio_mix_rings_fit(mix))))
+			audio_mix_switch(mix);
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	if(!mix->standby)
+		audio_mix_pcm_standby(mix);
+
+	return NULL;
+}
+
+/*
+ * Streams
+ */
+
+/*
+ * Blocks until the frames are in the ring, as a write to the pcm would.
+ * Returns the number of frames written, that is short when the stream is
+ * stopped meanwhile.
+ */
+int audio_mix_stream_write(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, int16_t *buffer, int frames)
+{
+	int channels;
+	int written = 0;
+	int index;
+	int count;
+	int chunk;
+
+	if(mix == NULL || stream == NULL || buffer == NULL)
+		return -1;
+
+	channels = mix->channels;
+
+	pthread_mutex_lock(&mix->lock);
+
+	while(written < frames) {
+		while(mix->running && stream->active && stream->fill == stream->size)
+			pthread_cond_wait(&mix->space_cond, &mix->lock);
+
+		if(!mix->running || !stream->active)
+			break;
+
+		count = stream->size - stream->fill;
+		if(count > frames - written)
+			count = frames - written;
+
+		index = (stream->read + stream->fill) % stream->size;
+
+		chunk = stream->size - index;
+		if(chunk > count)
+			chunk = count;
+
+		memcpy(stream->buffer + index * channels, buffer + written * channels,
+			chunk * channels * sizeof(int16_t));
+		memcpy(stream->buffer, buffer + (written + chunk) * channels,
+			(count - chunk) * channels * sizeof(int16_t));
+
+		stream->fill += count;
+		written += count;
+
+		pthread_cond_signal(&mix->cond);
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return written;
+}
+
+int audio_mix_stream_start(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream)
+{
+	if(mix == NULL || stream == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	if(!stream->active) {
+		if(mix->standby && !audio_mix_active(mix)) {
+			memset(&mix->startup, 0, sizeof(mix->startup));
+			mix->startup.time_start = audio_hw_time();
+		}
+
+		stream->active = 1;
+		stream->read = 0;
+		stream->fill = 0;
+
+		// Nothing was played since, there is nothing to ramp from
+		stream->gain_current[0] = stream->gain[0];
+		stream->gain_current[1] = stream->gain[1];
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+/*
+ * Frames left in the ring are dropped.
+ */
+int audio_mix_stream_stop(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream)
+{
+	if(mix == NULL || stream == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	stream->active = 0;
+	stream->fill = 0;
+
+	pthread_cond_broadcast(&mix->space_cond);
+	pthread_cond_signal(&mix->cond);
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+static int audio_mix_gain(float gain)
+{
+	if(gain < 0.0f)
+		gain = 0.0f;
+	else if(gain > 1.0f)
+		gain = 1.0f;
+
+	return (int) (gain * TINYALSA_AUDIO_MIX_GAIN_UNITY + 0.5f);
+}
+
+/*
+ * Mono mixes take the average of both gains. No mixer control is written,
+ * changes are counted to account for the mixer writes saved.
+ */
+int audio_mix_stream_set_gain(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, float left, float right)
+{
+	int gain[2];
+
+	if(mix == NULL || stream == NULL)
+		return -1;
+
+	gain[0] = audio_mix_gain(left);
+	gain[1] = audio_mix_gain(right);
+
+	if(mix->channels == 1) {
+		gain[0] = (gain[0] + gain[1]) / 2;
+		gain[1] = gain[0];
+	}
+
+	pthread_mutex_lock(&mix->lock);
+
+	if(stream->gain[0] != gain[0] || stream->gain[1] != gain[1]) {
+		stream->gain[0] = gain[0];
+		stream->gain[1] = gain[1];
+		stream->gain_changes++;
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+/*
+ * Sets the geometry of the profile picked by screen state. It is only
+ * validated against the pcm when applied, and dropped then if refused.
+ */
+int audio_mix_set_period(struct tinyalsa_audio_mix *mix,
+	int period_size, int period_count)
+{
+	if(mix == NULL || period_size <= 0 || period_count <= 0)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	mix->profiles[mix->profile_target].period_size = period_size;
+	mix->profiles[mix->profile_target].period_count = period_count;
+	mix->reconfigure = 1;
+
+	pthread_cond_signal(&mix->cond);
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+/*
+ * Geometry the mixed pcm has now, that changes as profiles are applied.
+ */
+int audio_mix_get_period(struct tinyalsa_audio_mix *mix,
+	int *period_size, int *period_count)
+{
+	if(mix == NULL || period_size == NULL || period_count == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	*period_size = mix->period_size;
+	*period_count = mix->period_count;
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+int audio_mix_set_profile(struct tinyalsa_audio_mix *mix, int profile)
+{
+	if(mix == NULL || profile < 0 || profile >= TINYALSA_AUDIO_MIX_PROFILES)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	if(mix->profile_target != profile) {
+		mix->profile_target = profile;
+		mix->reconfigure = 1;
+
+		pthread_cond_signal(&mix->cond);
+	}
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return 0;
+}
+
+/*
+ * Returns the data of the oldest stream, NULL when there is none.
+ */
+void *audio_mix_stream_first(struct tinyalsa_audio_mix *mix)
+{
+	void *data = NULL;
+
+	if(mix == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&mix->lock);
+
+	if(mix->streams_count > 0)
+		data = mix->streams[0]->data;
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return data;
+}
+
+/*
+ * Returns the number of streams left.
+ */
+int audio_mix_stream_remove(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream)
+{
+	int count;
+	int i;
+
+	if(mix == NULL || stream == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mix->lock);
+
+	for(i=0 ; i < mix->streams_count ; i++)
+		if(mix->streams[i] == stream)
+			break;
+
+	if(i < mix->streams_count) {
+		memmove(&mix->streams[i], &mix->streams[i + 1],
+			(mix->streams_count - i - 1) * sizeof(struct tinyalsa_audio_mix_stream *));
+		mix->streams_count--;
+	}
+
+	stream->active = 0;
+	count = mix->streams_count;
+
+	pthread_cond_broadcast(&mix->space_cond);
+	pthread_cond_signal(&mix->cond);
+	pthread_mutex_unlock(&mix->lock);
+
+	if(stream->buffer != NULL) {
+		free(stream->buffer);
+		stream->buffer = NULL;
+	}
+
+	return count;
+}
+
+/*
+ * Returns the number of streams, including the new one.
+ */
+int audio_mix_stream_add(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, void *data)
+{
+	int count;
+
+	if(mix == NULL || stream == NULL)
+		return -1;
+
+	memset(stream, 0, sizeof(struct tinyalsa_audio_mix_stream));
+
+	stream->data = data;
+	stream->gain[0] = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+	stream->gain[1] = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+	stream->gain_current[0] = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+	stream->gain_current[1] = TINYALSA_AUDIO_MIX_GAIN_UNITY;
+
+	// Sized under the lock, the period size may change in standby
+	pthread_mutex_lock(&mix->lock);
+
+	if(mix->streams_count == TINYALSA_AUDIO_MIX_STREAMS_MAX) {
+		pthread_mutex_unlock(&mix->lock);
+		ALOGE("Too many output streams");
+		return -1;
+	}
+
+	stream->size = mix->period_size * TINYALSA_AUDIO_MIX_RING_PERIODS;
+
+	stream->buffer = calloc(stream->size * mix->channels, sizeof(int16_t));
+	if(stream->buffer == NULL) {
+		pthread_mutex_unlock(&mix->lock);
+		return -ENOMEM;
+	}
+
+	mix->streams[mix->streams_count] = stream;
+	mix->streams_count++;
+	count = mix->streams_count;
+
+	pthread_mutex_unlock(&mix->lock);
+
+	return count;
+}
+
+int audio_mix_dump(struct tinyalsa_audio_mix *mix, int fd)
+{
+	struct tinyalsa_audio_mix_startup *startup;
+	struct tinyalsa_audio_mix_profile *profile;
+	struct tinyalsa_audio_mix_stream *stream;
+	char buffer[1024];
+	int64_t time_now;
+	int64_t time;
+	int length;
+	int rc;
+	int i;
+
+	if(mix == NULL)
+		return -1;
+
+	startup = &mix->startup;
+
+	// Written out of the lock
+	pthread_mutex_lock(&mix->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "Mix: %d streams, %s, %d frames x %d periods%s, %u periods, %u write errors\n",
+		mix->streams_count, mix->standby ? "standby" : "running", mix->period_size,
+		mix->period_count, mix->reconfigure ? " (change pending)" : "",
+		mix->periods, mix->write_errors);
+
+	time_now = audio_hw_time();
+
+	for(i=0 ; i < TINYALSA_AUDIO_MIX_PROFILES && length < (int) sizeof(buffer) ; i++) {
+		profile = &mix->profiles[i];
+
+		time = profile->time;
+		if(i == mix->profile)
+			time += time_now - mix->profile_time;
+
+		// Periods written are as many pcm wakeups
+		length += snprintf(buffer + length, sizeof(buffer) - length,
+			"Mix profile %s%s: %d frames x %d periods, %lld s, %u periods, %.1f wakeups/s\n",
+			audio_mix_profile_names[i], i == mix->profile ? " (current)" : "",
+			profile->period_size, profile->period_count, (long long) (time / 1000000),
+			profile->periods, time > 0 ? profile->periods * 1000000.0 / time : 0.0);
+	}
+
+	for(i=0 ; i < mix->streams_count && length < (int) sizeof(buffer) ; i++) {
+		stream = mix->streams[i];
+
+		length += snprintf(buffer + length, sizeof(buffer) - length,
+			"Mix stream %d: %s, gain %d/%d %d/%d, %u gain changes without mixer writes, %d frames queued, %u underruns\n", i,
+			stream->active ? "active" : "standby", stream->gain[0], TINYALSA_AUDIO_MIX_GAIN_UNITY,
+			stream->gain[1], TINYALSA_AUDIO_MIX_GAIN_UNITY, stream->gain_changes,
+			stream->fill, stream->underruns);
+	}
+
+	if(startup->time_write != 0 && length < (int) sizeof(buffer))
+		length += snprintf(buffer + length, sizeof(buffer) - length,
+			"Output time to first sample: %d us (process: %d us, pcm open: %d us, codec: %d us, barrier: %d us, write: %d us)\n",
+			(int) (startup->time_write - startup->time_start),
+			(int) (startup->time_process - startup->time_start),
+			(int) (startup->time_pcm_open - startup->time_process),
+			(int) (startup->time_codec_done - startup->time_codec_started),
+			(int) (startup->time_barrier - startup->time_pcm_open),
+			(int) (startup->time_write - startup->time_barrier));
+
+	pthread_mutex_unlock(&mix->lock);
+
+	if(length > (int) sizeof(buffer) - 1)
+		length = sizeof(buffer) - 1;
+
+	if(length > 0)
+		write(fd, buffer, length);
+
+	return 0;
+}
+
+/*
+ * Interface
+ */
+
+static int audio_mix_property_int(const char *key, int value)
+{
+	char property[PROPERTY_VALUE_MAX];
+
+	property_get(key, property, "");
+	if(property[0] == '\0')
+		return value;
+
+	return atoi(property);
+}
+
+/*
+ * The screen off profile defaults to periods RATIO times as large as the
+ * ones from the mixer config, the screen on one.
+ */
+static void audio_mix_profiles_init(struct tinyalsa_audio_mix *mix)
+{
+	struct tinyalsa_audio_mix_profile *profile;
+	int period_size;
+	int period_count;
+
+	profile = &mix->profiles[TINYALSA_AUDIO_MIX_PROFILE_SCREEN_ON];
+	profile->period_size = mix->mixer_props->period_size;
+	profile->period_count = mix->mixer_props->period_count;
+
+	period_size = mix->mixer_props->period_size * TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_RATIO;
+	if(period_size > TINYALSA_AUDIO_PERIOD_SIZE_MAX)
+		period_size = TINYALSA_AUDIO_PERIOD_SIZE_MAX;
+
+	period_size = audio_mix_property_int(TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_SIZE_PROPERTY,
+		period_size) & ~15;
+	period_count = audio_mix_property_int(TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_COUNT_PROPERTY,
+		mix->mixer_props->period_count);
+
+	if(period_size < TINYALSA_AUDIO_PERIOD_SIZE_MIN || period_size > TINYALSA_AUDIO_PERIOD_SIZE_MAX ||
+		period_count < TINYALSA_AUDIO_PERIOD_COUNT_MIN || period_count > TINYALSA_AUDIO_PERIOD_COUNT_MAX) {
+		ALOGE("Invalid screen off period geometry: %d frames, %d periods", period_size, period_count);
+		period_size = mix->mixer_props->period_size;
+		period_count = mix->mixer_props->period_count;
+	}
+
+	profile = &mix->profiles[TINYALSA_AUDIO_MIX_PROFILE_SCREEN_OFF];
+	profile->period_size = period_size;
+	profile->period_count = period_count;
+
+	mix->profile = TINYALSA_AUDIO_MIX_PROFILE_SCREEN_ON;
+	mix->profile_target = TINYALSA_AUDIO_MIX_PROFILE_SCREEN_ON;
+	mix->profile_time = audio_hw_time();
+}
+
+void audio_mix_close(struct tinyalsa_audio_mix *mix)
+{
+	ALOGD("%s(%p)", __func__, mix);
+
+	if(mix == NULL)
+		return;
+
+	pthread_mutex_lock(&mix->lock);
+	mix->running = 0;
+	pthread_cond_broadcast(&mix->space_cond);
+	pthread_cond_signal(&mix->cond);
+	pthread_mutex_unlock(&mix->lock);
+
+	pthread_join(mix->thread, NULL);
+
+	pthread_cond_destroy(&mix->space_cond);
+	pthread_cond_destroy(&mix->cond);
+	pthread_mutex_destroy(&mix->lock);
+
+	free(mix->buffer_mix);
+	free(mix->buffer_out);
+	free(mix);
+}
+
+int audio_mix_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_mix **mix_p)
+{
+	struct tinyalsa_mixer_io_props *mixer_props;
+	struct tinyalsa_audio_mix *mix;
+	int rc;
+
+	ALOGD("%s(%p, %p)", __func__, device, mix_p);
+
+	if(device == NULL || device->mixer == NULL || mix_p == NULL)
+		return -1;
+
+	mixer_props = tinyalsa_mixer_get_output_props(device->mixer);
+	if(mixer_props == NULL)
+		return -1;
+
+	// Default values
+	if(mixer_props->rate == 0)
+		mixer_props->rate = 44100;
+	if(mixer_props->channel_mask == 0)
+		mixer_props->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+	if(mixer_props->format == 0)
+		mixer_props->format = AUDIO_FORMAT_PCM_16_BIT;
+
+	// Outputs count their frames with the props format, it is the pcm one
+	if(mixer_props->format != AUDIO_FORMAT_PCM_16_BIT) {
+		ALOGE("Only PCM 16 is mixed, ignoring format: 0x%x", mixer_props->format);
+		mixer_props->format = AUDIO_FORMAT_PCM_16_BIT;
+	}
+
+	mix = calloc(1, sizeof(struct tinyalsa_audio_mix));
+	if(mix == NULL)
+		return -ENOMEM;
+
+	mix->device = device;
+	mix->mixer_props = mixer_props;
+	mix->channels = popcount(mixer_props->channel_mask);
+	mix->period_size = mixer_props->period_size;
+	mix->period_count = mixer_props->period_count;
+	mix->standby = 1;
+	mix->running = 1;
+
+	mix->buffer_mix = calloc(mixer_props->period_size * mix->channels, sizeof(int32_t));
+	mix->buffer_out = calloc(mixer_props->period_size * mix->channels, sizeof(int16_t));
+	if(mix->buffer_mix == NULL || mix->buffer_out == NULL)
+		goto error_buffers;
+
+	audio_mix_profiles_init(mix);
+
+	pthread_mutex_init(&mix->lock, NULL);
+	pthread_cond_init(&mix->cond, NULL);
+	pthread_cond_init(&mix->space_cond, NULL);
+
+	rc = pthread_create(&mix->thread, NULL, audio_mix_thread, mix);
+	if(rc != 0) {
+		ALOGE("Unable to create mix thread");
+		goto error_thread;
+	}
+
+	*mix_p = mix;
+
+	return 0;
+
+error_thread:
+	pthread_cond_destroy(&mix->space_cond);
+	pthread_cond_destroy(&mix->cond);
+	pthread_mutex_destroy(&mix->lock);
+
+error_buffers:
+	if(mix->buffer_mix != NULL)
+		free(mix->buffer_mix);
+	if(mix->buffer_out != NULL)
+		free(mix->buffer_out);
+
+	free(mix);
+	*mix_p = NULL;
+
+	return -1;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TINYALSA_AUDIO_MIX_H
+#define TINYALSA_AUDIO_MIX_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#define TINYALSA_AUDIO_MIX_STREAMS_MAX		8
+#define TINYALSA_AUDIO_MIX_RING_PERIODS		2
+
+#define TINYALSA_AUDIO_MIX_PCM_RETRY_MIN		20000
+#define TINYALSA_AUDIO_MIX_PCM_RETRY_MAX		1000000
+
+#define TINYALSA_AUDIO_MIX_GAIN_SHIFT		12
+#define TINYALSA_AUDIO_MIX_GAIN_UNITY		(1 << TINYALSA_AUDIO_MIX_GAIN_SHIFT)
+
+#define TINYALSA_AUDIO_MIX_PROFILE_SCREEN_ON	0
+#define TINYALSA_AUDIO_MIX_PROFILE_SCREEN_OFF	1
+#define TINYALSA_AUDIO_MIX_PROFILES		2
+
+#define TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_SIZE_PROPERTY	"persist.audio.mix.screen_off_period_size"
+#define TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_COUNT_PROPERTY	"persist.audio.mix.screen_off_period_count"
+#define TINYALSA_AUDIO_MIX_SCREEN_OFF_PERIOD_RATIO		4
+
+/*
+ * Output streams write into their own ring, at the hardware rate and
+ * channels. A mixer thread sums a period of every active stream, with the
+ * stream gain applied in the same pass, and saturates the sum into the
+ * hardware pcm. The pcm is opened when the first stream leaves standby and
+ * closed once every stream is in standby, so that streams opening and
+ * closing do not disturb it.
+ *
+ * Samples are 16-bit, gains are fixed-point with GAIN_SHIFT fractional bits.
+ * Left and right gains are set apart, a new gain is ramped to linearly over
+ * the next period mixed, so that volume changes and fades do not step.
+ *
+ * The period geometry comes from a profile picked by screen state: the one
+ * from the mixer config with the screen on, larger periods with it off. A
+ * new geometry is applied by the mixer thread once in standby, or once the
+ * periods queued to the pcm are all silent: the pcm is then reopened while
+ * streams keep running, their resamplers untouched. Queued frames are never
+ * dropped: with smaller rings, the switch waits until every ring fits in its
+ * new size, at the latest until standby. The pcm is probed with the
+ * geometry before the rings and mix buffers are reallocated, and the
+ * geometry is dropped if the pcm does not take it. The geometry in use is
+ * kept in the mix, under its lock, the mixer config props are left as read.
+ */
+
+/*
+ * Time to first sample after standby, as monotonic timestamps in us. The
+ * codec is brought up on the Yamaha-MC1N2-Audio worker meanwhile.
+ */
+struct tinyalsa_audio_mix_startup {
+	int64_t time_start;
+	int64_t time_pcm_open;
+	int64_t time_process;
+	int64_t time_codec_started;
+	int64_t time_codec_done;
+	int64_t time_barrier;
+	int64_t time_write;
+};
+
+/*
+ * Time spent with a profile in use, in us, and the periods written to the
+ * pcm meanwhile, that are as many wakeups.
+ */
+struct tinyalsa_audio_mix_profile {
+	int period_size;
+	int period_count;
+
+	int64_t time;
+	unsigned int periods;
+};
+
+struct tinyalsa_audio_mix_stream {
+	void *data;
+
+	int16_t *buffer;
+	int size;
+	int read;
+	int fill;
+
+	int active;
+	int gain[2];
+	int gain_current[2];
+
+	unsigned int gain_changes;
+	unsigned int underruns;
+};
+
+struct tinyalsa_audio_mix {
+	struct tinyalsa_audio_device *device;
+	struct tinyalsa_mixer_io_props *mixer_props;
+	int channels;
+	int period_size;
+	int period_count;
+
+	struct tinyalsa_audio_mix_stream *streams[TINYALSA_AUDIO_MIX_STREAMS_MAX];
+	int streams_count;
+
+	struct pcm *pcm;
+	int64_t pcm_retry_time;
+	int pcm_retry_delay;
+	int standby;
+	struct tinyalsa_audio_mix_startup startup;
+
+	struct tinyalsa_audio_mix_profile profiles[TINYALSA_AUDIO_MIX_PROFILES];
+	int profile;
+	int profile_target;
+	int64_t profile_time;
+	int reconfigure;
+	int silent_periods;
+
+	int32_t *buffer_mix;
+	int16_t *buffer_out;
+
+	unsigned int periods;
+	unsigned int write_errors;
+
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t space_cond;
+};
+
+int audio_mix_stream_write(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, int16_t *buffer, int frames);
+int audio_mix_stream_start(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream);
+int audio_mix_stream_stop(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream);
+int audio_mix_stream_set_gain(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, float left, float right);
+int audio_mix_set_period(struct tinyalsa_audio_mix *mix,
+	int period_size, int period_count);
+int audio_mix_get_period(struct tinyalsa_audio_mix *mix,
+	int *period_size, int *period_count);
+int audio_mix_set_profile(struct tinyalsa_audio_mix *mix, int profile);
+
+void *audio_mix_stream_first(struct tinyalsa_audio_mix *mix);
+int audio_mix_stream_remove(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream);
+int audio_mix_stream_add(struct tinyalsa_audio_mix *mix,
+	struct tinyalsa_audio_mix_stream *stream, void *data);
+
+int audio_mix_dump(struct tinyalsa_audio_mix *mix, int fd);
+
+void audio_mix_close(struct tinyalsa_audio_mix *mix);
+int audio_mix_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_mix **mix_p);
+
+#endif
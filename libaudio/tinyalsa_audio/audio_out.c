@@ -20,10 +20,14 @@
 
 #define LOG_TAG "TinyALSA-Audio Output"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include <cutils/str_parms.h>
@@ -43,78 +47,44 @@
  * Functions
  */
 
-int audio_out_pcm_open(struct tinyalsa_audio_stream_out *stream_out)
+/*
+ * Called with the stream lock held.
+ */
+int audio_out_standby_locked(struct tinyalsa_audio_stream_out *stream_out)
 {
-	struct pcm *pcm = NULL;
-	struct pcm_config pcm_config;
-
-	if(stream_out == NULL)
-		return -1;
-
-	memset(&pcm_config, 0, sizeof(pcm_config));
-	pcm_config.channels = popcount(stream_out->mixer_props->channel_mask);
-	pcm_config.rate = stream_out->mixer_props->rate;
-	switch(stream_out->mixer_props->format) {
-		case AUDIO_FORMAT_PCM_16_BIT:
-			pcm_config.format = PCM_FORMAT_S16_LE;
-			break;
-		case AUDIO_FORMAT_PCM_32_BIT:
-			pcm_config.format = PCM_FORMAT_S32_LE;
-			break;
-		default:
-			ALOGE("Invalid format: 0x%x", stream_out->mixer_props->format);
-			return -1;
-	}
-	pcm_config.period_size = stream_out->mixer_props->period_size;
-	pcm_config.period_count = stream_out->mixer_props->period_count;
-
-	pcm = pcm_open(stream_out->mixer_props->card,
-		stream_out->mixer_props->device, PCM_OUT, &pcm_config);
-
-	if(pcm == NULL || !pcm_is_ready(pcm)) {
-		ALOGE("Unable to open pcm device: %s", pcm_get_error(pcm));
-		return -1;
+	// The mix closes the pcm once every output is in standby
+	if(!stream_out->standby) {
+		if(stream_out->hdmi != NULL)
+			audio_hdmi_stop(stream_out->hdmi);
+		else
+			audio_mix_stream_stop(stream_out->device->mix, &stream_out->mix_stream);
 	}
 
-	stream_out->pcm = pcm;
-
-	if(stream_out->resampler != NULL)
-		stream_out->resampler->reset(stream_out->resampler);
+	stream_out->standby = 1;
 
 	return 0;
 }
 
-void audio_out_pcm_close(struct tinyalsa_audio_stream_out *stream_out)
-{
-	if(stream_out->pcm == NULL)
-		return;
-
-	pcm_close(stream_out->pcm);
-	stream_out->pcm = NULL;
-}
-
+/*
+ * Called with the stream lock held, no token is given for the null device.
+ */
 int audio_out_set_route(struct tinyalsa_audio_stream_out *stream_out,
-	audio_devices_t device)
+	audio_devices_t device, unsigned int *token)
 {
-	int rc;
-
 	if(stream_out == NULL)
 		return -1;
 
 	stream_out->device_current = device;
 
-	if(device == 0) {
-		pthread_mutex_unlock(&stream_out->lock);
-		return stream_out->stream.common.standby((struct audio_stream *) stream_out);
-	}
-
-	tinyalsa_mixer_set_device(stream_out->device->mixer, stream_out->device_current);
+	if(device == 0)
+		return audio_out_standby_locked(stream_out);
 
-#ifdef YAMAHA_MC1N2_AUDIO
-	yamaha_mc1n2_audio_set_route(stream_out->device->mc1n2_pdata, device);
-#endif
+	// The HDMI pcm has no codec or mixer path to set
+	if(stream_out->hdmi != NULL)
+		return 0;
 
-	return 0;
+	// The route worker applies mixer, codec and RIL changes
+	return audio_route_queue(stream_out->device->route, device, token);
 }
 
 int audio_out_resampler_open(struct tinyalsa_audio_stream_out *stream_out)
@@ -228,14 +198,16 @@ int audio_out_write_process(struct tinyalsa_audio_stream_out *stream_out, void *
 	}
 
 	if(buffer_in != NULL) {
-		if(stream_out->pcm == NULL || !pcm_is_ready(stream_out->pcm)) {
-			ALOGE("pcm device is not ready");
-			goto error;
-		}
-
-		rc = pcm_write(stream_out->pcm, buffer_in, size_in);
-		if(rc != 0) {
-			ALOGE("pcm write failed!");
+		frames_in = size_in / (popcount(stream_out->mixer_props->channel_mask) *
+			sizeof(int16_t));
+
+		if(stream_out->hdmi != NULL)
+			rc = audio_hdmi_write(stream_out->hdmi, (int16_t *) buffer_in, frames_in);
+		else
+			rc = audio_mix_stream_write(stream_out->device->mix, &stream_out->mix_stream,
+				(int16_t *) buffer_in, frames_in);
+		if(rc < (int) frames_in) {
+			ALOGE("mix write failed!");
 			goto error;
 		}
 	}
@@ -280,7 +252,7 @@ static int audio_out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
 	if(stream_out->rate != (int) rate) {
-		pthread_mutex_lock(&stream_out->lock);
+		audio_lock_lock(&stream_out->lock);
 
 		stream_out->rate = rate;
 
@@ -288,31 +260,42 @@ static int audio_out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 			audio_out_resampler_close(stream_out);
 			audio_out_resampler_open(stream_out);
 
-			stream_out->standby = 1;
+			audio_out_standby_locked(stream_out);
 		}
 
-		pthread_mutex_unlock(&stream_out->lock);
+		audio_lock_unlock(&stream_out->lock);
 	}
 
 	return 0;
 }
 
+/*
+ * Geometry of the pcm the stream plays to: the mix changes its own with the
+ * screen state, the HDMI one is set in the mixer config.
+ */
+static void audio_out_get_period(struct tinyalsa_audio_stream_out *stream_out,
+	int *period_size, int *period_count)
+{
+	if(stream_out->hdmi != NULL) {
+		*period_size = stream_out->mixer_props->period_size;
+		*period_count = stream_out->mixer_props->period_count;
+		return;
+	}
+
+	audio_mix_get_period(stream_out->device->mix, period_size, period_count);
+}
+
+// Set at open, AudioFlinger sizes its buffers with it once
 static size_t audio_out_get_buffer_size(const struct audio_stream *stream)
 {
 	struct tinyalsa_audio_stream_out *stream_out;
-	size_t size;
 
 	if(stream == NULL)
 		return -1;
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
-	size = (stream_out->mixer_props->period_size * stream_out->rate) /
-		stream_out->mixer_props->rate;
-	size = ((size + 15) / 16) * 16;
-	size = size * audio_stream_frame_size((struct audio_stream *) stream);
-
-	return size;
+	return stream_out->buffer_size;
 }
 
 static audio_channel_mask_t audio_out_get_channels(const struct audio_stream *stream)
@@ -350,15 +333,19 @@ static int audio_out_set_format(struct audio_stream *stream, audio_format_t form
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
+	// Without format conversion, only PCM 16 can be mixed
+	if((audio_format_t) format != AUDIO_FORMAT_PCM_16_BIT)
+		return -EINVAL;
+
 	if(stream_out->format != (audio_format_t) format) {
-		pthread_mutex_lock(&stream_out->lock);
+		audio_lock_lock(&stream_out->lock);
 
 		stream_out->format = format;
 
 		if(stream_out->format != stream_out->mixer_props->format)
-			stream_out->standby = 1;
+			audio_out_standby_locked(stream_out);
 
-		pthread_mutex_unlock(&stream_out->lock);
+		audio_lock_unlock(&stream_out->lock);
 	}
 
 	return 0;
@@ -376,39 +363,50 @@ static int audio_out_standby(struct audio_stream *stream)
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
-	pthread_mutex_lock(&stream_out->lock);
-
-	if(stream_out->pcm != NULL)
-		audio_out_pcm_close(stream_out);
-
-#ifdef YAMAHA_MC1N2_AUDIO
-	if(!stream_out->standby) {
-		rc = yamaha_mc1n2_audio_output_stop(stream_out->device->mc1n2_pdata);
-		if(rc < 0) {
-			ALOGE("Failed to set Yamaha-MC1N2-Audio route");
-		}
-	}
-#endif
-
-	stream_out->standby = 1;
-
-	pthread_mutex_unlock(&stream_out->lock);
+	audio_lock_lock(&stream_out->lock);
+	rc = audio_out_standby_locked(stream_out);
+	audio_lock_unlock(&stream_out->lock);
 
-	return 0;
+	return rc;
 }
 
 static int audio_out_dump(const struct audio_stream *stream, int fd)
 {
+	struct tinyalsa_audio_stream_out *stream_out;
+	char buffer[256];
+	int length;
+
 	ALOGD("%s(%p, %d)", __func__, stream, fd);
 
+	if(stream == NULL)
+		return -1;
+
+	stream_out = (struct tinyalsa_audio_stream_out *) stream;
+
+	audio_lock_lock(&stream_out->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "Output %p: %d Hz, %d channels, %s, device 0x%x, %s, %u underruns\n",
+		stream_out, stream_out->rate, popcount(stream_out->channel_mask),
+		stream_out->standby ? "standby" : "running", stream_out->device_current,
+		stream_out->hdmi != NULL ? "HDMI" : "mixed", stream_out->mix_stream.underruns);
+	if(length > 0)
+		write(fd, buffer, length < (int) sizeof(buffer) ? length : (int) sizeof(buffer) - 1);
+
+	audio_lock_unlock(&stream_out->lock);
+
 	return 0;
 }
 
 static int audio_out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
+	struct tinyalsa_audio_ril_interface *ril_interface;
 	struct tinyalsa_audio_stream_out *stream_out;
+	struct tinyalsa_audio_stream_out *primary;
 	struct str_parms *parms;
 	char value_string[32] = { 0 };
+	int period_size;
+	int period_count;
+	int handled = 0;
 	int value;
 	int rc;
 
@@ -426,25 +424,66 @@ static int audio_out_set_parameters(struct audio_stream *stream, const char *kvp
 	if(parms == NULL)
 		return -1;
 
-	rc = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value_string, sizeof(value_string));
+	audio_out_get_period(stream_out, &period_size, &period_count);
+
+	rc = audio_hw_period_parse(parms, stream_out->mixer_props->rate, &period_size, &period_count);
 	if(rc < 0)
 		goto error_params;
 
+	if(rc > 0) {
+		// The HDMI geometry is set in the mixer config
+		if(stream_out->hdmi != NULL)
+			goto error_params;
+
+		// Applied to every mixed output once they are all in standby
+		rc = audio_mix_set_period(stream_out->device->mix, period_size, period_count);
+		if(rc < 0)
+			goto error_params;
+
+		handled = 1;
+	}
+
+	rc = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value_string, sizeof(value_string));
+	if(rc < 0) {
+		if(handled)
+			goto complete;
+
+		goto error_params;
+	}
+
 	value = atoi(value_string);
 
-	pthread_mutex_lock(&stream_out->device->lock);
+	ril_interface = stream_out->device->ril_interface;
 
-	if(stream_out->device_current != (audio_devices_t) value) {
-		pthread_mutex_lock(&stream_out->lock);
-		audio_out_set_route(stream_out, (audio_devices_t) value);
-		pthread_mutex_unlock(&stream_out->lock);
+	// The published primary is not closed meanwhile the streams lock is held
+	audio_lock_lock(&stream_out->device->streams_lock);
+
+	// Only the primary output routes, the others forward their device to it
+	primary = stream_out;
+	if(stream_out->hdmi == NULL && value != 0) {
+		audio_lock_lock(&stream_out->device->lock);
+		if(stream_out->device->stream_out != NULL)
+			primary = stream_out->device->stream_out;
+		audio_lock_unlock(&stream_out->device->lock);
 	}
-	if(stream_out->device->ril_interface != NULL && stream_out->device->ril_interface->device_current != (audio_devices_t) value) {
-		audio_ril_interface_set_route(stream_out->device->ril_interface, (audio_devices_t) value);
+
+	if(primary != stream_out) {
+		audio_lock_lock(&stream_out->lock);
+		stream_out->device_current = (audio_devices_t) value;
+		audio_lock_unlock(&stream_out->lock);
 	}
 
-	pthread_mutex_unlock(&stream_out->device->lock);
+	if(primary->device_current != (audio_devices_t) value) {
+		audio_lock_lock(&primary->lock);
+		audio_out_set_route(primary, (audio_devices_t) value, NULL);
+		audio_lock_unlock(&primary->lock);
+	} else if(ril_interface != NULL && ril_interface->device_current != (audio_devices_t) value) {
+		audio_route_queue(stream_out->device->route, (audio_devices_t) value, NULL);
+	}
 
+	audio_lock_unlock(&stream_out->device->streams_lock);
+
+complete:
 	str_parms_destroy(parms);
 
 	return 0;
@@ -457,15 +496,33 @@ error_params:
 
 static char *audio_out_get_parameters(const struct audio_stream *stream, const char *keys)
 {
+	struct tinyalsa_audio_stream_out *stream_out;
+	int period_size;
+	int period_count;
+
 	ALOGD("%s(%p, %s)", __func__, stream, keys);
 
-	return strdup("");
+	if(stream == NULL)
+		return strdup("");
+
+	stream_out = (struct tinyalsa_audio_stream_out *) stream;
+
+	// Dynamic HDMI profiles are filled in from the probed sink
+	if(stream_out->hdmi != NULL)
+		return audio_hdmi_get_parameters(stream_out->hdmi, keys);
+
+	audio_out_get_period(stream_out, &period_size, &period_count);
+
+	return audio_hw_period_get_parameters(stream_out->mixer_props->rate,
+		period_size, period_count, keys);
 }
 
 static uint32_t audio_out_get_latency(const struct audio_stream_out *stream)
 {
 	struct tinyalsa_audio_stream_out *stream_out;
 	uint32_t latency;
+	int period_size;
+	int period_count;
 
 	ALOGD("%s(%p)", __func__, stream);
 
@@ -474,8 +531,11 @@ static uint32_t audio_out_get_latency(const struct audio_stream_out *stream)
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
-	latency = (stream_out->mixer_props->period_size *
-		stream_out->mixer_props->period_count * 1000) /
+	audio_out_get_period(stream_out, &period_size, &period_count);
+
+	// The mix or HDMI ring adds to the pcm buffering
+	latency = (period_size * (period_count + (stream_out->hdmi != NULL ?
+		TINYALSA_AUDIO_HDMI_RING_PERIODS : TINYALSA_AUDIO_MIX_RING_PERIODS)) * 1000) /
 		stream_out->mixer_props->rate;
 
 	return latency;
@@ -494,17 +554,18 @@ static int audio_out_set_volume(struct audio_stream_out *stream, float left,
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
 
-	if(stream_out->device == NULL || stream_out->device->mixer == NULL)
+	if(stream_out->device == NULL || stream_out->device->mix == NULL)
 		return -1;
 
-	volume = (left + right) / 2;
-
-	pthread_mutex_lock(&stream_out->device->lock);
-	tinyalsa_mixer_set_output_volume(stream_out->device->mixer,
-		stream_out->device_current, volume);
-	pthread_mutex_unlock(&stream_out->device->lock);
+	// Multichannel HDMI layouts take a single gain
+	if(stream_out->hdmi != NULL) {
+		volume = (left + right) / 2;
+		return audio_hdmi_set_gain(stream_out->hdmi, volume);
+	}
 
-	return 0;
+	// Ramped to as the stream is mixed, other outputs keep their own volume
+	return audio_mix_stream_set_gain(stream_out->device->mix,
+		&stream_out->mix_stream, left, right);
 }
 
 static ssize_t audio_out_write(struct audio_stream_out *stream,
@@ -521,22 +582,22 @@ static ssize_t audio_out_write(struct audio_stream_out *stream,
 	if(stream_out->device == NULL)
 		return -1;
 
-	pthread_mutex_lock(&stream_out->lock);
+	audio_lock_lock(&stream_out->lock);
 
 	if(stream_out->standby) {
-#ifdef YAMAHA_MC1N2_AUDIO
-		rc = yamaha_mc1n2_audio_output_start(stream_out->device->mc1n2_pdata);
-		if(rc < 0) {
-			ALOGE("Failed to set Yamaha-MC1N2-Audio route");
-		}
-#endif
-
-		rc = audio_out_pcm_open(stream_out);
+		// The mix brings the codec and pcm up if no other output runs
+		if(stream_out->hdmi != NULL)
+			rc = audio_hdmi_start(stream_out->hdmi);
+		else
+			rc = audio_mix_stream_start(stream_out->device->mix, &stream_out->mix_stream);
 		if(rc < 0) {
-			ALOGE("Unable to open pcm device");
+			ALOGE("Unable to start mix stream");
 			goto error;
 		}
 
+		if(stream_out->resampler != NULL)
+			stream_out->resampler->reset(stream_out->resampler);
+
 		stream_out->standby = 0;
 	}
 
@@ -546,12 +607,12 @@ static ssize_t audio_out_write(struct audio_stream_out *stream,
 		goto error;
 	}
 
-	pthread_mutex_unlock(&stream_out->lock);
+	audio_lock_unlock(&stream_out->lock);
 
 	return bytes;
 
 error:
-	pthread_mutex_unlock(&stream_out->lock);
+	audio_lock_unlock(&stream_out->lock);
 
 	return -1;
 }
@@ -578,6 +639,58 @@ static int audio_out_remove_audio_effect(const struct audio_stream *stream, effe
 	return 0;
 }
 
+/*
+ * Binds the stream to the HDMI pcm, returns -EINVAL with a config the sink
+ * takes filled in when it does not take the one asked for, and -1 when the
+ * stream has to be mixed instead.
+ */
+static int audio_out_hdmi_acquire(struct tinyalsa_audio_stream_out *stream_out,
+	struct audio_config *config)
+{
+	struct tinyalsa_audio_hdmi *hdmi;
+	audio_channel_mask_t channel_mask;
+	int rate;
+	int rc;
+
+	hdmi = stream_out->device->hdmi;
+
+	rc = audio_hdmi_probe(hdmi);
+	if(rc < 0)
+		return -1;
+
+	rc = audio_hdmi_get_default_config(hdmi, &channel_mask, &rate);
+	if(rc < 0)
+		return -1;
+
+	if(config->channel_mask != 0)
+		channel_mask = config->channel_mask;
+	if(config->sample_rate != 0)
+		rate = config->sample_rate;
+
+	if(stream_out->format != AUDIO_FORMAT_PCM_16_BIT ||
+		!audio_hdmi_supported(hdmi, channel_mask, rate)) {
+		audio_hdmi_get_default_config(hdmi, &channel_mask, &rate);
+
+		config->sample_rate = (uint32_t) rate;
+		config->channel_mask = (uint32_t) channel_mask;
+		config->format = AUDIO_FORMAT_PCM_16_BIT;
+
+		return -EINVAL;
+	}
+
+	// Another output holds the HDMI pcm
+	rc = audio_hdmi_acquire(hdmi, stream_out, channel_mask, rate);
+	if(rc < 0)
+		return -1;
+
+	stream_out->hdmi = hdmi;
+	stream_out->mixer_props = hdmi->mixer_props;
+	stream_out->channel_mask = channel_mask;
+	stream_out->rate = rate;
+
+	return 0;
+}
+
 /*
  * Interface
  */
@@ -587,33 +700,52 @@ void audio_hw_close_output_stream(struct audio_hw_device *dev,
 {
 	struct tinyalsa_audio_stream_out *stream_out;
 	struct tinyalsa_audio_device *tinyalsa_audio_device;
+	int count;
 
 	ALOGD("%s(%p)", __func__, stream);
 
 	stream_out = (struct tinyalsa_audio_stream_out *) stream;
+	tinyalsa_audio_device = (struct tinyalsa_audio_device *) dev;
 
-	if(stream_out != NULL && stream_out->resampler != NULL)
-		audio_out_resampler_close(stream_out);
+	if(stream_out == NULL || tinyalsa_audio_device == NULL)
+		return;
 
-#ifdef YAMAHA_MC1N2_AUDIO
-	if(stream_out != NULL && !stream_out->standby)
-		yamaha_mc1n2_audio_output_stop(stream_out->device->mc1n2_pdata);
-#endif
+	// The HDMI output is released for the next stream, nothing was mixed
+	if(stream_out->hdmi != NULL) {
+		audio_hdmi_release(stream_out->hdmi);
 
-	if(stream != NULL)
-		free(stream);
+		if(stream_out->resampler != NULL)
+			audio_out_resampler_close(stream_out);
 
-	if(dev == NULL)
+		audio_lock_destroy(&stream_out->lock);
+		free(stream_out);
 		return;
+	}
 
-	tinyalsa_audio_device = (struct tinyalsa_audio_device *) dev;
+	// Device paths that picked the stream up are done with it once the
+	// streams lock is taken, and cannot pick it up once it is released
+	audio_lock_lock(&tinyalsa_audio_device->streams_lock);
+
+	count = audio_mix_stream_remove(tinyalsa_audio_device->mix, &stream_out->mix_stream);
+
+	// Unpublished first, another mixed output stands in for the stream
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	if(tinyalsa_audio_device->stream_out == stream_out)
+		tinyalsa_audio_device->stream_out = (struct tinyalsa_audio_stream_out *)
+			audio_mix_stream_first(tinyalsa_audio_device->mix);
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
 
-	pthread_mutex_lock(&tinyalsa_audio_device->lock);
+	// The hardware output stays up as long as another stream is mixed
+	if(count == 0)
+		tinyalsa_mixer_set_output_state(tinyalsa_audio_device->mixer, 0);
 
-	tinyalsa_mixer_set_output_state(tinyalsa_audio_device->mixer, 0);
-	tinyalsa_audio_device->stream_out = NULL;
+	audio_lock_unlock(&tinyalsa_audio_device->streams_lock);
 
-	pthread_mutex_unlock(&tinyalsa_audio_device->lock);
+	if(stream_out->resampler != NULL)
+		audio_out_resampler_close(stream_out);
+
+	audio_lock_destroy(&stream_out->lock);
+	free(stream_out);
 }
 
 int audio_hw_open_output_stream(struct audio_hw_device *dev,
@@ -626,6 +758,11 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
 	struct tinyalsa_audio_device *tinyalsa_audio_device;
 	struct tinyalsa_audio_stream_out *tinyalsa_audio_stream_out;
 	struct audio_stream_out *stream;
+	unsigned int token;
+	int period_size;
+	int period_count;
+	size_t size;
+	int primary;
 	int rc;
 
 	ALOGD("%s(%p, %d, %p, %p)",
@@ -644,7 +781,7 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
 		return -ENOMEM;
 
 	tinyalsa_audio_stream_out->device = tinyalsa_audio_device;
-	tinyalsa_audio_device->stream_out = tinyalsa_audio_stream_out;
+	audio_lock_init(&tinyalsa_audio_stream_out->lock, "output");
 	stream = &(tinyalsa_audio_stream_out->stream);
 
 	stream->common.get_sample_rate = audio_out_get_sample_rate;
@@ -664,23 +801,16 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
 	stream->write = audio_out_write;
 	stream->get_render_position = audio_out_get_render_position;
 
-	if(tinyalsa_audio_device->mixer == NULL)
+	if(tinyalsa_audio_device->mixer == NULL || tinyalsa_audio_device->mix == NULL)
 		goto error_stream;
 
+	// Defaults are filled in by the mix at device open
 	tinyalsa_audio_stream_out->mixer_props =
 		tinyalsa_mixer_get_output_props(tinyalsa_audio_device->mixer);
 
 	if(tinyalsa_audio_stream_out->mixer_props == NULL)
 		goto error_stream;
 
-	// Default values
-	if(tinyalsa_audio_stream_out->mixer_props->rate == 0)
-		tinyalsa_audio_stream_out->mixer_props->rate = 44100;
-	if(tinyalsa_audio_stream_out->mixer_props->channel_mask == 0)
-		tinyalsa_audio_stream_out->mixer_props->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
-	if(tinyalsa_audio_stream_out->mixer_props->format == 0)
-		tinyalsa_audio_stream_out->mixer_props->format = AUDIO_FORMAT_PCM_16_BIT;
-
 	//Default incoming data will always be 44100Hz, stereo, PCM 16
 	if(config->sample_rate == 0)
 		tinyalsa_audio_stream_out->rate = 44100;
@@ -695,6 +825,41 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
 	else
 		tinyalsa_audio_stream_out->format = config->format;
 
+	// Without format conversion, only PCM 16 can be mixed
+	if(tinyalsa_audio_stream_out->format != AUDIO_FORMAT_PCM_16_BIT) {
+		ALOGD("Unsupported format 0x%x, suggesting PCM 16",
+			tinyalsa_audio_stream_out->format);
+
+		config->format = AUDIO_FORMAT_PCM_16_BIT;
+
+		audio_lock_destroy(&tinyalsa_audio_stream_out->lock);
+		free(tinyalsa_audio_stream_out);
+
+		return -EINVAL;
+	}
+
+	// Passed through at the sink rate and layout, mixed if HDMI is busy
+	if((devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) && tinyalsa_audio_device->hdmi != NULL) {
+		rc = audio_out_hdmi_acquire(tinyalsa_audio_stream_out, config);
+		if(rc == -EINVAL) {
+			ALOGD("Unsupported HDMI config, suggesting %d Hz with mask 0x%x",
+				config->sample_rate, config->channel_mask);
+
+			audio_lock_destroy(&tinyalsa_audio_stream_out->lock);
+			free(tinyalsa_audio_stream_out);
+
+			return -EINVAL;
+		}
+	}
+
+	audio_out_get_period(tinyalsa_audio_stream_out, &period_size, &period_count);
+
+	size = (period_size * tinyalsa_audio_stream_out->rate) /
+		tinyalsa_audio_stream_out->mixer_props->rate;
+	size = ((size + 15) / 16) * 16;
+	tinyalsa_audio_stream_out->buffer_size = size *
+		audio_stream_frame_size((struct audio_stream *) stream);
+
 	if(tinyalsa_audio_stream_out->rate != tinyalsa_audio_stream_out->mixer_props->rate) {
 		rc = audio_out_resampler_open(tinyalsa_audio_stream_out);
 		if(rc < 0) {
@@ -707,41 +872,74 @@ int audio_hw_open_output_stream(struct audio_hw_device *dev,
 	config->channel_mask = (uint32_t) tinyalsa_audio_stream_out->channel_mask;
 	config->format = (uint32_t) tinyalsa_audio_stream_out->format;
 
-	pthread_mutex_lock(&tinyalsa_audio_device->lock);
+	tinyalsa_audio_stream_out->standby = 1;
 
-	rc = tinyalsa_mixer_set_output_state(tinyalsa_audio_device->mixer, 1);
-	if(rc < 0) {
-		ALOGE("Unable to set output state");
-		pthread_mutex_unlock(&tinyalsa_audio_device->lock);
-		goto error_stream;
-	}
+	if(tinyalsa_audio_stream_out->hdmi != NULL) {
+		tinyalsa_audio_stream_out->device_current = devices;
 
-	pthread_mutex_lock(&tinyalsa_audio_stream_out->lock);
+		*stream_out = stream;
 
-	audio_out_set_route(tinyalsa_audio_stream_out, devices);
+		return 0;
+	}
 
-	pthread_mutex_unlock(&tinyalsa_audio_device->lock);
+	// The mixed stream count and the output state change together under
+	// the streams lock, so a concurrent close cannot turn the output off
+	audio_lock_lock(&tinyalsa_audio_device->streams_lock);
 
-	rc = audio_out_pcm_open(tinyalsa_audio_stream_out);
+	rc = audio_mix_stream_add(tinyalsa_audio_device->mix,
+		&tinyalsa_audio_stream_out->mix_stream, tinyalsa_audio_stream_out);
 	if(rc < 0) {
-		ALOGE("Unable to open pcm device");
-		pthread_mutex_unlock(&tinyalsa_audio_stream_out->lock);
-		goto error_stream;
+		ALOGE("Unable to add mix stream");
+		goto error_streams;
 	}
 
-	audio_out_pcm_close(tinyalsa_audio_stream_out);
+	// Other outputs keep the hardware output and the pcm running
+	if(rc == 1) {
+		rc = tinyalsa_mixer_set_output_state(tinyalsa_audio_device->mixer, 1);
+		if(rc < 0) {
+			ALOGE("Unable to set output state");
+			goto error_mix;
+		}
+	}
 
-	tinyalsa_audio_stream_out->standby = 1;
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	primary = tinyalsa_audio_device->stream_out == NULL;
+	if(primary)
+		tinyalsa_audio_device->stream_out = tinyalsa_audio_stream_out;
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
+
+	audio_lock_unlock(&tinyalsa_audio_device->streams_lock);
+
+	// Only the primary output routes, the others play on its device
+	if(primary) {
+		audio_lock_lock(&tinyalsa_audio_stream_out->lock);
 
-	pthread_mutex_unlock(&tinyalsa_audio_stream_out->lock);
+		rc = audio_out_set_route(tinyalsa_audio_stream_out, devices, &token);
+
+		// The initial route has to be in place before the first write
+		if(rc >= 0 && devices != 0)
+			audio_route_wait(tinyalsa_audio_device->route, token);
+
+		audio_lock_unlock(&tinyalsa_audio_stream_out->lock);
+	} else {
+		tinyalsa_audio_stream_out->device_current = devices;
+	}
 
 	*stream_out = stream;
 
 	return 0;
 
+error_mix:
+	audio_mix_stream_remove(tinyalsa_audio_device->mix, &tinyalsa_audio_stream_out->mix_stream);
+
+error_streams:
+	audio_lock_unlock(&tinyalsa_audio_device->streams_lock);
+
 error_stream:
+	if(tinyalsa_audio_stream_out->resampler != NULL)
+		audio_out_resampler_close(tinyalsa_audio_stream_out);
+	audio_lock_destroy(&tinyalsa_audio_stream_out->lock);
 	free(tinyalsa_audio_stream_out);
-	tinyalsa_audio_device->stream_out = NULL;
 
 	return -1;
 }
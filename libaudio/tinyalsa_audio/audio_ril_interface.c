@@ -18,6 +18,7 @@
 #define LOG_TAG "TinyALSA-Audio RIL Interface"
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -50,25 +51,141 @@ int (*_ril_get_wb_amr)(void *, void *);
 #define VOLUME_STEPS_DEFAULT  "5"
 #define VOLUME_STEPS_PROPERTY "ro.config.vc_call_vol_steps"
 
+/*
+ * RIL client callbacks only carry the client handle, they are matched with
+ * the interface that is currently open.
+ */
+static struct tinyalsa_audio_ril_interface *audio_ril_interface_current = NULL;
+static pthread_mutex_t audio_ril_interface_current_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int audio_ril_interface_wb_amr_callback(void *client, const void *data, size_t length)
+{
+	struct tinyalsa_audio_ril_interface *ril_interface;
+	int wb_amr;
+	int rate;
+
+	if(data == NULL || length < sizeof(int))
+		return 0;
+
+	wb_amr = ((int *) data)[0] ? 1 : 0;
+
+	ALOGD("%s(%d)", __func__, wb_amr);
+
+	pthread_mutex_lock(&audio_ril_interface_current_lock);
+
+	ril_interface = audio_ril_interface_current;
+	if(ril_interface == NULL || ril_interface->interface != client)
+		goto complete;
+
+	// Reported again at each call start, the route thread skips no-op switches
+	ril_interface->wb_amr = wb_amr;
+	rate = wb_amr ? TINYALSA_AUDIO_RIL_RATE_WB : TINYALSA_AUDIO_RIL_RATE_NB;
+
+	// Called from the RIL client thread, the switch is left to the route thread
+	audio_route_queue_modem_rate(ril_interface->device->route, rate);
+
+complete:
+	pthread_mutex_unlock(&audio_ril_interface_current_lock);
+
+	return 0;
+}
+
 static int audio_ril_interface_connect_if_required(struct tinyalsa_audio_ril_interface *ril_interface)
 {
+    // Connecting is left to the thread, that retries with a backoff
+    if (ril_interface->interface == NULL || !_ril_is_connected(ril_interface->interface))
+        return -ENOTCONN;
+
+    return 0;
+}
+
+// A call failing on a lost connection is carried out again once reconnected
+static int audio_ril_interface_call_error(struct tinyalsa_audio_ril_interface *ril_interface)
+{
+	if(ril_interface->interface == NULL || !_ril_is_connected(ril_interface->interface))
+		return -ENOTCONN;
+
+	return -1;
+}
+
+static int audio_ril_interface_connect(struct tinyalsa_audio_ril_interface *ril_interface)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&ril_interface->lock);
+
     if (_ril_is_connected(ril_interface->interface))
-        return 0;
+        goto complete;
 
     if (_ril_connect(ril_interface->interface) != RIL_CLIENT_ERR_SUCCESS) {
         ALOGE("ril_connect() failed");
-        return -1;
+        rc = -1;
+        goto complete;
     }
 
-    /* get wb amr status to set pcm samplerate depending on
-       wb amr status when ril is connected. */
-    /* FIXME: AMR */
-#if 0
-    if(_ril_get_wb_amr)
-        _ril_get_wb_amr(ril_interface->client, ril_set_wb_amr_callback);
-#endif
+    /* follow wb amr changes during the call, and get the current status to
+       set the pcm samplerate when ril is connected. */
+    if (_ril_register_unsolicited_handler(ril_interface->interface,
+        RIL_UNSOL_WB_AMR_STATE, audio_ril_interface_wb_amr_callback) != RIL_CLIENT_ERR_SUCCESS)
+        ALOGE("Unable to register WB-AMR state handler");
 
-    return 0;
+    if (_ril_get_wb_amr)
+        _ril_get_wb_amr(ril_interface->interface, audio_ril_interface_wb_amr_callback);
+
+complete:
+    pthread_mutex_unlock(&ril_interface->lock);
+
+    return rc;
+}
+
+static int audio_ril_interface_load(struct tinyalsa_audio_ril_interface *ril_interface)
+{
+	struct audio_ril_interface *interface;
+	void *dl_handle;
+
+	dl_handle = dlopen(RIL_CLIENT_LIBPATH, RTLD_NOW);
+	if(dl_handle == NULL) {
+		ALOGE("Unable to dlopen lib: %s", RIL_CLIENT_LIBPATH);
+		return -1;
+	}
+
+	_ril_open_client = dlsym(dl_handle, "OpenClient_RILD");
+	_ril_close_client = dlsym(dl_handle, "CloseClient_RILD");
+	_ril_connect = dlsym(dl_handle, "Connect_RILD");
+	_ril_is_connected = dlsym(dl_handle, "isConnected_RILD");
+	_ril_disconnect = dlsym(dl_handle, "Disconnect_RILD");
+	_ril_set_call_volume = dlsym(dl_handle, "SetCallVolume");
+	_ril_set_call_audio_path = dlsym(dl_handle, "SetCallAudioPath");
+	_ril_set_call_clock_sync = dlsym(dl_handle, "SetCallClockSync");
+        _ril_set_call_twomic = dlsym(dl_handle, "SetTwoMicControl");
+
+	_ril_register_unsolicited_handler = dlsym(dl_handle,
+						  "RegisterUnsolicitedHandler");
+	/* since this function is not supported in all RILs, don't require it */
+	_ril_get_wb_amr = dlsym(dl_handle, "GetWB_AMR");
+
+	if (!_ril_open_client || !_ril_close_client || !_ril_connect ||
+	    !_ril_is_connected || !_ril_disconnect || !_ril_set_call_volume ||
+	    !_ril_set_call_audio_path || !_ril_set_call_clock_sync ||
+	    !_ril_register_unsolicited_handler || !_ril_set_call_twomic) {
+	  ALOGE("Cannot get symbols from '%s'", RIL_CLIENT_LIBPATH);
+	  dlclose(dl_handle);
+	  return -1;
+	}
+
+	interface = _ril_open_client();
+	if(interface == NULL) {
+		ALOGE("Unable to open audio ril interface");
+		dlclose(dl_handle);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ril_interface->lock);
+	ril_interface->interface = interface;
+	ril_interface->dl_handle = dl_handle;
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return 0;
 }
 
 int audio_ril_interface_set_mic_mute(struct tinyalsa_audio_ril_interface *ril_interface, bool state)
@@ -82,7 +199,7 @@ int audio_ril_interface_set_mic_mute(struct tinyalsa_audio_ril_interface *ril_in
 
 }
 
-int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ril_interface,
+static int audio_ril_interface_volume_apply(struct tinyalsa_audio_ril_interface *ril_interface,
 	audio_devices_t device, float volume)
 {
 	int rc;
@@ -96,9 +213,8 @@ int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ri
 
 	pthread_mutex_lock(&ril_interface->lock);
 
-	/* Should this be returning -1 when a failure occurs? */
-	if (audio_ril_interface_connect_if_required(ril_interface))
-	  return 0;
+	if(audio_ril_interface_connect_if_required(ril_interface) < 0)
+		goto error_connect;
 
 	if(_ril_set_call_volume == NULL)
 		goto error;
@@ -130,7 +246,7 @@ int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ri
 	rc = _ril_set_call_volume(ril_interface->interface, sound_type,
 				  (int)(volume * ril_interface->volume_steps_max));
 
-	if(rc < 0) {
+	if(rc != RIL_CLIENT_ERR_SUCCESS) {
 		ALOGE("Failed to set RIL interface voice volume");
 		goto error;
 	}
@@ -140,12 +256,19 @@ int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ri
 	return 0;
 
 error:
+	rc = audio_ril_interface_call_error(ril_interface);
+
 	pthread_mutex_unlock(&ril_interface->lock);
 
-	return -1;
+	return rc;
+
+error_connect:
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return -ENOTCONN;
 }
 
-int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_interface, audio_devices_t device)
+static int audio_ril_interface_route_apply(struct tinyalsa_audio_ril_interface *ril_interface, audio_devices_t device)
 {
 	int rc;
 
@@ -158,11 +281,8 @@ int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_inter
 
 	pthread_mutex_lock(&ril_interface->lock);
 
-	/* Should this be returning -1 when a failure occurs? */
-	if (audio_ril_interface_connect_if_required(ril_interface))
-	  return 0;
-
-	ril_interface->device_current = device;
+	if(audio_ril_interface_connect_if_required(ril_interface) < 0)
+		goto error_connect;
 
 	if(_ril_set_call_audio_path == NULL)
 		goto error;
@@ -197,7 +317,7 @@ int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_inter
 
 	rc = _ril_set_call_audio_path(ril_interface->interface,path);
 
-	if(rc < 0) {
+	if(rc != RIL_CLIENT_ERR_SUCCESS) {
 		ALOGE("Failed to set RIL interface route");
 		goto error;
 	}
@@ -207,12 +327,19 @@ int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_inter
 	return 0;
 
 error:
+	rc = audio_ril_interface_call_error(ril_interface);
+
 	pthread_mutex_unlock(&ril_interface->lock);
 
-	return -1;
+	return rc;
+
+error_connect:
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return -ENOTCONN;
 }
 
-int audio_ril_interface_set_twomic(struct tinyalsa_audio_ril_interface *ril_interface, enum ril_twomic_enable twomic)
+static int audio_ril_interface_twomic_apply(struct tinyalsa_audio_ril_interface *ril_interface, enum ril_twomic_enable twomic)
 {
 	int rc;
 
@@ -223,16 +350,15 @@ int audio_ril_interface_set_twomic(struct tinyalsa_audio_ril_interface *ril_inte
 
 	pthread_mutex_lock(&ril_interface->lock);
 
-	/* Should this be returning -1 when a failure occurs? */
-	if (audio_ril_interface_connect_if_required(ril_interface))
-	  return 0;
+	if(audio_ril_interface_connect_if_required(ril_interface) < 0)
+		goto error_connect;
 
 	if(_ril_set_call_twomic == NULL)
 		goto error;
 
 	rc = _ril_set_call_twomic(ril_interface->interface,AUDIENCE,twomic);
 
-	if(rc < 0) {
+	if(rc != RIL_CLIENT_ERR_SUCCESS) {
 		ALOGE("Failed to set RIL interface route");
 		goto error;
 	}
@@ -242,11 +368,309 @@ int audio_ril_interface_set_twomic(struct tinyalsa_audio_ril_interface *ril_inte
 	return 0;
 
 error:
+	rc = audio_ril_interface_call_error(ril_interface);
+
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return rc;
+
+error_connect:
 	pthread_mutex_unlock(&ril_interface->lock);
 
+	return -ENOTCONN;
+}
+
+static int audio_ril_interface_wb_amr_apply(struct tinyalsa_audio_ril_interface *ril_interface)
+{
+	int rc;
+
+	ALOGD("%s()", __func__);
+
+	if(ril_interface == NULL)
+		return -1;
+
+	pthread_mutex_lock(&ril_interface->lock);
+
+	if(audio_ril_interface_connect_if_required(ril_interface) < 0)
+		goto error_connect;
+
+	// The status is reported to the callback
+	if(_ril_get_wb_amr != NULL) {
+		rc = _ril_get_wb_amr(ril_interface->interface, audio_ril_interface_wb_amr_callback);
+		if(rc != RIL_CLIENT_ERR_SUCCESS) {
+			ALOGE("Failed to get RIL interface WB-AMR state");
+			goto error;
+		}
+	}
+
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return 0;
+
+error:
+	rc = audio_ril_interface_call_error(ril_interface);
+
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return rc;
+
+error_connect:
+	pthread_mutex_unlock(&ril_interface->lock);
+
+	return -ENOTCONN;
+}
+
+/*
+ * Queue
+ */
+
+static int audio_ril_interface_queue_find(struct tinyalsa_audio_ril_interface *ril_interface,
+	enum tinyalsa_audio_ril_command_type type)
+{
+	int index;
+	int i;
+
+	for(i=0 ; i < ril_interface->queue_count ; i++) {
+		index = (ril_interface->queue_head + i) % TINYALSA_AUDIO_RIL_QUEUE_SIZE;
+		if(ril_interface->queue[index].type == type)
+			return i;
+	}
+
 	return -1;
 }
 
+static int audio_ril_interface_queue(struct tinyalsa_audio_ril_interface *ril_interface,
+	struct tinyalsa_audio_ril_command *command)
+{
+	int index;
+	int i;
+
+	pthread_mutex_lock(&ril_interface->queue_lock);
+
+	if(ril_interface->unavailable) {
+		pthread_mutex_unlock(&ril_interface->queue_lock);
+		return -1;
+	}
+
+	// Only the latest command of each type is kept, in the order of the
+	// latest changes, so the queue never holds more than one per type
+	i = audio_ril_interface_queue_find(ril_interface, command->type);
+	if(i >= 0) {
+		for( ; i < ril_interface->queue_count - 1 ; i++) {
+			index = (ril_interface->queue_head + i) % TINYALSA_AUDIO_RIL_QUEUE_SIZE;
+			memcpy(&ril_interface->queue[index],
+				&ril_interface->queue[(index + 1) % TINYALSA_AUDIO_RIL_QUEUE_SIZE],
+				sizeof(struct tinyalsa_audio_ril_command));
+		}
+
+		ril_interface->queue_count--;
+		ril_interface->collapsed_count++;
+	}
+
+	index = (ril_interface->queue_head + ril_interface->queue_count) %
+		TINYALSA_AUDIO_RIL_QUEUE_SIZE;
+	memcpy(&ril_interface->queue[index], command, sizeof(struct tinyalsa_audio_ril_command));
+	ril_interface->queue_count++;
+
+	pthread_cond_signal(&ril_interface->queue_cond);
+	pthread_mutex_unlock(&ril_interface->queue_lock);
+
+	return 0;
+}
+
+static void audio_ril_interface_backoff_wait(struct tinyalsa_audio_ril_interface *ril_interface,
+	int backoff)
+{
+	struct timespec ts;
+	struct timeval tv;
+	int rc = 0;
+
+	gettimeofday(&tv, NULL);
+
+	ts.tv_sec = tv.tv_sec + backoff / 1000;
+	ts.tv_nsec = tv.tv_usec * 1000 + (backoff % 1000) * 1000000;
+	if(ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	// New commands do not cut the backoff short, closing does
+	while(ril_interface->running && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&ril_interface->queue_cond, &ril_interface->queue_lock, &ts);
+}
+
+static void *audio_ril_interface_thread(void *data)
+{
+	struct tinyalsa_audio_ril_interface *ril_interface;
+	struct tinyalsa_audio_ril_command command;
+	int rc;
+
+	ril_interface = (struct tinyalsa_audio_ril_interface *) data;
+
+	// Loading the client is kept out of the HAL open and call setup paths
+	rc = audio_ril_interface_load(ril_interface);
+
+	pthread_mutex_lock(&ril_interface->queue_lock);
+
+	if(rc < 0) {
+		ALOGE("RIL client is unavailable, RIL commands are dropped");
+		ril_interface->unavailable = 1;
+		ril_interface->queue_count = 0;
+		goto complete;
+	}
+
+	while(1) {
+		if(!ril_interface->connected) {
+			if(!ril_interface->running)
+				break;
+
+			pthread_mutex_unlock(&ril_interface->queue_lock);
+			rc = audio_ril_interface_connect(ril_interface);
+			pthread_mutex_lock(&ril_interface->queue_lock);
+
+			if(rc == 0) {
+				ALOGD("Connected to RIL after %d failures", ril_interface->connect_failures);
+				ril_interface->connected = 1;
+				ril_interface->connect_count++;
+				ril_interface->connect_failures = 0;
+				ril_interface->backoff = 0;
+				continue;
+			}
+
+			ril_interface->connect_failures++;
+
+			if(ril_interface->backoff == 0)
+				ril_interface->backoff = TINYALSA_AUDIO_RIL_BACKOFF_MIN;
+			else if(ril_interface->backoff * 2 < TINYALSA_AUDIO_RIL_BACKOFF_MAX)
+				ril_interface->backoff *= 2;
+			else
+				ril_interface->backoff = TINYALSA_AUDIO_RIL_BACKOFF_MAX;
+
+			ALOGE("Unable to connect to RIL, retrying in %d ms", ril_interface->backoff);
+
+			audio_ril_interface_backoff_wait(ril_interface, ril_interface->backoff);
+			continue;
+		}
+
+		if(ril_interface->queue_count == 0) {
+			if(!ril_interface->running)
+				break;
+
+			pthread_cond_wait(&ril_interface->queue_cond, &ril_interface->queue_lock);
+			continue;
+		}
+
+		memcpy(&command, &ril_interface->queue[ril_interface->queue_head], sizeof(command));
+		ril_interface->queue_head = (ril_interface->queue_head + 1) % TINYALSA_AUDIO_RIL_QUEUE_SIZE;
+		ril_interface->queue_count--;
+
+		pthread_mutex_unlock(&ril_interface->queue_lock);
+
+		switch(command.type) {
+			case TINYALSA_AUDIO_RIL_COMMAND_VOLUME:
+				rc = audio_ril_interface_volume_apply(ril_interface, command.device, command.volume);
+				break;
+			case TINYALSA_AUDIO_RIL_COMMAND_ROUTE:
+				rc = audio_ril_interface_route_apply(ril_interface, command.device);
+				break;
+			case TINYALSA_AUDIO_RIL_COMMAND_TWOMIC:
+				rc = audio_ril_interface_twomic_apply(ril_interface, command.twomic);
+				break;
+			case TINYALSA_AUDIO_RIL_COMMAND_WB_AMR:
+				rc = audio_ril_interface_wb_amr_apply(ril_interface);
+				break;
+			default:
+				rc = -1;
+				break;
+		}
+
+		pthread_mutex_lock(&ril_interface->queue_lock);
+
+		if(rc == -ENOTCONN) {
+			// The command is carried out again once reconnected
+			ALOGE("RIL connection lost, reconnecting");
+			ril_interface->connected = 0;
+
+			// A queued command of the same type is newer and replaces it,
+			// otherwise there is always room as the queue holds one per type
+			if(audio_ril_interface_queue_find(ril_interface, command.type) < 0) {
+				ril_interface->queue_head = (ril_interface->queue_head +
+					TINYALSA_AUDIO_RIL_QUEUE_SIZE - 1) % TINYALSA_AUDIO_RIL_QUEUE_SIZE;
+				memcpy(&ril_interface->queue[ril_interface->queue_head], &command, sizeof(command));
+				ril_interface->queue_count++;
+			}
+		}
+	}
+
+	if(ril_interface->queue_count > 0)
+		ALOGE("Dropping %d RIL commands, not connected", ril_interface->queue_count);
+
+complete:
+	pthread_mutex_unlock(&ril_interface->queue_lock);
+
+	return NULL;
+}
+
+int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ril_interface,
+	audio_devices_t device, float volume)
+{
+	struct tinyalsa_audio_ril_command command;
+
+	if(ril_interface == NULL)
+		return -1;
+
+	memset(&command, 0, sizeof(command));
+	command.type = TINYALSA_AUDIO_RIL_COMMAND_VOLUME;
+	command.device = device;
+	command.volume = volume;
+
+	return audio_ril_interface_queue(ril_interface, &command);
+}
+
+int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_interface, audio_devices_t device)
+{
+	struct tinyalsa_audio_ril_command command;
+
+	if(ril_interface == NULL)
+		return -1;
+
+	// The route is current as soon as it is queued, commands are ordered
+	ril_interface->device_current = device;
+
+	memset(&command, 0, sizeof(command));
+	command.type = TINYALSA_AUDIO_RIL_COMMAND_ROUTE;
+	command.device = device;
+
+	return audio_ril_interface_queue(ril_interface, &command);
+}
+
+int audio_ril_interface_set_twomic(struct tinyalsa_audio_ril_interface *ril_interface, enum ril_twomic_enable twomic)
+{
+	struct tinyalsa_audio_ril_command command;
+
+	if(ril_interface == NULL)
+		return -1;
+
+	memset(&command, 0, sizeof(command));
+	command.type = TINYALSA_AUDIO_RIL_COMMAND_TWOMIC;
+	command.twomic = twomic;
+
+	return audio_ril_interface_queue(ril_interface, &command);
+}
+
+int audio_ril_interface_query_wb_amr(struct tinyalsa_audio_ril_interface *ril_interface)
+{
+	struct tinyalsa_audio_ril_command command;
+
+	if(ril_interface == NULL)
+		return -1;
+
+	memset(&command, 0, sizeof(command));
+	command.type = TINYALSA_AUDIO_RIL_COMMAND_WB_AMR;
+
+	return audio_ril_interface_queue(ril_interface, &command);
+}
+
 /*
  * Interface
  */
@@ -258,8 +682,29 @@ void audio_ril_interface_close(struct audio_hw_device *dev,
 
 	ALOGD("%s(%p)", __func__, ril_interface);
 
+	if(ril_interface == NULL)
+		return;
+
+	// Late WB-AMR reports are dropped from now on
+	pthread_mutex_lock(&audio_ril_interface_current_lock);
+	if(audio_ril_interface_current == ril_interface)
+		audio_ril_interface_current = NULL;
+	pthread_mutex_unlock(&audio_ril_interface_current_lock);
+
+	// Queued commands are carried out before the thread exits, if connected
+	pthread_mutex_lock(&ril_interface->queue_lock);
+	ril_interface->running = 0;
+	pthread_cond_signal(&ril_interface->queue_cond);
+	pthread_mutex_unlock(&ril_interface->queue_lock);
+
+	pthread_join(ril_interface->thread, NULL);
+
+	pthread_cond_destroy(&ril_interface->queue_cond);
+	pthread_mutex_destroy(&ril_interface->queue_lock);
+	pthread_mutex_destroy(&ril_interface->lock);
+
 	if(ril_interface->dl_handle != NULL) {
-	  if ((_ril_disconnect(ril_interface->interface) != RIL_CLIENT_ERR_SUCCESS) ||
+	  if ((ril_interface->connected && _ril_disconnect(ril_interface->interface) != RIL_CLIENT_ERR_SUCCESS) ||
 	      (_ril_close_client(ril_interface->interface) != RIL_CLIENT_ERR_SUCCESS)) {
 	    ALOGE("ril_disconnect() or ril_close_client() failed");
 	    return;
@@ -269,8 +714,7 @@ void audio_ril_interface_close(struct audio_hw_device *dev,
 	  ril_interface->dl_handle = NULL;
 	}
 
-	if(ril_interface != NULL)
-		free(ril_interface);
+	free(ril_interface);
 
 	if(dev == NULL)
 		return;
@@ -283,12 +727,8 @@ void audio_ril_interface_close(struct audio_hw_device *dev,
 int audio_ril_interface_open(struct audio_hw_device *dev, audio_devices_t device,
 	struct tinyalsa_audio_ril_interface **ril_interface)
 {
-	struct audio_ril_interface *(*audio_ril_interface_open)(void);
-
 	struct tinyalsa_audio_device *tinyalsa_audio_device;
 	struct tinyalsa_audio_ril_interface *tinyalsa_audio_ril_interface;
-	struct audio_ril_interface *interface;
-	void *dl_handle;
 	int rc;
 
 	char property[PROPERTY_VALUE_MAX];
@@ -307,68 +747,50 @@ int audio_ril_interface_open(struct audio_hw_device *dev, audio_devices_t device
 	tinyalsa_audio_ril_interface->device = tinyalsa_audio_device;
 	tinyalsa_audio_device->ril_interface = tinyalsa_audio_ril_interface;
 
-	dl_handle = dlopen(RIL_CLIENT_LIBPATH, RTLD_NOW);
-	if(dl_handle == NULL) {
-		ALOGE("Unable to dlopen lib: %s", RIL_CLIENT_LIBPATH);
-		goto error_interface;
-	}
-
-	_ril_open_client = dlsym(dl_handle, "OpenClient_RILD");
-	_ril_close_client = dlsym(dl_handle, "CloseClient_RILD");
-	_ril_connect = dlsym(dl_handle, "Connect_RILD");
-	_ril_is_connected = dlsym(dl_handle, "isConnected_RILD");
-	_ril_disconnect = dlsym(dl_handle, "Disconnect_RILD");
-	_ril_set_call_volume = dlsym(dl_handle, "SetCallVolume");
-	_ril_set_call_audio_path = dlsym(dl_handle, "SetCallAudioPath");
-	_ril_set_call_clock_sync = dlsym(dl_handle, "SetCallClockSync");
-        _ril_set_call_twomic = dlsym(dl_handle, "SetTwoMicControl");
-
-	_ril_register_unsolicited_handler = dlsym(dl_handle,
-						  "RegisterUnsolicitedHandler");
-	/* since this function is not supported in all RILs, don't require it */
-	_ril_get_wb_amr = dlsym(dl_handle, "GetWB_AMR");
-
-	if (!_ril_open_client || !_ril_close_client || !_ril_connect ||
-	    !_ril_is_connected || !_ril_disconnect || !_ril_set_call_volume ||
-	    !_ril_set_call_audio_path || !_ril_set_call_clock_sync ||
-	    !_ril_register_unsolicited_handler || !_ril_set_call_twomic) {
-	  ALOGE("Cannot get symbols from '%s'", RIL_CLIENT_LIBPATH);
-	  dlclose(dl_handle);
-	  goto error_interface;
-	}
-
-	interface = _ril_open_client();
-	if(interface == NULL) {
-		ALOGE("Unable to open audio ril interface");
-		goto error_interface;
-	}
-
-	tinyalsa_audio_ril_interface->interface = interface;
-	tinyalsa_audio_ril_interface->dl_handle = dl_handle;
-
 	property_get(VOLUME_STEPS_PROPERTY, property, VOLUME_STEPS_DEFAULT);
 	tinyalsa_audio_ril_interface->volume_steps_max = atoi(property);
 	/* this catches the case where VOLUME_STEPS_PROPERTY does not contain
 	   an integer */
 	if (tinyalsa_audio_ril_interface->volume_steps_max == 0)
 	  tinyalsa_audio_ril_interface->volume_steps_max = atoi(VOLUME_STEPS_DEFAULT);
-	
-	if(device) {
-		tinyalsa_audio_ril_interface->device_current = device;
-		audio_ril_interface_set_route(tinyalsa_audio_ril_interface, device);
+
+	pthread_mutex_init(&tinyalsa_audio_ril_interface->lock, NULL);
+	pthread_mutex_init(&tinyalsa_audio_ril_interface->queue_lock, NULL);
+	pthread_cond_init(&tinyalsa_audio_ril_interface->queue_cond, NULL);
+
+	tinyalsa_audio_ril_interface->running = 1;
+
+	pthread_mutex_lock(&audio_ril_interface_current_lock);
+	audio_ril_interface_current = tinyalsa_audio_ril_interface;
+	pthread_mutex_unlock(&audio_ril_interface_current_lock);
+
+	// The client is loaded and connected by the thread, in the background
+	rc = pthread_create(&tinyalsa_audio_ril_interface->thread, NULL,
+		audio_ril_interface_thread, tinyalsa_audio_ril_interface);
+	if(rc != 0) {
+		ALOGE("Unable to create RIL interface thread");
+		goto error_thread;
 	}
 
+	if(device)
+		audio_ril_interface_set_route(tinyalsa_audio_ril_interface, device);
+
 	*ril_interface = tinyalsa_audio_ril_interface;
 
 	return 0;
 
-error_interface:
+error_thread:
+	pthread_mutex_lock(&audio_ril_interface_current_lock);
+	audio_ril_interface_current = NULL;
+	pthread_mutex_unlock(&audio_ril_interface_current_lock);
+
+	pthread_cond_destroy(&tinyalsa_audio_ril_interface->queue_cond);
+	pthread_mutex_destroy(&tinyalsa_audio_ril_interface->queue_lock);
+	pthread_mutex_destroy(&tinyalsa_audio_ril_interface->lock);
+
 	*ril_interface = NULL;
 	free(tinyalsa_audio_ril_interface);
 	tinyalsa_audio_device->ril_interface = NULL;
 
-	if(dl_handle != NULL)
-		dlclose(dl_handle);
-
 	return -1;
 }
@@ -15,25 +15,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+
 #include "audio_hw.h"
 
 #ifndef TINYALSA_AUDIO_RIL_INTERFACE_H
 #define TINYALSA_AUDIO_RIL_INTERFACE_H
 
-struct tinyalsa_audio_ril_interface {
-	void *interface;
-	struct tinyalsa_audio_device *device;
-
-        int volume_steps_max;
-
-	void *dl_handle;
-
-	audio_devices_t device_current;
-
-	pthread_mutex_t lock;
-};
-
+// Test builds set libsecril-client-mock.so, that stands in without rild
+#ifndef RIL_CLIENT_LIBPATH
 #define RIL_CLIENT_LIBPATH "libsecril-client.so"
+#endif
 
 #define RIL_CLIENT_ERR_SUCCESS      0
 #define RIL_CLIENT_ERR_AGAIN        1
@@ -82,10 +74,81 @@ enum ril_twomic_enable {
     TWO_MIC_SOLUTION_ON
 };
 
+/*
+ * WB-AMR status is reported at connect and whenever it changes during a
+ * call, the modem PCM then runs at 16 kHz instead of 8 kHz.
+ */
+
+#define RIL_UNSOL_WB_AMR_STATE	11017
+
+#define TINYALSA_AUDIO_RIL_RATE_NB	8000
+#define TINYALSA_AUDIO_RIL_RATE_WB	16000
+
+/*
+ * RIL calls may block on the modem, so they are carried out by a worker
+ * thread in queue order. A new command replaces the queued command of the
+ * same type, so the queue holds at most one command per type.
+ *
+ * The session is kept across calls: the thread loads the client at open,
+ * connects and reconnects with an exponential backoff (in ms). Commands
+ * that fail on a lost connection are kept for after the reconnection.
+ */
+
+enum tinyalsa_audio_ril_command_type {
+	TINYALSA_AUDIO_RIL_COMMAND_VOLUME,
+	TINYALSA_AUDIO_RIL_COMMAND_ROUTE,
+	TINYALSA_AUDIO_RIL_COMMAND_TWOMIC,
+	TINYALSA_AUDIO_RIL_COMMAND_WB_AMR
+};
+
+struct tinyalsa_audio_ril_command {
+	enum tinyalsa_audio_ril_command_type type;
+	audio_devices_t device;
+	float volume;
+	enum ril_twomic_enable twomic;
+};
+
+#define TINYALSA_AUDIO_RIL_QUEUE_SIZE	(TINYALSA_AUDIO_RIL_COMMAND_WB_AMR + 1)
+
+#define TINYALSA_AUDIO_RIL_BACKOFF_MIN	100
+#define TINYALSA_AUDIO_RIL_BACKOFF_MAX	10000
+
+struct tinyalsa_audio_ril_interface {
+	void *interface;
+	struct tinyalsa_audio_device *device;
+
+        int volume_steps_max;
+
+	void *dl_handle;
+
+	audio_devices_t device_current;
+	int wb_amr;
+
+	struct tinyalsa_audio_ril_command queue[TINYALSA_AUDIO_RIL_QUEUE_SIZE];
+	int queue_head;
+	int queue_count;
+	int collapsed_count;
+
+	int connected;
+	int unavailable;
+	int backoff;
+	int connect_count;
+	int connect_failures;
+
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_cond;
+
+	pthread_mutex_t lock;
+};
+
 int audio_ril_interface_set_mic_mute(struct tinyalsa_audio_ril_interface *ril_interface, bool state);
 int audio_ril_interface_set_voice_volume(struct tinyalsa_audio_ril_interface *ril_interface, audio_devices_t device, float volume);
 int audio_ril_interface_set_route(struct tinyalsa_audio_ril_interface *ril_interface, audio_devices_t device);
 int audio_ril_interface_set_twomic(struct tinyalsa_audio_ril_interface *ril_interface, enum ril_twomic_enable);
+int audio_ril_interface_query_wb_amr(struct tinyalsa_audio_ril_interface *ril_interface);
 
 void audio_ril_interface_close(struct audio_hw_device *dev,
 	struct tinyalsa_audio_ril_interface *interface);
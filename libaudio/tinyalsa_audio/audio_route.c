@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "TinyALSA-Audio Route"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <cutils/log.h>
+
+#ifdef YAMAHA_MC1N2_AUDIO
+#include <yamaha-mc1n2-audio.h>
+#endif
+
+#define EFFECT_UUID_NULL EFFECT_UUID_NULL_ROUTE
+#define EFFECT_UUID_NULL_STR EFFECT_UUID_NULL_STR_ROUTE
+#include "audio_hw.h"
+#include "audio_route.h"
+
+/*
+ * Functions
+ */
+
+static void audio_route_apply(struct tinyalsa_audio_route *route,
+	enum tinyalsa_audio_route_direction direction, audio_devices_t device)
+{
+	struct tinyalsa_audio_device *tinyalsa_audio_device;
+	audio_mode_t mode;
+	int rc;
+
+	ALOGD("%s(%d, 0x%x)++", __func__, direction, device);
+
+	tinyalsa_audio_device = route->device;
+
+	audio_lock_lock(&tinyalsa_audio_device->hw_lock);
+
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	mode = tinyalsa_audio_device->mode;
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
+
+	rc = tinyalsa_mixer_set_device(tinyalsa_audio_device->mixer, device);
+	if(rc < 0)
+		ALOGE("Unable to set mixer route for device: 0x%x", device);
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	rc = yamaha_mc1n2_audio_set_route(tinyalsa_audio_device->mc1n2_pdata, device);
+	if(rc < 0)
+		ALOGE("Failed to set Yamaha-MC1N2-Audio route");
+#endif
+
+	// The RIL session outlives calls, the modem route only matters in call
+	if(direction == TINYALSA_AUDIO_ROUTE_DIRECTION_OUTPUT &&
+		mode == AUDIO_MODE_IN_CALL &&
+		tinyalsa_audio_device->ril_interface != NULL &&
+		tinyalsa_audio_device->ril_interface->device_current != device)
+		audio_ril_interface_set_route(tinyalsa_audio_device->ril_interface, device);
+
+	if(direction == TINYALSA_AUDIO_ROUTE_DIRECTION_OUTPUT &&
+		tinyalsa_audio_device->voice_bridge != NULL)
+		audio_voice_bridge_update(tinyalsa_audio_device->voice_bridge,
+			mode == AUDIO_MODE_IN_CALL, device, 0);
+
+	audio_lock_unlock(&tinyalsa_audio_device->hw_lock);
+
+	ALOGD("%s(%d, 0x%x)--", __func__, direction, device);
+}
+
+static void audio_route_modem_rate_apply(struct tinyalsa_audio_route *route,
+	int rate, int64_t time_queued)
+{
+	struct tinyalsa_audio_device *tinyalsa_audio_device;
+	audio_mode_t mode;
+	int64_t time_start;
+	int64_t time_done;
+	int rc;
+
+	ALOGD("%s(%d)++", __func__, rate);
+
+	tinyalsa_audio_device = route->device;
+
+	audio_lock_lock(&tinyalsa_audio_device->hw_lock);
+
+	audio_lock_lock(&tinyalsa_audio_device->lock);
+	mode = tinyalsa_audio_device->mode;
+	audio_lock_unlock(&tinyalsa_audio_device->lock);
+
+	// The call may have ended since the modem reported the rate
+	if(mode != AUDIO_MODE_IN_CALL) {
+		audio_lock_unlock(&tinyalsa_audio_device->hw_lock);
+		return;
+	}
+
+	time_start = audio_hw_time();
+
+	rc = tinyalsa_mixer_set_modem_rate(tinyalsa_audio_device->mixer, rate);
+	if(rc < 0)
+		ALOGE("Unable to set mixer modem rate: %d", rate);
+
+#ifdef YAMAHA_MC1N2_AUDIO
+	rc = yamaha_mc1n2_audio_set_modem_rate(tinyalsa_audio_device->mc1n2_pdata, rate);
+	if(rc < 0)
+		ALOGE("Failed to set Yamaha-MC1N2-Audio modem rate");
+#endif
+
+	if(tinyalsa_audio_device->voice_bridge != NULL)
+		audio_voice_bridge_update(tinyalsa_audio_device->voice_bridge, 1, 0, rate);
+
+	time_done = audio_hw_time();
+
+	audio_lock_unlock(&tinyalsa_audio_device->hw_lock);
+
+	pthread_mutex_lock(&route->lock);
+
+	route->modem_rate_switches++;
+	route->modem_rate_switch_time = time_done - time_start;
+	if(route->modem_rate_switch_time > route->modem_rate_switch_time_max)
+		route->modem_rate_switch_time_max = route->modem_rate_switch_time;
+
+	pthread_mutex_unlock(&route->lock);
+
+	ALOGD("%s(%d)-- switched in %lld us, %lld us after the modem report", __func__, rate,
+		(long long) (time_done - time_start), (long long) (time_done - time_queued));
+}
+
+static struct tinyalsa_audio_route_request *audio_route_request_next(
+	struct tinyalsa_audio_route *route)
+{
+	struct tinyalsa_audio_route_request *request = NULL;
+	int i;
+
+	// Requests are applied in the order they first entered the queue
+	for(i=0 ; i < TINYALSA_AUDIO_ROUTE_DIRECTION_MAX ; i++) {
+		if(!route->requests[i].pending)
+			continue;
+
+		if(request == NULL || (int) (route->requests[i].seq_first - request->seq_first) < 0)
+			request = &route->requests[i];
+	}
+
+	return request;
+}
+
+static void *audio_route_thread(void *data)
+{
+	struct tinyalsa_audio_route *route;
+	struct tinyalsa_audio_route_request *request;
+	enum tinyalsa_audio_route_direction direction;
+	audio_devices_t device;
+	int64_t time_queued;
+	unsigned int seq;
+	int rate;
+
+	route = (struct tinyalsa_audio_route *) data;
+
+	pthread_mutex_lock(&route->lock);
+
+	while(1) {
+		if(route->modem_rate_pending) {
+			rate = route->modem_rate;
+			time_queued = route->modem_rate_queued;
+			route->modem_rate_pending = 0;
+
+			pthread_mutex_unlock(&route->lock);
+
+			audio_route_modem_rate_apply(route, rate, time_queued);
+
+			pthread_mutex_lock(&route->lock);
+			continue;
+		}
+
+		request = audio_route_request_next(route);
+		if(request == NULL) {
+			if(!route->running)
+				break;
+
+			pthread_cond_wait(&route->cond, &route->lock);
+			continue;
+		}
+
+		direction = (enum tinyalsa_audio_route_direction) (request - route->requests);
+		device = request->device;
+		seq = request->seq;
+		request->pending = 0;
+
+		pthread_mutex_unlock(&route->lock);
+
+		audio_route_apply(route, direction, device);
+
+		pthread_mutex_lock(&route->lock);
+
+		request->seq_done = seq;
+		pthread_cond_broadcast(&route->done_cond);
+	}
+
+	pthread_mutex_unlock(&route->lock);
+
+	return NULL;
+}
+
+int audio_route_queue(struct tinyalsa_audio_route *route,
+	audio_devices_t device, unsigned int *token)
+{
+	struct tinyalsa_audio_route_request *request;
+	enum tinyalsa_audio_route_direction direction;
+
+	ALOGD("%s(%p, 0x%x)", __func__, route, device);
+
+	if(route == NULL)
+		return -1;
+
+	if(tinyalsa_mixer_is_output_device(device)) {
+		direction = TINYALSA_AUDIO_ROUTE_DIRECTION_OUTPUT;
+	} else if(tinyalsa_mixer_is_input_device(device)) {
+		direction = TINYALSA_AUDIO_ROUTE_DIRECTION_INPUT;
+	} else {
+		ALOGE("Invalid device: 0x%x", device);
+		return -1;
+	}
+
+	pthread_mutex_lock(&route->lock);
+
+	request = &route->requests[direction];
+
+	route->seq++;
+
+	if(request->pending) {
+		route->collapsed_count++;
+		ALOGD("Superseding pending route 0x%x with 0x%x (%d collapsed)",
+			request->device, device, route->collapsed_count);
+	} else {
+		request->seq_first = route->seq;
+	}
+
+	request->device = device;
+	request->seq = route->seq;
+	request->pending = 1;
+
+	if(token != NULL)
+		*token = (route->seq << 1) | direction;
+
+	pthread_cond_signal(&route->cond);
+	pthread_mutex_unlock(&route->lock);
+
+	return 0;
+}
+
+int audio_route_wait(struct tinyalsa_audio_route *route, unsigned int token)
+{
+	struct tinyalsa_audio_route_request *request;
+	unsigned int seq;
+
+	if(route == NULL)
+		return -1;
+
+	request = &route->requests[token & 1];
+	seq = token >> 1;
+
+	pthread_mutex_lock(&route->lock);
+
+	while((int) ((request->seq_done << 1) - (seq << 1)) < 0 && route->running)
+		pthread_cond_wait(&route->done_cond, &route->lock);
+
+	pthread_mutex_unlock(&route->lock);
+
+	return 0;
+}
+
+int audio_route_queue_modem_rate(struct tinyalsa_audio_route *route, int rate)
+{
+	ALOGD("%s(%p, %d)", __func__, route, rate);
+
+	if(route == NULL)
+		return -1;
+
+	pthread_mutex_lock(&route->lock);
+
+	route->modem_rate = rate;
+	route->modem_rate_queued = audio_hw_time();
+	route->modem_rate_pending = 1;
+
+	pthread_cond_signal(&route->cond);
+	pthread_mutex_unlock(&route->lock);
+
+	return 0;
+}
+
+int audio_route_dump(struct tinyalsa_audio_route *route, int fd)
+{
+	char buffer[256];
+	int length;
+
+	if(route == NULL)
+		return -1;
+
+	pthread_mutex_lock(&route->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "Route: %d collapsed, modem rate %d Hz, %u switches, last %lld us, max %lld us\n",
+		route->collapsed_count, route->modem_rate, route->modem_rate_switches,
+		(long long) route->modem_rate_switch_time, (long long) route->modem_rate_switch_time_max);
+
+	pthread_mutex_unlock(&route->lock);
+
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	return 0;
+}
+
+/*
+ * Interface
+ */
+
+void audio_route_close(struct tinyalsa_audio_route *route)
+{
+	ALOGD("%s(%p)", __func__, route);
+
+	if(route == NULL)
+		return;
+
+	// Pending requests are drained before the thread exits
+	pthread_mutex_lock(&route->lock);
+	route->running = 0;
+	pthread_cond_signal(&route->cond);
+	pthread_mutex_unlock(&route->lock);
+
+	pthread_join(route->thread, NULL);
+
+	pthread_cond_destroy(&route->done_cond);
+	pthread_cond_destroy(&route->cond);
+	pthread_mutex_destroy(&route->lock);
+
+	free(route);
+}
+
+int audio_route_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_route **route_p)
+{
+	struct tinyalsa_audio_route *route;
+	int rc;
+
+	ALOGD("%s(%p, %p)", __func__, device, route_p);
+
+	if(device == NULL || route_p == NULL)
+		return -1;
+
+	route = calloc(1, sizeof(struct tinyalsa_audio_route));
+	if(route == NULL)
+		return -ENOMEM;
+
+	route->device = device;
+	route->running = 1;
+
+	pthread_mutex_init(&route->lock, NULL);
+	pthread_cond_init(&route->cond, NULL);
+	pthread_cond_init(&route->done_cond, NULL);
+
+	rc = pthread_create(&route->thread, NULL, audio_route_thread, route);
+	if(rc != 0) {
+		ALOGE("Unable to create route thread");
+		goto error_route;
+	}
+
+	*route_p = route;
+
+	return 0;
+
+error_route:
+	pthread_cond_destroy(&route->done_cond);
+	pthread_cond_destroy(&route->cond);
+	pthread_mutex_destroy(&route->lock);
+
+	free(route);
+	*route_p = NULL;
+
+	return -1;
+}
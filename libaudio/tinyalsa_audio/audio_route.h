@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TINYALSA_AUDIO_ROUTE_H
+#define TINYALSA_AUDIO_ROUTE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+/*
+ * Route changes are applied by a dedicated worker thread. Only the latest
+ * request for each direction is kept: a new request supersedes the pending
+ * one, so routing churn costs a single transition.
+ *
+ * Tokens carry the direction in their lowest bit and a sequence number in
+ * the upper bits. A token is complete once the request, or a later request
+ * of the same direction that superseded it, has been applied.
+ *
+ * Modem rate switches reported by the RIL are applied by the same thread,
+ * only the latest rate is kept. Times are in us.
+ */
+
+enum tinyalsa_audio_route_direction {
+	TINYALSA_AUDIO_ROUTE_DIRECTION_OUTPUT,
+	TINYALSA_AUDIO_ROUTE_DIRECTION_INPUT,
+	TINYALSA_AUDIO_ROUTE_DIRECTION_MAX
+};
+
+struct tinyalsa_audio_route_request {
+	audio_devices_t device;
+	int pending;
+
+	unsigned int seq;
+	unsigned int seq_first;
+	unsigned int seq_done;
+};
+
+struct tinyalsa_audio_route {
+	struct tinyalsa_audio_device *device;
+
+	struct tinyalsa_audio_route_request requests[TINYALSA_AUDIO_ROUTE_DIRECTION_MAX];
+	unsigned int seq;
+	int collapsed_count;
+
+	int modem_rate;
+	int modem_rate_pending;
+	int64_t modem_rate_queued;
+	unsigned int modem_rate_switches;
+	int64_t modem_rate_switch_time;
+	int64_t modem_rate_switch_time_max;
+
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+};
+
+int audio_route_queue(struct tinyalsa_audio_route *route,
+	audio_devices_t device, unsigned int *token);
+int audio_route_wait(struct tinyalsa_audio_route *route, unsigned int token);
+int audio_route_queue_modem_rate(struct tinyalsa_audio_route *route, int rate);
+int audio_route_dump(struct tinyalsa_audio_route *route, int fd);
+
+void audio_route_close(struct tinyalsa_audio_route *route);
+int audio_route_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_route **route_p);
+
+#endif
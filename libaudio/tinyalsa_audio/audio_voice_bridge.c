@@ -0,0 +1,666 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_TAG "TinyALSA-Audio Voice Bridge"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#define EFFECT_UUID_NULL EFFECT_UUID_NULL_VOICE_BRIDGE
+#define EFFECT_UUID_NULL_STR EFFECT_UUID_NULL_STR_VOICE_BRIDGE
+#include "audio_hw.h"
+#include "audio_voice_bridge.h"
+#include "mixer.h"
+
+/*
+ * Ring
+ */
+
+static void audio_voice_bridge_ring_write(struct tinyalsa_audio_voice_bridge_path *path,
+	int16_t *buffer, int frames)
+{
+	struct tinyalsa_audio_voice_bridge_ring *ring;
+	int index;
+	int i;
+
+	ring = &path->ring;
+
+	// The oldest frames are dropped when the sink stalls
+	if(ring->fill + frames > ring->size) {
+		i = ring->fill + frames - ring->size;
+		ring->read = (ring->read + i) % ring->size;
+		ring->fill -= i;
+		path->overflows++;
+	}
+
+	index = (ring->read + ring->fill) % ring->size;
+
+	for(i=0 ; i < frames ; i++) {
+		ring->buffer[index] = buffer[i];
+		index = (index + 1) % ring->size;
+	}
+
+	ring->fill += frames;
+}
+
+static void audio_voice_bridge_ring_read(struct tinyalsa_audio_voice_bridge_path *path,
+	int16_t *buffer, int frames)
+{
+	struct tinyalsa_audio_voice_bridge_ring *ring;
+	int i;
+
+	ring = &path->ring;
+
+	for(i=0 ; i < frames ; i++) {
+		buffer[i] = ring->buffer[ring->read];
+		ring->read = (ring->read + 1) % ring->size;
+	}
+
+	ring->fill -= frames;
+}
+
+/*
+ * Processing
+ */
+
+static int audio_voice_bridge_rates_supported(int rate_in, int rate_out)
+{
+	return rate_in == rate_out || rate_in == rate_out * 2 || rate_in * 2 == rate_out;
+}
+
+static int audio_voice_bridge_convert(struct tinyalsa_audio_voice_bridge_path *path,
+	int16_t *in, int frames, int16_t *out)
+{
+	int16_t previous;
+	int i;
+
+	previous = path->history;
+
+	if(path->rate_out == path->rate_in * 2) {
+		// Linear interpolation
+		for(i=0 ; i < frames ; i++) {
+			out[i * 2] = (int16_t) (((int) previous + in[i]) / 2);
+			out[i * 2 + 1] = in[i];
+			previous = in[i];
+		}
+
+		path->history = previous;
+
+		return frames * 2;
+	} else if(path->rate_in == path->rate_out * 2) {
+		// [1 2 1] / 4 low-pass, then decimation
+		for(i=0 ; i < frames / 2 ; i++) {
+			out[i] = (int16_t) (((int) previous + 2 * in[i * 2] + in[i * 2 + 1]) / 4);
+			previous = in[i * 2 + 1];
+		}
+
+		path->history = previous;
+
+		return frames / 2;
+	}
+
+	memcpy(out, in, frames * sizeof(int16_t));
+
+	return frames;
+}
+
+/*
+ * Slips a sample when the average latency is off target by more than half
+ * a sink period, at the quietest sample of the period where it is the least
+ * audible. The buffer has room for an extra frame.
+ */
+static int audio_voice_bridge_slip(struct tinyalsa_audio_voice_bridge_path *path,
+	int16_t *buffer, int frames)
+{
+	int latency;
+	int target;
+	int threshold;
+	int index = 0;
+	int i;
+
+	latency = path->latency_avg >> 4;
+	target = path->period_out * 2;
+	threshold = path->period_out / 2;
+
+	if(frames <= 1 || (latency <= target + threshold && latency >= target - threshold))
+		return frames;
+
+	for(i=1 ; i < frames ; i++)
+		if(abs(buffer[i]) < abs(buffer[index]))
+			index = i;
+
+	if(latency > target + threshold) {
+		memmove(&buffer[index], &buffer[index + 1], (frames - index - 1) * sizeof(int16_t));
+		path->slips_dropped++;
+
+		return frames - 1;
+	}
+
+	memmove(&buffer[index + 1], &buffer[index], (frames - index) * sizeof(int16_t));
+	path->slips_inserted++;
+
+	return frames + 1;
+}
+
+static void audio_voice_bridge_latency_update(struct tinyalsa_audio_voice_bridge_path *path)
+{
+	struct timespec ts;
+	unsigned int avail;
+	int latency;
+
+	latency = path->ring.fill;
+
+	if(pcm_get_htimestamp(path->pcm_out, &avail, &ts) == 0)
+		latency += pcm_get_buffer_size(path->pcm_out) - (int) avail;
+
+	// Average over 16 periods, kept multiplied by 16
+	path->latency_avg += latency - (path->latency_avg >> 4);
+	path->latency = latency;
+
+	if(latency > path->latency_max)
+		path->latency_max = latency;
+}
+
+static void *audio_voice_bridge_thread(void *data)
+{
+	struct tinyalsa_audio_voice_bridge_path *path;
+	int frames;
+	int ready;
+	int rc;
+
+	path = (struct tinyalsa_audio_voice_bridge_path *) data;
+
+	ALOGD("%s(%s): %d Hz to %d Hz", __func__, path->name, path->rate_in, path->rate_out);
+
+	// The sink starts with the target latency of silence
+	memset(path->buffer_out, 0, path->period_out * sizeof(int16_t));
+	pcm_write(path->pcm_out, path->buffer_out, path->period_out * sizeof(int16_t));
+	pcm_write(path->pcm_out, path->buffer_out, path->period_out * sizeof(int16_t));
+
+	// The source is only read once ready, it has to run before that
+	pcm_start(path->pcm_in);
+
+	while(path->running) {
+		ready = pcm_wait(path->pcm_in, TINYALSA_AUDIO_VOICE_BRIDGE_WAIT_TIMEOUT);
+		if(ready > 0)
+			rc = pcm_read(path->pcm_in, path->buffer_in, path->period_in * sizeof(int16_t));
+		else
+			rc = -1;
+
+		if(rc != 0) {
+			if(!path->running)
+				break;
+
+			path->xruns++;
+
+			// Started again after an xrun
+			if(ready < 0)
+				pcm_start(path->pcm_in);
+
+			// Keeps the sink fed without spinning on a failing source, a
+			// timeout already waited
+			memset(path->buffer_in, 0, path->period_in * sizeof(int16_t));
+			if(ready != 0)
+				usleep(path->period_in * 1000000 / path->rate_in);
+		}
+
+		frames = audio_voice_bridge_convert(path, path->buffer_in, path->period_in, path->buffer_convert);
+		frames = audio_voice_bridge_slip(path, path->buffer_convert, frames);
+
+		audio_voice_bridge_ring_write(path, path->buffer_convert, frames);
+		path->frames += frames;
+
+		while(path->running && path->ring.fill >= path->period_out) {
+			audio_voice_bridge_ring_read(path, path->buffer_out, path->period_out);
+
+			// An xrun is recovered by the write, a stalled sink drops the period
+			ready = pcm_wait(path->pcm_out, TINYALSA_AUDIO_VOICE_BRIDGE_WAIT_TIMEOUT);
+			if(ready != 0)
+				rc = pcm_write(path->pcm_out, path->buffer_out, path->period_out * sizeof(int16_t));
+			else
+				rc = -1;
+
+			if(rc != 0)
+				path->xruns++;
+		}
+
+		audio_voice_bridge_latency_update(path);
+	}
+
+	return NULL;
+}
+
+/*
+ * Path
+ */
+
+static struct pcm *audio_voice_bridge_pcm_open(struct tinyalsa_mixer_io_props *props,
+	unsigned int flags, int rate)
+{
+	struct pcm_config pcm_config;
+	struct pcm *pcm;
+
+	memset(&pcm_config, 0, sizeof(pcm_config));
+	pcm_config.channels = 1;
+	pcm_config.rate = rate;
+	pcm_config.format = PCM_FORMAT_S16_LE;
+	pcm_config.period_size = props->period_size;
+	pcm_config.period_count = props->period_count;
+
+	// Playback starts with the first period rather than a full buffer
+	if(flags == PCM_OUT)
+		pcm_config.start_threshold = props->period_size;
+
+	pcm = pcm_open(props->card, props->device, flags, &pcm_config);
+	if(pcm == NULL || !pcm_is_ready(pcm)) {
+		ALOGE("Unable to open pcm device %d:%d: %s", props->card, props->device,
+			pcm_get_error(pcm));
+		if(pcm != NULL)
+			pcm_close(pcm);
+		return NULL;
+	}
+
+	return pcm;
+}
+
+static void audio_voice_bridge_path_close(struct tinyalsa_audio_voice_bridge_path *path)
+{
+	if(path->pcm_in != NULL) {
+		pcm_close(path->pcm_in);
+		path->pcm_in = NULL;
+	}
+
+	if(path->pcm_out != NULL) {
+		pcm_close(path->pcm_out);
+		path->pcm_out = NULL;
+	}
+}
+
+static int audio_voice_bridge_path_open(struct tinyalsa_audio_voice_bridge_path *path,
+	struct tinyalsa_mixer_io_props *props_in, int rate_in,
+	struct tinyalsa_mixer_io_props *props_out, int rate_out)
+{
+	path->pcm_in = audio_voice_bridge_pcm_open(props_in, PCM_IN, rate_in);
+	if(path->pcm_in == NULL)
+		goto error;
+
+	path->pcm_out = audio_voice_bridge_pcm_open(props_out, PCM_OUT, rate_out);
+	if(path->pcm_out == NULL)
+		goto error;
+
+	path->rate_in = rate_in;
+	path->rate_out = rate_out;
+
+	return 0;
+
+error:
+	audio_voice_bridge_path_close(path);
+
+	return -1;
+}
+
+static int audio_voice_bridge_path_start(struct tinyalsa_audio_voice_bridge_path *path)
+{
+	struct sched_param param;
+	pthread_attr_t attr;
+	int rc;
+
+	path->ring.read = 0;
+	path->ring.fill = 0;
+	path->history = 0;
+	path->latency = 0;
+	path->latency_avg = (path->period_out * 2) << 4;
+	path->running = 1;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = TINYALSA_AUDIO_VOICE_BRIDGE_PRIORITY;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	rc = pthread_create(&path->thread, &attr, audio_voice_bridge_thread, path);
+
+	pthread_attr_destroy(&attr);
+
+	if(rc != 0) {
+		ALOGE("Unable to create real-time %s thread, using normal priority", path->name);
+
+		rc = pthread_create(&path->thread, NULL, audio_voice_bridge_thread, path);
+		if(rc != 0) {
+			ALOGE("Unable to create %s thread", path->name);
+			path->running = 0;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void audio_voice_bridge_path_stop(struct tinyalsa_audio_voice_bridge_path *path)
+{
+	if(!path->running)
+		return;
+
+	// The thread sees it within a wait timeout, even with a stalled pcm
+	path->running = 0;
+
+	pthread_join(path->thread, NULL);
+}
+
+/*
+ * Functions
+ */
+
+static void audio_voice_bridge_stop(struct tinyalsa_audio_voice_bridge *bridge)
+{
+	ALOGD("%s(%p)", __func__, bridge);
+
+	audio_voice_bridge_path_stop(&bridge->downlink);
+	audio_voice_bridge_path_stop(&bridge->uplink);
+
+	audio_voice_bridge_path_close(&bridge->downlink);
+	audio_voice_bridge_path_close(&bridge->uplink);
+
+	bridge->running = 0;
+}
+
+static int audio_voice_bridge_start(struct tinyalsa_audio_voice_bridge *bridge)
+{
+	int modem_rate;
+	int sco_rate;
+	int rc;
+
+	modem_rate = bridge->modem_rate;
+	sco_rate = bridge->sco_props->rate;
+
+	ALOGD("%s(%p): modem %d Hz, BT SCO %d Hz", __func__, bridge, modem_rate, sco_rate);
+
+	if(!audio_voice_bridge_rates_supported(modem_rate, sco_rate)) {
+		ALOGE("Unsupported rates: modem %d Hz, BT SCO %d Hz", modem_rate, sco_rate);
+		return -1;
+	}
+
+	rc = audio_voice_bridge_path_open(&bridge->downlink, bridge->modem_props, modem_rate,
+		bridge->sco_props, sco_rate);
+	if(rc < 0)
+		goto error;
+
+	rc = audio_voice_bridge_path_open(&bridge->uplink, bridge->sco_props, sco_rate,
+		bridge->modem_props, modem_rate);
+	if(rc < 0)
+		goto error;
+
+	rc = audio_voice_bridge_path_start(&bridge->downlink);
+	if(rc < 0)
+		goto error;
+
+	rc = audio_voice_bridge_path_start(&bridge->uplink);
+	if(rc < 0)
+		goto error;
+
+	bridge->running = 1;
+	bridge->starts++;
+
+	return 0;
+
+error:
+	audio_voice_bridge_stop(bridge);
+
+	return -1;
+}
+
+/*
+ * Calls are serialized by the device hw_lock. A null device or rate keeps
+ * the current one. The bridge runs in call with a BT SCO device and is
+ * restarted when the modem rate changes.
+ */
+int audio_voice_bridge_update(struct tinyalsa_audio_voice_bridge *bridge,
+	int in_call, audio_devices_t device, int modem_rate)
+{
+	int active;
+	int rc;
+
+	ALOGD("%s(%p, %d, 0x%x, %d)", __func__, bridge, in_call, device, modem_rate);
+
+	if(bridge == NULL)
+		return -1;
+
+	bridge->in_call = in_call;
+
+	if(device != 0)
+		bridge->device_current = device;
+
+	if(modem_rate != 0 && modem_rate != bridge->modem_rate) {
+		bridge->modem_rate = modem_rate;
+
+		if(bridge->running)
+			audio_voice_bridge_stop(bridge);
+	}
+
+	active = bridge->in_call && audio_is_bluetooth_sco_device(bridge->device_current);
+
+	if(!active && bridge->running)
+		audio_voice_bridge_stop(bridge);
+
+	if(active && !bridge->running) {
+		rc = audio_voice_bridge_start(bridge);
+		if(rc < 0) {
+			ALOGE("Unable to start voice bridge");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int audio_voice_bridge_dump(struct tinyalsa_audio_voice_bridge *bridge, int fd)
+{
+	struct tinyalsa_audio_voice_bridge_path *paths[2];
+	struct tinyalsa_audio_voice_bridge_path *path;
+	char buffer[256];
+	int length;
+	int drift;
+	int i;
+
+	if(bridge == NULL)
+		return -1;
+
+	length = snprintf(buffer, sizeof(buffer), "Voice bridge: %s, modem %d Hz, BT SCO %d Hz, %u starts\n",
+		bridge->running ? "running" : "stopped", bridge->modem_rate,
+		bridge->sco_props->rate, bridge->starts);
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	paths[0] = &bridge->downlink;
+	paths[1] = &bridge->uplink;
+
+	// Counters are only written by the path threads, read without locking
+	for(i=0 ; i < 2 ; i++) {
+		path = paths[i];
+
+		drift = 0;
+		if(path->frames > 0)
+			drift = (int) (((int64_t) path->slips_inserted - path->slips_dropped) * 1000000 / path->frames);
+
+		length = snprintf(buffer, sizeof(buffer), "Voice bridge %s: latency %d frames, average %d, max %d, drift %d ppm (%u dropped, %u inserted), %u overflows, %u xruns\n",
+			path->name, path->latency, path->latency_avg >> 4, path->latency_max, drift,
+			path->slips_dropped, path->slips_inserted, path->overflows, path->xruns);
+		if(length > 0 && length < (int) sizeof(buffer))
+			write(fd, buffer, length);
+	}
+
+	return 0;
+}
+
+/*
+ * Interface
+ */
+
+static void audio_voice_bridge_path_free(struct tinyalsa_audio_voice_bridge_path *path)
+{
+	if(path->buffer_in != NULL) {
+		free(path->buffer_in);
+		path->buffer_in = NULL;
+	}
+
+	if(path->buffer_convert != NULL) {
+		free(path->buffer_convert);
+		path->buffer_convert = NULL;
+	}
+
+	if(path->buffer_out != NULL) {
+		free(path->buffer_out);
+		path->buffer_out = NULL;
+	}
+
+	if(path->ring.buffer != NULL) {
+		free(path->ring.buffer);
+		path->ring.buffer = NULL;
+	}
+}
+
+/*
+ * Buffers are sized for the largest conversion ratio, so that nothing is
+ * allocated while bridging.
+ */
+static int audio_voice_bridge_path_alloc(struct tinyalsa_audio_voice_bridge *bridge,
+	struct tinyalsa_audio_voice_bridge_path *path, char *name,
+	int period_in, int period_out)
+{
+	path->bridge = bridge;
+	path->name = name;
+	path->period_in = period_in;
+	path->period_out = period_out;
+
+	path->buffer_in = calloc(period_in, sizeof(int16_t));
+	path->buffer_convert = calloc(period_in * 2 + 1, sizeof(int16_t));
+	path->buffer_out = calloc(period_out, sizeof(int16_t));
+
+	path->ring.size = (period_in * 2 + period_out) * 4;
+	path->ring.buffer = calloc(path->ring.size, sizeof(int16_t));
+
+	if(path->buffer_in == NULL || path->buffer_convert == NULL ||
+		path->buffer_out == NULL || path->ring.buffer == NULL) {
+		audio_voice_bridge_path_free(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void audio_voice_bridge_close(struct tinyalsa_audio_voice_bridge *bridge)
+{
+	ALOGD("%s(%p)", __func__, bridge);
+
+	if(bridge == NULL)
+		return;
+
+	if(bridge->running)
+		audio_voice_bridge_stop(bridge);
+
+	audio_voice_bridge_path_free(&bridge->downlink);
+	audio_voice_bridge_path_free(&bridge->uplink);
+
+	free(bridge);
+}
+
+int audio_voice_bridge_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_voice_bridge **bridge_p)
+{
+	struct tinyalsa_audio_voice_bridge *bridge;
+	struct tinyalsa_mixer_io_props *modem_props;
+	struct tinyalsa_mixer_io_props *sco_props;
+	char property[PROPERTY_VALUE_MAX];
+	int rc;
+
+	ALOGD("%s(%p, %p)", __func__, device, bridge_p);
+
+	if(device == NULL || device->mixer == NULL || bridge_p == NULL)
+		return -1;
+
+	*bridge_p = NULL;
+
+	property_get(TINYALSA_AUDIO_VOICE_BRIDGE_PROPERTY, property, "0");
+	if(atoi(property) == 0)
+		return 0;
+
+	modem_props = tinyalsa_mixer_get_modem_props(device->mixer);
+	sco_props = tinyalsa_mixer_get_sco_props(device->mixer);
+
+	if(sco_props->rate == 0) {
+		ALOGE("No BT SCO pcm in the mixer config, voice bridge is disabled");
+		return 0;
+	}
+
+	// Default values, periods are kept even for decimation
+	if(modem_props->period_size == 0)
+		modem_props->period_size = TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_SIZE_DEFAULT;
+	if(modem_props->period_count == 0)
+		modem_props->period_count = TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_COUNT_DEFAULT;
+	if(sco_props->period_size == 0)
+		sco_props->period_size = TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_SIZE_DEFAULT;
+	if(sco_props->period_count == 0)
+		sco_props->period_count = TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_COUNT_DEFAULT;
+
+	modem_props->period_size &= ~1;
+	sco_props->period_size &= ~1;
+
+	bridge = calloc(1, sizeof(struct tinyalsa_audio_voice_bridge));
+	if(bridge == NULL)
+		return -ENOMEM;
+
+	bridge->device = device;
+	bridge->modem_props = modem_props;
+	bridge->sco_props = sco_props;
+	bridge->modem_rate = modem_props->rate != 0 ? modem_props->rate :
+		TINYALSA_AUDIO_VOICE_BRIDGE_RATE_DEFAULT;
+
+	rc = audio_voice_bridge_path_alloc(bridge, &bridge->downlink, "downlink",
+		modem_props->period_size, sco_props->period_size);
+	if(rc < 0)
+		goto error_bridge;
+
+	rc = audio_voice_bridge_path_alloc(bridge, &bridge->uplink, "uplink",
+		sco_props->period_size, modem_props->period_size);
+	if(rc < 0)
+		goto error_bridge;
+
+	*bridge_p = bridge;
+
+	return 0;
+
+error_bridge:
+	audio_voice_bridge_path_free(&bridge->downlink);
+	audio_voice_bridge_path_free(&bridge->uplink);
+
+	free(bridge);
+
+	return -1;
+}
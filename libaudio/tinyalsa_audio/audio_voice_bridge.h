@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TINYALSA_AUDIO_VOICE_BRIDGE_H
+#define TINYALSA_AUDIO_VOICE_BRIDGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#include <system/audio.h>
+
+#define TINYALSA_AUDIO_VOICE_BRIDGE_PROPERTY		"persist.audio.voice_bridge"
+#define TINYALSA_AUDIO_VOICE_BRIDGE_PRIORITY		2
+
+#define TINYALSA_AUDIO_VOICE_BRIDGE_RATE_DEFAULT	8000
+#define TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_SIZE_DEFAULT	160
+#define TINYALSA_AUDIO_VOICE_BRIDGE_PERIOD_COUNT_DEFAULT	4
+
+#define TINYALSA_AUDIO_VOICE_BRIDGE_WAIT_TIMEOUT	100
+
+/*
+ * Software voice path between the modem PCM and the BT SCO PCM, used for
+ * calls routed to BT SCO devices, that have no analog path on the codec.
+ *
+ * Each direction has a real-time thread that reads a period from its
+ * source, converts the rate (8 kHz and 16 kHz, mono 16-bit) into a ring
+ * and writes periods from the ring to its sink. The latency (ring and
+ * sink buffer) is kept around two sink periods by slipping one sample per
+ * period, which compensates for drift between the two clocks. Threads
+ * only read or write once pcm_wait() says the pcm is ready, and count an
+ * xrun past the wait timeout (in ms), so that a stalled pcm never keeps
+ * them from seeing a stop.
+ *
+ * Latencies are in frames at the sink rate.
+ */
+
+struct tinyalsa_audio_voice_bridge_ring {
+	int16_t *buffer;
+	int size;
+	int read;
+	int fill;
+};
+
+struct tinyalsa_audio_voice_bridge_path {
+	struct tinyalsa_audio_voice_bridge *bridge;
+	char *name;
+
+	struct pcm *pcm_in;
+	struct pcm *pcm_out;
+	int rate_in;
+	int rate_out;
+	int period_in;
+	int period_out;
+
+	int16_t *buffer_in;
+	int16_t *buffer_convert;
+	int16_t *buffer_out;
+	int16_t history;
+	struct tinyalsa_audio_voice_bridge_ring ring;
+
+	pthread_t thread;
+	int running;
+
+	int latency;
+	int latency_avg;
+	int latency_max;
+	int64_t frames;
+	unsigned int slips_dropped;
+	unsigned int slips_inserted;
+	unsigned int overflows;
+	unsigned int xruns;
+};
+
+struct tinyalsa_audio_voice_bridge {
+	struct tinyalsa_audio_device *device;
+
+	struct tinyalsa_mixer_io_props *modem_props;
+	struct tinyalsa_mixer_io_props *sco_props;
+
+	struct tinyalsa_audio_voice_bridge_path downlink;
+	struct tinyalsa_audio_voice_bridge_path uplink;
+
+	audio_devices_t device_current;
+	int modem_rate;
+	int in_call;
+	int running;
+	unsigned int starts;
+};
+
+int audio_voice_bridge_update(struct tinyalsa_audio_voice_bridge *bridge,
+	int in_call, audio_devices_t device, int modem_rate);
+int audio_voice_bridge_dump(struct tinyalsa_audio_voice_bridge *bridge, int fd);
+
+void audio_voice_bridge_close(struct tinyalsa_audio_voice_bridge *bridge);
+int audio_voice_bridge_open(struct tinyalsa_audio_device *device,
+	struct tinyalsa_audio_voice_bridge **bridge_p);
+
+#endif
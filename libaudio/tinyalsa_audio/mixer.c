@@ -22,10 +22,16 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
+#include <sys/inotify.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <expat.h>
 
@@ -90,9 +96,44 @@ void tinyalsa_mixer_data_free(struct tinyalsa_mixer_data *mixer_data)
 		mixer_data->attr = NULL;
 	}
 
+	if(mixer_data->curve != NULL) {
+		free(mixer_data->curve);
+		mixer_data->curve = NULL;
+	}
+
 	free(mixer_data);
 }
 
+struct tinyalsa_mixer_data *tinyalsa_mixer_data_copy(struct tinyalsa_mixer_data *mixer_data)
+{
+	struct tinyalsa_mixer_data *mixer_data_copy;
+
+	if(mixer_data == NULL)
+		return NULL;
+
+	mixer_data_copy = tinyalsa_mixer_data_alloc();
+	if(mixer_data_copy == NULL)
+		return NULL;
+
+	mixer_data_copy->type = mixer_data->type;
+
+	if(mixer_data->name != NULL)
+		mixer_data_copy->name = strdup(mixer_data->name);
+	if(mixer_data->value != NULL)
+		mixer_data_copy->value = strdup(mixer_data->value);
+	if(mixer_data->attr != NULL)
+		mixer_data_copy->attr = strdup(mixer_data->attr);
+
+	if(mixer_data->curve != NULL) {
+		mixer_data_copy->curve = (struct tinyalsa_mixer_curve *)
+			malloc(sizeof(struct tinyalsa_mixer_curve));
+		if(mixer_data_copy->curve != NULL)
+			memcpy(mixer_data_copy->curve, mixer_data->curve, sizeof(struct tinyalsa_mixer_curve));
+	}
+
+	return mixer_data_copy;
+}
+
 struct tinyalsa_mixer_data *tinyalsa_mixer_get_data_with_attr(
 	struct list_head *list_data, char *attr)
 {
@@ -120,6 +161,466 @@ struct tinyalsa_mixer_data *tinyalsa_mixer_get_data_with_attr(
 	return mixer_data;
 }
 
+struct tinyalsa_mixer_data *tinyalsa_mixer_get_data_with_name(
+	struct list_head *list_data, char *name)
+{
+	struct tinyalsa_mixer_data *mixer_data;
+
+	while(list_data != NULL) {
+		mixer_data = (struct tinyalsa_mixer_data *) list_data->data;
+
+		if(mixer_data != NULL && mixer_data->type == MIXER_DATA_TYPE_CTRL &&
+			mixer_data->name != NULL && strcmp(mixer_data->name, name) == 0)
+			return mixer_data;
+
+		list_data = list_data->next;
+	}
+
+	return NULL;
+}
+
+/*
+ * Mixer curve
+ */
+
+struct tinyalsa_mixer_curve *tinyalsa_mixer_curve_get(
+	struct tinyalsa_mixer_data *mixer_data)
+{
+	if(mixer_data == NULL)
+		return NULL;
+
+	if(mixer_data->curve == NULL)
+		mixer_data->curve = (struct tinyalsa_mixer_curve *)
+			calloc(1, sizeof(struct tinyalsa_mixer_curve));
+
+	return mixer_data->curve;
+}
+
+int tinyalsa_mixer_curve_add_point(struct tinyalsa_mixer_curve *curve,
+	float volume, float db)
+{
+	int i;
+
+	if(curve == NULL)
+		return -1;
+
+	if(curve->points_count >= TINYALSA_MIXER_CURVE_POINTS_MAX)
+		return -1;
+
+	// Keep the points sorted by volume
+	for(i=curve->points_count ; i > 0 && curve->points[i-1].volume > volume ; i--)
+		curve->points[i] = curve->points[i-1];
+
+	curve->points[i].volume = volume;
+	curve->points[i].db = db;
+	curve->points_count++;
+
+	return 0;
+}
+
+float tinyalsa_mixer_curve_db(struct tinyalsa_mixer_curve *curve, float volume)
+{
+	struct tinyalsa_mixer_curve_point *point_prev;
+	struct tinyalsa_mixer_curve_point *point;
+	int i;
+
+	if(volume <= curve->points[0].volume)
+		return curve->points[0].db;
+
+	for(i=1 ; i < curve->points_count ; i++) {
+		point_prev = &curve->points[i-1];
+		point = &curve->points[i];
+
+		if(volume > point->volume)
+			continue;
+
+		if(point->volume == point_prev->volume)
+			return point->db;
+
+		return point_prev->db + (point->db - point_prev->db) *
+			(volume - point_prev->volume) / (point->volume - point_prev->volume);
+	}
+
+	return curve->points[curve->points_count - 1].db;
+}
+
+int tinyalsa_mixer_curve_compile(struct tinyalsa_mixer_data *mixer_data)
+{
+	struct tinyalsa_mixer_curve *curve;
+	int value_min, value_max, values_count;
+	float volume, ratio;
+	int i;
+
+	if(mixer_data == NULL || mixer_data->value == NULL)
+		return -1;
+
+	// Only controls with a min-max range are volume controls
+	values_count = sscanf(mixer_data->value, "%d-%d", &value_min, &value_max);
+	if(values_count != 2) {
+		if(mixer_data->curve != NULL) {
+			ALOGE("Volume curve on ctrl without range: %s", mixer_data->name);
+			free(mixer_data->curve);
+			mixer_data->curve = NULL;
+		}
+
+		return 0;
+	}
+
+	curve = tinyalsa_mixer_curve_get(mixer_data);
+	if(curve == NULL)
+		return -1;
+
+	curve->value_min = value_min;
+	curve->value_max = value_max;
+
+	if(curve->points_count > 0 && curve->db_max <= curve->db_min) {
+		ALOGE("Invalid dB range for ctrl: %s", mixer_data->name);
+		curve->points_count = 0;
+	}
+
+	for(i=0 ; i < TINYALSA_MIXER_CURVE_LUT_SIZE ; i++) {
+		volume = (float) i / (TINYALSA_MIXER_CURVE_LUT_SIZE - 1);
+
+		if(curve->points_count > 0) {
+			ratio = (tinyalsa_mixer_curve_db(curve, volume) - curve->db_min) /
+				(curve->db_max - curve->db_min);
+
+			if(ratio < 0)
+				ratio = 0;
+			else if(ratio > 1)
+				ratio = 1;
+
+			curve->lut[i] = value_min + (int) (ratio * (value_max - value_min) + 0.5f);
+		} else {
+			// Without breakpoints, keep the linear register mapping
+			curve->lut[i] = (value_max - value_min) * volume + value_min;
+		}
+	}
+
+	return 0;
+}
+
+int tinyalsa_mixer_curve_value(struct tinyalsa_mixer_curve *curve, float volume)
+{
+	int index;
+
+	if(volume <= 0)
+		index = 0;
+	else if(volume >= 1)
+		index = TINYALSA_MIXER_CURVE_LUT_SIZE - 1;
+	else
+		index = (int) (volume * (TINYALSA_MIXER_CURVE_LUT_SIZE - 1) + 0.5f);
+
+	return curve->lut[index];
+}
+
+/*
+ * Mixer shadow
+ */
+
+struct tinyalsa_mixer_shadow *tinyalsa_mixer_shadow_get(struct tinyalsa_mixer *mixer,
+	int card, char *name)
+{
+	struct tinyalsa_mixer_shadow *shadow;
+	struct list_head *list;
+
+	if(mixer == NULL || name == NULL)
+		return NULL;
+
+	list = mixer->shadows;
+
+	while(list != NULL) {
+		shadow = (struct tinyalsa_mixer_shadow *) list->data;
+		if(shadow != NULL && shadow->card == card &&
+			strcmp(shadow->name, name) == 0)
+			return shadow;
+
+		list = list->next;
+	}
+
+	list = list_head_alloc();
+	shadow = (struct tinyalsa_mixer_shadow *)
+		calloc(1, sizeof(struct tinyalsa_mixer_shadow));
+	if(list == NULL || shadow == NULL)
+		goto error_shadow;
+
+	shadow->card = card;
+	shadow->name = strdup(name);
+	if(shadow->name == NULL)
+		goto error_shadow;
+
+	list->data = (void *) shadow;
+	list->next = mixer->shadows;
+	if(mixer->shadows != NULL)
+		mixer->shadows->prev = list;
+	mixer->shadows = list;
+
+	return shadow;
+
+error_shadow:
+	if(shadow != NULL)
+		free(shadow);
+	if(list != NULL)
+		list_head_free(list);
+
+	return NULL;
+}
+
+void tinyalsa_mixer_shadow_set(struct tinyalsa_mixer_shadow *shadow, char *value)
+{
+	if(shadow == NULL)
+		return;
+
+	if(shadow->value != NULL) {
+		free(shadow->value);
+		shadow->value = NULL;
+	}
+
+	if(value != NULL)
+		shadow->value = strdup(value);
+}
+
+void tinyalsa_mixer_shadows_free(struct tinyalsa_mixer *mixer)
+{
+	struct tinyalsa_mixer_shadow *shadow;
+	struct list_head *list;
+	struct list_head *list_prev;
+
+	if(mixer == NULL)
+		return;
+
+	list = mixer->shadows;
+
+	while(list != NULL) {
+		shadow = (struct tinyalsa_mixer_shadow *) list->data;
+		if(shadow != NULL) {
+			tinyalsa_mixer_shadow_set(shadow, NULL);
+			free(shadow->name);
+			free(shadow);
+		}
+
+		list_prev = list;
+		list = list->next;
+
+		list_prev->next = NULL;
+		list_head_free(list_prev);
+	}
+
+	mixer->shadows = NULL;
+}
+
+/*
+ * Mixer journal
+ */
+
+void tinyalsa_mixer_journal_add(struct tinyalsa_mixer *mixer,
+	struct mixer_ctl *ctl, struct tinyalsa_mixer_shadow *shadow, char *name)
+{
+	struct tinyalsa_mixer_journal *journal;
+	struct list_head *list;
+	char value_string[12];
+	const char *value = NULL;
+	int type;
+	int rc;
+
+	if(shadow != NULL && shadow->value != NULL) {
+		value = shadow->value;
+	} else {
+		// Unknown values are read back so that they can be restored
+		type = mixer_ctl_get_type(ctl);
+		rc = mixer_ctl_get_value(ctl, 0);
+
+		if(rc >= 0 && (type == MIXER_CTL_TYPE_BOOL || type == MIXER_CTL_TYPE_INT ||
+			type == MIXER_CTL_TYPE_BYTE)) {
+			snprintf(value_string, sizeof(value_string), "%d", rc);
+			value = value_string;
+		} else if(rc >= 0 && type == MIXER_CTL_TYPE_ENUM) {
+			value = mixer_ctl_get_enum_string(ctl, rc);
+		}
+
+		if(value == NULL)
+			ALOGE("Unable to read ctrl, it cannot be rolled back: %s", name);
+	}
+
+	list = list_head_alloc();
+	journal = (struct tinyalsa_mixer_journal *)
+		calloc(1, sizeof(struct tinyalsa_mixer_journal));
+	if(list == NULL || journal == NULL)
+		goto error_journal;
+
+	journal->name = strdup(name);
+	if(value != NULL)
+		journal->value = strdup(value);
+
+	// Newest first, which is the rollback order
+	list->data = (void *) journal;
+	list->next = mixer->journal;
+	if(mixer->journal != NULL)
+		mixer->journal->prev = list;
+	mixer->journal = list;
+
+	return;
+
+error_journal:
+	ALOGE("Unable to journal ctrl: %s", name);
+
+	if(journal != NULL)
+		free(journal);
+	if(list != NULL)
+		list_head_free(list);
+}
+
+void tinyalsa_mixer_journal_free(struct tinyalsa_mixer *mixer)
+{
+	struct tinyalsa_mixer_journal *journal;
+	struct list_head *list;
+	struct list_head *list_prev;
+
+	list = mixer->journal;
+
+	while(list != NULL) {
+		journal = (struct tinyalsa_mixer_journal *) list->data;
+		if(journal != NULL) {
+			if(journal->name != NULL)
+				free(journal->name);
+			if(journal->value != NULL)
+				free(journal->value);
+			free(journal);
+		}
+
+		list_prev = list;
+		list = list->next;
+
+		list_prev->next = NULL;
+		list_head_free(list_prev);
+	}
+
+	mixer->journal = NULL;
+}
+
+/*
+ * Mixer trace
+ */
+
+void tinyalsa_mixer_trace_record(struct tinyalsa_mixer *mixer,
+	struct tinyalsa_mixer_shadow *shadow, char *name, char *value,
+	int64_t time_start, int rc)
+{
+	struct tinyalsa_mixer_trace_entry *entry;
+	int64_t duration;
+	int bucket;
+
+	if(mixer == NULL || mixer->trace == NULL)
+		return;
+
+	duration = audio_hw_time() - time_start;
+
+	entry = &mixer->trace->entries[mixer->trace->index];
+	mixer->trace->index = (mixer->trace->index + 1) % TINYALSA_MIXER_TRACE_SIZE;
+	if(mixer->trace->count < TINYALSA_MIXER_TRACE_SIZE)
+		mixer->trace->count++;
+
+	entry->timestamp = time_start;
+	entry->duration = (int32_t) duration;
+	entry->transition = mixer->transition;
+	entry->card = mixer->card;
+	entry->rc = rc;
+	strncpy(entry->name, name, sizeof(entry->name) - 1);
+	entry->name[sizeof(entry->name) - 1] = '\0';
+	strncpy(entry->value, value, sizeof(entry->value) - 1);
+	entry->value[sizeof(entry->value) - 1] = '\0';
+
+	if(shadow == NULL)
+		return;
+
+	// Bucket n holds durations in [2^(n-1), 2^n) us
+	for(bucket=0 ; duration > 0 && bucket < TINYALSA_MIXER_HISTOGRAM_SIZE - 1 ; bucket++)
+		duration >>= 1;
+
+	shadow->histogram[bucket]++;
+	if(entry->duration > shadow->duration_max)
+		shadow->duration_max = entry->duration;
+}
+
+void tinyalsa_mixer_trace_printf(int fd, const char *format, ...)
+{
+	char buffer[256];
+	va_list ap;
+	int length;
+
+	va_start(ap, format);
+	length = vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+
+	if(length < 0)
+		return;
+
+	if(length >= (int) sizeof(buffer))
+		length = sizeof(buffer) - 1;
+
+	write(fd, buffer, length);
+}
+
+int tinyalsa_mixer_trace_dump_file(struct tinyalsa_mixer *mixer, char *path)
+{
+	struct tinyalsa_mixer_trace_header header;
+	struct tinyalsa_mixer_trace_histogram histogram;
+	struct tinyalsa_mixer_shadow *shadow;
+	struct list_head *list;
+	unsigned int index;
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if(f == NULL) {
+		ALOGE("Unable to open mixer trace file: %s", path);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TINYALSA_MIXER_TRACE_MAGIC;
+	header.version = TINYALSA_MIXER_TRACE_VERSION;
+	header.entry_size = sizeof(struct tinyalsa_mixer_trace_entry);
+	header.entries_count = mixer->trace->count;
+	header.histogram_size = sizeof(struct tinyalsa_mixer_trace_histogram);
+
+	for(list=mixer->shadows ; list != NULL ; list = list->next)
+		header.histograms_count++;
+
+	fwrite(&header, sizeof(header), 1, f);
+
+	// Entries are stored oldest first
+	index = (mixer->trace->index + TINYALSA_MIXER_TRACE_SIZE - mixer->trace->count) %
+		TINYALSA_MIXER_TRACE_SIZE;
+
+	for(i=0 ; i < mixer->trace->count ; i++) {
+		fwrite(&mixer->trace->entries[index], sizeof(struct tinyalsa_mixer_trace_entry), 1, f);
+		index = (index + 1) % TINYALSA_MIXER_TRACE_SIZE;
+	}
+
+	for(list=mixer->shadows ; list != NULL ; list = list->next) {
+		shadow = (struct tinyalsa_mixer_shadow *) list->data;
+
+		memset(&histogram, 0, sizeof(histogram));
+		histogram.card = shadow->card;
+		histogram.duration_max = shadow->duration_max;
+		strncpy(histogram.name, shadow->name, sizeof(histogram.name) - 1);
+		memcpy(histogram.buckets, shadow->histogram, sizeof(histogram.buckets));
+
+		fwrite(&histogram, sizeof(histogram), 1, f);
+	}
+
+	if(ferror(f)) {
+		ALOGE("Unable to write mixer trace file: %s", path);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
 /*
  * Mixer device
  */
@@ -152,6 +653,7 @@ void tinyalsa_mixer_device_free(struct tinyalsa_mixer_device *mixer_device)
 		list_prev = list_data;
 		list_data = list_data->next;
 
+		list_prev->next = NULL;
 		list_head_free(list_prev);
 	}
 
@@ -166,6 +668,7 @@ void tinyalsa_mixer_device_free(struct tinyalsa_mixer_device *mixer_device)
 		list_prev = list_data;
 		list_data = list_data->next;
 
+		list_prev->next = NULL;
 		list_head_free(list_prev);
 	}
 
@@ -175,9 +678,134 @@ void tinyalsa_mixer_device_free(struct tinyalsa_mixer_device *mixer_device)
 	free(mixer_device);
 }
 
-struct tinyalsa_mixer_device *tinyalsa_mixer_get_device(struct tinyalsa_mixer_io *mixer_io,
-	audio_devices_t device)
+/*
+ * Appends copies of the mixer data of a list at the end of another.
+ */
+int tinyalsa_mixer_device_list_append(struct list_head **list_start,
+	struct list_head *list_data)
+{
+	struct tinyalsa_mixer_data *mixer_data;
+	struct list_head *list_prev;
+	struct list_head *list;
+
+	list_prev = *list_start;
+	while(list_prev != NULL && list_prev->next != NULL)
+		list_prev = list_prev->next;
+
+	while(list_data != NULL) {
+		mixer_data = tinyalsa_mixer_data_copy((struct tinyalsa_mixer_data *) list_data->data);
+		if(mixer_data == NULL)
+			return -1;
+
+		list = list_head_alloc();
+		if(list == NULL) {
+			tinyalsa_mixer_data_free(mixer_data);
+			return -1;
+		}
+
+		list->data = (void *) mixer_data;
+
+		if(list_prev == NULL) {
+			*list_start = list;
+		} else {
+			list_prev->next = list;
+			list->prev = list_prev;
+		}
+
+		list_prev = list;
+		list_data = list_data->next;
+	}
+
+	return 0;
+}
+
+struct tinyalsa_mixer_device *tinyalsa_mixer_get_device_rate(struct tinyalsa_mixer_io *mixer_io,
+	audio_devices_t device, int rate);
+
+/*
+ * Combined devices run the enable and disable controls of every member
+ * device, in member order: later members take precedence on shared
+ * controls. The result is cached at the end of the devices list with the
+ * rate it was composed for, even when no member is rate specific, so that
+ * a lookup at another rate composes the members for that rate.
+ */
+struct tinyalsa_mixer_device *tinyalsa_mixer_device_compose(struct tinyalsa_mixer_io *mixer_io,
+	audio_devices_t device, int rate)
+{
+	struct tinyalsa_mixer_device *mixer_device_member;
+	struct tinyalsa_mixer_device *mixer_device;
+	struct list_head *list_prev;
+	struct list_head *list;
+	audio_devices_t members;
+	audio_devices_t member;
+	int rc;
+
+	mixer_device = calloc(1, sizeof(struct tinyalsa_mixer_device));
+	if(mixer_device == NULL)
+		return NULL;
+
+	mixer_device->props.type = device;
+	mixer_device->props.rate = rate;
+
+	members = device & ~AUDIO_DEVICE_BIT_IN;
+
+	while(members != 0) {
+		member = (members & (~members + 1)) | (device & AUDIO_DEVICE_BIT_IN);
+		members &= members - 1;
+
+		mixer_device_member = tinyalsa_mixer_get_device_rate(mixer_io, member, rate);
+		if(mixer_device_member == NULL) {
+			ALOGE("Unable to find member device 0x%x of 0x%x", member, device);
+			goto error_device;
+		}
+
+		rc = tinyalsa_mixer_device_list_append(&mixer_device->enable,
+			mixer_device_member->enable);
+		if(rc < 0)
+			goto error_device;
+
+		rc = tinyalsa_mixer_device_list_append(&mixer_device->disable,
+			mixer_device_member->disable);
+		if(rc < 0)
+			goto error_device;
+	}
+
+	list = list_head_alloc();
+	if(list == NULL)
+		goto error_device;
+
+	list->data = (void *) mixer_device;
+
+	if(mixer_io->devices == NULL) {
+		mixer_io->devices = list;
+	} else {
+		list_prev = mixer_io->devices;
+
+		while(list_prev->next != NULL)
+			list_prev = list_prev->next;
+
+		list_prev->next = list;
+		list->prev = list_prev;
+	}
+
+	ALOGD("Composed combined device 0x%x at %d Hz", device, rate);
+
+	return mixer_device;
+
+error_device:
+	tinyalsa_mixer_device_free(mixer_device);
+
+	return NULL;
+}
+
+/*
+ * Devices with a rate are only used at that rate and take precedence over
+ * devices without a rate.
+ */
+struct tinyalsa_mixer_device *tinyalsa_mixer_get_device_rate(struct tinyalsa_mixer_io *mixer_io,
+	audio_devices_t device, int rate)
 {
+	struct tinyalsa_mixer_device *mixer_device_any = NULL;
 	struct tinyalsa_mixer_device *mixer_device = NULL;
 	struct list_head *list = NULL;
 
@@ -189,15 +817,29 @@ struct tinyalsa_mixer_device *tinyalsa_mixer_get_device(struct tinyalsa_mixer_io
 	while(list != NULL) {
 		mixer_device = (struct tinyalsa_mixer_device *) list->data;
 		if(mixer_device != NULL && mixer_device->props.type == device) {
-			break;
-		} else {
-			mixer_device = NULL;
+			if(mixer_device->props.rate != 0 && mixer_device->props.rate == rate)
+				return mixer_device;
+
+			if(mixer_device->props.rate == 0 && mixer_device_any == NULL)
+				mixer_device_any = mixer_device;
 		}
 
 		list = list->next;
 	}
 
-	return mixer_device;
+	if(mixer_device_any == NULL && popcount(device & ~AUDIO_DEVICE_BIT_IN) > 1)
+		return tinyalsa_mixer_device_compose(mixer_io, device, rate);
+
+	return mixer_device_any;
+}
+
+struct tinyalsa_mixer_device *tinyalsa_mixer_get_device(struct tinyalsa_mixer_io *mixer_io,
+	audio_devices_t device)
+{
+	if(mixer_io == NULL)
+		return NULL;
+
+	return tinyalsa_mixer_get_device_rate(mixer_io, device, mixer_io->props.rate);
 }
 
 /*
@@ -224,6 +866,7 @@ void tinyalsa_mixer_io_free_devices(struct tinyalsa_mixer_io *mixer_io)
 		list_prev = list_device;
 		list_device = list_device->next;
 
+		list_prev->next = NULL;
 		list_head_free(list_prev);
 	}
 }
@@ -237,7 +880,9 @@ void tinyalsa_mixer_config_start(void *data, const XML_Char *elem,
 {
 	struct tinyalsa_mixer_config_data *config_data;
 	struct tinyalsa_mixer_data *mixer_data;
+	struct tinyalsa_mixer_curve *curve;
 	struct list_head *list;
+	float volume, db;
 	int i;
 
 	if(data == NULL || elem == NULL || attr == NULL)
@@ -369,11 +1014,43 @@ void tinyalsa_mixer_config_start(void *data, const XML_Char *elem,
 			} else if(strcmp(attr[i], "device") == 0) {
 				i++;
 				config_data->io_props.device = atoi(attr[i]);
+			} else if(strcmp(attr[i], "rate") == 0) {
+				i++;
+				config_data->io_props.rate = atoi(attr[i]);
+			} else if(strcmp(attr[i], "period_size") == 0) {
+				i++;
+				config_data->io_props.period_size = atoi(attr[i]);
+			} else if(strcmp(attr[i], "period_count") == 0) {
+				i++;
+				config_data->io_props.period_count = atoi(attr[i]);
 			} else {
 				ALOGE("Unknown modem attr: %s", attr[i]);
 			}
 		}
+	} else if(strcmp(elem, "bt-sco") == 0 || strcmp(elem, "hdmi") == 0) {
+		for(i=0 ; attr[i] != NULL && attr[i+1] ; i++) {
+			if(strcmp(attr[i], "card") == 0) {
+				i++;
+				config_data->io_props.card = atoi(attr[i]);
+			} else if(strcmp(attr[i], "device") == 0) {
+				i++;
+				config_data->io_props.device = atoi(attr[i]);
+			} else if(strcmp(attr[i], "rate") == 0) {
+				i++;
+				config_data->io_props.rate = atoi(attr[i]);
+			} else if(strcmp(attr[i], "period_size") == 0) {
+				i++;
+				config_data->io_props.period_size = atoi(attr[i]);
+			} else if(strcmp(attr[i], "period_count") == 0) {
+				i++;
+				config_data->io_props.period_count = atoi(attr[i]);
+			} else {
+				ALOGE("Unknown %s attr: %s", elem, attr[i]);
+			}
+		}
 	} else if(strcmp(elem, "device") == 0) {
+		memset(&config_data->device_props, 0, sizeof(config_data->device_props));
+
 		for(i=0 ; attr[i] != NULL && attr[i+1] != NULL ; i++) {
 			if(strcmp(attr[i], "type") == 0) {
 				i++;
@@ -443,16 +1120,19 @@ void tinyalsa_mixer_config_start(void *data, const XML_Char *elem,
 						ALOGE("Unknown device attr: %s", attr[i]);
 					}
 				}
+			} else if(strcmp(attr[i], "rate") == 0) {
+				i++;
+				config_data->device_props.rate = atoi(attr[i]);
 			} else {
 				ALOGE("Unknown device attr: %s", attr[i]);
 			}
+		}
 
-			if(config_data->device_props.type != 0) {
-				config_data->device = tinyalsa_mixer_device_alloc();
-				memcpy(&config_data->device->props, &config_data->device_props, sizeof(config_data->device_props));
-			} else {
-				ALOGE("Missing attrs for elem: %s", elem);
-			}
+		if(config_data->device_props.type != 0) {
+			config_data->device = tinyalsa_mixer_device_alloc();
+			memcpy(&config_data->device->props, &config_data->device_props, sizeof(config_data->device_props));
+		} else {
+			ALOGE("Missing attrs for elem: %s", elem);
 		}
 	} else if(strcmp(elem, "path") == 0) {
 		for(i=0 ; attr[i] != NULL && attr[i+1] != NULL ; i++) {
@@ -491,6 +1171,16 @@ void tinyalsa_mixer_config_start(void *data, const XML_Char *elem,
 			} else if(strcmp(attr[i], "value") == 0) {
 				i++;
 				mixer_data->value = strdup((char *) attr[i]);
+			} else if(strcmp(attr[i], "db-min") == 0) {
+				i++;
+				curve = tinyalsa_mixer_curve_get(mixer_data);
+				if(curve != NULL)
+					curve->db_min = atof(attr[i]);
+			} else if(strcmp(attr[i], "db-max") == 0) {
+				i++;
+				curve = tinyalsa_mixer_curve_get(mixer_data);
+				if(curve != NULL)
+					curve->db_max = atof(attr[i]);
 			} else {
 				ALOGE("Unknown ctrl attr: %s", attr[i]);
 			}
@@ -505,10 +1195,40 @@ void tinyalsa_mixer_config_start(void *data, const XML_Char *elem,
 			}
 
 			config_data->list = list;
+			config_data->mixer_data = mixer_data;
 		} else {
 			tinyalsa_mixer_data_free(mixer_data);
 			list_head_free(list);
 		}
+	} else if(strcmp(elem, "point") == 0) {
+		if(config_data->mixer_data == NULL) {
+			ALOGE("Missing ctrl for elem: %s", elem);
+			return;
+		}
+
+		volume = -1;
+		db = 0;
+
+		for(i=0 ; attr[i] != NULL && attr[i+1] != NULL ; i++) {
+			if(strcmp(attr[i], "volume") == 0) {
+				i++;
+				volume = atof(attr[i]);
+			} else if(strcmp(attr[i], "db") == 0) {
+				i++;
+				db = atof(attr[i]);
+			} else {
+				ALOGE("Unknown point attr: %s", attr[i]);
+			}
+		}
+
+		if(volume < 0 || volume > 1) {
+			ALOGE("Missing or invalid volume for elem: %s", elem);
+			return;
+		}
+
+		curve = tinyalsa_mixer_curve_get(config_data->mixer_data);
+		if(tinyalsa_mixer_curve_add_point(curve, volume, db) < 0)
+			ALOGE("Unable to add point to ctrl: %s", config_data->mixer_data->name);
 	}
 }
 
@@ -535,6 +1255,13 @@ void tinyalsa_mixer_config_end(void *data, const XML_Char *elem)
 		memcpy(&config_data->mixer->modem.props, &config_data->io_props, sizeof(config_data->io_props));
 		memset(&config_data->io_props, 0, sizeof(config_data->io_props));
 		config_data->direction = 0;
+	} else if(strcmp(elem, "bt-sco") == 0) {
+		memcpy(&config_data->mixer->sco_props, &config_data->io_props, sizeof(config_data->io_props));
+		memset(&config_data->io_props, 0, sizeof(config_data->io_props));
+	} else if(strcmp(elem, "hdmi") == 0) {
+		memcpy(&config_data->mixer->hdmi_props, &config_data->io_props, sizeof(config_data->io_props));
+		memset(&config_data->io_props, 0, sizeof(config_data->io_props));
+		config_data->mixer->hdmi = 1;
 	} else if(strcmp(elem, "device") == 0) {
 		// direction == 0 will fallback to out
 		if(config_data->direction == TINYALSA_MIXER_DIRECTION_OUTPUT) {
@@ -589,6 +1316,13 @@ void tinyalsa_mixer_config_end(void *data, const XML_Char *elem)
 	} else if(strcmp(elem, "path") == 0) {
 		config_data->list_start = 0;
 		config_data->list = 0;
+	} else if(strcmp(elem, "ctrl") == 0) {
+		if(config_data->mixer_data != NULL &&
+			tinyalsa_mixer_curve_compile(config_data->mixer_data) < 0)
+			ALOGE("Unable to compile volume curve for ctrl: %s",
+				config_data->mixer_data->name);
+
+		config_data->mixer_data = NULL;
 	}
 }
 
@@ -658,50 +1392,158 @@ error_file:
  * Route/Directions
  */
 
-int tinyalsa_mixer_set_route_ctrl(struct tinyalsa_mixer *mixer,
-	struct tinyalsa_mixer_data *mixer_data)
+int tinyalsa_mixer_set_ctrl(struct tinyalsa_mixer *mixer,
+	char *name, char *value_string)
+{
+	struct tinyalsa_mixer_shadow *shadow;
+	struct mixer_ctl *ctl;
+	char shadow_string[12];
+	char *string;
+	int64_t time_start = 0;
+	int value = 0;
+	int type;
+	int rc;
+	int i;
+
+	ctl = mixer_get_ctl_by_name(mixer->mixer, name);
+	if(ctl == NULL) {
+		ALOGE("Unable to find ctrl: %s", name);
+		return -1;
+	}
+
+	type = mixer_ctl_get_type(ctl);
+
+	ALOGD("Setting %s to %s", name, value_string);
+
+	switch(type) {
+		case MIXER_CTL_TYPE_BOOL:
+			// Shadow values are numeric, config values are on/off
+			value = strcmp(value_string, "on") == 0 || atoi(value_string) > 0 ?
+				1 : 0;
+			break;
+		case MIXER_CTL_TYPE_INT:
+			value = atoi(value_string);
+			break;
+		case MIXER_CTL_TYPE_BYTE:
+			value = atoi(value_string) & 0xff;
+			break;
+	}
+
+	shadow = tinyalsa_mixer_shadow_get(mixer, mixer->card, name);
+
+	if(mixer->diff && shadow != NULL && shadow->value != NULL) {
+		if(type == MIXER_CTL_TYPE_BOOL || type == MIXER_CTL_TYPE_INT ||
+			type == MIXER_CTL_TYPE_BYTE) {
+			snprintf(shadow_string, sizeof(shadow_string), "%d", value);
+			string = shadow_string;
+		} else {
+			string = value_string;
+		}
+
+		if(strcmp(shadow->value, string) == 0) {
+			ALOGD("Keeping %s to %s", name, value_string);
+			return 0;
+		}
+	}
+
+	if(mixer->journaling)
+		tinyalsa_mixer_journal_add(mixer, ctl, shadow, name);
+
+	if(mixer->trace != NULL)
+		time_start = audio_hw_time();
+
+	rc = 0;
+
+	if(type == MIXER_CTL_TYPE_BOOL || type == MIXER_CTL_TYPE_INT ||
+		type == MIXER_CTL_TYPE_BYTE) {
+		for(i=0 ; i < (int) mixer_ctl_get_num_values(ctl) ; i++) {
+			rc = mixer_ctl_set_value(ctl, i, value);
+			if(rc < 0)
+				break;
+		}
+	} else if(type == MIXER_CTL_TYPE_ENUM || type == MIXER_CTL_TYPE_UNKNOWN) {
+		rc = mixer_ctl_set_enum_by_string(ctl, value_string);
+	}
+
+	if(mixer->trace != NULL)
+		tinyalsa_mixer_trace_record(mixer, shadow, name, value_string,
+			time_start, rc);
+
+	if(rc < 0)
+		goto error_shadow;
+
+	if(type == MIXER_CTL_TYPE_BOOL || type == MIXER_CTL_TYPE_INT ||
+		type == MIXER_CTL_TYPE_BYTE) {
+		snprintf(shadow_string, sizeof(shadow_string), "%d", value);
+		tinyalsa_mixer_shadow_set(shadow, shadow_string);
+	} else if(type == MIXER_CTL_TYPE_ENUM || type == MIXER_CTL_TYPE_UNKNOWN) {
+		tinyalsa_mixer_shadow_set(shadow, value_string);
+	}
+
+	return 0;
+
+error_shadow:
+	// The control may have been partially written
+	tinyalsa_mixer_shadow_set(shadow, NULL);
+
+	return -1;
+}
+
+int tinyalsa_mixer_set_route_ctrl(struct tinyalsa_mixer *mixer,
+	struct tinyalsa_mixer_data *mixer_data)
+{
+	if(mixer_data->type != MIXER_DATA_TYPE_CTRL)
+		return -1;
+
+	return tinyalsa_mixer_set_ctrl(mixer, mixer_data->name, mixer_data->value);
+}
+
+void tinyalsa_mixer_transaction_begin(struct tinyalsa_mixer *mixer)
+{
+	tinyalsa_mixer_journal_free(mixer);
+	mixer->journaling = 1;
+}
+
+void tinyalsa_mixer_transaction_commit(struct tinyalsa_mixer *mixer)
 {
-	struct mixer_ctl *ctl;
-	int value = 0;
-	int type;
-	int rc;
-	int i;
+	mixer->journaling = 0;
+	tinyalsa_mixer_journal_free(mixer);
+}
 
-	if(mixer_data->type != MIXER_DATA_TYPE_CTRL)
-		return -1;
+int tinyalsa_mixer_transaction_rollback(struct tinyalsa_mixer *mixer)
+{
+	struct tinyalsa_mixer_journal *journal;
+	struct list_head *list;
+	int diff;
+	int rc = 0;
 
-	ctl = mixer_get_ctl_by_name(mixer->mixer, mixer_data->name);
-	type = mixer_ctl_get_type(ctl);
+	mixer->journaling = 0;
 
-	ALOGD("Setting %s to %s", mixer_data->name, mixer_data->value);
+	diff = mixer->diff;
+	mixer->diff = 0;
 
-	switch(type) {
-		case MIXER_CTL_TYPE_BOOL:
-			value = strcmp(mixer_data->value, "on") == 0 ?
-				1 : 0;
-			break;
-		case MIXER_CTL_TYPE_INT:
-			value = atoi(mixer_data->value);
-			break;
-		case MIXER_CTL_TYPE_BYTE:
-			value = atoi(mixer_data->value) & 0xff;
-			break;
-	}
+	for(list=mixer->journal ; list != NULL ; list = list->next) {
+		journal = (struct tinyalsa_mixer_journal *) list->data;
+		if(journal == NULL)
+			continue;
 
-	if(type == MIXER_CTL_TYPE_BOOL || type == MIXER_CTL_TYPE_INT ||
-		type == MIXER_CTL_TYPE_BYTE) {
-		for(i=0 ; i < mixer_ctl_get_num_values(ctl) ; i++) {
-			rc = mixer_ctl_set_value(ctl, i, value);
-			if(rc < 0)
-				return -1;
+		if(journal->value == NULL) {
+			rc = -1;
+			continue;
 		}
-	} else if(type == MIXER_CTL_TYPE_ENUM || type == MIXER_CTL_TYPE_UNKNOWN) {
-		rc = mixer_ctl_set_enum_by_string(ctl, mixer_data->value);
-		if(rc < 0)
-			return -1;
+
+		ALOGD("Rolling back %s to %s", journal->name, journal->value);
+
+		// Failed writes leave the shadow unknown
+		if(tinyalsa_mixer_set_ctrl(mixer, journal->name, journal->value) < 0)
+			rc = -1;
 	}
 
-	return 0;
+	mixer->diff = diff;
+
+	tinyalsa_mixer_journal_free(mixer);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_route_list(struct tinyalsa_mixer *mixer, struct list_head *list)
@@ -737,6 +1579,49 @@ int tinyalsa_mixer_set_route_list(struct tinyalsa_mixer *mixer, struct list_head
 	return 0;
 }
 
+/*
+ * Runs the disable controls of a device for the controls that it enables
+ * and that the next device does not, so that the next device can be applied
+ * on top without disabling the whole current device.
+ */
+int tinyalsa_mixer_set_route_removed(struct tinyalsa_mixer *mixer,
+	struct tinyalsa_mixer_device *mixer_device,
+	struct tinyalsa_mixer_device *mixer_device_next)
+{
+	struct tinyalsa_mixer_data *mixer_data;
+	struct list_head *list;
+	int rc;
+
+	if(mixer == NULL || mixer->mixer == NULL || mixer_device == NULL)
+		return -1;
+
+	for(list=mixer_device->disable ; list != NULL ; list = list->next) {
+		mixer_data = (struct tinyalsa_mixer_data *) list->data;
+		if(mixer_data == NULL || mixer_data->type != MIXER_DATA_TYPE_CTRL ||
+			mixer_data->name == NULL)
+			continue;
+
+		if(mixer_data->attr != NULL &&
+			strcmp(mixer_data->attr, "voice-volume") == 0)
+			continue;
+
+		if(tinyalsa_mixer_get_data_with_name(mixer_device->enable, mixer_data->name) == NULL)
+			continue;
+
+		if(mixer_device_next != NULL &&
+			tinyalsa_mixer_get_data_with_name(mixer_device_next->enable, mixer_data->name) != NULL)
+			continue;
+
+		rc = tinyalsa_mixer_set_route_ctrl(mixer, mixer_data);
+		if(rc < 0) {
+			ALOGE("Unable to set control!");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 int tinyalsa_mixer_set_route(struct tinyalsa_mixer *mixer,
 	struct tinyalsa_mixer_io *mixer_io, audio_devices_t device)
 {
@@ -755,6 +1640,9 @@ int tinyalsa_mixer_set_route(struct tinyalsa_mixer *mixer,
 		return -1;
 	}
 
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
+
 
 	mixer_device = tinyalsa_mixer_get_device(mixer_io, device);
 	if(mixer_device == NULL) {
@@ -766,20 +1654,27 @@ int tinyalsa_mixer_set_route(struct tinyalsa_mixer *mixer,
 	if(mixer_device == mixer_io->device_current)
 		goto exit_mixer;
 
+	// Shadows are exact within a transaction, so unchanged ctrls are skipped
+	tinyalsa_mixer_transaction_begin(mixer);
+	mixer->diff = 1;
+
 	if(mixer_io->device_current != NULL) {
 		rc = tinyalsa_mixer_set_route_list(mixer, mixer_io->device_current->disable);
 		if(rc < 0) {
 			ALOGE("Unable to disable current device controls");
-			goto error_mixer;
+			goto error_transaction;
 		}
 	}
 
 	rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->enable);
 	if(rc < 0) {
 		ALOGE("Unable to enable device controls");
-		goto error_mixer;
+		goto error_transaction;
 	}
 
+	mixer->diff = 0;
+	tinyalsa_mixer_transaction_commit(mixer);
+
 	mixer_io->device_current = mixer_device;
 
 exit_mixer:
@@ -790,6 +1685,15 @@ exit_mixer:
 
 	return 0;
 
+error_transaction:
+	mixer->diff = 0;
+
+	rc = tinyalsa_mixer_transaction_rollback(mixer);
+	if(rc < 0) {
+		ALOGE("Unable to roll back route, current device is unknown");
+		mixer_io->device_current = NULL;
+	}
+
 error_mixer:
 	mixer_close(mixer->mixer);
 	mixer->mixer = NULL;
@@ -806,9 +1710,9 @@ int tinyalsa_mixer_set_device_volume_with_attr(struct tinyalsa_mixer *mixer,
 	struct tinyalsa_mixer_io *mixer_io = NULL;
 	struct tinyalsa_mixer_device *mixer_device = NULL;
 	struct tinyalsa_mixer_data *mixer_data = NULL;
+	struct tinyalsa_mixer_shadow *shadow = NULL;
 	struct list_head *list = NULL;
-	int value, value_min, value_max, values_count;
-	char *value_string = NULL;
+	char value_string[12];
 	int rc;
 
 	if(mixer == NULL || attr == NULL)
@@ -836,16 +1740,10 @@ int tinyalsa_mixer_set_device_volume_with_attr(struct tinyalsa_mixer *mixer,
 		return -1;
 	}
 
-	mixer->mixer = mixer_open(mixer_io->props.card);
-	if(mixer->mixer == NULL) {
-		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
-		return -1;
-	}
-
 	mixer_device = tinyalsa_mixer_get_device(mixer_io, device);
 	if(mixer_device == NULL) {
 		ALOGE("Unable to find a matching device: 0x%x", device);
-		goto error_mixer;
+		return -1;
 	}
 
 	list = mixer_device->enable;
@@ -853,35 +1751,40 @@ int tinyalsa_mixer_set_device_volume_with_attr(struct tinyalsa_mixer *mixer,
 	mixer_data = tinyalsa_mixer_get_data_with_attr(list, attr);
 	if(mixer_data == NULL) {
 		ALOGE("Unable to find a matching ctrl with attr: %s", attr);
-		goto error_mixer;
+		return -1;
 	}
 
-	if(mixer_data->value == NULL) {
-		ALOGE("Missing mixer data value!");
-		goto error_mixer;
+	if(mixer_data->curve == NULL) {
+		ALOGE("Missing volume curve for ctrl: %s", mixer_data->name);
+		return -1;
 	}
 
-	values_count = sscanf(mixer_data->value, "%d-%d", &value_min, &value_max);
-	if(values_count != 2) {
-		ALOGE("Failed to get mixer data value!");
-		goto error_mixer;
+	snprintf(value_string, sizeof(value_string), "%d",
+		tinyalsa_mixer_curve_value(mixer_data->curve, volume));
+
+	// Volume updates often map to the register value already set
+	shadow = tinyalsa_mixer_shadow_get(mixer, mixer_io->props.card, mixer_data->name);
+	if(shadow != NULL && shadow->value != NULL &&
+		strcmp(shadow->value, value_string) == 0) {
+		ALOGD("%s(direction=%d, device=%d, attr=%s, volume=%f)-- (UNCHANGED)",__func__,direction,device,attr,volume);
+		return 0;
 	}
 
-	value = (value_max - value_min) * volume + value_min;
+	mixer->mixer = mixer_open(mixer_io->props.card);
+	if(mixer->mixer == NULL) {
+		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
+		return -1;
+	}
 
-	// Ugly workaround because a string value is needed
-	value_string = mixer_data->value;
-	asprintf(&mixer_data->value, "%d", value);
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
 
-	rc = tinyalsa_mixer_set_route_ctrl(mixer, mixer_data);
+	rc = tinyalsa_mixer_set_ctrl(mixer, mixer_data->name, value_string);
 	if(rc < 0) {
 		ALOGE("Unable to set ctrl!");
-		goto error_data;
+		goto error_mixer;
 	}
 
-	free(mixer_data->value);
-	mixer_data->value = value_string;
-
 	mixer_close(mixer->mixer);
 	mixer->mixer = NULL;
 
@@ -889,12 +1792,6 @@ int tinyalsa_mixer_set_device_volume_with_attr(struct tinyalsa_mixer *mixer,
 
 	return 0;
 
-error_data:
-	free(mixer_data->value);
-	mixer_data->value = value_string;
-
-	ALOGD("%s(direction=%d, device=%d, attr=%s, volume=%f)-- (DATA ERROR)",__func__,direction,device,attr,volume);
-
 error_mixer:
 	mixer_close(mixer->mixer);
 	mixer->mixer = NULL;
@@ -947,6 +1844,9 @@ int tinyalsa_mixer_set_device_state_with_attr(struct tinyalsa_mixer *mixer,
 		return -1;
 	}
 
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
+
 	mixer_device = tinyalsa_mixer_get_device(mixer_io, device);
 	if(mixer_device == NULL) {
 		ALOGE("Unable to find a matching device: 0x%x", device);
@@ -981,127 +1881,528 @@ error_mixer:
 	mixer_close(mixer->mixer);
 	mixer->mixer = NULL;
 
-	ALOGD("%s(direction=%d, device=%d, attr=%s, state=%d)-- (MIXER ERROR)",__func__,direction,device,attr,state);
+	ALOGD("%s(direction=%d, device=%d, attr=%s, state=%d)-- (MIXER ERROR)",__func__,direction,device,attr,state);
+
+	return -1;
+}
+
+int tinyalsa_mixer_set_state(struct tinyalsa_mixer *mixer,
+	enum tinyalsa_mixer_direction direction, int state)
+{
+	struct tinyalsa_mixer_io *mixer_io = NULL;
+	struct tinyalsa_mixer_device *mixer_device = NULL;
+	struct list_head *list;
+	audio_devices_t default_device;
+	int rc;
+
+	if(mixer == NULL)
+		return -1;
+
+	state = state >= 1 ? 1 : 0;
+
+	ALOGD("%s(direction=%d, state=%d)++",__func__,direction,state);
+
+	switch(direction) {
+		case TINYALSA_MIXER_DIRECTION_OUTPUT:
+			mixer_io = &mixer->output;
+			default_device = AUDIO_DEVICE_OUT_DEFAULT;
+			break;
+		case TINYALSA_MIXER_DIRECTION_INPUT:
+			mixer_io = &mixer->input;
+			default_device = AUDIO_DEVICE_IN_DEFAULT;
+			break;
+		case TINYALSA_MIXER_DIRECTION_MODEM:
+			mixer_io = &mixer->modem;
+			default_device = AUDIO_DEVICE_OUT_DEFAULT;
+			break;
+		default:
+			ALOGE("Invalid diretion: 0x%x", direction);
+			return -1;
+	}
+
+	if(mixer_io->state == state) {
+		ALOGD("Current state is already: %d", state);
+		return 0;
+	}
+
+	mixer->mixer = mixer_open(mixer_io->props.card);
+	if(mixer->mixer == NULL) {
+		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
+		return -1;
+	}
+
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
+
+	tinyalsa_mixer_transaction_begin(mixer);
+
+	if(!state && mixer_io->device_current != NULL &&
+		mixer_io->device_current->disable != NULL) {
+		rc = tinyalsa_mixer_set_route_list(mixer, mixer_io->device_current->disable);
+		if(rc < 0) {
+			ALOGE("Unable to disable current device controls");
+			goto error_transaction;
+		}
+	}
+
+	mixer_device = tinyalsa_mixer_get_device(mixer_io, default_device);
+	if(mixer_device == NULL) {
+		ALOGD("Unable to find default device");
+		// This is not really an issue
+	}
+
+	if(state && mixer_device != NULL && mixer_device->enable != NULL) {
+		rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->enable);
+		if(rc < 0) {
+			ALOGE("Unable to enable default device controls");
+			goto error_transaction;
+		}
+	} else if(!state && mixer_device != NULL) {
+		rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->disable);
+		if(rc < 0) {
+			ALOGE("Unable to disable default device controls");
+			goto error_transaction;
+		}
+	}
+
+	tinyalsa_mixer_transaction_commit(mixer);
+
+	mixer_io->device_current = NULL;
+	mixer_io->state = state;
+
+	mixer_close(mixer->mixer);
+	mixer->mixer = NULL;
+
+	ALOGD("%s(direction=%d, state=%d)--",__func__,direction,state);
+
+	return 0;
+
+error_transaction:
+	rc = tinyalsa_mixer_transaction_rollback(mixer);
+	if(rc < 0) {
+		ALOGE("Unable to roll back state, current device is unknown");
+		mixer_io->device_current = NULL;
+	}
+
+error_mixer:
+	mixer_close(mixer->mixer);
+	mixer->mixer = NULL;
+
+	ALOGD("%s(direction=%d, state=%d)-- (MIXER ERROR)",__func__,direction,state);
+
+	return -1;
+}
+
+/*
+ * Reload
+ */
+
+int tinyalsa_mixer_io_reload(struct tinyalsa_mixer *mixer,
+	struct tinyalsa_mixer_io *mixer_io, struct tinyalsa_mixer_io *mixer_io_new,
+	audio_devices_t default_device)
+{
+	struct tinyalsa_mixer_device *mixer_device_current;
+	struct tinyalsa_mixer_device *mixer_device = NULL;
+	struct list_head *devices;
+	int rc;
+
+	// The current device is freed with the old devices, out of the lock
+	mixer_device_current = mixer_io->device_current;
+
+	if(mixer_io->device_current != NULL) {
+		mixer_device = tinyalsa_mixer_get_device_rate(mixer_io_new,
+			mixer_io->device_current->props.type, mixer_io->props.rate);
+		if(mixer_device == NULL)
+			ALOGE("Current device is missing from new config: 0x%x",
+				mixer_io->device_current->props.type);
+	}
+
+	// Old devices are handed back so that they are freed out of the lock
+	devices = mixer_io->devices;
+	mixer_io->devices = mixer_io_new->devices;
+	mixer_io_new->devices = devices;
+	mixer_io->device_current = mixer_device;
+
+	if(!mixer_io->state)
+		return 0;
+
+	// The default route is recorded as current, so that it is disabled on
+	// the next route change
+	if(mixer_device == NULL) {
+		mixer_device = tinyalsa_mixer_get_device(mixer_io, default_device);
+		mixer_io->device_current = mixer_device;
+	}
+
+	if(mixer_device == NULL && mixer_device_current == NULL)
+		return 0;
+
+	mixer->mixer = mixer_open(mixer_io->props.card);
+	if(mixer->mixer == NULL) {
+		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
+		return -1;
+	}
+
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
+
+	// Only controls that differ from the shadow are written, controls
+	// dropped from the current device by the new config are disabled
+	mixer->diff = 1;
+
+	rc = 0;
+	if(mixer_device_current != NULL)
+		rc = tinyalsa_mixer_set_route_removed(mixer, mixer_device_current,
+			mixer_device);
+
+	if(rc >= 0 && mixer_device != NULL)
+		rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->enable);
+
+	mixer->diff = 0;
+
+	mixer_close(mixer->mixer);
+	mixer->mixer = NULL;
+
+	if(rc < 0) {
+		ALOGE("Unable to re-apply device controls: 0x%x",
+			mixer_io->device_current != NULL ? mixer_io->device_current->props.type : 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+int tinyalsa_mixer_reload(struct tinyalsa_mixer *mixer)
+{
+	struct tinyalsa_mixer *mixer_new;
+	int rc;
+
+	ALOGD("%s(%p)", __func__, mixer);
+
+	if(mixer == NULL || mixer->config_file == NULL)
+		return -1;
+
+	mixer_new = calloc(1, sizeof(struct tinyalsa_mixer));
+	if(mixer_new == NULL)
+		return -1;
+
+	// The new database is built without holding the lock
+	rc = tinyalsa_mixer_config_parse(mixer_new, mixer->config_file);
+	if(rc < 0 || mixer_new->output.devices == NULL) {
+		ALOGE("Unable to parse mixer config, keeping the current one");
+		goto error_mixer;
+	}
+
+	pthread_mutex_lock(&mixer->lock);
+
+	tinyalsa_mixer_io_reload(mixer, &mixer->output, &mixer_new->output,
+		AUDIO_DEVICE_OUT_DEFAULT);
+	tinyalsa_mixer_io_reload(mixer, &mixer->input, &mixer_new->input,
+		AUDIO_DEVICE_IN_DEFAULT);
+	tinyalsa_mixer_io_reload(mixer, &mixer->modem, &mixer_new->modem,
+		AUDIO_DEVICE_OUT_DEFAULT);
+
+	pthread_mutex_unlock(&mixer->lock);
+
+	ALOGD("Reloaded mixer config: %s", mixer->config_file);
+
+	// I/O props are kept since streams may be using them
+	tinyalsa_mixer_io_free_devices(&mixer_new->output);
+	tinyalsa_mixer_io_free_devices(&mixer_new->input);
+	tinyalsa_mixer_io_free_devices(&mixer_new->modem);
+
+	free(mixer_new);
+
+	return 0;
+
+error_mixer:
+	tinyalsa_mixer_io_free_devices(&mixer_new->output);
+	tinyalsa_mixer_io_free_devices(&mixer_new->input);
+	tinyalsa_mixer_io_free_devices(&mixer_new->modem);
+
+	free(mixer_new);
 
 	return -1;
 }
 
-int tinyalsa_mixer_set_state(struct tinyalsa_mixer *mixer,
-	enum tinyalsa_mixer_direction direction, int state)
+void *tinyalsa_mixer_reload_thread(void *data)
 {
-	struct tinyalsa_mixer_io *mixer_io = NULL;
-	struct tinyalsa_mixer_device *mixer_device = NULL;
-	struct list_head *list;
-	audio_devices_t default_device;
+	struct tinyalsa_mixer *mixer;
+	struct inotify_event *event;
+	struct pollfd fds[2];
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char *name;
+	int length;
+	int offset;
+	int reload;
 	int rc;
 
-	if(mixer == NULL)
-		return -1;
+	mixer = (struct tinyalsa_mixer *) data;
 
-	state = state >= 1 ? 1 : 0;
+	name = strrchr(mixer->config_file, '/');
+	name = name != NULL ? name + 1 : mixer->config_file;
 
-	ALOGD("%s(direction=%d, state=%d)++",__func__,direction,state);
+	while(mixer->reload_running) {
+		fds[0].fd = mixer->reload_fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = mixer->reload_pipe[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
 
-	switch(direction) {
-		case TINYALSA_MIXER_DIRECTION_OUTPUT:
-			mixer_io = &mixer->output;
-			default_device = AUDIO_DEVICE_OUT_DEFAULT;
-			break;
-		case TINYALSA_MIXER_DIRECTION_INPUT:
-			mixer_io = &mixer->input;
-			default_device = AUDIO_DEVICE_IN_DEFAULT;
+		rc = poll(fds, 2, -1);
+		if(rc < 0) {
+			if(errno == EINTR)
+				continue;
+
+			ALOGE("Unable to poll mixer config watch");
 			break;
-		case TINYALSA_MIXER_DIRECTION_MODEM:
-			mixer_io = &mixer->modem;
-			default_device = AUDIO_DEVICE_OUT_DEFAULT;
+		}
+
+		if(fds[1].revents != 0)
 			break;
-		default:
-			ALOGE("Invalid diretion: 0x%x", direction);
-			return -1;
-	}
 
-	if(mixer_io->state == state) {
-		ALOGD("Current state is already: %d", state);
-		return 0;
+		if(!(fds[0].revents & POLLIN))
+			continue;
+
+		length = read(mixer->reload_fd, buffer, sizeof(buffer));
+		if(length <= 0)
+			continue;
+
+		reload = 0;
+
+		for(offset=0 ; offset + (int) sizeof(struct inotify_event) <= length ;
+			offset += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *) (buffer + offset);
+			if(event->len > 0 && strcmp(event->name, name) == 0)
+				reload = 1;
+		}
+
+		if(reload)
+			tinyalsa_mixer_reload(mixer);
 	}
 
-	mixer->mixer = mixer_open(mixer_io->props.card);
-	if(mixer->mixer == NULL) {
-		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
+	return NULL;
+}
+
+int tinyalsa_mixer_reload_start(struct tinyalsa_mixer *mixer)
+{
+	char *path;
+	char *p;
+	int rc;
+
+	path = strdup(mixer->config_file);
+	if(path == NULL)
 		return -1;
+
+	p = strrchr(path, '/');
+	if(p == NULL) {
+		ALOGE("Unable to find mixer config dir: %s", mixer->config_file);
+		goto error_path;
 	}
 
-	if(!state && mixer_io->device_current != NULL &&
-		mixer_io->device_current->disable != NULL) {
-		rc = tinyalsa_mixer_set_route_list(mixer, mixer_io->device_current->disable);
-		if(rc < 0) {
-			ALOGE("Unable to disable current device controls");
-			goto error_mixer;
-		}
+	if(p == path)
+		p[1] = '\0';
+	else
+		*p = '\0';
+
+	mixer->reload_fd = inotify_init();
+	if(mixer->reload_fd < 0) {
+		ALOGE("Unable to init inotify");
+		goto error_path;
 	}
 
-	mixer_device = tinyalsa_mixer_get_device(mixer_io, default_device);
-	if(mixer_device == NULL) {
-		ALOGD("Unable to find default device");
-		// This is not really an issue
+	// Editors and adb push either rewrite or rename the file
+	rc = inotify_add_watch(mixer->reload_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if(rc < 0) {
+		ALOGE("Unable to watch mixer config dir: %s", path);
+		goto error_inotify;
 	}
 
-	if(state && mixer_device != NULL && mixer_device->enable != NULL) {
-		rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->enable);
-		if(rc < 0) {
-			ALOGE("Unable to enable default device controls");
-			goto error_mixer;
-		}
-	} else if(!state && mixer_device != NULL) {
-		rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->disable);
-		if(rc < 0) {
-			ALOGE("Unable to disable default device controls");
-			goto error_mixer;
-		}
+	rc = pipe(mixer->reload_pipe);
+	if(rc < 0) {
+		ALOGE("Unable to create reload pipe");
+		goto error_inotify;
 	}
 
-	mixer_io->device_current = NULL;
-	mixer_io->state = state;
+	mixer->reload_running = 1;
 
-	mixer_close(mixer->mixer);
-	mixer->mixer = NULL;
+	rc = pthread_create(&mixer->reload_thread, NULL, tinyalsa_mixer_reload_thread, mixer);
+	if(rc != 0) {
+		ALOGE("Unable to create reload thread");
+		goto error_pipe;
+	}
 
-	ALOGD("%s(direction=%d, state=%d)--",__func__,direction,state);
+	free(path);
 
 	return 0;
 
-error_mixer:
-	mixer_close(mixer->mixer);
-	mixer->mixer = NULL;
+error_pipe:
+	mixer->reload_running = 0;
 
-	ALOGD("%s(direction=%d, state=%d)-- (MIXER ERROR)",__func__,direction,state);
+	close(mixer->reload_pipe[0]);
+	close(mixer->reload_pipe[1]);
+
+error_inotify:
+	close(mixer->reload_fd);
+	mixer->reload_fd = -1;
+
+error_path:
+	free(path);
 
 	return -1;
 }
 
+void tinyalsa_mixer_reload_stop(struct tinyalsa_mixer *mixer)
+{
+	if(!mixer->reload_running)
+		return;
+
+	mixer->reload_running = 0;
+	write(mixer->reload_pipe[1], "", 1);
+
+	pthread_join(mixer->reload_thread, NULL);
+
+	close(mixer->reload_pipe[0]);
+	close(mixer->reload_pipe[1]);
+	close(mixer->reload_fd);
+	mixer->reload_fd = -1;
+}
+
 /*
  * Interface
  */
 
 int tinyalsa_mixer_set_output_state(struct tinyalsa_mixer *mixer, int state)
 {
+	int rc;
+
 	ALOGD("%s(%d)", __func__, state);
 
-	return tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_OUTPUT, state);
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_OUTPUT, state);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_input_state(struct tinyalsa_mixer *mixer, int state)
 {
+	int rc;
+
 	ALOGD("%s(%d)", __func__, state);
 
-	return tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_INPUT, state);
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_INPUT, state);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_modem_state(struct tinyalsa_mixer *mixer, int state)
 {
+	int rc;
+
 	ALOGD("%s(%d)", __func__, state);
 
-	return tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_MODEM, state);
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_state(mixer, TINYALSA_MIXER_DIRECTION_MODEM, state);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
+}
+
+/*
+ * Switching the modem rate keeps the call path up: the current device is
+ * not disabled, only the controls that the device for the new rate no longer
+ * enables are disabled and the controls that differ from the shadows are
+ * written.
+ */
+int tinyalsa_mixer_set_modem_rate(struct tinyalsa_mixer *mixer, int rate)
+{
+	struct tinyalsa_mixer_device *mixer_device = NULL;
+	struct tinyalsa_mixer_io *mixer_io;
+	int rc;
+
+	ALOGD("%s(%d)", __func__, rate);
+
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+
+	mixer_io = &mixer->modem;
+	mixer_io->props.rate = rate;
+
+	if(!mixer_io->state || mixer_io->device_current == NULL)
+		goto complete;
+
+	mixer_device = tinyalsa_mixer_get_device(mixer_io, mixer_io->device_current->props.type);
+	if(mixer_device == NULL || mixer_device == mixer_io->device_current)
+		goto complete;
+
+	mixer->mixer = mixer_open(mixer_io->props.card);
+	if(mixer->mixer == NULL) {
+		ALOGE("Unable to open mixer for card: %d", mixer_io->props.card);
+		goto error_lock;
+	}
+
+	mixer->card = mixer_io->props.card;
+	mixer->transition++;
+
+	tinyalsa_mixer_transaction_begin(mixer);
+	mixer->diff = 1;
+
+	rc = tinyalsa_mixer_set_route_removed(mixer, mixer_io->device_current,
+		mixer_device);
+	if(rc < 0) {
+		ALOGE("Unable to disable device controls for rate: %d", rate);
+		goto error_transaction;
+	}
+
+	rc = tinyalsa_mixer_set_route_list(mixer, mixer_device->enable);
+	if(rc < 0) {
+		ALOGE("Unable to enable device controls for rate: %d", rate);
+		goto error_transaction;
+	}
+
+	mixer->diff = 0;
+	tinyalsa_mixer_transaction_commit(mixer);
+
+	mixer_io->device_current = mixer_device;
+
+	mixer_close(mixer->mixer);
+	mixer->mixer = NULL;
+
+complete:
+	pthread_mutex_unlock(&mixer->lock);
+
+	return 0;
+
+error_transaction:
+	mixer->diff = 0;
+
+	rc = tinyalsa_mixer_transaction_rollback(mixer);
+	if(rc < 0) {
+		ALOGE("Unable to roll back route, current device is unknown");
+		mixer_io->device_current = NULL;
+	}
+
+	mixer_close(mixer->mixer);
+	mixer->mixer = NULL;
+
+error_lock:
+	pthread_mutex_unlock(&mixer->lock);
+
+	return -1;
 }
 
 int tinyalsa_mixer_set_device(struct tinyalsa_mixer *mixer, audio_devices_t device)
@@ -1113,95 +2414,213 @@ int tinyalsa_mixer_set_device(struct tinyalsa_mixer *mixer, audio_devices_t devi
 	if(mixer == NULL)
 		return -1;
 
-	if(!audio_is_output_device(device) && !audio_is_input_device(device)) {
+	if(!tinyalsa_mixer_is_output_device(device) && !tinyalsa_mixer_is_input_device(device)) {
 		ALOGE("Invalid device: 0x%x", device);
 		return -1;
 	}
 
+	pthread_mutex_lock(&mixer->lock);
 
-	if(audio_is_output_device(device) && mixer->output.state) {
+	if(tinyalsa_mixer_is_output_device(device) && mixer->output.state) {
 		rc = tinyalsa_mixer_set_route(mixer, &mixer->output, device);
 		if(rc < 0) {
 			ALOGE("Unable to set route for output device: 0x%x", device);
-			return -1;
+			goto error_lock;
 		}
 	}
 
-	if(audio_is_input_device(device) && mixer->input.state) {
+	if(tinyalsa_mixer_is_input_device(device) && mixer->input.state) {
 		rc = tinyalsa_mixer_set_route(mixer, &mixer->input, device);
 		if(rc < 0) {
 			ALOGE("Unable to set route for input device: 0x%x", device);
-			return -1;
+			goto error_lock;
 		}
 	}
 
-	if(audio_is_output_device(device) && mixer->modem.state) {
+	if(tinyalsa_mixer_is_output_device(device) && mixer->modem.state) {
 		rc = tinyalsa_mixer_set_route(mixer, &mixer->modem, device);
 		if(rc < 0) {
 			ALOGE("Unable to set route for modem device: 0x%x", device);
-			return -1;
+			goto error_lock;
 		}
 	}
 
+	pthread_mutex_unlock(&mixer->lock);
+
 	return 0;
+
+error_lock:
+	pthread_mutex_unlock(&mixer->lock);
+
+	return -1;
 }
 
 int tinyalsa_mixer_set_output_volume(struct tinyalsa_mixer *mixer,
 	audio_devices_t device, float volume)
 {
+	int rc;
+
 	ALOGD("%s(%p, %x, %f)", __func__, mixer, device, volume);
 
-	return tinyalsa_mixer_set_device_volume_with_attr(mixer,
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_device_volume_with_attr(mixer,
 		TINYALSA_MIXER_DIRECTION_OUTPUT, device,
 		"output-volume", volume);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_master_volume(struct tinyalsa_mixer *mixer, float volume)
 {
+	int rc;
+
 	ALOGD("%s(%p, %f)", __func__, mixer, volume);
 
-	return tinyalsa_mixer_set_device_volume_with_attr(mixer,
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_device_volume_with_attr(mixer,
 		TINYALSA_MIXER_DIRECTION_OUTPUT, AUDIO_DEVICE_OUT_DEFAULT, 
 		"master-volume", volume);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_mic_mute(struct tinyalsa_mixer *mixer,
 	audio_devices_t device, int mute)
 {
+	int rc;
+
 	ALOGD("%s(%p, %x, %d)", __func__, mixer, device, mute);
 
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+
 	// Mic mute can be set for both input and modem directions
-	if(audio_is_input_device(device)) {
-		return tinyalsa_mixer_set_device_state_with_attr(mixer,
+	if(tinyalsa_mixer_is_input_device(device)) {
+		rc = tinyalsa_mixer_set_device_state_with_attr(mixer,
 			TINYALSA_MIXER_DIRECTION_INPUT, device,
 			"mic-mute", mute);
-	} else if(audio_is_output_device(device)) {
-		return tinyalsa_mixer_set_device_state_with_attr(mixer,
+	} else if(tinyalsa_mixer_is_output_device(device)) {
+		rc = tinyalsa_mixer_set_device_state_with_attr(mixer,
 			TINYALSA_MIXER_DIRECTION_MODEM, device,
 			"mic-mute", mute);
 	} else {
-		return -1;
+		rc = -1;
 	}
+
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_input_gain(struct tinyalsa_mixer *mixer,
 	audio_devices_t device, float gain)
 {
+	int rc;
+
 	ALOGD("%s(%p, %x, %f)", __func__, mixer, device, gain);
 
-	return tinyalsa_mixer_set_device_volume_with_attr(mixer,
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_device_volume_with_attr(mixer,
 		TINYALSA_MIXER_DIRECTION_INPUT, device,
 		"input-gain", gain);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
 }
 
 int tinyalsa_mixer_set_voice_volume(struct tinyalsa_mixer *mixer,
 	audio_devices_t device, float volume)
 {
+	int rc;
+
 	ALOGD("%s(%p, %x, %f)", __func__, mixer, device, volume);
 
-	return tinyalsa_mixer_set_device_volume_with_attr(mixer,
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+	rc = tinyalsa_mixer_set_device_volume_with_attr(mixer,
 		TINYALSA_MIXER_DIRECTION_MODEM, device,
 		"voice-volume", volume);
+	pthread_mutex_unlock(&mixer->lock);
+
+	return rc;
+}
+
+int tinyalsa_mixer_dump(struct tinyalsa_mixer *mixer, int fd)
+{
+	struct tinyalsa_mixer_trace_entry *entry;
+	struct tinyalsa_mixer_shadow *shadow;
+	struct list_head *list;
+	unsigned int index;
+	unsigned int count;
+	unsigned int i;
+
+	ALOGD("%s(%p, %d)", __func__, mixer, fd);
+
+	if(mixer == NULL)
+		return -1;
+
+	pthread_mutex_lock(&mixer->lock);
+
+	if(mixer->trace == NULL) {
+		tinyalsa_mixer_trace_printf(fd, "Mixer trace is disabled, set %s to 1\n",
+			TINYALSA_MIXER_TRACE_PROPERTY);
+		goto complete;
+	}
+
+	tinyalsa_mixer_trace_printf(fd, "Mixer ctrl latency histograms (log2 us buckets):\n");
+
+	for(list=mixer->shadows ; list != NULL ; list = list->next) {
+		shadow = (struct tinyalsa_mixer_shadow *) list->data;
+
+		for(count=0, i=0 ; i < TINYALSA_MIXER_HISTOGRAM_SIZE ; i++)
+			count += shadow->histogram[i];
+
+		if(count == 0)
+			continue;
+
+		tinyalsa_mixer_trace_printf(fd, "  [%d] %s: %u writes, max %d us:",
+			shadow->card, shadow->name, count, shadow->duration_max);
+		for(i=0 ; i < TINYALSA_MIXER_HISTOGRAM_SIZE ; i++)
+			tinyalsa_mixer_trace_printf(fd, " %u", shadow->histogram[i]);
+		tinyalsa_mixer_trace_printf(fd, "\n");
+	}
+
+	tinyalsa_mixer_trace_printf(fd, "Mixer ctrl writes (%u):\n", mixer->trace->count);
+
+	index = (mixer->trace->index + TINYALSA_MIXER_TRACE_SIZE - mixer->trace->count) %
+		TINYALSA_MIXER_TRACE_SIZE;
+
+	for(i=0 ; i < mixer->trace->count ; i++) {
+		entry = &mixer->trace->entries[index];
+		index = (index + 1) % TINYALSA_MIXER_TRACE_SIZE;
+
+		tinyalsa_mixer_trace_printf(fd, "  %lld #%u [%d] %s = %s: %d us%s\n",
+			(long long) entry->timestamp, entry->transition, entry->card,
+			entry->name, entry->value, entry->duration,
+			entry->rc < 0 ? " (failed)" : "");
+	}
+
+	tinyalsa_mixer_trace_dump_file(mixer, TINYALSA_MIXER_TRACE_FILE);
+
+complete:
+	pthread_mutex_unlock(&mixer->lock);
+
+	return 0;
 }
 
 struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_output_props(struct tinyalsa_mixer *mixer)
@@ -1225,6 +2644,26 @@ struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_modem_props(struct tinyalsa_m
 	return &(mixer->modem.props);
 }
 
+struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_sco_props(struct tinyalsa_mixer *mixer)
+{
+	ALOGD("%s(%p)", __func__, mixer);
+
+	return &(mixer->sco_props);
+}
+
+/*
+ * Returns NULL when there is no HDMI pcm in the config.
+ */
+struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_hdmi_props(struct tinyalsa_mixer *mixer)
+{
+	ALOGD("%s(%p)", __func__, mixer);
+
+	if(!mixer->hdmi)
+		return NULL;
+
+	return &(mixer->hdmi_props);
+}
+
 void tinyalsa_mixer_close(struct tinyalsa_mixer *mixer)
 {
 	ALOGD("%s(%p)", __func__, mixer);
@@ -1232,6 +2671,8 @@ void tinyalsa_mixer_close(struct tinyalsa_mixer *mixer)
 	if(mixer == NULL)
 		return;
 
+	tinyalsa_mixer_reload_stop(mixer);
+
 	tinyalsa_mixer_set_output_state(mixer, 0);
 	tinyalsa_mixer_set_input_state(mixer, 0);
 	tinyalsa_mixer_set_modem_state(mixer, 0);
@@ -1240,12 +2681,23 @@ void tinyalsa_mixer_close(struct tinyalsa_mixer *mixer)
 	tinyalsa_mixer_io_free_devices(&mixer->input);
 	tinyalsa_mixer_io_free_devices(&mixer->modem);
 
+	tinyalsa_mixer_shadows_free(mixer);
+
+	pthread_mutex_destroy(&mixer->lock);
+
+	if(mixer->config_file != NULL)
+		free(mixer->config_file);
+
+	if(mixer->trace != NULL)
+		free(mixer->trace);
+
 	free(mixer);
 }
 
 int tinyalsa_mixer_open(struct tinyalsa_mixer **mixer_p, char *config_file)
 {
 	struct tinyalsa_mixer *mixer = NULL;
+	char property[PROPERTY_VALUE_MAX];
 	int rc;
 
 	ALOGD("%s(%p, %s)", __func__, mixer_p, config_file);
@@ -1254,6 +2706,15 @@ int tinyalsa_mixer_open(struct tinyalsa_mixer **mixer_p, char *config_file)
 		return -1;
 
 	mixer = calloc(1, sizeof(struct tinyalsa_mixer));
+	if(mixer == NULL)
+		return -1;
+
+	mixer->reload_fd = -1;
+	pthread_mutex_init(&mixer->lock, NULL);
+
+	mixer->config_file = strdup(config_file);
+	if(mixer->config_file == NULL)
+		goto error_mixer;
 
 	rc = tinyalsa_mixer_config_parse(mixer, config_file);
 	if(rc < 0) {
@@ -1261,6 +2722,18 @@ int tinyalsa_mixer_open(struct tinyalsa_mixer **mixer_p, char *config_file)
 		goto error_mixer;
 	}
 
+	rc = tinyalsa_mixer_reload_start(mixer);
+	if(rc < 0)
+		ALOGE("Unable to watch mixer config, live reload is disabled");
+
+	property_get(TINYALSA_MIXER_TRACE_PROPERTY, property, "0");
+	if(atoi(property) > 0) {
+		mixer->trace = (struct tinyalsa_mixer_trace *)
+			calloc(1, sizeof(struct tinyalsa_mixer_trace));
+		if(mixer->trace == NULL)
+			ALOGE("Unable to allocate mixer trace");
+	}
+
 	*mixer_p = mixer;
 
 	return 0;
@@ -1268,6 +2741,15 @@ int tinyalsa_mixer_open(struct tinyalsa_mixer **mixer_p, char *config_file)
 error_mixer:
 	*mixer_p = NULL;
 
+	tinyalsa_mixer_io_free_devices(&mixer->output);
+	tinyalsa_mixer_io_free_devices(&mixer->input);
+	tinyalsa_mixer_io_free_devices(&mixer->modem);
+
+	pthread_mutex_destroy(&mixer->lock);
+
+	if(mixer->config_file != NULL)
+		free(mixer->config_file);
+
 	free(mixer);
 
 	return -1;
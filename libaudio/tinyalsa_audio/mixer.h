@@ -18,6 +18,9 @@
 #ifndef TINYALSA_AUDIO_MIXER_H
 #define TINYALSA_AUDIO_MIXER_H
 
+#include <pthread.h>
+#include <stdint.h>
+
 #include <tinyalsa/asoundlib.h>
 
 #include <hardware/audio.h>
@@ -38,15 +41,111 @@ enum tinyalsa_mixer_data_type {
 	MIXER_DATA_TYPE_MAX
 };
 
+#define TINYALSA_MIXER_CURVE_POINTS_MAX	16
+#define TINYALSA_MIXER_CURVE_LUT_SIZE	256
+
+struct tinyalsa_mixer_curve_point {
+	float volume;
+	float db;
+};
+
+/*
+ * Volume curves map a [0, 1] volume to a register value. Breakpoints are
+ * given in dB and the register is assumed to be linear in dB between
+ * db_min and db_max. The curve is compiled into a LUT at load time.
+ */
+struct tinyalsa_mixer_curve {
+	int value_min;
+	int value_max;
+
+	float db_min;
+	float db_max;
+
+	struct tinyalsa_mixer_curve_point points[TINYALSA_MIXER_CURVE_POINTS_MAX];
+	int points_count;
+
+	int lut[TINYALSA_MIXER_CURVE_LUT_SIZE];
+};
+
+#define TINYALSA_MIXER_HISTOGRAM_SIZE	16
+
+/*
+ * Last value written to a control, value is NULL when unknown.
+ */
+struct tinyalsa_mixer_shadow {
+	int card;
+	char *name;
+	char *value;
+
+	unsigned int histogram[TINYALSA_MIXER_HISTOGRAM_SIZE];
+	int duration_max;
+};
+
+/*
+ * Previous value of a control written during a transaction.
+ */
+struct tinyalsa_mixer_journal {
+	char *name;
+	char *value;
+};
+
+#define TINYALSA_MIXER_TRACE_PROPERTY	"persist.audio.mixer.trace"
+#define TINYALSA_MIXER_TRACE_FILE	"/data/misc/audio/mixer-trace.bin"
+#define TINYALSA_MIXER_TRACE_SIZE	256
+#define TINYALSA_MIXER_TRACE_MAGIC	0x4352544d
+#define TINYALSA_MIXER_TRACE_VERSION	1
+
+/*
+ * Control writes are traced when the trace property is set. Durations are
+ * in us and transition is the route change the write was part of.
+ */
+struct tinyalsa_mixer_trace_entry {
+	int64_t timestamp;
+	int32_t duration;
+	uint32_t transition;
+	int32_t card;
+	int32_t rc;
+	char name[40];
+	char value[16];
+};
+
+struct tinyalsa_mixer_trace {
+	struct tinyalsa_mixer_trace_entry entries[TINYALSA_MIXER_TRACE_SIZE];
+	unsigned int index;
+	unsigned int count;
+};
+
+/*
+ * Binary dump: header, entries (oldest first) then histograms.
+ */
+struct tinyalsa_mixer_trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t entries_count;
+	uint32_t histogram_size;
+	uint32_t histograms_count;
+};
+
+struct tinyalsa_mixer_trace_histogram {
+	int32_t card;
+	int32_t duration_max;
+	char name[40];
+	uint32_t buckets[TINYALSA_MIXER_HISTOGRAM_SIZE];
+};
+
 struct tinyalsa_mixer_data {
 	enum tinyalsa_mixer_data_type type;
 	char *name;
 	char *value;
 	char *attr;
+
+	struct tinyalsa_mixer_curve *curve;
 };
 
 struct tinyalsa_mixer_device_props {
 	audio_devices_t type;
+	int rate;
 };
 
 struct tinyalsa_mixer_device {
@@ -55,6 +154,24 @@ struct tinyalsa_mixer_device {
 	struct list_head *disable;
 };
 
+/*
+ * Device masks may combine several devices of a direction, such as speaker
+ * and wired headset for ringtones. Combined devices missing from the config
+ * are composed from their member devices and cached in the devices list.
+ */
+static inline int tinyalsa_mixer_is_output_device(audio_devices_t device)
+{
+	return device != 0 && (device & AUDIO_DEVICE_BIT_IN) == 0 &&
+		(device & ~AUDIO_DEVICE_OUT_ALL) == 0;
+}
+
+static inline int tinyalsa_mixer_is_input_device(audio_devices_t device)
+{
+	return (device & AUDIO_DEVICE_BIT_IN) != 0 &&
+		(device & ~AUDIO_DEVICE_BIT_IN) != 0 &&
+		(device & ~AUDIO_DEVICE_IN_ALL) == 0;
+}
+
 struct tinyalsa_mixer_io_props {
 	int card;
 	int device;
@@ -78,7 +195,27 @@ struct tinyalsa_mixer {
 	struct tinyalsa_mixer_io output;
 	struct tinyalsa_mixer_io input;
 	struct tinyalsa_mixer_io modem;
+	struct tinyalsa_mixer_io_props sco_props;
+	struct tinyalsa_mixer_io_props hdmi_props;
+	int hdmi;
 	struct mixer *mixer;
+	int card;
+	int diff;
+
+	struct tinyalsa_mixer_trace *trace;
+	unsigned int transition;
+
+	struct list_head *shadows;
+	struct list_head *journal;
+	int journaling;
+
+	char *config_file;
+	pthread_t reload_thread;
+	int reload_running;
+	int reload_fd;
+	int reload_pipe[2];
+
+	pthread_mutex_t lock;
 };
 
 enum tinyalsa_mixer_direction {
@@ -95,6 +232,7 @@ struct tinyalsa_mixer_config_data {
 	enum tinyalsa_mixer_direction direction;
 
 	struct tinyalsa_mixer_device *device;
+	struct tinyalsa_mixer_data *mixer_data;
 	struct list_head **list_start;
 	struct list_head *list;
 };
@@ -102,6 +240,7 @@ struct tinyalsa_mixer_config_data {
 int tinyalsa_mixer_set_output_state(struct tinyalsa_mixer *mixer, int state);
 int tinyalsa_mixer_set_input_state(struct tinyalsa_mixer *mixer, int state);
 int tinyalsa_mixer_set_modem_state(struct tinyalsa_mixer *mixer, int state);
+int tinyalsa_mixer_set_modem_rate(struct tinyalsa_mixer *mixer, int rate);
 
 int tinyalsa_mixer_set_device(struct tinyalsa_mixer *mixer, audio_devices_t device);
 
@@ -115,9 +254,13 @@ int tinyalsa_mixer_set_input_gain(struct tinyalsa_mixer *mixer,
 int tinyalsa_mixer_set_voice_volume(struct tinyalsa_mixer *mixer,
 	audio_devices_t device, float volume);
 
+int tinyalsa_mixer_dump(struct tinyalsa_mixer *mixer, int fd);
+
 struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_output_props(struct tinyalsa_mixer *mixer);
 struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_input_props(struct tinyalsa_mixer *mixer);
 struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_modem_props(struct tinyalsa_mixer *mixer);
+struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_sco_props(struct tinyalsa_mixer *mixer);
+struct tinyalsa_mixer_io_props *tinyalsa_mixer_get_hdmi_props(struct tinyalsa_mixer *mixer);
 
 void tinyalsa_mixer_close(struct tinyalsa_mixer *mixer);
 int tinyalsa_mixer_open(struct tinyalsa_mixer **mixer_p, char *config_file);
@@ -0,0 +1,119 @@
+# Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+LOCAL_PATH := $(call my-dir)
+
+# The benchmark runs the HAL on the device, against libsecril-client-mock
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	audio_ril_benchmark.c \
+	../audio_hw.c \
+	../audio_out.c \
+	../audio_in.c \
+	../audio_ril_interface.c \
+	../audio_route.c \
+	../audio_lock.c \
+	../audio_voice_bridge.c \
+	../audio_mix.c \
+	../audio_hdmi.c \
+	../mixer.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include \
+	external/expat/lib \
+	system/media/audio_utils/include \
+	system/media/audio_effects/include \
+	hardware/tinyalsa-audio/include
+
+LOCAL_CFLAGS += -DRIL_CLIENT_LIBPATH=\"libsecril-client-mock.so\"
+
+LOCAL_SHARED_LIBRARIES := \
+	libc \
+	libcutils \
+	libutils \
+	libexpat \
+	libtinyalsa \
+	libaudioutils \
+	libdl
+
+ifeq ($(strip $(BOARD_USE_YAMAHA_MC1N2_AUDIO)),true)
+  LOCAL_CFLAGS += -DYAMAHA_MC1N2_AUDIO
+  LOCAL_C_INCLUDES += $(LOCAL_PATH)/../../yamaha-mc1n2-audio/include
+  LOCAL_SHARED_LIBRARIES += libyamaha-mc1n2-audio
+
+  LOCAL_CFLAGS += -DYAMAHA_MC1N2_AUDIO_DEVICE=\"smdk4210\"
+
+endif
+
+LOCAL_REQUIRED_MODULES := libsecril-client-mock
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_MODULE := audio_ril_benchmark
+
+include $(BUILD_EXECUTABLE)
+
+# The compose test checks the combined devices composed from the mixer
+# config, mixer.c pulls in the rest of the HAL
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	mixer_compose_test.c \
+	../audio_hw.c \
+	../audio_out.c \
+	../audio_in.c \
+	../audio_ril_interface.c \
+	../audio_route.c \
+	../audio_lock.c \
+	../audio_voice_bridge.c \
+	../audio_mix.c \
+	../audio_hdmi.c \
+	../mixer.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include \
+	external/expat/lib \
+	system/media/audio_utils/include \
+	system/media/audio_effects/include \
+	hardware/tinyalsa-audio/include
+
+LOCAL_SHARED_LIBRARIES := \
+	libc \
+	libcutils \
+	libutils \
+	libexpat \
+	libtinyalsa \
+	libaudioutils \
+	libdl
+
+ifeq ($(strip $(BOARD_USE_YAMAHA_MC1N2_AUDIO)),true)
+  LOCAL_CFLAGS += -DYAMAHA_MC1N2_AUDIO
+  LOCAL_C_INCLUDES += $(LOCAL_PATH)/../../yamaha-mc1n2-audio/include
+  LOCAL_SHARED_LIBRARIES += libyamaha-mc1n2-audio
+
+  LOCAL_CFLAGS += -DYAMAHA_MC1N2_AUDIO_DEVICE=\"smdk4210\"
+
+endif
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_MODULE := mixer_compose_test
+
+include $(BUILD_EXECUTABLE)
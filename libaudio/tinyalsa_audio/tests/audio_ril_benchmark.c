@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+#include "audio_hw.h"
+
+/*
+ * Sets up calls on the HAL, with volume and route changes during the call,
+ * against libsecril-client-mock, that this build loads as the RIL client.
+ * Reports the time spent in set_mode, the time from set_mode until the
+ * modem path is set by the RIL worker, and the RIL client calls made with
+ * a device lock held, as seen from the mock hook. Scripting the mock with
+ * latencies, failures and drops (see secril-client-mock.c) shows how these
+ * hold up against a slow or restarting rild.
+ */
+
+#define AUDIO_RIL_BENCHMARK_ITERATIONS	20
+#define AUDIO_RIL_BENCHMARK_CHURN	12
+#define AUDIO_RIL_BENCHMARK_IDLE	500
+#define AUDIO_RIL_BENCHMARK_TIMEOUT	10000
+
+typedef void (*audio_ril_benchmark_hook)(const char *call, int rc, void *data);
+typedef void (*audio_ril_benchmark_hook_set)(audio_ril_benchmark_hook hook, void *data);
+
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+struct audio_ril_benchmark {
+	struct tinyalsa_audio_device *device;
+	pthread_t thread;
+
+	unsigned int calls;
+	unsigned int calls_locked;
+	unsigned int calls_caller;
+	unsigned int calls_failed;
+
+	int path_pending;
+	int64_t time_path;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/*
+ * Hook
+ */
+
+// Called after each RIL client call, from the thread that made it
+static void audio_ril_benchmark_hook_call(const char *call, int rc, void *data)
+{
+	struct audio_ril_benchmark *benchmark = (struct audio_ril_benchmark *) data;
+	struct tinyalsa_audio_device *device;
+
+	pthread_mutex_lock(&benchmark->lock);
+
+	device = benchmark->device;
+	if(device == NULL)
+		goto complete;
+
+	benchmark->calls++;
+
+	if(audio_lock_held(&device->lock) || audio_lock_held(&device->hw_lock))
+		benchmark->calls_locked++;
+
+	if(pthread_equal(pthread_self(), benchmark->thread))
+		benchmark->calls_caller++;
+
+	if(rc != 0)
+		benchmark->calls_failed++;
+
+	if(benchmark->path_pending && rc == 0 && strcmp(call, "path") == 0) {
+		benchmark->time_path = audio_hw_time();
+		benchmark->path_pending = 0;
+	}
+
+	pthread_cond_broadcast(&benchmark->cond);
+
+complete:
+	pthread_mutex_unlock(&benchmark->lock);
+}
+
+/*
+ * Waits
+ */
+
+static void audio_ril_benchmark_timespec(struct timespec *ts, int timeout)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	ts->tv_sec = tv.tv_sec + timeout / 1000;
+	ts->tv_nsec = tv.tv_usec * 1000 + (timeout % 1000) * 1000000;
+	if(ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int audio_ril_benchmark_wait_path(struct audio_ril_benchmark *benchmark,
+	int timeout)
+{
+	struct timespec ts;
+	int pending;
+	int rc = 0;
+
+	audio_ril_benchmark_timespec(&ts, timeout);
+
+	pthread_mutex_lock(&benchmark->lock);
+
+	while(benchmark->path_pending && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&benchmark->cond, &benchmark->lock, &ts);
+
+	pending = benchmark->path_pending;
+	benchmark->path_pending = 0;
+
+	pthread_mutex_unlock(&benchmark->lock);
+
+	return pending ? -1 : 0;
+}
+
+// Queued RIL commands are done once no call was made for the idle time
+static void audio_ril_benchmark_wait_idle(struct audio_ril_benchmark *benchmark,
+	int idle)
+{
+	struct timespec ts;
+	unsigned int calls;
+	int rc;
+
+	pthread_mutex_lock(&benchmark->lock);
+
+	do {
+		calls = benchmark->calls;
+		audio_ril_benchmark_timespec(&ts, idle);
+
+		rc = 0;
+		while(calls == benchmark->calls && rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&benchmark->cond, &benchmark->lock, &ts);
+	} while(calls != benchmark->calls);
+
+	pthread_mutex_unlock(&benchmark->lock);
+}
+
+/*
+ * Call
+ */
+
+static int audio_ril_benchmark_call(struct audio_ril_benchmark *benchmark,
+	struct audio_hw_device *dev, int churn, int idle,
+	int64_t *time_mode, int64_t *time_setup)
+{
+	audio_devices_t devices[] = {
+		AUDIO_DEVICE_OUT_SPEAKER,
+		AUDIO_DEVICE_OUT_WIRED_HEADSET,
+		AUDIO_DEVICE_OUT_EARPIECE,
+	};
+	char parameters[32];
+	int64_t time_start;
+	int rc;
+	int i;
+
+	pthread_mutex_lock(&benchmark->lock);
+	benchmark->path_pending = 1;
+	pthread_mutex_unlock(&benchmark->lock);
+
+	time_start = audio_hw_time();
+
+	dev->set_mode(dev, AUDIO_MODE_IN_CALL);
+
+	*time_mode = audio_hw_time() - time_start;
+
+	rc = audio_ril_benchmark_wait_path(benchmark, AUDIO_RIL_BENCHMARK_TIMEOUT);
+	if(rc < 0)
+		fprintf(stderr, "No modem path set after %d ms\n", AUDIO_RIL_BENCHMARK_TIMEOUT);
+	else
+		*time_setup = benchmark->time_path - time_start;
+
+	// Volume keys, with a route change every third press
+	for(i=0 ; i < churn ; i++) {
+		dev->set_voice_volume(dev, (float) (i % 5 + 1) / 5);
+
+		if(i % 3 == 2) {
+			snprintf(parameters, sizeof(parameters), "%s=%d",
+				AUDIO_PARAMETER_STREAM_ROUTING, devices[(i / 3) % 3]);
+			dev->set_parameters(dev, parameters);
+		}
+	}
+
+	dev->set_mode(dev, AUDIO_MODE_NORMAL);
+
+	audio_ril_benchmark_wait_idle(benchmark, idle);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct audio_ril_benchmark benchmark;
+	audio_ril_benchmark_hook_set hook_set;
+	struct audio_hw_device *dev;
+	struct hw_device_t *common;
+	void *dl_handle;
+	int iterations = AUDIO_RIL_BENCHMARK_ITERATIONS;
+	int churn = AUDIO_RIL_BENCHMARK_CHURN;
+	int idle = AUDIO_RIL_BENCHMARK_IDLE;
+	int64_t time_mode, time_mode_total = 0, time_mode_max = 0;
+	int64_t time_setup, time_setup_total = 0, time_setup_max = 0;
+	int setups = 0;
+	int c;
+	int i;
+
+	while((c = getopt(argc, argv, "n:c:i:")) != -1) {
+		switch(c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'c':
+				churn = atoi(optarg);
+				break;
+			case 'i':
+				idle = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n iterations] [-c changes per call] [-i idle ms]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(iterations <= 0 || churn < 0 || idle <= 0)
+		return 1;
+
+	memset(&benchmark, 0, sizeof(benchmark));
+	pthread_mutex_init(&benchmark.lock, NULL);
+	pthread_cond_init(&benchmark.cond, NULL);
+	benchmark.thread = pthread_self();
+
+	// The HAL gets the same instance when it loads the client
+	dl_handle = dlopen(RIL_CLIENT_LIBPATH, RTLD_NOW);
+	if(dl_handle == NULL) {
+		fprintf(stderr, "Unable to dlopen lib: %s\n", RIL_CLIENT_LIBPATH);
+		return 1;
+	}
+
+	hook_set = (audio_ril_benchmark_hook_set) dlsym(dl_handle, "secril_client_mock_hook_set");
+	if(hook_set == NULL) {
+		fprintf(stderr, "%s is not libsecril-client-mock\n", RIL_CLIENT_LIBPATH);
+		dlclose(dl_handle);
+		return 1;
+	}
+
+	hook_set(audio_ril_benchmark_hook_call, &benchmark);
+
+	if(HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+		AUDIO_HARDWARE_INTERFACE, &common) < 0) {
+		fprintf(stderr, "Unable to open the audio device\n");
+		hook_set(NULL, NULL);
+		dlclose(dl_handle);
+		return 1;
+	}
+
+	dev = (struct audio_hw_device *) common;
+
+	pthread_mutex_lock(&benchmark.lock);
+	benchmark.device = (struct tinyalsa_audio_device *) dev;
+	pthread_mutex_unlock(&benchmark.lock);
+
+	// The client is loaded and connected in the background at open
+	audio_ril_benchmark_wait_idle(&benchmark, idle);
+
+	pthread_mutex_lock(&benchmark.lock);
+	benchmark.calls = 0;
+	benchmark.calls_locked = 0;
+	benchmark.calls_caller = 0;
+	benchmark.calls_failed = 0;
+	pthread_mutex_unlock(&benchmark.lock);
+
+	for(i=0 ; i < iterations ; i++) {
+		time_mode = 0;
+		time_setup = 0;
+
+		if(audio_ril_benchmark_call(&benchmark, dev, churn, idle, &time_mode, &time_setup) == 0) {
+			time_setup_total += time_setup;
+			if(time_setup > time_setup_max)
+				time_setup_max = time_setup;
+			setups++;
+		}
+
+		time_mode_total += time_mode;
+		if(time_mode > time_mode_max)
+			time_mode_max = time_mode;
+	}
+
+	hook_set(NULL, NULL);
+
+	printf("%d calls, %d changes per call, %d with the modem path set:\n",
+		iterations, churn, setups);
+	printf("set_mode: %lld us average, %lld us max\n",
+		(long long) (time_mode_total / iterations), (long long) time_mode_max);
+	if(setups > 0)
+		printf("Call audio setup: %lld us average, %lld us max\n",
+			(long long) (time_setup_total / setups), (long long) time_setup_max);
+	printf("RIL calls: %u, %u with a device lock held, %u from the caller, %u failed\n",
+		benchmark.calls, benchmark.calls_locked, benchmark.calls_caller,
+		benchmark.calls_failed);
+
+	pthread_mutex_lock(&benchmark.lock);
+	benchmark.device = NULL;
+	pthread_mutex_unlock(&benchmark.lock);
+
+	common->close(common);
+
+	dlclose(dl_handle);
+
+	pthread_cond_destroy(&benchmark.cond);
+	pthread_mutex_destroy(&benchmark.lock);
+
+	return setups == iterations && benchmark.calls_locked == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw.h"
+#include "mixer.h"
+
+/*
+ * Checks the combined devices composed from their members: members with an
+ * entry for the looked up rate have it composed in, the others have their
+ * any rate entry composed in, and composed devices are cached per rate.
+ * The config is written to the path given as argument, or to
+ * MIXER_COMPOSE_TEST_CONFIG_FILE.
+ */
+
+#define MIXER_COMPOSE_TEST_CONFIG_FILE	"/data/local/tmp/mixer_compose_test.xml"
+
+#define MIXER_COMPOSE_TEST_CONFIG \
+	"<tinyalsa-audio device=\"test\">\n" \
+	"<output card=\"0\" device=\"0\" rate=\"44100\" channels=\"2\" format=\"PCM_16\" period_size=\"1024\" period_count=\"4\">\n" \
+	"<device type=\"earpiece\"><path type=\"enable\"><ctrl name=\"Earpiece\" value=\"1\" /></path></device>\n" \
+	"<device type=\"speaker\"><path type=\"enable\"><ctrl name=\"Speaker\" value=\"1\" /></path></device>\n" \
+	"<device type=\"wired-headset\"><path type=\"enable\"><ctrl name=\"Headset\" value=\"1\" /></path></device>\n" \
+	"<device type=\"wired-headset\" rate=\"16000\"><path type=\"enable\"><ctrl name=\"Headset\" value=\"1\" /><ctrl name=\"Headset WB\" value=\"1\" /></path></device>\n" \
+	"</output>\n" \
+	"</tinyalsa-audio>\n"
+
+int tinyalsa_mixer_config_parse(struct tinyalsa_mixer *mixer, char *config_file);
+void tinyalsa_mixer_io_free_devices(struct tinyalsa_mixer_io *mixer_io);
+struct tinyalsa_mixer_device *tinyalsa_mixer_get_device_rate(struct tinyalsa_mixer_io *mixer_io,
+	audio_devices_t device, int rate);
+struct tinyalsa_mixer_data *tinyalsa_mixer_get_data_with_name(
+	struct list_head *list_data, char *name);
+
+int mixer_compose_test_check(struct tinyalsa_mixer_device *mixer_device,
+	char *name, int enabled, const char *label)
+{
+	struct tinyalsa_mixer_data *mixer_data;
+
+	if(mixer_device == NULL) {
+		fprintf(stderr, "%s: no device\n", label);
+		return 1;
+	}
+
+	mixer_data = tinyalsa_mixer_get_data_with_name(mixer_device->enable, name);
+	if((mixer_data != NULL) != enabled) {
+		fprintf(stderr, "%s: %s is %s\n", label, name,
+			mixer_data != NULL ? "enabled" : "missing");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tinyalsa_mixer_device *device_nb, *device_wb, *device;
+	struct tinyalsa_mixer *mixer;
+	struct tinyalsa_mixer_io *mixer_io;
+	audio_devices_t combined;
+	char *config_file;
+	int tests = 0;
+	int failures = 0;
+	FILE *f;
+
+	config_file = argc > 1 ? argv[1] : MIXER_COMPOSE_TEST_CONFIG_FILE;
+
+	f = fopen(config_file, "w");
+	if(f == NULL) {
+		fprintf(stderr, "Unable to write config: %s\n", config_file);
+		return 1;
+	}
+
+	fputs(MIXER_COMPOSE_TEST_CONFIG, f);
+	fclose(f);
+
+	mixer = calloc(1, sizeof(struct tinyalsa_mixer));
+	if(mixer == NULL)
+		return 1;
+
+	if(tinyalsa_mixer_config_parse(mixer, config_file) < 0) {
+		fprintf(stderr, "Unable to parse config: %s\n", config_file);
+		free(mixer);
+		return 1;
+	}
+
+	mixer_io = &mixer->output;
+	combined = AUDIO_DEVICE_OUT_SPEAKER | AUDIO_DEVICE_OUT_WIRED_HEADSET;
+
+	// Narrowband first, with no rate specific member
+	device_nb = tinyalsa_mixer_get_device_rate(mixer_io, combined, 8000);
+	tests += 3;
+	failures += mixer_compose_test_check(device_nb, "Speaker", 1, "Narrowband");
+	failures += mixer_compose_test_check(device_nb, "Headset", 1, "Narrowband");
+	failures += mixer_compose_test_check(device_nb, "Headset WB", 0, "Narrowband");
+
+	// The narrowband device does not stand in for the wideband members
+	device_wb = tinyalsa_mixer_get_device_rate(mixer_io, combined, 16000);
+	tests += 3;
+	failures += mixer_compose_test_check(device_wb, "Speaker", 1, "Wideband");
+	failures += mixer_compose_test_check(device_wb, "Headset WB", 1, "Wideband");
+	if(device_wb == device_nb) {
+		fprintf(stderr, "Wideband: narrowband device returned\n");
+		failures++;
+	}
+
+	// Both are cached
+	tests += 2;
+	if(tinyalsa_mixer_get_device_rate(mixer_io, combined, 8000) != device_nb) {
+		fprintf(stderr, "Narrowband: composed again\n");
+		failures++;
+	}
+	if(tinyalsa_mixer_get_device_rate(mixer_io, combined, 16000) != device_wb) {
+		fprintf(stderr, "Wideband: composed again\n");
+		failures++;
+	}
+
+	// Members without an entry for the rate are composed from any rate
+	device = tinyalsa_mixer_get_device_rate(mixer_io,
+		AUDIO_DEVICE_OUT_EARPIECE | AUDIO_DEVICE_OUT_SPEAKER, 16000);
+	tests += 2;
+	failures += mixer_compose_test_check(device, "Earpiece", 1, "Any rate");
+	failures += mixer_compose_test_check(device, "Speaker", 1, "Any rate");
+
+	tinyalsa_mixer_io_free_devices(&mixer->output);
+	tinyalsa_mixer_io_free_devices(&mixer->input);
+	tinyalsa_mixer_io_free_devices(&mixer->modem);
+	free(mixer);
+
+	printf("Compose: %d tests, %d failures\n", tests, failures);
+
+	return failures == 0 ? 0 : 1;
+}
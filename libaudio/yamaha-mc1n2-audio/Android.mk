@@ -42,4 +42,53 @@ LOCAL_MODULE := libyamaha-mc1n2-audio
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	yamaha-mc1n2-audio-params.c \
+	device/smdk4210.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/include
+
+ifeq ($(BOARD_HAS_EARPIECE), true)
+  LOCAL_CFLAGS += -DHAS_EARPIECE
+endif
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_MODULE := yamaha-mc1n2-audio-params
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	yamaha-mc1n2-audio-ae.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/include
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_MODULE := yamaha-mc1n2-audio-ae
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	yamaha-mc1n2-audio-fake.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/include
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_MODULE := libyamaha-mc1n2-audio-fake
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(LOCAL_PATH)/tests/Android.mk
+
 endif
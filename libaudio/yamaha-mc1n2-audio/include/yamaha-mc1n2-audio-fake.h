@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YAMAHA_MC1N2_AUDIO_FAKE_H
+#define YAMAHA_MC1N2_AUDIO_FAKE_H
+
+#include <stdint.h>
+
+#include <yamaha-mc1n2-audio.h>
+
+/*
+ * Fake codec backend, only built for host tools: it is set with
+ * yamaha_mc1n2_audio_backend_set() and never opens the hw_node.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX	64
+#define YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX	16
+
+/*
+ * Fake codec: register state as last written, command counts and per
+ * command latencies in us. Latencies are accounted as modeled time and
+ * only slept for when delay is set.
+ */
+struct yamaha_mc1n2_audio_fake {
+	MCDRV_AE_INFO ae_info;
+	MCDRV_PATH_INFO path_info;
+	MCDRV_DAC_INFO dac_info;
+	MCDRV_ADC_INFO adc_info;
+	MCDRV_SP_INFO sp_info;
+	MCDRV_PDM_INFO pdm_info;
+	MCDRV_DNG_INFO dng_info;
+	MCDRV_SYSEQ_INFO syseq_info;
+
+	int media_play;
+	int voice_rec;
+	int call;
+
+	unsigned int set_ctrl_count[YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX];
+	unsigned int notify_count[YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX];
+	unsigned int ioctl_count;
+
+	int set_ctrl_latency[YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX];
+	int notify_latency[YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX];
+
+	int64_t time_modeled;
+	int delay;
+};
+
+extern struct yamaha_mc1n2_audio_backend yamaha_mc1n2_audio_backend_fake;
+
+int yamaha_mc1n2_audio_fake_latency_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	int command, unsigned long dcmd, int latency);
+int yamaha_mc1n2_audio_fake_delay_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	int delay);
+struct yamaha_mc1n2_audio_fake *yamaha_mc1n2_audio_fake_get(
+	struct yamaha_mc1n2_audio_pdata *pdata);
+
+#endif
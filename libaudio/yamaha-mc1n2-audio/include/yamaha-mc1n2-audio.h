@@ -18,6 +18,9 @@
 #ifndef YAMAHA_MC1N2_AUDIO_H
 #define YAMAHA_MC1N2_AUDIO_H
 
+#include <pthread.h>
+#include <stdint.h>
+
 #include <system/audio.h>
 
 #include "mc1n2.h"
@@ -40,21 +43,180 @@ struct yamaha_mc1n2_audio_params_init {
 	MCDRV_SYSEQ_INFO syseq_info;
 };
 
+/*
+ * Modem routes may be specific to the modem PCM rate, routes with a zero
+ * rate apply to any rate.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_MODEM_RATE_NB	8000
+#define YAMAHA_MC1N2_AUDIO_MODEM_RATE_WB	16000
+
 struct yamaha_mc1n2_audio_params_route {
 	audio_devices_t device;
 	enum yamaha_mc1n2_audio_direction direction;
+	int rate;
 
 	MCDRV_AE_INFO ae_info;
 	MCDRV_PATH_INFO path_info;
 	MCDRV_DAC_INFO dac_info;
 };
 
+enum yamaha_mc1n2_audio_merge_kind {
+	YAMAHA_MC1N2_AUDIO_MERGE_SIMPLE,
+	YAMAHA_MC1N2_AUDIO_MERGE_PATH
+};
+
+struct yamaha_mc1n2_audio_merge_field {
+	size_t offset;
+	size_t size;
+	enum yamaha_mc1n2_audio_merge_kind kind;
+};
+
 struct yamaha_mc1n2_audio_params {
 	struct yamaha_mc1n2_audio_params_init *init;
 	struct yamaha_mc1n2_audio_params_route *routes;
 	int routes_count;
 };
 
+/*
+ * Params file: the header is followed by the init params and the routes,
+ * stored with the in-memory layout. Struct sizes are checked at load.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_PARAMS_FILE		"/system/etc/yamaha-mc1n2-audio-%s.bin"
+#define YAMAHA_MC1N2_AUDIO_PARAMS_MAGIC		0x50324e4d
+#define YAMAHA_MC1N2_AUDIO_PARAMS_VERSION	2
+
+struct yamaha_mc1n2_audio_params_header {
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t init_size;
+	uint32_t init_offset;
+
+	uint32_t route_size;
+	uint32_t routes_offset;
+	uint32_t routes_count;
+};
+
+/*
+ * AE presets file: precompiled presets, several presets may share a name
+ * with different output devices. Presets override the AE block of routes.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_AE_PRESETS_FILE	"/system/etc/yamaha-mc1n2-audio-%s-ae.bin"
+#define YAMAHA_MC1N2_AUDIO_AE_PRESETS_DATA_FILE	"/data/misc/audio/yamaha-mc1n2-audio-%s-ae.bin"
+#define YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAGIC	0x41324e4d
+#define YAMAHA_MC1N2_AUDIO_AE_PRESETS_VERSION	1
+
+#define YAMAHA_MC1N2_AUDIO_AE_PRESET_KEY	"mc1n2_ae_preset"
+#define YAMAHA_MC1N2_AUDIO_AE_PRESET_RELOAD_KEY	"mc1n2_ae_preset_reload"
+#define YAMAHA_MC1N2_AUDIO_AE_PRESET_NAME_SIZE	32
+
+struct yamaha_mc1n2_audio_ae_presets_header {
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t preset_size;
+	uint32_t presets_offset;
+	uint32_t presets_count;
+};
+
+struct yamaha_mc1n2_audio_ae_preset {
+	uint32_t device;
+	char name[YAMAHA_MC1N2_AUDIO_AE_PRESET_NAME_SIZE];
+
+	MCDRV_AE_INFO ae_info;
+};
+
+/*
+ * AE coefficient blocks, only sent for enabled engines.
+ */
+struct yamaha_mc1n2_audio_ae_block {
+	unsigned long update_flag;
+	unsigned char onoff;
+	size_t offset;
+	size_t size;
+};
+
+// Routes are indexed by the bit of single-bit devices
+#define YAMAHA_MC1N2_AUDIO_ROUTES_INDEX_SIZE	32
+
+#define YAMAHA_MC1N2_AUDIO_ROUTE_CACHE_SIZE	8
+
+/*
+ * Merged route params only depend on the direction states and devices,
+ * entries are stale once the generation no longer matches.
+ */
+struct yamaha_mc1n2_audio_route_cache {
+	int valid;
+	unsigned int generation;
+	unsigned int used;
+
+	int output_state;
+	int input_state;
+	int modem_state;
+	int modem_rate;
+	audio_devices_t output_device;
+	audio_devices_t input_device;
+
+	struct yamaha_mc1n2_audio_params_route params;
+};
+
+#define YAMAHA_MC1N2_AUDIO_SHADOW_AE	(1 << 0)
+#define YAMAHA_MC1N2_AUDIO_SHADOW_PATH	(1 << 1)
+#define YAMAHA_MC1N2_AUDIO_SHADOW_DAC	(1 << 2)
+
+#define YAMAHA_MC1N2_AUDIO_HOLDOFF_PROPERTY	"persist.audio.mc1n2.holdoff"
+#define YAMAHA_MC1N2_AUDIO_HOLDOFF_DEFAULT	"500"
+
+/*
+ * Codec bring-up can run on a helper thread, so that it overlaps with the
+ * pcm open and the processing of the first buffer. Times are in us.
+ *
+ * Stops are deferred by the hold-off (in ms) and carried out by the same
+ * thread, a start within the hold-off cancels the pending stop.
+ */
+struct yamaha_mc1n2_audio_worker {
+	pthread_t thread;
+	int running;
+	int pending;
+	int rc;
+
+	int64_t time_queued;
+	int64_t time_started;
+	int64_t time_done;
+
+	int holdoff;
+	int64_t stop_deadline[YAMAHA_MC1N2_AUDIO_DIRECTION_MAX];
+	unsigned int stops_deferred[YAMAHA_MC1N2_AUDIO_DIRECTION_MAX];
+	unsigned int stops_done[YAMAHA_MC1N2_AUDIO_DIRECTION_MAX];
+	unsigned int stops_avoided[YAMAHA_MC1N2_AUDIO_DIRECTION_MAX];
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+};
+
+/*
+ * Backends carry the ioctls to the codec: the hardware backend uses the
+ * hw_node. Host tools may set another backend, such as the fake codec of
+ * yamaha-mc1n2-audio-fake.h, before the first ioctl.
+ */
+
+struct yamaha_mc1n2_audio_pdata;
+
+struct yamaha_mc1n2_audio_backend {
+	char *name;
+	int (*open)(struct yamaha_mc1n2_audio_pdata *pdata);
+	int (*ioctl)(struct yamaha_mc1n2_audio_pdata *pdata,
+		int command, struct mc1n2_ctrl_args *hw_ctrl);
+	void (*close)(struct yamaha_mc1n2_audio_pdata *pdata);
+	int (*dump)(struct yamaha_mc1n2_audio_pdata *pdata, int fd);
+};
+
+extern struct yamaha_mc1n2_audio_backend yamaha_mc1n2_audio_backend_hw;
+
 struct yamaha_mc1n2_audio_device_ops {
 	char *hw_node;
 	int hw_fd;
@@ -65,12 +227,53 @@ struct yamaha_mc1n2_audio_pdata {
 	char *name;
 	struct yamaha_mc1n2_audio_device_ops *ops;
 
+	struct yamaha_mc1n2_audio_backend *backend;
+	void *backend_data;
+	int backend_opened;
+
 	audio_devices_t output_device;
 	audio_devices_t input_device;
 
 	int output_state;
 	int input_state;
 	int modem_state;
+	int modem_rate;
+
+	// Last modem rate switch, times are in us
+	unsigned int modem_rate_switches;
+	int64_t modem_rate_switch_time;
+	int64_t modem_rate_switch_time_max;
+
+	struct yamaha_mc1n2_audio_params params_builtin;
+	void *params_map;
+	size_t params_map_size;
+
+	struct yamaha_mc1n2_audio_params_route *routes_index
+		[YAMAHA_MC1N2_AUDIO_DIRECTION_MAX][YAMAHA_MC1N2_AUDIO_ROUTES_INDEX_SIZE];
+	struct yamaha_mc1n2_audio_params_route *routes_index_wb
+		[YAMAHA_MC1N2_AUDIO_ROUTES_INDEX_SIZE];
+
+	struct yamaha_mc1n2_audio_route_cache route_cache[YAMAHA_MC1N2_AUDIO_ROUTE_CACHE_SIZE];
+	unsigned int route_cache_generation;
+	unsigned int route_cache_clock;
+
+	struct yamaha_mc1n2_audio_ae_preset *ae_presets;
+	int ae_presets_count;
+	void *ae_presets_map;
+	size_t ae_presets_map_size;
+
+	char ae_preset_name[YAMAHA_MC1N2_AUDIO_AE_PRESET_NAME_SIZE];
+	struct yamaha_mc1n2_audio_ae_preset *ae_presets_index[YAMAHA_MC1N2_AUDIO_ROUTES_INDEX_SIZE];
+
+	// Last successfully applied route blocks
+	struct yamaha_mc1n2_audio_params_route route_shadow;
+	int route_shadow_valid;
+	unsigned long route_shadow_ae_blocks;
+
+	struct yamaha_mc1n2_audio_worker worker;
+
+	// Held by the routines, the worker lock is never held while taking it
+	pthread_mutex_t lock;
 };
 
 /*
@@ -79,6 +282,8 @@ struct yamaha_mc1n2_audio_pdata {
 
 extern struct yamaha_mc1n2_audio_pdata smdk4210_pdata;
 
+extern unsigned char yamaha_mc1n2_audio_path_merge_lut[256][2];
+
 /*
  * Functions
  */
@@ -91,6 +296,11 @@ int yamaha_mc1n2_audio_ioctl_set_ctrl(struct yamaha_mc1n2_audio_pdata *pdata,
 int yamaha_mc1n2_audio_ioctl_notify(struct yamaha_mc1n2_audio_pdata *pdata,
 	unsigned long command);
 
+// Backend
+void yamaha_mc1n2_audio_backend_close(struct yamaha_mc1n2_audio_pdata *pdata);
+int yamaha_mc1n2_audio_backend_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	struct yamaha_mc1n2_audio_backend *backend);
+
 // Routines
 int yamaha_mc1n2_audio_init(struct yamaha_mc1n2_audio_pdata *pdata);
 int yamaha_mc1n2_audio_output_start(struct yamaha_mc1n2_audio_pdata *pdata);
@@ -100,9 +310,36 @@ int yamaha_mc1n2_audio_input_stop(struct yamaha_mc1n2_audio_pdata *pdata);
 int yamaha_mc1n2_audio_modem_start(struct yamaha_mc1n2_audio_pdata *pdata);
 int yamaha_mc1n2_audio_modem_stop(struct yamaha_mc1n2_audio_pdata *pdata);
 
+// Worker
+int64_t yamaha_mc1n2_audio_time(void);
+int yamaha_mc1n2_audio_output_start_async(struct yamaha_mc1n2_audio_pdata *pdata);
+int yamaha_mc1n2_audio_output_start_wait(struct yamaha_mc1n2_audio_pdata *pdata,
+	int64_t *time_started, int64_t *time_done);
+int yamaha_mc1n2_audio_dump(struct yamaha_mc1n2_audio_pdata *pdata, int fd);
+
+// Route merge
+int yamaha_mc1n2_audio_params_route_simple_array_merge(int length,
+	unsigned char *array_src, unsigned char *array_dst);
+int yamaha_mc1n2_audio_params_route_path_array_merge(int length,
+	unsigned char *array_src, unsigned char *array_dst);
+int yamaha_mc1n2_audio_params_route_merge(
+	struct yamaha_mc1n2_audio_params_route *params_src,
+	struct yamaha_mc1n2_audio_params_route *params_dst);
+
+// Route cache
+void yamaha_mc1n2_audio_route_cache_invalidate(struct yamaha_mc1n2_audio_pdata *pdata);
+void yamaha_mc1n2_audio_route_shadow_invalidate(struct yamaha_mc1n2_audio_pdata *pdata);
+
+// AE presets
+int yamaha_mc1n2_audio_ae_preset_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	char *name);
+int yamaha_mc1n2_audio_ae_presets_reload(struct yamaha_mc1n2_audio_pdata *pdata);
+
 // Values configuration
 int yamaha_mc1n2_audio_set_route(struct yamaha_mc1n2_audio_pdata *pdata,
 	audio_devices_t device);
+int yamaha_mc1n2_audio_set_modem_rate(struct yamaha_mc1n2_audio_pdata *pdata,
+	int rate);
 char *yamaha_mc1n2_audio_get_hw_node(struct yamaha_mc1n2_audio_pdata *pdata);
 
 // Init/Deinit
@@ -0,0 +1,96 @@
+# Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+LOCAL_PATH := $(call my-dir)
+
+# The merge test is built for the target as well, so that the NEON path of
+# the library is the one checked there.
+
+merge_test_src_files := \
+	yamaha-mc1n2-audio-merge-test.c \
+	../yamaha-mc1n2-audio.c \
+	../device/smdk4210.c
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(merge_test_src_files)
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/../include
+
+LOCAL_SHARED_LIBRARIES := \
+	libc \
+	libcutils \
+	libutils
+
+ifeq ($(BOARD_HAS_EARPIECE), true)
+  LOCAL_CFLAGS += -DHAS_EARPIECE
+endif
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_MODULE := yamaha-mc1n2-audio-merge-test
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(merge_test_src_files)
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/../include
+
+LOCAL_STATIC_LIBRARIES := \
+	libcutils \
+	liblog
+
+LOCAL_LDLIBS := -lpthread
+
+ifeq ($(BOARD_HAS_EARPIECE), true)
+  LOCAL_CFLAGS += -DHAS_EARPIECE
+endif
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_MODULE := yamaha-mc1n2-audio-merge-test
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	yamaha-mc1n2-audio-benchmark.c \
+	../yamaha-mc1n2-audio.c \
+	../device/smdk4210.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/../include
+
+LOCAL_STATIC_LIBRARIES := \
+	libyamaha-mc1n2-audio-fake \
+	libcutils \
+	liblog
+
+LOCAL_LDLIBS := -lpthread
+
+ifeq ($(BOARD_HAS_EARPIECE), true)
+  LOCAL_CFLAGS += -DHAS_EARPIECE
+endif
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_MODULE := yamaha-mc1n2-audio-benchmark
+
+include $(BUILD_HOST_EXECUTABLE)
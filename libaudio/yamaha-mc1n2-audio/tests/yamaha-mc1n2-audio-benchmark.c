@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <yamaha-mc1n2-audio.h>
+#include <yamaha-mc1n2-audio-fake.h>
+
+/*
+ * Replays start, stop and route sequences of the HAL against the fake codec
+ * and reports, per sequence, the ioctls issued and the time they would take
+ * on the codec.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_BENCHMARK_ITERATIONS		100
+
+struct yamaha_mc1n2_audio_benchmark {
+	char *name;
+	void (*run)(struct yamaha_mc1n2_audio_pdata *pdata);
+};
+
+/*
+ * Sequences
+ */
+
+// Media playback on the speaker
+void yamaha_mc1n2_audio_benchmark_playback(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_SPEAKER);
+	yamaha_mc1n2_audio_output_start(pdata);
+	yamaha_mc1n2_audio_output_stop(pdata);
+}
+
+// Headset plugged and unplugged during playback
+void yamaha_mc1n2_audio_benchmark_route(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_SPEAKER);
+	yamaha_mc1n2_audio_output_start(pdata);
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_WIRED_HEADSET);
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_SPEAKER);
+	yamaha_mc1n2_audio_output_stop(pdata);
+}
+
+// Ringtone on the speaker and the headset
+void yamaha_mc1n2_audio_benchmark_ringtone(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	yamaha_mc1n2_audio_set_route(pdata,
+		AUDIO_DEVICE_OUT_SPEAKER | AUDIO_DEVICE_OUT_WIRED_HEADSET);
+	yamaha_mc1n2_audio_output_start(pdata);
+	yamaha_mc1n2_audio_output_stop(pdata);
+}
+
+// Recording from the built-in mic
+void yamaha_mc1n2_audio_benchmark_capture(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_IN_BUILTIN_MIC);
+	yamaha_mc1n2_audio_input_start(pdata);
+	yamaha_mc1n2_audio_input_stop(pdata);
+}
+
+// Call on the earpiece, switched to wideband, then to the speaker
+void yamaha_mc1n2_audio_benchmark_call(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_EARPIECE);
+	yamaha_mc1n2_audio_set_modem_rate(pdata, YAMAHA_MC1N2_AUDIO_MODEM_RATE_NB);
+	yamaha_mc1n2_audio_modem_start(pdata);
+	yamaha_mc1n2_audio_input_start(pdata);
+	yamaha_mc1n2_audio_set_modem_rate(pdata, YAMAHA_MC1N2_AUDIO_MODEM_RATE_WB);
+	yamaha_mc1n2_audio_set_route(pdata, AUDIO_DEVICE_OUT_SPEAKER);
+	yamaha_mc1n2_audio_input_stop(pdata);
+	yamaha_mc1n2_audio_modem_stop(pdata);
+	yamaha_mc1n2_audio_set_modem_rate(pdata, YAMAHA_MC1N2_AUDIO_MODEM_RATE_NB);
+}
+
+struct yamaha_mc1n2_audio_benchmark yamaha_mc1n2_audio_benchmarks[] = {
+	{ "playback", yamaha_mc1n2_audio_benchmark_playback },
+	{ "route", yamaha_mc1n2_audio_benchmark_route },
+	{ "ringtone", yamaha_mc1n2_audio_benchmark_ringtone },
+	{ "capture", yamaha_mc1n2_audio_benchmark_capture },
+	{ "call", yamaha_mc1n2_audio_benchmark_call },
+};
+
+int yamaha_mc1n2_audio_benchmarks_count = sizeof(yamaha_mc1n2_audio_benchmarks) /
+	sizeof(struct yamaha_mc1n2_audio_benchmark);
+
+/*
+ * Replay
+ */
+
+void yamaha_mc1n2_audio_benchmark_holdoff_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	int holdoff)
+{
+	pthread_mutex_lock(&pdata->worker.lock);
+	pdata->worker.holdoff = holdoff;
+	pthread_mutex_unlock(&pdata->worker.lock);
+}
+
+int yamaha_mc1n2_audio_benchmark_run(struct yamaha_mc1n2_audio_benchmark *benchmark,
+	int iterations, int holdoff, int delay)
+{
+	struct yamaha_mc1n2_audio_pdata *pdata = NULL;
+	struct yamaha_mc1n2_audio_fake *fake;
+	unsigned int set_ctrl = 0;
+	unsigned int notify = 0;
+	int64_t time_start;
+	int64_t time;
+	int i;
+
+	if(yamaha_mc1n2_audio_start(&pdata, "smdk4210") < 0) {
+		fprintf(stderr, "Unable to start Yamaha-MC1N2-Audio\n");
+		return -1;
+	}
+
+	yamaha_mc1n2_audio_backend_set(pdata, &yamaha_mc1n2_audio_backend_fake);
+	yamaha_mc1n2_audio_fake_delay_set(pdata, delay);
+	yamaha_mc1n2_audio_benchmark_holdoff_set(pdata, holdoff);
+
+	// Init params are written at HAL open, before any sequence
+	yamaha_mc1n2_audio_init(pdata);
+
+	fake = yamaha_mc1n2_audio_fake_get(pdata);
+	memset(fake->set_ctrl_count, 0, sizeof(fake->set_ctrl_count));
+	memset(fake->notify_count, 0, sizeof(fake->notify_count));
+	fake->ioctl_count = 0;
+	fake->time_modeled = 0;
+
+	time_start = yamaha_mc1n2_audio_time();
+
+	for(i=0 ; i < iterations ; i++)
+		benchmark->run(pdata);
+
+	// Stops deferred by the hold-off are carried out by the worker
+	if(holdoff > 0)
+		usleep(holdoff * 2000);
+
+	time = yamaha_mc1n2_audio_time() - time_start;
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX ; i++)
+		set_ctrl += fake->set_ctrl_count[i];
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX ; i++)
+		notify += fake->notify_count[i];
+
+	printf("%-10s %8.1f %8.1f %8.1f %12.1f %12.1f\n", benchmark->name,
+		(float) fake->ioctl_count / iterations, (float) set_ctrl / iterations,
+		(float) notify / iterations, (float) fake->time_modeled / iterations,
+		(float) time / iterations);
+
+	yamaha_mc1n2_audio_stop(pdata);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = YAMAHA_MC1N2_AUDIO_BENCHMARK_ITERATIONS;
+	int holdoff = 0;
+	int delay = 0;
+	int c;
+	int i;
+
+	while((c = getopt(argc, argv, "n:h:d")) != -1) {
+		switch(c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'h':
+				holdoff = atoi(optarg);
+				break;
+			case 'd':
+				delay = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n iterations] [-h holdoff ms] [-d]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(iterations <= 0)
+		return 1;
+
+	printf("%d iterations, %d ms hold-off, latencies %s, per iteration:\n",
+		iterations, holdoff, delay ? "slept" : "modeled");
+	printf("%-10s %8s %8s %8s %12s %12s\n", "sequence", "ioctls", "set_ctrl",
+		"notify", "modeled us", "wall us");
+
+	for(i=0 ; i < yamaha_mc1n2_audio_benchmarks_count ; i++) {
+		if(yamaha_mc1n2_audio_benchmark_run(&yamaha_mc1n2_audio_benchmarks[i],
+			iterations, holdoff, delay) < 0)
+			return 1;
+	}
+
+	return 0;
+}
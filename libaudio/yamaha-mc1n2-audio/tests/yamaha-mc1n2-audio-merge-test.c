@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <yamaha-mc1n2-audio.h>
+
+/*
+ * Differential test of the route merge: the table driven merge, along with
+ * its NEON path when built with __ARM_NEON__, is checked against the
+ * original per-field merge and its per-bit path loop.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_MERGE_TEST_RANDOM	20000
+
+/*
+ * Reference merge
+ */
+
+void yamaha_mc1n2_audio_merge_test_simple_array_merge(int length,
+	unsigned char *array_src, unsigned char *array_dst)
+{
+	int i;
+
+	for(i=0 ; i < length ; i++) {
+		if(array_dst[i] == 0)
+			array_dst[i] = array_src[i];
+	}
+}
+
+void yamaha_mc1n2_audio_merge_test_path_array_merge(int length,
+	unsigned char *array_src, unsigned char *array_dst)
+{
+	unsigned char v;
+	int i, j;
+
+	for(i=0 ; i < length ; i++) {
+		if(array_dst[i] == 0) {
+			array_dst[i] = array_src[i];
+		} else {
+			v = array_src[i];
+
+			for(j=0; j < 8 ; j++) {
+				if((1 << j) & array_dst[i]) {
+					if(j % 2 == 0)
+						v &= ~(1 << (j+1));
+					else
+						v &= ~(1 << (j-1));
+
+					v |= (1 << j);
+				}
+			}
+
+			array_dst[i] = v;
+		}
+	}
+}
+
+#define SIMPLE(field) \
+	yamaha_mc1n2_audio_merge_test_simple_array_merge(sizeof(params_src->field), \
+		(unsigned char *) &params_src->field, (unsigned char *) &params_dst->field)
+
+#define PATH(field) \
+	yamaha_mc1n2_audio_merge_test_path_array_merge(sizeof(params_src->path_info.field.abSrcOnOff), \
+		params_src->path_info.field.abSrcOnOff, params_dst->path_info.field.abSrcOnOff)
+
+void yamaha_mc1n2_audio_merge_test_merge(
+	struct yamaha_mc1n2_audio_params_route *params_src,
+	struct yamaha_mc1n2_audio_params_route *params_dst)
+{
+	// ae_info
+	SIMPLE(ae_info.bOnOff);
+	SIMPLE(ae_info.abBex);
+	SIMPLE(ae_info.abWide);
+	SIMPLE(ae_info.abDrc);
+	SIMPLE(ae_info.abEq5);
+	SIMPLE(ae_info.abEq3);
+
+	// path_info
+	PATH(asHpOut[0]);
+	PATH(asHpOut[1]);
+	PATH(asSpOut[0]);
+	PATH(asSpOut[1]);
+	PATH(asRcOut[0]);
+	PATH(asLout1[0]);
+	PATH(asLout1[1]);
+	PATH(asLout2[0]);
+	PATH(asLout2[1]);
+	PATH(asPeak[0]);
+	PATH(asDit0[0]);
+	PATH(asDit1[0]);
+	PATH(asDit2[0]);
+	PATH(asDac[0]);
+	PATH(asDac[1]);
+	PATH(asAe[0]);
+	PATH(asCdsp[0]);
+	PATH(asCdsp[1]);
+	PATH(asCdsp[2]);
+	PATH(asCdsp[3]);
+	PATH(asAdc0[0]);
+	PATH(asAdc0[1]);
+	PATH(asAdc1[0]);
+	PATH(asMix[0]);
+	PATH(asBias[0]);
+
+	// dac_info
+	SIMPLE(dac_info.bMasterSwap);
+	SIMPLE(dac_info.bVoiceSwap);
+	SIMPLE(dac_info.bDcCut);
+}
+
+/*
+ * Checks
+ */
+
+int yamaha_mc1n2_audio_merge_test_check(
+	struct yamaha_mc1n2_audio_params_route *params_src,
+	struct yamaha_mc1n2_audio_params_route *params_dst,
+	struct yamaha_mc1n2_audio_params_route *params_result)
+{
+	struct yamaha_mc1n2_audio_params_route params_ref;
+
+	memcpy(&params_ref, params_dst, sizeof(params_ref));
+	memcpy(params_result, params_dst, sizeof(struct yamaha_mc1n2_audio_params_route));
+
+	yamaha_mc1n2_audio_merge_test_merge(params_src, &params_ref);
+	yamaha_mc1n2_audio_params_route_merge(params_src, params_result);
+
+	return memcmp(&params_ref, params_result, sizeof(params_ref)) == 0 ? 0 : -1;
+}
+
+/*
+ * Every destination byte is merged with every source byte, over a length
+ * that is not a multiple of the vector width.
+ */
+int yamaha_mc1n2_audio_merge_test_bytes(void)
+{
+	unsigned char src[259], dst[259], ref[259];
+	int failures = 0;
+	int s, i;
+
+	for(s=0 ; s < 256 ; s++) {
+		for(i=0 ; i < (int) sizeof(dst) ; i++) {
+			src[i] = s;
+			dst[i] = i & 0xff;
+		}
+
+		memcpy(ref, dst, sizeof(ref));
+		yamaha_mc1n2_audio_merge_test_path_array_merge(sizeof(src), src, ref);
+		yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(src), src, dst);
+		if(memcmp(ref, dst, sizeof(ref)) != 0) {
+			fprintf(stderr, "Path merge mismatch for source byte 0x%02x\n", s);
+			failures++;
+		}
+
+		for(i=0 ; i < (int) sizeof(dst) ; i++)
+			dst[i] = i & 0xff;
+
+		memcpy(ref, dst, sizeof(ref));
+		yamaha_mc1n2_audio_merge_test_simple_array_merge(sizeof(src), src, ref);
+		yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(src), src, dst);
+		if(memcmp(ref, dst, sizeof(ref)) != 0) {
+			fprintf(stderr, "Simple merge mismatch for source byte 0x%02x\n", s);
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+int main(int argc, char *argv[])
+{
+	struct yamaha_mc1n2_audio_params *params = &smdk4210_pdata.ops->params;
+	struct yamaha_mc1n2_audio_params_route *routes = NULL;
+	struct yamaha_mc1n2_audio_params_route params_a, params_b, params_c;
+	unsigned char *data_a, *data_b;
+	int routes_count;
+	int tests = 0;
+	int failures = 0;
+	int i, j, k;
+
+	// The init params come first, as they are merged in before any route
+	routes_count = params->routes_count + 1;
+	routes = calloc(routes_count, sizeof(struct yamaha_mc1n2_audio_params_route));
+	if(routes == NULL)
+		return 1;
+
+	memcpy(&routes[0].ae_info, &params->init->ae_info, sizeof(routes[0].ae_info));
+	memcpy(&routes[0].path_info, &params->init->path_info, sizeof(routes[0].path_info));
+	memcpy(&routes[0].dac_info, &params->init->dac_info, sizeof(routes[0].dac_info));
+	memcpy(&routes[1], params->routes, params->routes_count * sizeof(struct yamaha_mc1n2_audio_params_route));
+
+	// Every pair of routes, then every chain of three
+	for(i=0 ; i < routes_count ; i++) {
+		for(j=0 ; j < routes_count ; j++) {
+			tests++;
+			if(yamaha_mc1n2_audio_merge_test_check(&routes[i], &routes[j], &params_a) < 0) {
+				fprintf(stderr, "Route merge mismatch: %d into %d\n", i, j);
+				failures++;
+				continue;
+			}
+
+			for(k=0 ; k < routes_count ; k++) {
+				tests++;
+				if(yamaha_mc1n2_audio_merge_test_check(&params_a, &routes[k], &params_b) < 0) {
+					fprintf(stderr, "Route merge mismatch: %d into %d into %d\n", i, j, k);
+					failures++;
+				}
+			}
+		}
+	}
+
+	// Sparse random params, as routes only set a few fields
+	srand(1);
+	data_a = (unsigned char *) &params_a;
+	data_b = (unsigned char *) &params_b;
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_MERGE_TEST_RANDOM ; i++) {
+		for(j=0 ; j < (int) sizeof(params_a) ; j++) {
+			data_a[j] = rand() % 4 ? 0 : rand();
+			data_b[j] = rand() % 3 ? 0 : rand();
+		}
+
+		tests++;
+		if(yamaha_mc1n2_audio_merge_test_check(&params_b, &params_a, &params_c) < 0) {
+			fprintf(stderr, "Random merge mismatch: %d\n", i);
+			failures++;
+		}
+	}
+
+	tests += 512;
+	failures += yamaha_mc1n2_audio_merge_test_bytes();
+
+	free(routes);
+
+#ifdef __ARM_NEON__
+	printf("Merge (NEON): %d routes, %d tests, %d failures\n", routes_count, tests, failures);
+#else
+	printf("Merge: %d routes, %d tests, %d failures\n", routes_count, tests, failures);
+#endif
+
+	return failures == 0 ? 0 : 1;
+}
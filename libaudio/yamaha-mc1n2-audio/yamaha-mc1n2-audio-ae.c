@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <yamaha-mc1n2-audio.h>
+
+/*
+ * Compiles AE presets from a text description, one statement per line:
+ *
+ *   preset [name] [device mask]
+ *   onoff [bOnOff]
+ *   bex|wide|drc|eq5|eq3 [hex bytes...]
+ *
+ * Coefficient lines append to their block, so long blocks can be split
+ * across lines. Lines starting with # are ignored.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAX	64
+
+struct yamaha_mc1n2_audio_ae_field {
+	char *name;
+	size_t offset;
+	size_t size;
+};
+
+#define YAMAHA_MC1N2_AUDIO_AE_FIELD(name, field) \
+	{ name, offsetof(MCDRV_AE_INFO, field), sizeof(((MCDRV_AE_INFO *) 0)->field) }
+
+struct yamaha_mc1n2_audio_ae_field yamaha_mc1n2_audio_ae_fields[] = {
+	YAMAHA_MC1N2_AUDIO_AE_FIELD("bex", abBex),
+	YAMAHA_MC1N2_AUDIO_AE_FIELD("wide", abWide),
+	YAMAHA_MC1N2_AUDIO_AE_FIELD("drc", abDrc),
+	YAMAHA_MC1N2_AUDIO_AE_FIELD("eq5", abEq5),
+	YAMAHA_MC1N2_AUDIO_AE_FIELD("eq3", abEq3),
+};
+
+int yamaha_mc1n2_audio_ae_fields_count = sizeof(yamaha_mc1n2_audio_ae_fields) /
+	sizeof(struct yamaha_mc1n2_audio_ae_field);
+
+struct yamaha_mc1n2_audio_ae_preset yamaha_mc1n2_audio_ae_presets[YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAX];
+int yamaha_mc1n2_audio_ae_presets_count = 0;
+
+int yamaha_mc1n2_audio_ae_parse(FILE *f)
+{
+	struct yamaha_mc1n2_audio_ae_preset *preset = NULL;
+	struct yamaha_mc1n2_audio_ae_field *field;
+	size_t fields_length[sizeof(yamaha_mc1n2_audio_ae_fields) / sizeof(struct yamaha_mc1n2_audio_ae_field)];
+	char line[1024];
+	char *keyword;
+	char *token;
+	char *end;
+	unsigned long value;
+	int line_number = 0;
+	int i;
+
+	while(fgets(line, sizeof(line), f) != NULL) {
+		line_number++;
+
+		keyword = strtok(line, " \t\r\n");
+		if(keyword == NULL || keyword[0] == '#')
+			continue;
+
+		if(strcmp(keyword, "preset") == 0) {
+			if(yamaha_mc1n2_audio_ae_presets_count >= YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAX) {
+				fprintf(stderr, "Line %d: too many presets\n", line_number);
+				return -1;
+			}
+
+			preset = &yamaha_mc1n2_audio_ae_presets[yamaha_mc1n2_audio_ae_presets_count++];
+			memset(fields_length, 0, sizeof(fields_length));
+
+			token = strtok(NULL, " \t\r\n");
+			if(token == NULL || strlen(token) >= sizeof(preset->name)) {
+				fprintf(stderr, "Line %d: invalid preset name\n", line_number);
+				return -1;
+			}
+
+			strcpy(preset->name, token);
+
+			token = strtok(NULL, " \t\r\n");
+			if(token == NULL) {
+				fprintf(stderr, "Line %d: missing preset device\n", line_number);
+				return -1;
+			}
+
+			preset->device = strtoul(token, NULL, 0);
+			continue;
+		}
+
+		if(preset == NULL) {
+			fprintf(stderr, "Line %d: %s outside of a preset\n", line_number, keyword);
+			return -1;
+		}
+
+		if(strcmp(keyword, "onoff") == 0) {
+			token = strtok(NULL, " \t\r\n");
+			if(token == NULL) {
+				fprintf(stderr, "Line %d: missing onoff value\n", line_number);
+				return -1;
+			}
+
+			preset->ae_info.bOnOff = strtoul(token, NULL, 0);
+			continue;
+		}
+
+		field = NULL;
+		for(i=0 ; i < yamaha_mc1n2_audio_ae_fields_count ; i++) {
+			if(strcmp(keyword, yamaha_mc1n2_audio_ae_fields[i].name) == 0) {
+				field = &yamaha_mc1n2_audio_ae_fields[i];
+				break;
+			}
+		}
+
+		if(field == NULL) {
+			fprintf(stderr, "Line %d: unknown keyword: %s\n", line_number, keyword);
+			return -1;
+		}
+
+		while((token = strtok(NULL, " \t\r\n")) != NULL) {
+			if(fields_length[i] >= field->size) {
+				fprintf(stderr, "Line %d: too many %s bytes\n", line_number, field->name);
+				return -1;
+			}
+
+			value = strtoul(token, &end, 16);
+			if(*end != '\0' || value > 0xff) {
+				fprintf(stderr, "Line %d: invalid byte: %s\n", line_number, token);
+				return -1;
+			}
+
+			((unsigned char *) &preset->ae_info)[field->offset + fields_length[i]] = value;
+			fields_length[i]++;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct yamaha_mc1n2_audio_ae_presets_header header;
+	FILE *f;
+	int rc;
+
+	if(argc < 3) {
+		fprintf(stderr, "Usage: %s [source] [file]\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "r");
+	if(f == NULL) {
+		fprintf(stderr, "Unable to open file: %s\n", argv[1]);
+		return 1;
+	}
+
+	rc = yamaha_mc1n2_audio_ae_parse(f);
+	fclose(f);
+
+	if(rc < 0)
+		return 1;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAGIC;
+	header.version = YAMAHA_MC1N2_AUDIO_AE_PRESETS_VERSION;
+	header.preset_size = sizeof(struct yamaha_mc1n2_audio_ae_preset);
+	header.presets_offset = sizeof(header);
+	header.presets_count = yamaha_mc1n2_audio_ae_presets_count;
+
+	f = fopen(argv[2], "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Unable to open file: %s\n", argv[2]);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(yamaha_mc1n2_audio_ae_presets, header.preset_size, header.presets_count, f);
+
+	if(ferror(f)) {
+		fprintf(stderr, "Unable to write file: %s\n", argv[2]);
+		fclose(f);
+		return 1;
+	}
+
+	fclose(f);
+
+	printf("Wrote %d AE presets to %s\n", header.presets_count, argv[2]);
+
+	return 0;
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/ioctl.h>
+
+#define LOG_TAG "Yamaha-MC1N2-Audio Fake"
+#include <cutils/log.h>
+
+#include <system/audio.h>
+
+#include <yamaha-mc1n2-audio.h>
+#include <yamaha-mc1n2-audio-fake.h>
+
+/*
+ * Model
+ */
+
+void yamaha_mc1n2_audio_fake_set_ae(struct yamaha_mc1n2_audio_fake *fake,
+	MCDRV_AE_INFO *ae_info, unsigned long update_info)
+{
+	// On/off flags match the bOnOff bits
+	fake->ae_info.bOnOff = (fake->ae_info.bOnOff & ~(update_info & 0x0f)) |
+		(ae_info->bOnOff & update_info & 0x0f);
+
+	if(update_info & MCDRV_AEUPDATE_FLAG_BEX)
+		memcpy(fake->ae_info.abBex, ae_info->abBex, sizeof(fake->ae_info.abBex));
+	if(update_info & MCDRV_AEUPDATE_FLAG_WIDE)
+		memcpy(fake->ae_info.abWide, ae_info->abWide, sizeof(fake->ae_info.abWide));
+	if(update_info & MCDRV_AEUPDATE_FLAG_DRC)
+		memcpy(fake->ae_info.abDrc, ae_info->abDrc, sizeof(fake->ae_info.abDrc));
+	if(update_info & MCDRV_AEUPDATE_FLAG_EQ5)
+		memcpy(fake->ae_info.abEq5, ae_info->abEq5, sizeof(fake->ae_info.abEq5));
+	if(update_info & MCDRV_AEUPDATE_FLAG_EQ3)
+		memcpy(fake->ae_info.abEq3, ae_info->abEq3, sizeof(fake->ae_info.abEq3));
+}
+
+void yamaha_mc1n2_audio_fake_set_path(struct yamaha_mc1n2_audio_fake *fake,
+	MCDRV_PATH_INFO *path_info)
+{
+	unsigned char *src;
+	unsigned char *dst;
+	int i;
+
+	src = (unsigned char *) path_info;
+	dst = (unsigned char *) &fake->path_info;
+
+	// ON/OFF pairs switch the source, empty pairs leave it untouched
+	for(i=0 ; i < (int) sizeof(MCDRV_PATH_INFO) ; i++)
+		dst[i] = (dst[i] & yamaha_mc1n2_audio_path_merge_lut[src[i]][0]) |
+			yamaha_mc1n2_audio_path_merge_lut[src[i]][1];
+}
+
+void yamaha_mc1n2_audio_fake_set_dac(struct yamaha_mc1n2_audio_fake *fake,
+	MCDRV_DAC_INFO *dac_info, unsigned long update_info)
+{
+	if(update_info & MCDRV_DAC_MSWP_UPDATE_FLAG)
+		fake->dac_info.bMasterSwap = dac_info->bMasterSwap;
+	if(update_info & MCDRV_DAC_VSWP_UPDATE_FLAG)
+		fake->dac_info.bVoiceSwap = dac_info->bVoiceSwap;
+	if(update_info & MCDRV_DAC_HPF_UPDATE_FLAG)
+		fake->dac_info.bDcCut = dac_info->bDcCut;
+}
+
+void yamaha_mc1n2_audio_fake_set_adc(struct yamaha_mc1n2_audio_fake *fake,
+	MCDRV_ADC_INFO *adc_info, unsigned long update_info)
+{
+	if(update_info & MCDRV_ADCADJ_UPDATE_FLAG)
+		fake->adc_info.bAgcAdjust = adc_info->bAgcAdjust;
+	if(update_info & MCDRV_ADCAGC_UPDATE_FLAG)
+		fake->adc_info.bAgcOn = adc_info->bAgcOn;
+	if(update_info & MCDRV_ADCMONO_UPDATE_FLAG)
+		fake->adc_info.bMono = adc_info->bMono;
+}
+
+int yamaha_mc1n2_audio_fake_set_ctrl(struct yamaha_mc1n2_audio_fake *fake,
+	struct mc1n2_ctrl_args *hw_ctrl)
+{
+	void *data;
+
+	data = hw_ctrl->pvPrm;
+	if(data == NULL)
+		return -1;
+
+	// Blocks without per-field modeling are taken as a whole
+	switch(hw_ctrl->dCmd) {
+		case MCDRV_SET_AUDIOENGINE:
+			yamaha_mc1n2_audio_fake_set_ae(fake, (MCDRV_AE_INFO *) data, hw_ctrl->dPrm);
+			break;
+		case MCDRV_SET_PATH:
+			yamaha_mc1n2_audio_fake_set_path(fake, (MCDRV_PATH_INFO *) data);
+			break;
+		case MCDRV_SET_DAC:
+			yamaha_mc1n2_audio_fake_set_dac(fake, (MCDRV_DAC_INFO *) data, hw_ctrl->dPrm);
+			break;
+		case MCDRV_SET_ADC:
+			yamaha_mc1n2_audio_fake_set_adc(fake, (MCDRV_ADC_INFO *) data, hw_ctrl->dPrm);
+			break;
+		case MCDRV_SET_SP:
+			memcpy(&fake->sp_info, data, sizeof(fake->sp_info));
+			break;
+		case MCDRV_SET_PDM:
+			memcpy(&fake->pdm_info, data, sizeof(fake->pdm_info));
+			break;
+		case MCDRV_SET_DNG:
+			memcpy(&fake->dng_info, data, sizeof(fake->dng_info));
+			break;
+		case MCDRV_SET_SYSEQ:
+			memcpy(&fake->syseq_info, data, sizeof(fake->syseq_info));
+			break;
+		default:
+			ALOGE("%s: unsupported command: %ld", __func__, (long) hw_ctrl->dCmd);
+			return -1;
+	}
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_fake_notify(struct yamaha_mc1n2_audio_fake *fake,
+	struct mc1n2_ctrl_args *hw_ctrl)
+{
+	switch(hw_ctrl->dCmd) {
+		case MCDRV_NOTIFY_CALL_START:
+		case MCDRV_NOTIFY_CALL_STOP:
+			fake->call = hw_ctrl->dCmd == MCDRV_NOTIFY_CALL_START;
+			break;
+		case MCDRV_NOTIFY_MEDIA_PLAY_START:
+		case MCDRV_NOTIFY_MEDIA_PLAY_STOP:
+			fake->media_play = hw_ctrl->dCmd == MCDRV_NOTIFY_MEDIA_PLAY_START;
+			break;
+		case MCDRV_NOTIFY_VOICE_REC_START:
+		case MCDRV_NOTIFY_VOICE_REC_STOP:
+			fake->voice_rec = hw_ctrl->dCmd == MCDRV_NOTIFY_VOICE_REC_START;
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Backend
+ */
+
+int yamaha_mc1n2_audio_fake_open(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_fake *fake;
+	int i;
+
+	if(pdata == NULL)
+		return -1;
+
+	if(pdata->backend_data == NULL) {
+		fake = calloc(1, sizeof(struct yamaha_mc1n2_audio_fake));
+		if(fake == NULL)
+			return -1;
+
+		// Rough I2C costs of the driver, the audio engine being the largest
+		for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX ; i++)
+			fake->set_ctrl_latency[i] = 500;
+		for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX ; i++)
+			fake->notify_latency[i] = 2000;
+
+		fake->set_ctrl_latency[MCDRV_SET_AUDIOENGINE] = 8000;
+		fake->set_ctrl_latency[MCDRV_SET_PATH] = 3000;
+
+		pdata->backend_data = fake;
+	}
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_fake_ioctl(struct yamaha_mc1n2_audio_pdata *pdata,
+	int command, struct mc1n2_ctrl_args *hw_ctrl)
+{
+	struct yamaha_mc1n2_audio_fake *fake;
+	int latency = 0;
+	int rc = -1;
+
+	if(pdata == NULL || pdata->backend_data == NULL || hw_ctrl == NULL)
+		return -1;
+
+	fake = (struct yamaha_mc1n2_audio_fake *) pdata->backend_data;
+
+	if(command == MC1N2_IOCTL_SET_CTRL) {
+		if(hw_ctrl->dCmd >= YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX)
+			return -1;
+
+		rc = yamaha_mc1n2_audio_fake_set_ctrl(fake, hw_ctrl);
+		fake->set_ctrl_count[hw_ctrl->dCmd]++;
+		latency = fake->set_ctrl_latency[hw_ctrl->dCmd];
+	} else if(command == MC1N2_IOCTL_NOTIFY) {
+		if(hw_ctrl->dCmd >= YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX)
+			return -1;
+
+		rc = yamaha_mc1n2_audio_fake_notify(fake, hw_ctrl);
+		fake->notify_count[hw_ctrl->dCmd]++;
+		latency = fake->notify_latency[hw_ctrl->dCmd];
+	} else {
+		ALOGE("%s: unsupported ioctl: 0x%x", __func__, command);
+		return -1;
+	}
+
+	fake->ioctl_count++;
+	fake->time_modeled += latency;
+
+	if(fake->delay && latency > 0)
+		usleep(latency);
+
+	return rc;
+}
+
+void yamaha_mc1n2_audio_fake_close(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata == NULL)
+		return;
+
+	if(pdata->backend_data != NULL) {
+		free(pdata->backend_data);
+		pdata->backend_data = NULL;
+	}
+}
+
+int yamaha_mc1n2_audio_fake_dump(struct yamaha_mc1n2_audio_pdata *pdata, int fd)
+{
+	struct yamaha_mc1n2_audio_fake *fake;
+	char buffer[256];
+	int length;
+	int i;
+
+	if(pdata == NULL || pdata->backend_data == NULL)
+		return -1;
+
+	fake = (struct yamaha_mc1n2_audio_fake *) pdata->backend_data;
+
+	length = snprintf(buffer, sizeof(buffer),
+		"Yamaha-MC1N2-Audio fake: %u ioctls, %lld us modeled, play %d, rec %d, call %d, ae 0x%x\n",
+		fake->ioctl_count, (long long) fake->time_modeled, fake->media_play,
+		fake->voice_rec, fake->call, fake->ae_info.bOnOff);
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX ; i++) {
+		if(fake->set_ctrl_count[i] == 0)
+			continue;
+
+		length = snprintf(buffer, sizeof(buffer), "  SET_CTRL %d: %u\n",
+			i, fake->set_ctrl_count[i]);
+		if(length > 0 && length < (int) sizeof(buffer))
+			write(fd, buffer, length);
+	}
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX ; i++) {
+		if(fake->notify_count[i] == 0)
+			continue;
+
+		length = snprintf(buffer, sizeof(buffer), "  NOTIFY %d: %u\n",
+			i, fake->notify_count[i]);
+		if(length > 0 && length < (int) sizeof(buffer))
+			write(fd, buffer, length);
+	}
+
+	return 0;
+}
+
+struct yamaha_mc1n2_audio_backend yamaha_mc1n2_audio_backend_fake = {
+	.name = "fake",
+	.open = yamaha_mc1n2_audio_fake_open,
+	.ioctl = yamaha_mc1n2_audio_fake_ioctl,
+	.close = yamaha_mc1n2_audio_fake_close,
+	.dump = yamaha_mc1n2_audio_fake_dump,
+};
+
+/*
+ * Interface
+ */
+
+int yamaha_mc1n2_audio_fake_latency_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	int command, unsigned long dcmd, int latency)
+{
+	struct yamaha_mc1n2_audio_fake *fake;
+
+	fake = yamaha_mc1n2_audio_fake_get(pdata);
+	if(fake == NULL)
+		return -1;
+
+	if(command == MC1N2_IOCTL_SET_CTRL && dcmd < YAMAHA_MC1N2_AUDIO_FAKE_SET_CTRL_MAX)
+		fake->set_ctrl_latency[dcmd] = latency;
+	else if(command == MC1N2_IOCTL_NOTIFY && dcmd < YAMAHA_MC1N2_AUDIO_FAKE_NOTIFY_MAX)
+		fake->notify_latency[dcmd] = latency;
+	else
+		return -1;
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_fake_delay_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	int delay)
+{
+	struct yamaha_mc1n2_audio_fake *fake;
+
+	fake = yamaha_mc1n2_audio_fake_get(pdata);
+	if(fake == NULL)
+		return -1;
+
+	fake->delay = delay;
+
+	return 0;
+}
+
+struct yamaha_mc1n2_audio_fake *yamaha_mc1n2_audio_fake_get(
+	struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata == NULL || pdata->backend != &yamaha_mc1n2_audio_backend_fake)
+		return NULL;
+
+	if(pdata->backend_data == NULL && yamaha_mc1n2_audio_fake_open(pdata) < 0)
+		return NULL;
+
+	return (struct yamaha_mc1n2_audio_fake *) pdata->backend_data;
+}
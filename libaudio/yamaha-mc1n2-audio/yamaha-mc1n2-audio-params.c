@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <yamaha-mc1n2-audio.h>
+
+/*
+ * Generates the params file of a platform from its built-in tables, it must
+ * be built with the same struct layout as the target.
+ */
+
+struct yamaha_mc1n2_audio_pdata *yamaha_mc1n2_audio_params_platforms[] = {
+	&smdk4210_pdata,
+};
+
+int yamaha_mc1n2_audio_params_platforms_count = sizeof(yamaha_mc1n2_audio_params_platforms) /
+	sizeof(struct yamaha_mc1n2_audio_pdata *);
+
+int main(int argc, char *argv[])
+{
+	struct yamaha_mc1n2_audio_params_header header;
+	struct yamaha_mc1n2_audio_params *params = NULL;
+	FILE *f;
+	int i;
+
+	if(argc < 3) {
+		fprintf(stderr, "Usage: %s [platform] [file]\n", argv[0]);
+		return 1;
+	}
+
+	for(i=0 ; i < yamaha_mc1n2_audio_params_platforms_count ; i++) {
+		if(strcmp(yamaha_mc1n2_audio_params_platforms[i]->name, argv[1]) == 0) {
+			params = &yamaha_mc1n2_audio_params_platforms[i]->ops->params;
+			break;
+		}
+	}
+
+	if(params == NULL || params->init == NULL || params->routes == NULL) {
+		fprintf(stderr, "Unknown platform: %s\n", argv[1]);
+		return 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = YAMAHA_MC1N2_AUDIO_PARAMS_MAGIC;
+	header.version = YAMAHA_MC1N2_AUDIO_PARAMS_VERSION;
+	header.init_size = sizeof(struct yamaha_mc1n2_audio_params_init);
+	header.init_offset = sizeof(header);
+	header.route_size = sizeof(struct yamaha_mc1n2_audio_params_route);
+	header.routes_offset = (header.init_offset + header.init_size + 3) & ~3;
+	header.routes_count = params->routes_count;
+
+	f = fopen(argv[2], "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Unable to open file: %s\n", argv[2]);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(params->init, header.init_size, 1, f);
+
+	for(i=header.init_offset + header.init_size ; i < (int) header.routes_offset ; i++)
+		fputc(0, f);
+
+	fwrite(params->routes, header.route_size, header.routes_count, f);
+
+	if(ferror(f)) {
+		fprintf(stderr, "Unable to write file: %s\n", argv[2]);
+		fclose(f);
+		return 1;
+	}
+
+	fclose(f);
+
+	printf("Wrote %d routes for %s to %s\n", header.routes_count, argv[1], argv[2]);
+
+	return 0;
+}
@@ -17,16 +17,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
 
 #include <linux/ioctl.h>
 
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
 #define LOG_TAG "Yamaha-MC1N2-Audio"
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <system/audio.h>
 
@@ -39,19 +52,28 @@ struct yamaha_mc1n2_audio_pdata *yamaha_mc1n2_audio_platforms[] = {
 int yamaha_mc1n2_audio_platforms_count = sizeof(yamaha_mc1n2_audio_platforms) /
 	sizeof(struct yamaha_mc1n2_audio_pdata *);
 
+pthread_once_t yamaha_mc1n2_audio_platforms_once = PTHREAD_ONCE_INIT;
+
+void yamaha_mc1n2_audio_platforms_init(void)
+{
+	int i;
+
+	for(i=0 ; i < yamaha_mc1n2_audio_platforms_count ; i++) {
+		pthread_mutex_init(&yamaha_mc1n2_audio_platforms[i]->lock, NULL);
+		pthread_mutex_init(&yamaha_mc1n2_audio_platforms[i]->worker.lock, NULL);
+		pthread_cond_init(&yamaha_mc1n2_audio_platforms[i]->worker.cond, NULL);
+		pthread_cond_init(&yamaha_mc1n2_audio_platforms[i]->worker.done_cond, NULL);
+	}
+}
+
 /*
- * IOCTL
+ * Backend
  */
 
-int yamaha_mc1n2_audio_ioctl(struct yamaha_mc1n2_audio_pdata *pdata,
-	int command, struct mc1n2_ctrl_args *hw_ctrl)
+int yamaha_mc1n2_audio_hw_open(struct yamaha_mc1n2_audio_pdata *pdata)
 {
 	char *hw_node = NULL;
 	int hw_fd = -1;
-	int rc = -1;
-
-	if(pdata == NULL || pdata->ops == NULL)
-		return -1;
 
 	hw_node = pdata->ops->hw_node;
 	if(hw_node == NULL) {
@@ -59,19 +81,96 @@ int yamaha_mc1n2_audio_ioctl(struct yamaha_mc1n2_audio_pdata *pdata,
 		return -1;
 	}
 
-	if(pdata->ops->hw_fd <= 0) {
-		hw_fd = open(hw_node, O_RDWR);
-		if(hw_fd < 0) {
-			ALOGE("%s: error, unable to open hw_node (fd is %d)!", __func__, hw_fd);
+	hw_fd = open(hw_node, O_RDWR);
+	if(hw_fd < 0) {
+		ALOGE("%s: error, unable to open hw_node (fd is %d)!", __func__, hw_fd);
+		return -1;
+	}
+
+	pdata->ops->hw_fd = hw_fd;
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_hw_ioctl(struct yamaha_mc1n2_audio_pdata *pdata,
+	int command, struct mc1n2_ctrl_args *hw_ctrl)
+{
+	return ioctl(pdata->ops->hw_fd, command, hw_ctrl);
+}
+
+void yamaha_mc1n2_audio_hw_close(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata->ops->hw_fd >= 0)
+		close(pdata->ops->hw_fd);
+
+	pdata->ops->hw_fd = -1;
+}
+
+struct yamaha_mc1n2_audio_backend yamaha_mc1n2_audio_backend_hw = {
+	.name = "hw",
+	.open = yamaha_mc1n2_audio_hw_open,
+	.ioctl = yamaha_mc1n2_audio_hw_ioctl,
+	.close = yamaha_mc1n2_audio_hw_close,
+	.dump = NULL,
+};
+
+void yamaha_mc1n2_audio_backend_close(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata->backend != NULL)
+		pdata->backend->close(pdata);
+
+	pdata->backend_opened = 0;
+}
+
+int yamaha_mc1n2_audio_backend_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	struct yamaha_mc1n2_audio_backend *backend)
+{
+	ALOGD("%s(%s)", __func__, backend != NULL ? backend->name : "");
+
+	if(pdata == NULL || pdata->ops == NULL || backend == NULL)
+		return -1;
+
+	pthread_mutex_lock(&pdata->lock);
+
+	if(pdata->backend != backend)
+		yamaha_mc1n2_audio_backend_close(pdata);
+
+	pdata->backend = backend;
+
+	// Nothing is known about the state of the new backend
+	yamaha_mc1n2_audio_route_shadow_invalidate(pdata);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return 0;
+}
+
+/*
+ * IOCTL
+ */
+
+int yamaha_mc1n2_audio_ioctl(struct yamaha_mc1n2_audio_pdata *pdata,
+	int command, struct mc1n2_ctrl_args *hw_ctrl)
+{
+	int rc = -1;
+
+	if(pdata == NULL || pdata->ops == NULL || pdata->backend == NULL)
+		return -1;
+
+	if(!pdata->backend_opened) {
+		rc = pdata->backend->open(pdata);
+		if(rc < 0) {
+			ALOGE("%s: error, unable to open %s backend!", __func__, pdata->backend->name);
 			return -1;
 		}
 
-		pdata->ops->hw_fd = hw_fd;
+		pdata->backend_opened = 1;
 	}
 
-	rc = ioctl(pdata->ops->hw_fd, command, hw_ctrl);
+	rc = pdata->backend->ioctl(pdata, command, hw_ctrl);
 	if(rc < 0) {
-		ALOGE("%s: error, ioctl on hw_node failed (rc is %d)!", __func__, rc);
+		ALOGE("%s: error, ioctl on %s backend failed (rc is %d)!", __func__,
+			pdata->backend->name, rc);
 		return -1;
 	}
 
@@ -124,6 +223,8 @@ int yamaha_mc1n2_audio_init(struct yamaha_mc1n2_audio_pdata *pdata)
 	if(params == NULL)
 		return -1;
 
+	yamaha_mc1n2_audio_route_shadow_invalidate(pdata);
+
 	rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_DAC,
 		&params->dac_info, 0x07);
 	if(rc < 0) {
@@ -173,8 +274,10 @@ struct yamaha_mc1n2_audio_params_route *
 	yamaha_mc1n2_audio_params_route_find(struct yamaha_mc1n2_audio_pdata *pdata,
 	audio_devices_t device, enum yamaha_mc1n2_audio_direction direction)
 {
+	struct yamaha_mc1n2_audio_params_route *params_any = NULL;
 	struct yamaha_mc1n2_audio_params_route *params = NULL;
 	int params_count = 0;
+	int rate = 0;
 	int i;
 
 	if(pdata == NULL || pdata->ops == NULL)
@@ -182,28 +285,149 @@ struct yamaha_mc1n2_audio_params_route *
 
 	ALOGD("(%s): device = %d, direction = %d",__func__,device,direction);
 
+	// Only modem routes depend on the rate
+	if(direction == YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM)
+		rate = pdata->modem_rate;
+
+	if(device != 0 && (device & (device - 1)) == 0 &&
+		direction < YAMAHA_MC1N2_AUDIO_DIRECTION_MAX) {
+		if(rate == YAMAHA_MC1N2_AUDIO_MODEM_RATE_WB &&
+			pdata->routes_index_wb[ffs(device) - 1] != NULL)
+			return pdata->routes_index_wb[ffs(device) - 1];
+
+		return pdata->routes_index[direction][ffs(device) - 1];
+	}
+
 	params = pdata->ops->params.routes;
 	params_count = pdata->ops->params.routes_count;
 	if(params == NULL || params_count <= 0)
 		return NULL;
 
 	for(i=0 ; i < params_count ; i++) {
-		if(params[i].device == device && params[i].direction == direction)
+		if(params[i].device != device || params[i].direction != direction)
+			continue;
+
+		if(params[i].rate == rate && rate != 0)
 			return &params[i];
+
+		if(params[i].rate == 0 && params_any == NULL)
+			params_any = &params[i];
 	}
 
-	return NULL;
+	return params_any;
 }
 
+/*
+ * Route params are merged field by field: simple fields keep the
+ * destination unless it is zero, path fields hold ON/OFF bit pairs where
+ * the destination pairs take precedence over the source.
+ */
+
+#define YAMAHA_MC1N2_AUDIO_MERGE_FIELD(field, kind) \
+	{ offsetof(struct yamaha_mc1n2_audio_params_route, field), \
+	sizeof(((struct yamaha_mc1n2_audio_params_route *) 0)->field), kind }
+
+struct yamaha_mc1n2_audio_merge_field yamaha_mc1n2_audio_merge_fields[] = {
+	// Each block is only made of byte fields of the same kind
+	YAMAHA_MC1N2_AUDIO_MERGE_FIELD(ae_info, YAMAHA_MC1N2_AUDIO_MERGE_SIMPLE),
+	YAMAHA_MC1N2_AUDIO_MERGE_FIELD(path_info, YAMAHA_MC1N2_AUDIO_MERGE_PATH),
+	YAMAHA_MC1N2_AUDIO_MERGE_FIELD(dac_info, YAMAHA_MC1N2_AUDIO_MERGE_SIMPLE),
+};
+
+int yamaha_mc1n2_audio_merge_fields_count = sizeof(yamaha_mc1n2_audio_merge_fields) /
+	sizeof(struct yamaha_mc1n2_audio_merge_field);
+
+/*
+ * Path byte merge, indexed by the destination byte: the result is
+ * (src & keep) | set. Destination pairs with both bits set resolve to the
+ * OFF bit, like the original bit loop did.
+ */
+
+unsigned char yamaha_mc1n2_audio_path_merge_lut[256][2] = {
+	{ 0xff, 0x00 }, { 0xfc, 0x01 }, { 0xfc, 0x02 }, { 0xfc, 0x02 },
+	{ 0xf3, 0x04 }, { 0xf0, 0x05 }, { 0xf0, 0x06 }, { 0xf0, 0x06 },
+	{ 0xf3, 0x08 }, { 0xf0, 0x09 }, { 0xf0, 0x0a }, { 0xf0, 0x0a },
+	{ 0xf3, 0x08 }, { 0xf0, 0x09 }, { 0xf0, 0x0a }, { 0xf0, 0x0a },
+	{ 0xcf, 0x10 }, { 0xcc, 0x11 }, { 0xcc, 0x12 }, { 0xcc, 0x12 },
+	{ 0xc3, 0x14 }, { 0xc0, 0x15 }, { 0xc0, 0x16 }, { 0xc0, 0x16 },
+	{ 0xc3, 0x18 }, { 0xc0, 0x19 }, { 0xc0, 0x1a }, { 0xc0, 0x1a },
+	{ 0xc3, 0x18 }, { 0xc0, 0x19 }, { 0xc0, 0x1a }, { 0xc0, 0x1a },
+	{ 0xcf, 0x20 }, { 0xcc, 0x21 }, { 0xcc, 0x22 }, { 0xcc, 0x22 },
+	{ 0xc3, 0x24 }, { 0xc0, 0x25 }, { 0xc0, 0x26 }, { 0xc0, 0x26 },
+	{ 0xc3, 0x28 }, { 0xc0, 0x29 }, { 0xc0, 0x2a }, { 0xc0, 0x2a },
+	{ 0xc3, 0x28 }, { 0xc0, 0x29 }, { 0xc0, 0x2a }, { 0xc0, 0x2a },
+	{ 0xcf, 0x20 }, { 0xcc, 0x21 }, { 0xcc, 0x22 }, { 0xcc, 0x22 },
+	{ 0xc3, 0x24 }, { 0xc0, 0x25 }, { 0xc0, 0x26 }, { 0xc0, 0x26 },
+	{ 0xc3, 0x28 }, { 0xc0, 0x29 }, { 0xc0, 0x2a }, { 0xc0, 0x2a },
+	{ 0xc3, 0x28 }, { 0xc0, 0x29 }, { 0xc0, 0x2a }, { 0xc0, 0x2a },
+	{ 0x3f, 0x40 }, { 0x3c, 0x41 }, { 0x3c, 0x42 }, { 0x3c, 0x42 },
+	{ 0x33, 0x44 }, { 0x30, 0x45 }, { 0x30, 0x46 }, { 0x30, 0x46 },
+	{ 0x33, 0x48 }, { 0x30, 0x49 }, { 0x30, 0x4a }, { 0x30, 0x4a },
+	{ 0x33, 0x48 }, { 0x30, 0x49 }, { 0x30, 0x4a }, { 0x30, 0x4a },
+	{ 0x0f, 0x50 }, { 0x0c, 0x51 }, { 0x0c, 0x52 }, { 0x0c, 0x52 },
+	{ 0x03, 0x54 }, { 0x00, 0x55 }, { 0x00, 0x56 }, { 0x00, 0x56 },
+	{ 0x03, 0x58 }, { 0x00, 0x59 }, { 0x00, 0x5a }, { 0x00, 0x5a },
+	{ 0x03, 0x58 }, { 0x00, 0x59 }, { 0x00, 0x5a }, { 0x00, 0x5a },
+	{ 0x0f, 0x60 }, { 0x0c, 0x61 }, { 0x0c, 0x62 }, { 0x0c, 0x62 },
+	{ 0x03, 0x64 }, { 0x00, 0x65 }, { 0x00, 0x66 }, { 0x00, 0x66 },
+	{ 0x03, 0x68 }, { 0x00, 0x69 }, { 0x00, 0x6a }, { 0x00, 0x6a },
+	{ 0x03, 0x68 }, { 0x00, 0x69 }, { 0x00, 0x6a }, { 0x00, 0x6a },
+	{ 0x0f, 0x60 }, { 0x0c, 0x61 }, { 0x0c, 0x62 }, { 0x0c, 0x62 },
+	{ 0x03, 0x64 }, { 0x00, 0x65 }, { 0x00, 0x66 }, { 0x00, 0x66 },
+	{ 0x03, 0x68 }, { 0x00, 0x69 }, { 0x00, 0x6a }, { 0x00, 0x6a },
+	{ 0x03, 0x68 }, { 0x00, 0x69 }, { 0x00, 0x6a }, { 0x00, 0x6a },
+	{ 0x3f, 0x80 }, { 0x3c, 0x81 }, { 0x3c, 0x82 }, { 0x3c, 0x82 },
+	{ 0x33, 0x84 }, { 0x30, 0x85 }, { 0x30, 0x86 }, { 0x30, 0x86 },
+	{ 0x33, 0x88 }, { 0x30, 0x89 }, { 0x30, 0x8a }, { 0x30, 0x8a },
+	{ 0x33, 0x88 }, { 0x30, 0x89 }, { 0x30, 0x8a }, { 0x30, 0x8a },
+	{ 0x0f, 0x90 }, { 0x0c, 0x91 }, { 0x0c, 0x92 }, { 0x0c, 0x92 },
+	{ 0x03, 0x94 }, { 0x00, 0x95 }, { 0x00, 0x96 }, { 0x00, 0x96 },
+	{ 0x03, 0x98 }, { 0x00, 0x99 }, { 0x00, 0x9a }, { 0x00, 0x9a },
+	{ 0x03, 0x98 }, { 0x00, 0x99 }, { 0x00, 0x9a }, { 0x00, 0x9a },
+	{ 0x0f, 0xa0 }, { 0x0c, 0xa1 }, { 0x0c, 0xa2 }, { 0x0c, 0xa2 },
+	{ 0x03, 0xa4 }, { 0x00, 0xa5 }, { 0x00, 0xa6 }, { 0x00, 0xa6 },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x0f, 0xa0 }, { 0x0c, 0xa1 }, { 0x0c, 0xa2 }, { 0x0c, 0xa2 },
+	{ 0x03, 0xa4 }, { 0x00, 0xa5 }, { 0x00, 0xa6 }, { 0x00, 0xa6 },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x3f, 0x80 }, { 0x3c, 0x81 }, { 0x3c, 0x82 }, { 0x3c, 0x82 },
+	{ 0x33, 0x84 }, { 0x30, 0x85 }, { 0x30, 0x86 }, { 0x30, 0x86 },
+	{ 0x33, 0x88 }, { 0x30, 0x89 }, { 0x30, 0x8a }, { 0x30, 0x8a },
+	{ 0x33, 0x88 }, { 0x30, 0x89 }, { 0x30, 0x8a }, { 0x30, 0x8a },
+	{ 0x0f, 0x90 }, { 0x0c, 0x91 }, { 0x0c, 0x92 }, { 0x0c, 0x92 },
+	{ 0x03, 0x94 }, { 0x00, 0x95 }, { 0x00, 0x96 }, { 0x00, 0x96 },
+	{ 0x03, 0x98 }, { 0x00, 0x99 }, { 0x00, 0x9a }, { 0x00, 0x9a },
+	{ 0x03, 0x98 }, { 0x00, 0x99 }, { 0x00, 0x9a }, { 0x00, 0x9a },
+	{ 0x0f, 0xa0 }, { 0x0c, 0xa1 }, { 0x0c, 0xa2 }, { 0x0c, 0xa2 },
+	{ 0x03, 0xa4 }, { 0x00, 0xa5 }, { 0x00, 0xa6 }, { 0x00, 0xa6 },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x0f, 0xa0 }, { 0x0c, 0xa1 }, { 0x0c, 0xa2 }, { 0x0c, 0xa2 },
+	{ 0x03, 0xa4 }, { 0x00, 0xa5 }, { 0x00, 0xa6 }, { 0x00, 0xa6 },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+	{ 0x03, 0xa8 }, { 0x00, 0xa9 }, { 0x00, 0xaa }, { 0x00, 0xaa },
+};
+
 int yamaha_mc1n2_audio_params_route_simple_array_merge(int length,
 	unsigned char *array_src, unsigned char *array_dst)
 {
-	int i;
+	int i = 0;
 
 	if(length <= 0 || array_src == NULL || array_dst == NULL)
 		return -1;
 
-	for(i=0 ; i < length ; i++) {
+#ifdef __ARM_NEON__
+	for( ; i + 16 <= length ; i += 16) {
+		uint8x16_t src = vld1q_u8(array_src + i);
+		uint8x16_t dst = vld1q_u8(array_dst + i);
+
+		vst1q_u8(array_dst + i, vbslq_u8(vceqq_u8(dst, vdupq_n_u8(0)), src, dst));
+	}
+#endif
+
+	for( ; i < length ; i++) {
 		if(array_dst[i] == 0)
 			array_dst[i] = array_src[i];
 	}
@@ -214,31 +438,31 @@ int yamaha_mc1n2_audio_params_route_simple_array_merge(int length,
 int yamaha_mc1n2_audio_params_route_path_array_merge(int length,
 	unsigned char *array_src, unsigned char *array_dst)
 {
-	int i, j;
-	unsigned char v;
+	unsigned char *lut;
+	int i = 0;
 
 	if(length <= 0 || array_src == NULL || array_dst == NULL)
 		return -1;
 
-	for(i=0 ; i < length ; i++) {
-		if(array_dst[i] == 0) {
-			array_dst[i] = array_src[i];
-		} else {
-			v = array_src[i];
+#ifdef __ARM_NEON__
+	for( ; i + 16 <= length ; i += 16) {
+		uint8x16_t src = vld1q_u8(array_src + i);
+		uint8x16_t dst = vld1q_u8(array_dst + i);
+		uint8x16_t even = vdupq_n_u8(0x55);
+		uint8x16_t touched, set;
 
-			for(j=0; j < 8 ; j++) {
-				if((1 << j) & array_dst[i]) {
-					if(j % 2 == 0)
-						v &= ~(1 << (j+1));
-					else
-						v &= ~(1 << (j-1));
+		// Same as the LUT: pairs touched by dst are replaced by dst
+		touched = vandq_u8(vorrq_u8(dst, vshrq_n_u8(dst, 1)), even);
+		touched = vorrq_u8(touched, vshlq_n_u8(touched, 1));
+		set = vbicq_u8(dst, vandq_u8(vshrq_n_u8(dst, 1), even));
 
-					v |= (1 << j);
-				}
-			}
+		vst1q_u8(array_dst + i, vorrq_u8(vbicq_u8(src, touched), set));
+	}
+#endif
 
-			array_dst[i] = v;
-		}
+	for( ; i < length ; i++) {
+		lut = yamaha_mc1n2_audio_path_merge_lut[array_dst[i]];
+		array_dst[i] = (array_src[i] & lut[0]) | lut[1];
 	}
 
 	return 0;
@@ -248,99 +472,145 @@ int yamaha_mc1n2_audio_params_route_merge(
 	struct yamaha_mc1n2_audio_params_route *params_src,
 	struct yamaha_mc1n2_audio_params_route *params_dst)
 {
+	struct yamaha_mc1n2_audio_merge_field *field;
+	unsigned char *src;
+	unsigned char *dst;
+	int i;
+
 	if(params_src == NULL || params_dst == NULL)
 		return -1;
 
-	// ae_info
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.bOnOff),
-		&params_src->ae_info.bOnOff, &params_dst->ae_info.bOnOff);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.abBex),
-		params_src->ae_info.abBex, params_dst->ae_info.abBex);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.abWide),
-		params_src->ae_info.abWide, params_dst->ae_info.abWide);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.abDrc),
-		params_src->ae_info.abDrc, params_dst->ae_info.abDrc);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.abEq5),
-		params_src->ae_info.abEq5, params_dst->ae_info.abEq5);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->ae_info.abEq3),
-		params_src->ae_info.abEq3, params_dst->ae_info.abEq3);
-
-	// path_info
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asHpOut[0].abSrcOnOff),
-		params_src->path_info.asHpOut[0].abSrcOnOff, params_dst->path_info.asHpOut[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asHpOut[1].abSrcOnOff),
-		params_src->path_info.asHpOut[1].abSrcOnOff, params_dst->path_info.asHpOut[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asSpOut[0].abSrcOnOff),
-		params_src->path_info.asSpOut[0].abSrcOnOff, params_dst->path_info.asSpOut[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asSpOut[1].abSrcOnOff),
-		params_src->path_info.asSpOut[1].abSrcOnOff, params_dst->path_info.asSpOut[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asRcOut[0].abSrcOnOff),
-		params_src->path_info.asRcOut[0].abSrcOnOff, params_dst->path_info.asRcOut[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asLout1[0].abSrcOnOff),
-		params_src->path_info.asLout1[0].abSrcOnOff, params_dst->path_info.asLout1[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asLout1[1].abSrcOnOff),
-		params_src->path_info.asLout1[1].abSrcOnOff, params_dst->path_info.asLout1[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asLout2[0].abSrcOnOff),
-		params_src->path_info.asLout2[0].abSrcOnOff, params_dst->path_info.asLout2[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asLout2[1].abSrcOnOff),
-		params_src->path_info.asLout2[1].abSrcOnOff, params_dst->path_info.asLout2[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asPeak[0].abSrcOnOff),
-		params_src->path_info.asPeak[0].abSrcOnOff, params_dst->path_info.asPeak[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asDit0[0].abSrcOnOff),
-		params_src->path_info.asDit0[0].abSrcOnOff, params_dst->path_info.asDit0[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asDit1[0].abSrcOnOff),
-		params_src->path_info.asDit1[0].abSrcOnOff, params_dst->path_info.asDit1[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asDit2[0].abSrcOnOff),
-		params_src->path_info.asDit2[0].abSrcOnOff, params_dst->path_info.asDit2[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asDac[0].abSrcOnOff),
-		params_src->path_info.asDac[0].abSrcOnOff, params_dst->path_info.asDac[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asDac[1].abSrcOnOff),
-		params_src->path_info.asDac[1].abSrcOnOff, params_dst->path_info.asDac[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asAe[0].abSrcOnOff),
-		params_src->path_info.asAe[0].abSrcOnOff, params_dst->path_info.asAe[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asCdsp[0].abSrcOnOff),
-		params_src->path_info.asCdsp[0].abSrcOnOff, params_dst->path_info.asCdsp[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asCdsp[1].abSrcOnOff),
-		params_src->path_info.asCdsp[1].abSrcOnOff, params_dst->path_info.asCdsp[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asCdsp[2].abSrcOnOff),
-		params_src->path_info.asCdsp[2].abSrcOnOff, params_dst->path_info.asCdsp[2].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asCdsp[3].abSrcOnOff),
-		params_src->path_info.asCdsp[3].abSrcOnOff, params_dst->path_info.asCdsp[3].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asAdc0[0].abSrcOnOff),
-		params_src->path_info.asAdc0[0].abSrcOnOff, params_dst->path_info.asAdc0[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asAdc0[1].abSrcOnOff),
-		params_src->path_info.asAdc0[1].abSrcOnOff, params_dst->path_info.asAdc0[1].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asAdc1[0].abSrcOnOff),
-		params_src->path_info.asAdc1[0].abSrcOnOff, params_dst->path_info.asAdc1[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asMix[0].abSrcOnOff),
-		params_src->path_info.asMix[0].abSrcOnOff, params_dst->path_info.asMix[0].abSrcOnOff);
-	yamaha_mc1n2_audio_params_route_path_array_merge(sizeof(params_src->path_info.asBias[0].abSrcOnOff),
-		params_src->path_info.asBias[0].abSrcOnOff, params_dst->path_info.asBias[0].abSrcOnOff);
-
-	// dac_info
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->dac_info.bMasterSwap),
-		&params_src->dac_info.bMasterSwap, &params_dst->dac_info.bMasterSwap);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->dac_info.bVoiceSwap),
-		&params_src->dac_info.bVoiceSwap, &params_dst->dac_info.bVoiceSwap);
-	yamaha_mc1n2_audio_params_route_simple_array_merge(sizeof(params_src->dac_info.bDcCut),
-		&params_src->dac_info.bDcCut, &params_dst->dac_info.bDcCut);
+	for(i=0 ; i < yamaha_mc1n2_audio_merge_fields_count ; i++) {
+		field = &yamaha_mc1n2_audio_merge_fields[i];
+		src = (unsigned char *) params_src + field->offset;
+		dst = (unsigned char *) params_dst + field->offset;
+
+		switch(field->kind) {
+			case YAMAHA_MC1N2_AUDIO_MERGE_SIMPLE:
+				yamaha_mc1n2_audio_params_route_simple_array_merge(field->size, src, dst);
+				break;
+			case YAMAHA_MC1N2_AUDIO_MERGE_PATH:
+				yamaha_mc1n2_audio_params_route_path_array_merge(field->size, src, dst);
+				break;
+		}
+	}
 
 	return 0;
 }
 
-int yamaha_mc1n2_audio_route_start(struct yamaha_mc1n2_audio_pdata *pdata)
+/*
+ * Paths enabled by either params stay enabled, other paths disabled by
+ * either params are disabled.
+ */
+int yamaha_mc1n2_audio_params_route_path_array_union(int length,
+	unsigned char *array_src, unsigned char *array_dst)
+{
+	unsigned char on, off;
+	int i;
+
+	if(length <= 0 || array_src == NULL || array_dst == NULL)
+		return -1;
+
+	for(i=0 ; i < length ; i++) {
+		// Pairs with both bits set are OFF, as with the merge
+		on = ((array_src[i] & ~(array_src[i] >> 1)) |
+			(array_dst[i] & ~(array_dst[i] >> 1))) & 0x55;
+		off = ((array_src[i] | array_dst[i]) >> 1) & 0x55 & ~on;
+
+		array_dst[i] = on | (off << 1);
+	}
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_params_route_union(
+	struct yamaha_mc1n2_audio_params_route *params_src,
+	struct yamaha_mc1n2_audio_params_route *params_dst)
+{
+	struct yamaha_mc1n2_audio_merge_field *field;
+	unsigned char *src;
+	unsigned char *dst;
+	int i;
+
+	if(params_src == NULL || params_dst == NULL)
+		return -1;
+
+	for(i=0 ; i < yamaha_mc1n2_audio_merge_fields_count ; i++) {
+		field = &yamaha_mc1n2_audio_merge_fields[i];
+		src = (unsigned char *) params_src + field->offset;
+		dst = (unsigned char *) params_dst + field->offset;
+
+		switch(field->kind) {
+			case YAMAHA_MC1N2_AUDIO_MERGE_SIMPLE:
+				yamaha_mc1n2_audio_params_route_simple_array_merge(field->size, src, dst);
+				break;
+			case YAMAHA_MC1N2_AUDIO_MERGE_PATH:
+				yamaha_mc1n2_audio_params_route_path_array_union(field->size, src, dst);
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Combined devices without a route of their own, such as speaker and wired
+ * headset for ringtones, get the union of their member routes. The result
+ * is kept in the route cache along with the rest of the merge.
+ */
+int yamaha_mc1n2_audio_params_route_get(struct yamaha_mc1n2_audio_pdata *pdata,
+	audio_devices_t device, enum yamaha_mc1n2_audio_direction direction,
+	struct yamaha_mc1n2_audio_params_route *params)
+{
+	struct yamaha_mc1n2_audio_params_route *params_route;
+	audio_devices_t members;
+	audio_devices_t member;
+	int found = 0;
+
+	params_route = yamaha_mc1n2_audio_params_route_find(pdata, device, direction);
+	if(params_route != NULL) {
+		memcpy(params, params_route, sizeof(struct yamaha_mc1n2_audio_params_route));
+		return 0;
+	}
+
+	members = device & ~AUDIO_DEVICE_BIT_IN;
+	if(members == 0 || (members & (members - 1)) == 0)
+		return -1;
+
+	memset(params, 0, sizeof(struct yamaha_mc1n2_audio_params_route));
+
+	while(members != 0) {
+		member = (members & (~members + 1)) | (device & AUDIO_DEVICE_BIT_IN);
+		members &= members - 1;
+
+		params_route = yamaha_mc1n2_audio_params_route_find(pdata, member, direction);
+		if(params_route == NULL) {
+			ALOGE("No route for member device 0x%x of 0x%x", member, device);
+			continue;
+		}
+
+		yamaha_mc1n2_audio_params_route_union(params_route, params);
+		found = 1;
+	}
+
+	if(!found)
+		return -1;
+
+	params->device = device;
+	params->direction = direction;
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_route_build(struct yamaha_mc1n2_audio_pdata *pdata,
+	struct yamaha_mc1n2_audio_params_route *params)
 {
-	struct yamaha_mc1n2_audio_params_route *params_route = NULL;
 	struct yamaha_mc1n2_audio_params_init *params_init = NULL;
-	struct yamaha_mc1n2_audio_params_route *params = NULL;
 	struct yamaha_mc1n2_audio_params_route params_src;
 	struct yamaha_mc1n2_audio_params_route params_dst;
-
 	int rc;
 
-	ALOGD("%s()", __func__);
-
-	if(pdata == NULL || pdata->ops == NULL)
+	if(pdata == NULL || pdata->ops == NULL || params == NULL)
 		return -1;
 
 	params_init = pdata->ops->params.init;
@@ -354,147 +624,312 @@ int yamaha_mc1n2_audio_route_start(struct yamaha_mc1n2_audio_pdata *pdata)
 
 output_merge:
 	if(pdata->output_state) {
-		params_route = yamaha_mc1n2_audio_params_route_find(pdata,
-			pdata->output_device, YAMAHA_MC1N2_AUDIO_DIRECTION_OUTPUT);
-		if(params_route == NULL)
+		rc = yamaha_mc1n2_audio_params_route_get(pdata,
+			pdata->output_device, YAMAHA_MC1N2_AUDIO_DIRECTION_OUTPUT, &params_dst);
+		if(rc < 0)
 			goto input_merge;
 
-		memcpy(&params_dst, params_route, sizeof(params_dst));
 		yamaha_mc1n2_audio_params_route_merge(&params_src, &params_dst);
 		memcpy(&params_src, &params_dst, sizeof(params_src));
 	}
 
 input_merge:
 	if(pdata->input_state) {
-		params_route = yamaha_mc1n2_audio_params_route_find(pdata,
-			pdata->input_device, YAMAHA_MC1N2_AUDIO_DIRECTION_INPUT);
-		if(params_route == NULL)
+		rc = yamaha_mc1n2_audio_params_route_get(pdata,
+			pdata->input_device, YAMAHA_MC1N2_AUDIO_DIRECTION_INPUT, &params_dst);
+		if(rc < 0)
 			goto modem_merge;
 
-		memcpy(&params_dst, params_route, sizeof(params_dst));
 		yamaha_mc1n2_audio_params_route_merge(&params_src, &params_dst);
 		memcpy(&params_src, &params_dst, sizeof(params_src));
 	}
 
 modem_merge:
 	if(pdata->modem_state) {
-		params_route = yamaha_mc1n2_audio_params_route_find(pdata,
-			pdata->output_device, YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM);
-		if(params_route == NULL)
-			goto route_start;
+		rc = yamaha_mc1n2_audio_params_route_get(pdata,
+			pdata->output_device, YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM, &params_dst);
+		if(rc < 0)
+			goto route_build;
 
-		memcpy(&params_dst, params_route, sizeof(params_dst));
 		yamaha_mc1n2_audio_params_route_merge(&params_src, &params_dst);
 		memcpy(&params_src, &params_dst, sizeof(params_src));
 	}
 
-route_start:
-	params = &(params_src);
+route_build:
+	memcpy(params, &params_src, sizeof(params_src));
 
-	rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_AUDIOENGINE,
-		&params->ae_info, 0x0f);
-	if(rc < 0) {
-		ALOGE("SET_AUDIOENGINE IOCTL failed, aborting!");
-		return -1;
-	}
+	return 0;
+}
 
-	rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_PATH,
-		&params->path_info, 0x00);
-	if(rc < 0) {
-		ALOGE("SET_PATH IOCTL failed, aborting!");
-		return -1;
+void yamaha_mc1n2_audio_route_cache_invalidate(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata == NULL)
+		return;
+
+	pdata->route_cache_generation++;
+}
+
+struct yamaha_mc1n2_audio_params_route *
+	yamaha_mc1n2_audio_route_cache_get(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_route_cache *cache = NULL;
+	audio_devices_t output_device;
+	audio_devices_t input_device;
+	int modem_rate;
+	int rc;
+	int i;
+
+	// Devices of inactive directions have no effect on the merge
+	output_device = pdata->output_state || pdata->modem_state ?
+		pdata->output_device : 0;
+	input_device = pdata->input_state ? pdata->input_device : 0;
+	modem_rate = pdata->modem_state ? pdata->modem_rate : 0;
+
+	pdata->route_cache_clock++;
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_ROUTE_CACHE_SIZE ; i++) {
+		if(!pdata->route_cache[i].valid ||
+			pdata->route_cache[i].generation != pdata->route_cache_generation)
+			continue;
+
+		if(pdata->route_cache[i].output_state == pdata->output_state &&
+			pdata->route_cache[i].input_state == pdata->input_state &&
+			pdata->route_cache[i].modem_state == pdata->modem_state &&
+			pdata->route_cache[i].modem_rate == modem_rate &&
+			pdata->route_cache[i].output_device == output_device &&
+			pdata->route_cache[i].input_device == input_device) {
+			pdata->route_cache[i].used = pdata->route_cache_clock;
+			return &pdata->route_cache[i].params;
+		}
 	}
 
-	rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_DAC,
-		&params->dac_info, 0x07);
-	if(rc < 0) {
-		ALOGE("SET_DAC IOCTL failed, aborting!");
-		return -1;
+	// Replace a stale entry or else the least recently used one
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_ROUTE_CACHE_SIZE ; i++) {
+		if(!pdata->route_cache[i].valid ||
+			pdata->route_cache[i].generation != pdata->route_cache_generation) {
+			cache = &pdata->route_cache[i];
+			break;
+		}
+
+		if(cache == NULL || (int) (pdata->route_cache[i].used - cache->used) < 0)
+			cache = &pdata->route_cache[i];
 	}
 
-	return 0;
+	cache->valid = 0;
+
+	rc = yamaha_mc1n2_audio_route_build(pdata, &cache->params);
+	if(rc < 0)
+		return NULL;
+
+	cache->valid = 1;
+	cache->generation = pdata->route_cache_generation;
+	cache->used = pdata->route_cache_clock;
+	cache->output_state = pdata->output_state;
+	cache->input_state = pdata->input_state;
+	cache->modem_state = pdata->modem_state;
+	cache->modem_rate = modem_rate;
+	cache->output_device = output_device;
+	cache->input_device = input_device;
+
+	return &cache->params;
 }
 
-int yamaha_mc1n2_audio_output_start(struct yamaha_mc1n2_audio_pdata *pdata)
+void yamaha_mc1n2_audio_route_shadow_invalidate(struct yamaha_mc1n2_audio_pdata *pdata)
 {
-	int rc;
+	if(pdata == NULL)
+		return;
 
-	ALOGD("%s()", __func__);
+	pdata->route_shadow_valid = 0;
+	pdata->route_shadow_ae_blocks = 0;
+}
 
-	if(pdata == NULL || pdata->ops == NULL)
-		return -1;
+#define YAMAHA_MC1N2_AUDIO_AE_BLOCK(field, flag, onoff) \
+	{ flag, onoff, offsetof(MCDRV_AE_INFO, field), \
+	sizeof(((MCDRV_AE_INFO *) 0)->field) }
+
+struct yamaha_mc1n2_audio_ae_block yamaha_mc1n2_audio_ae_blocks[] = {
+	YAMAHA_MC1N2_AUDIO_AE_BLOCK(abBex, MCDRV_AEUPDATE_FLAG_BEX, MCDRV_BEXWIDE_ON),
+	YAMAHA_MC1N2_AUDIO_AE_BLOCK(abWide, MCDRV_AEUPDATE_FLAG_WIDE, MCDRV_BEXWIDE_ON),
+	YAMAHA_MC1N2_AUDIO_AE_BLOCK(abDrc, MCDRV_AEUPDATE_FLAG_DRC, MCDRV_DRC_ON),
+	YAMAHA_MC1N2_AUDIO_AE_BLOCK(abEq5, MCDRV_AEUPDATE_FLAG_EQ5, MCDRV_EQ5_ON),
+	YAMAHA_MC1N2_AUDIO_AE_BLOCK(abEq3, MCDRV_AEUPDATE_FLAG_EQ3, MCDRV_EQ3_ON),
+};
 
-	pdata->output_state = 1;
+int yamaha_mc1n2_audio_ae_blocks_count = sizeof(yamaha_mc1n2_audio_ae_blocks) /
+	sizeof(struct yamaha_mc1n2_audio_ae_block);
 
-	rc = yamaha_mc1n2_audio_route_start(pdata);
-	if(rc < 0) {
-		ALOGE("Route start failed, aborting!");
-		return -1;
-	}
+struct yamaha_mc1n2_audio_ae_preset *
+	yamaha_mc1n2_audio_ae_preset_find(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	audio_devices_t device;
+	int i;
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_MEDIA_PLAY_START);
-	if(rc < 0) {
-		ALOGE("NOTIFY_MEDIA_PLAY_START IOCTL failed, aborting!");
-		return -1;
+	if(pdata->ae_preset_name[0] == '\0')
+		return NULL;
+
+	device = pdata->output_state || pdata->modem_state ? pdata->output_device : 0;
+	if(device == 0)
+		return NULL;
+
+	if((device & (device - 1)) == 0)
+		return pdata->ae_presets_index[ffs(device) - 1];
+
+	for(i=0 ; i < pdata->ae_presets_count ; i++) {
+		if((pdata->ae_presets[i].device & device) != 0 &&
+			strcmp(pdata->ae_presets[i].name, pdata->ae_preset_name) == 0)
+			return &pdata->ae_presets[i];
 	}
 
-	return 0;
+	return NULL;
 }
 
-int yamaha_mc1n2_audio_output_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+int yamaha_mc1n2_audio_ae_apply(struct yamaha_mc1n2_audio_pdata *pdata,
+	struct yamaha_mc1n2_audio_params_route *params)
 {
+	struct yamaha_mc1n2_audio_ae_preset *preset;
+	struct yamaha_mc1n2_audio_ae_block *block;
+	MCDRV_AE_INFO *shadow;
+	MCDRV_AE_INFO *ae_info;
+	unsigned long update_info;
 	int rc;
+	int i;
 
-	ALOGD("%s()", __func__);
+	shadow = &pdata->route_shadow.ae_info;
 
-	if(pdata == NULL || pdata->ops == NULL)
-		return -1;
+	preset = yamaha_mc1n2_audio_ae_preset_find(pdata);
+	ae_info = preset != NULL ? &preset->ae_info : &params->ae_info;
 
-	pdata->output_state = 0;
+	// One update flag per engine for the on/off state
+	if(pdata->route_shadow_valid & YAMAHA_MC1N2_AUDIO_SHADOW_AE)
+		update_info = (ae_info->bOnOff ^ shadow->bOnOff) & 0x0f;
+	else
+		update_info = 0x0f;
 
-	rc = yamaha_mc1n2_audio_route_start(pdata);
-	if(rc < 0) {
-		ALOGE("Route start failed, aborting!");
-		return -1;
+	for(i=0 ; i < yamaha_mc1n2_audio_ae_blocks_count ; i++) {
+		block = &yamaha_mc1n2_audio_ae_blocks[i];
+
+		if(!(ae_info->bOnOff & block->onoff))
+			continue;
+
+		if(!(pdata->route_shadow_ae_blocks & block->update_flag) ||
+			memcmp((unsigned char *) ae_info + block->offset,
+			(unsigned char *) shadow + block->offset, block->size) != 0)
+			update_info |= block->update_flag;
 	}
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_MEDIA_PLAY_STOP);
+	if(update_info == 0)
+		return 0;
+
+	rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_AUDIOENGINE,
+		ae_info, update_info);
 	if(rc < 0) {
-		ALOGE("NOTIFY_MEDIA_PLAY_STOP IOCTL failed, aborting!");
+		ALOGE("SET_AUDIOENGINE IOCTL failed, aborting!");
+		pdata->route_shadow_valid &= ~YAMAHA_MC1N2_AUDIO_SHADOW_AE;
+		pdata->route_shadow_ae_blocks = 0;
 		return -1;
 	}
 
+	shadow->bOnOff = ae_info->bOnOff;
+
+	for(i=0 ; i < yamaha_mc1n2_audio_ae_blocks_count ; i++) {
+		block = &yamaha_mc1n2_audio_ae_blocks[i];
+
+		if(!(update_info & block->update_flag))
+			continue;
+
+		memcpy((unsigned char *) shadow + block->offset,
+			(unsigned char *) ae_info + block->offset, block->size);
+		pdata->route_shadow_ae_blocks |= block->update_flag;
+	}
+
+	pdata->route_shadow_valid |= YAMAHA_MC1N2_AUDIO_SHADOW_AE;
+
 	return 0;
 }
 
-int yamaha_mc1n2_audio_input_start(struct yamaha_mc1n2_audio_pdata *pdata)
+int yamaha_mc1n2_audio_route_apply(struct yamaha_mc1n2_audio_pdata *pdata,
+	struct yamaha_mc1n2_audio_params_route *params)
 {
+	struct yamaha_mc1n2_audio_params_route *shadow;
+	MCDRV_PATH_INFO path_info;
+	unsigned char *path_src;
+	unsigned char *path_shadow;
+	unsigned char *path_dst;
+	unsigned long update_info;
+	int changed;
 	int rc;
+	int i;
 
-	ALOGD("%s()", __func__);
+	shadow = &pdata->route_shadow;
 
-	if(pdata == NULL || pdata->ops == NULL)
+	rc = yamaha_mc1n2_audio_ae_apply(pdata, params);
+	if(rc < 0)
 		return -1;
 
-	pdata->input_state = 1;
+	// Zero path bytes leave the sources untouched, so only changes are sent
+	if(pdata->route_shadow_valid & YAMAHA_MC1N2_AUDIO_SHADOW_PATH) {
+		path_src = (unsigned char *) &params->path_info;
+		path_shadow = (unsigned char *) &shadow->path_info;
+		path_dst = (unsigned char *) &path_info;
+		changed = 0;
+
+		for(i=0 ; i < (int) sizeof(MCDRV_PATH_INFO) ; i++) {
+			if(path_src[i] != path_shadow[i]) {
+				path_dst[i] = path_src[i];
+				changed = 1;
+			} else {
+				path_dst[i] = 0;
+			}
+		}
+	} else {
+		memcpy(&path_info, &params->path_info, sizeof(path_info));
+		changed = 1;
+	}
 
-	rc = yamaha_mc1n2_audio_route_start(pdata);
-	if(rc < 0) {
-		ALOGE("Route start failed, aborting!");
-		return -1;
+	if(changed) {
+		rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_PATH,
+			&path_info, 0x00);
+		if(rc < 0) {
+			ALOGE("SET_PATH IOCTL failed, aborting!");
+			pdata->route_shadow_valid &= ~YAMAHA_MC1N2_AUDIO_SHADOW_PATH;
+			return -1;
+		}
+
+		memcpy(&shadow->path_info, &params->path_info, sizeof(shadow->path_info));
+		pdata->route_shadow_valid |= YAMAHA_MC1N2_AUDIO_SHADOW_PATH;
 	}
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_VOICE_REC_START);
-	if(rc < 0) {
-		ALOGE("NOTIFY_VOICE_REC_START IOCTL failed, aborting!");
-		return -1;
+	if(pdata->route_shadow_valid & YAMAHA_MC1N2_AUDIO_SHADOW_DAC) {
+		update_info = 0;
+		if(params->dac_info.bMasterSwap != shadow->dac_info.bMasterSwap)
+			update_info |= MCDRV_DAC_MSWP_UPDATE_FLAG;
+		if(params->dac_info.bVoiceSwap != shadow->dac_info.bVoiceSwap)
+			update_info |= MCDRV_DAC_VSWP_UPDATE_FLAG;
+		if(params->dac_info.bDcCut != shadow->dac_info.bDcCut)
+			update_info |= MCDRV_DAC_HPF_UPDATE_FLAG;
+	} else {
+		update_info = 0x07;
+	}
+
+	if(update_info != 0) {
+		rc = yamaha_mc1n2_audio_ioctl_set_ctrl(pdata, MCDRV_SET_DAC,
+			&params->dac_info, update_info);
+		if(rc < 0) {
+			ALOGE("SET_DAC IOCTL failed, aborting!");
+			pdata->route_shadow_valid &= ~YAMAHA_MC1N2_AUDIO_SHADOW_DAC;
+			return -1;
+		}
+
+		memcpy(&shadow->dac_info, &params->dac_info, sizeof(shadow->dac_info));
+		pdata->route_shadow_valid |= YAMAHA_MC1N2_AUDIO_SHADOW_DAC;
 	}
 
 	return 0;
 }
 
-int yamaha_mc1n2_audio_input_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+int yamaha_mc1n2_audio_route_start(struct yamaha_mc1n2_audio_pdata *pdata)
 {
+	struct yamaha_mc1n2_audio_params_route *params = NULL;
 	int rc;
 
 	ALOGD("%s()", __func__);
@@ -502,7 +937,39 @@ int yamaha_mc1n2_audio_input_stop(struct yamaha_mc1n2_audio_pdata *pdata)
 	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
 
-	pdata->input_state = 0;
+	params = yamaha_mc1n2_audio_route_cache_get(pdata);
+	if(params == NULL) {
+		ALOGE("Unable to build route params!");
+		return -1;
+	}
+
+	return yamaha_mc1n2_audio_route_apply(pdata, params);
+}
+
+int yamaha_mc1n2_audio_state_apply(struct yamaha_mc1n2_audio_pdata *pdata,
+	enum yamaha_mc1n2_audio_direction direction, int state)
+{
+	unsigned long command;
+	int rc;
+
+	ALOGD("%s(%d, %d)", __func__, direction, state);
+
+	switch(direction) {
+		case YAMAHA_MC1N2_AUDIO_DIRECTION_OUTPUT:
+			pdata->output_state = state;
+			command = state ? MCDRV_NOTIFY_MEDIA_PLAY_START : MCDRV_NOTIFY_MEDIA_PLAY_STOP;
+			break;
+		case YAMAHA_MC1N2_AUDIO_DIRECTION_INPUT:
+			pdata->input_state = state;
+			command = state ? MCDRV_NOTIFY_VOICE_REC_START : MCDRV_NOTIFY_VOICE_REC_STOP;
+			break;
+		case YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM:
+			pdata->modem_state = state;
+			command = state ? MCDRV_NOTIFY_CALL_START : MCDRV_NOTIFY_CALL_STOP;
+			break;
+		default:
+			return -1;
+	}
 
 	rc = yamaha_mc1n2_audio_route_start(pdata);
 	if(rc < 0) {
@@ -510,65 +977,441 @@ int yamaha_mc1n2_audio_input_stop(struct yamaha_mc1n2_audio_pdata *pdata)
 		return -1;
 	}
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_VOICE_REC_STOP);
+	// The driver may reconfigure the codec for calls
+	if(direction == YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM)
+		yamaha_mc1n2_audio_route_shadow_invalidate(pdata);
+
+	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, command);
 	if(rc < 0) {
-		ALOGE("NOTIFY_VOICE_REC_START IOCTL failed, aborting!");
+		ALOGE("NOTIFY IOCTL (0x%lx) failed, aborting!", command);
 		return -1;
 	}
 
 	return 0;
 }
 
-int yamaha_mc1n2_audio_modem_start(struct yamaha_mc1n2_audio_pdata *pdata)
+/*
+ * Worker
+ */
+
+int64_t yamaha_mc1n2_audio_time(void)
 {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void yamaha_mc1n2_audio_holdoff_expire(struct yamaha_mc1n2_audio_pdata *pdata,
+	enum yamaha_mc1n2_audio_direction direction)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
+	int64_t deadline;
+
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&pdata->lock);
+	pthread_mutex_lock(&worker->lock);
+
+	// The stop may have been cancelled or rescheduled meanwhile
+	deadline = worker->stop_deadline[direction];
+	if(deadline == 0 || (worker->running && deadline > yamaha_mc1n2_audio_time())) {
+		pthread_mutex_unlock(&worker->lock);
+		pthread_mutex_unlock(&pdata->lock);
+		return;
+	}
+
+	worker->stop_deadline[direction] = 0;
+	worker->stops_done[direction]++;
+
+	pthread_mutex_unlock(&worker->lock);
+
+	yamaha_mc1n2_audio_state_apply(pdata, direction, 0);
+
+	pthread_mutex_unlock(&pdata->lock);
+}
+
+void *yamaha_mc1n2_audio_worker_thread(void *data)
+{
+	struct yamaha_mc1n2_audio_pdata *pdata;
+	struct yamaha_mc1n2_audio_worker *worker;
+	struct timeval tv;
+	struct timespec ts;
+	int64_t deadline;
+	int64_t timeout;
+	int direction;
 	int rc;
+	int i;
+
+	pdata = (struct yamaha_mc1n2_audio_pdata *) data;
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&worker->lock);
+
+	while(1) {
+		if(!worker->pending) {
+			deadline = 0;
+			direction = 0;
+
+			for(i=0 ; i < YAMAHA_MC1N2_AUDIO_DIRECTION_MAX ; i++) {
+				if(worker->stop_deadline[i] != 0 &&
+					(deadline == 0 || worker->stop_deadline[i] < deadline)) {
+					deadline = worker->stop_deadline[i];
+					direction = i;
+				}
+			}
+
+			if(deadline == 0) {
+				if(!worker->running)
+					break;
+
+				pthread_cond_wait(&worker->cond, &worker->lock);
+				continue;
+			}
+
+			// Deferred stops are flushed when the worker stops
+			timeout = deadline - yamaha_mc1n2_audio_time();
+			if(worker->running && timeout > 0) {
+				gettimeofday(&tv, NULL);
+				ts.tv_sec = tv.tv_sec + timeout / 1000000;
+				ts.tv_nsec = (tv.tv_usec + timeout % 1000000) * 1000;
+				if(ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+
+				pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+				continue;
+			}
+
+			pthread_mutex_unlock(&worker->lock);
+
+			yamaha_mc1n2_audio_holdoff_expire(pdata,
+				(enum yamaha_mc1n2_audio_direction) direction);
+
+			pthread_mutex_lock(&worker->lock);
+			continue;
+		}
+
+		worker->time_started = yamaha_mc1n2_audio_time();
+
+		pthread_mutex_unlock(&worker->lock);
+
+		rc = yamaha_mc1n2_audio_output_start(pdata);
+
+		pthread_mutex_lock(&worker->lock);
+
+		worker->rc = rc;
+		worker->time_done = yamaha_mc1n2_audio_time();
+		worker->pending = 0;
+		pthread_cond_broadcast(&worker->done_cond);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+int yamaha_mc1n2_audio_output_start_async(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
 
 	ALOGD("%s()", __func__);
 
 	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
 
-	pdata->modem_state = 1;
+	worker = &pdata->worker;
 
-	rc = yamaha_mc1n2_audio_route_start(pdata);
-	if(rc < 0) {
-		ALOGE("Route start failed, aborting!");
-		return -1;
+	pthread_mutex_lock(&worker->lock);
+
+	if(!worker->running) {
+		pthread_mutex_unlock(&worker->lock);
+		return yamaha_mc1n2_audio_output_start(pdata);
 	}
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_CALL_START);
-	if(rc < 0) {
-		ALOGE("NOTIFY_CALL_START IOCTL failed, aborting!");
+	// Only a single start can be in flight, a new one waits for the last
+	while(worker->pending)
+		pthread_cond_wait(&worker->done_cond, &worker->lock);
+
+	worker->time_queued = yamaha_mc1n2_audio_time();
+	worker->time_started = worker->time_queued;
+	worker->time_done = worker->time_queued;
+	worker->rc = 0;
+	worker->pending = 1;
+
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	return 0;
+}
+
+int yamaha_mc1n2_audio_output_start_wait(struct yamaha_mc1n2_audio_pdata *pdata,
+	int64_t *time_started, int64_t *time_done)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
+	int rc;
+
+	if(pdata == NULL || pdata->ops == NULL)
+		return -1;
+
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&worker->lock);
+
+	while(worker->pending)
+		pthread_cond_wait(&worker->done_cond, &worker->lock);
+
+	if(time_started != NULL)
+		*time_started = worker->time_started;
+	if(time_done != NULL)
+		*time_done = worker->time_done;
+
+	rc = worker->rc;
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return rc;
+}
+
+int yamaha_mc1n2_audio_worker_start(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
+	char value[PROPERTY_VALUE_MAX];
+	int rc;
+
+	if(pdata == NULL)
+		return -1;
+
+	worker = &pdata->worker;
+
+	if(worker->running)
+		return 0;
+
+	worker->pending = 0;
+	worker->rc = 0;
+	memset(worker->stop_deadline, 0, sizeof(worker->stop_deadline));
+
+	property_get(YAMAHA_MC1N2_AUDIO_HOLDOFF_PROPERTY, value, YAMAHA_MC1N2_AUDIO_HOLDOFF_DEFAULT);
+	worker->holdoff = atoi(value);
+	if(worker->holdoff < 0)
+		worker->holdoff = 0;
+
+	worker->running = 1;
+
+	rc = pthread_create(&worker->thread, NULL, yamaha_mc1n2_audio_worker_thread, pdata);
+	if(rc != 0) {
+		ALOGE("Unable to create worker thread, starting synchronously");
+		worker->running = 0;
 		return -1;
 	}
 
 	return 0;
 }
 
-int yamaha_mc1n2_audio_modem_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+void yamaha_mc1n2_audio_worker_stop(struct yamaha_mc1n2_audio_pdata *pdata)
 {
+	struct yamaha_mc1n2_audio_worker *worker;
+
+	if(pdata == NULL)
+		return;
+
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&worker->lock);
+
+	if(!worker->running) {
+		pthread_mutex_unlock(&worker->lock);
+		return;
+	}
+
+	// A pending start is completed before the thread exits
+	worker->running = 0;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_join(worker->thread, NULL);
+}
+
+int yamaha_mc1n2_audio_direction_start(struct yamaha_mc1n2_audio_pdata *pdata,
+	enum yamaha_mc1n2_audio_direction direction)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
 	int rc;
 
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&pdata->lock);
+	pthread_mutex_lock(&worker->lock);
+
+	// Starting again within the hold-off keeps the codec powered
+	if(worker->stop_deadline[direction] != 0) {
+		worker->stop_deadline[direction] = 0;
+		worker->stops_avoided[direction]++;
+
+		ALOGD("Avoided power cycle for direction %d (%u avoided)",
+			direction, worker->stops_avoided[direction]);
+
+		pthread_mutex_unlock(&worker->lock);
+		pthread_mutex_unlock(&pdata->lock);
+
+		return 0;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	rc = yamaha_mc1n2_audio_state_apply(pdata, direction, 1);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
+}
+
+int yamaha_mc1n2_audio_direction_stop(struct yamaha_mc1n2_audio_pdata *pdata,
+	enum yamaha_mc1n2_audio_direction direction)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
+	int rc;
+
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&pdata->lock);
+	pthread_mutex_lock(&worker->lock);
+
+	if(worker->running && worker->holdoff > 0) {
+		worker->stop_deadline[direction] = yamaha_mc1n2_audio_time() +
+			(int64_t) worker->holdoff * 1000;
+		worker->stops_deferred[direction]++;
+
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+		pthread_mutex_unlock(&pdata->lock);
+
+		return 0;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	rc = yamaha_mc1n2_audio_state_apply(pdata, direction, 0);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
+}
+
+int yamaha_mc1n2_audio_dump(struct yamaha_mc1n2_audio_pdata *pdata, int fd)
+{
+	struct yamaha_mc1n2_audio_worker *worker;
+	char buffer[256];
+	int length;
+	int i;
+
+	ALOGD("%s(%d)", __func__, fd);
+
+	if(pdata == NULL)
+		return -1;
+
+	worker = &pdata->worker;
+
+	pthread_mutex_lock(&worker->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "Yamaha-MC1N2-Audio power-down hold-off: %d ms\n",
+		worker->holdoff);
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	for(i=0 ; i < YAMAHA_MC1N2_AUDIO_DIRECTION_MAX ; i++) {
+		length = snprintf(buffer, sizeof(buffer), "  [%d] stops: %u deferred, %u done, %u power cycles avoided%s\n",
+			i, worker->stops_deferred[i], worker->stops_done[i], worker->stops_avoided[i],
+			worker->stop_deadline[i] != 0 ? " (stop pending)" : "");
+		if(length > 0 && length < (int) sizeof(buffer))
+			write(fd, buffer, length);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_mutex_lock(&pdata->lock);
+
+	length = snprintf(buffer, sizeof(buffer), "Yamaha-MC1N2-Audio modem rate: %d Hz, %u switches, last %lld us, max %lld us\n",
+		pdata->modem_rate, pdata->modem_rate_switches, (long long) pdata->modem_rate_switch_time,
+		(long long) pdata->modem_rate_switch_time_max);
+	if(length > 0 && length < (int) sizeof(buffer))
+		write(fd, buffer, length);
+
+	if(pdata->backend != NULL && pdata->backend->dump != NULL)
+		pdata->backend->dump(pdata, fd);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return 0;
+}
+
+/*
+ * Directions
+ */
+
+int yamaha_mc1n2_audio_output_start(struct yamaha_mc1n2_audio_pdata *pdata)
+{
 	ALOGD("%s()", __func__);
 
 	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
 
-	pdata->modem_state = 0;
+	return yamaha_mc1n2_audio_direction_start(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_OUTPUT);
+}
 
-	rc = yamaha_mc1n2_audio_route_start(pdata);
-	if(rc < 0) {
-		ALOGE("Route start failed, aborting!");
+int yamaha_mc1n2_audio_output_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
-	}
 
-	rc = yamaha_mc1n2_audio_ioctl_notify(pdata, MCDRV_NOTIFY_CALL_STOP);
-	if(rc < 0) {
-		ALOGE("NOTIFY_CALL_START IOCTL failed, aborting!");
+	// A pending asynchronous start has to complete first
+	yamaha_mc1n2_audio_output_start_wait(pdata, NULL, NULL);
+
+	return yamaha_mc1n2_audio_direction_stop(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_OUTPUT);
+}
+
+int yamaha_mc1n2_audio_input_start(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
-	}
 
-	return 0;
+	return yamaha_mc1n2_audio_direction_start(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_INPUT);
+}
+
+int yamaha_mc1n2_audio_input_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
+		return -1;
+
+	return yamaha_mc1n2_audio_direction_stop(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_INPUT);
+}
+
+int yamaha_mc1n2_audio_modem_start(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
+		return -1;
+
+	return yamaha_mc1n2_audio_direction_start(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM);
+}
+
+int yamaha_mc1n2_audio_modem_stop(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
+		return -1;
+
+	return yamaha_mc1n2_audio_direction_stop(pdata, YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM);
 }
 
 /*
@@ -579,24 +1422,79 @@ int yamaha_mc1n2_audio_set_route(struct yamaha_mc1n2_audio_pdata *pdata,
 	audio_devices_t device)
 {
 	int changed = 0;
+	int rc = 0;
 
 	ALOGD("%s(%x)", __func__, device);
 
-	if(pdata == NULL)
+	if(pdata == NULL || device == 0)
 		return -1;
 
-	if(audio_is_output_device(device) && pdata->output_device != device) {
+	pthread_mutex_lock(&pdata->lock);
+
+	// Combined devices are routed as the union of their members
+	if((device & AUDIO_DEVICE_BIT_IN) == 0 && pdata->output_device != device) {
 		pdata->output_device = device;
 		changed = 1;
-	} else if(audio_is_input_device(device) && pdata->input_device != device) {
+	} else if((device & AUDIO_DEVICE_BIT_IN) != 0 && pdata->input_device != device) {
 		pdata->input_device = device;
 		changed = 1;
 	}
 
 	if(changed && (pdata->output_state || pdata->input_state || pdata->modem_state))
-		return yamaha_mc1n2_audio_route_start(pdata);
+		rc = yamaha_mc1n2_audio_route_start(pdata);
 
-	return 0;
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
+}
+
+/*
+ * The call is not restarted: only the route blocks that differ between the
+ * narrowband and wideband modem routes are written.
+ */
+int yamaha_mc1n2_audio_set_modem_rate(struct yamaha_mc1n2_audio_pdata *pdata,
+	int rate)
+{
+	int64_t time_start;
+	int64_t time;
+	int rc = 0;
+
+	ALOGD("%s(%d)", __func__, rate);
+
+	if(pdata == NULL)
+		return -1;
+
+	pthread_mutex_lock(&pdata->lock);
+
+	if(pdata->modem_rate == rate)
+		goto complete;
+
+	pdata->modem_rate = rate;
+
+	if(!pdata->modem_state)
+		goto complete;
+
+	time_start = yamaha_mc1n2_audio_time();
+
+	rc = yamaha_mc1n2_audio_route_start(pdata);
+	if(rc < 0) {
+		ALOGE("Unable to switch modem route to %d Hz", rate);
+		goto complete;
+	}
+
+	time = yamaha_mc1n2_audio_time() - time_start;
+
+	pdata->modem_rate_switches++;
+	pdata->modem_rate_switch_time = time;
+	if(time > pdata->modem_rate_switch_time_max)
+		pdata->modem_rate_switch_time_max = time;
+
+	ALOGD("Switched modem route to %d Hz in %lld us", rate, (long long) time);
+
+complete:
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
 }
 
 char *yamaha_mc1n2_audio_get_hw_node(struct yamaha_mc1n2_audio_pdata *pdata)
@@ -607,6 +1505,330 @@ char *yamaha_mc1n2_audio_get_hw_node(struct yamaha_mc1n2_audio_pdata *pdata)
 	return pdata->ops->hw_node;
 }
 
+/*
+ * Params
+ */
+
+void yamaha_mc1n2_audio_params_route_index(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_params_route *params;
+	audio_devices_t device;
+	int i;
+
+	memset(pdata->routes_index, 0, sizeof(pdata->routes_index));
+	memset(pdata->routes_index_wb, 0, sizeof(pdata->routes_index_wb));
+
+	params = pdata->ops->params.routes;
+	if(params == NULL)
+		return;
+
+	// The first matching route wins, as with a linear lookup
+	for(i=pdata->ops->params.routes_count - 1 ; i >= 0 ; i--) {
+		device = params[i].device;
+		if(device == 0 || (device & (device - 1)) != 0)
+			continue;
+
+		if(params[i].direction >= YAMAHA_MC1N2_AUDIO_DIRECTION_MAX)
+			continue;
+
+		if(params[i].rate == YAMAHA_MC1N2_AUDIO_MODEM_RATE_WB &&
+			params[i].direction == YAMAHA_MC1N2_AUDIO_DIRECTION_MODEM)
+			pdata->routes_index_wb[ffs(device) - 1] = &params[i];
+		else
+			pdata->routes_index[params[i].direction][ffs(device) - 1] = &params[i];
+	}
+}
+
+int yamaha_mc1n2_audio_params_load(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_params_header *header;
+	char path[PATH_MAX];
+	struct stat st;
+	void *data;
+	int fd;
+	int rc;
+
+	snprintf(path, sizeof(path), YAMAHA_MC1N2_AUDIO_PARAMS_FILE, pdata->name);
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		ALOGD("No params file, using built-in params");
+		return -1;
+	}
+
+	rc = fstat(fd, &st);
+	if(rc < 0 || st.st_size < (off_t) sizeof(struct yamaha_mc1n2_audio_params_header)) {
+		ALOGE("Invalid params file: %s", path);
+		goto error_fd;
+	}
+
+	// Params are used in place, the mapping is never written to
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(data == MAP_FAILED) {
+		ALOGE("Unable to map params file: %s", path);
+		goto error_fd;
+	}
+
+	close(fd);
+
+	header = (struct yamaha_mc1n2_audio_params_header *) data;
+
+	if(header->magic != YAMAHA_MC1N2_AUDIO_PARAMS_MAGIC ||
+		header->version != YAMAHA_MC1N2_AUDIO_PARAMS_VERSION) {
+		ALOGE("Unsupported params file: %s", path);
+		goto error_map;
+	}
+
+	if(header->init_size != sizeof(struct yamaha_mc1n2_audio_params_init) ||
+		header->route_size != sizeof(struct yamaha_mc1n2_audio_params_route)) {
+		ALOGE("Params file does not match params layout: %s", path);
+		goto error_map;
+	}
+
+	// Sizes are 32-bit on the target, bounds are checked without sums or
+	// products that could wrap
+	if(header->init_offset % sizeof(uint32_t) != 0 ||
+		header->routes_offset % sizeof(uint32_t) != 0 ||
+		header->init_offset > (size_t) st.st_size ||
+		header->init_size > (size_t) st.st_size - header->init_offset ||
+		header->routes_offset > (size_t) st.st_size ||
+		header->routes_count > ((size_t) st.st_size - header->routes_offset) / header->route_size) {
+		ALOGE("Truncated params file: %s", path);
+		goto error_map;
+	}
+
+	pdata->params_map = data;
+	pdata->params_map_size = st.st_size;
+
+	pdata->ops->params.init = (struct yamaha_mc1n2_audio_params_init *)
+		((unsigned char *) data + header->init_offset);
+	pdata->ops->params.routes = (struct yamaha_mc1n2_audio_params_route *)
+		((unsigned char *) data + header->routes_offset);
+	pdata->ops->params.routes_count = header->routes_count;
+
+	ALOGD("Loaded %d routes from params file: %s", header->routes_count, path);
+
+	return 0;
+
+error_map:
+	munmap(data, st.st_size);
+
+	return -1;
+
+error_fd:
+	close(fd);
+
+	return -1;
+}
+
+void yamaha_mc1n2_audio_params_unload(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	if(pdata->params_map == NULL)
+		return;
+
+	memcpy(&pdata->ops->params, &pdata->params_builtin, sizeof(pdata->ops->params));
+
+	munmap(pdata->params_map, pdata->params_map_size);
+	pdata->params_map = NULL;
+	pdata->params_map_size = 0;
+}
+
+/*
+ * AE presets
+ */
+
+void yamaha_mc1n2_audio_ae_presets_index(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_ae_preset *preset;
+	int i, j;
+
+	memset(pdata->ae_presets_index, 0, sizeof(pdata->ae_presets_index));
+
+	if(pdata->ae_preset_name[0] == '\0' || pdata->ae_presets == NULL)
+		return;
+
+	// The first preset matching a device wins
+	for(i=pdata->ae_presets_count - 1 ; i >= 0 ; i--) {
+		preset = &pdata->ae_presets[i];
+
+		if(strcmp(preset->name, pdata->ae_preset_name) != 0)
+			continue;
+
+		for(j=0 ; j < YAMAHA_MC1N2_AUDIO_ROUTES_INDEX_SIZE ; j++) {
+			if(preset->device & (1U << j))
+				pdata->ae_presets_index[j] = preset;
+		}
+	}
+}
+
+int yamaha_mc1n2_audio_ae_presets_load(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_ae_presets_header *header;
+	char path[PATH_MAX];
+	struct yamaha_mc1n2_audio_ae_preset *presets;
+	struct stat st;
+	void *data;
+	int fd;
+	int rc;
+	int i;
+
+	// Presets tuned on site take precedence over the system ones
+	snprintf(path, sizeof(path), YAMAHA_MC1N2_AUDIO_AE_PRESETS_DATA_FILE, pdata->name);
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		snprintf(path, sizeof(path), YAMAHA_MC1N2_AUDIO_AE_PRESETS_FILE, pdata->name);
+
+		fd = open(path, O_RDONLY);
+		if(fd < 0) {
+			ALOGD("No AE presets file");
+			return -1;
+		}
+	}
+
+	rc = fstat(fd, &st);
+	if(rc < 0 || st.st_size < (off_t) sizeof(struct yamaha_mc1n2_audio_ae_presets_header)) {
+		ALOGE("Invalid AE presets file: %s", path);
+		goto error_fd;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(data == MAP_FAILED) {
+		ALOGE("Unable to map AE presets file: %s", path);
+		goto error_fd;
+	}
+
+	close(fd);
+
+	header = (struct yamaha_mc1n2_audio_ae_presets_header *) data;
+
+	if(header->magic != YAMAHA_MC1N2_AUDIO_AE_PRESETS_MAGIC ||
+		header->version != YAMAHA_MC1N2_AUDIO_AE_PRESETS_VERSION ||
+		header->preset_size != sizeof(struct yamaha_mc1n2_audio_ae_preset)) {
+		ALOGE("Unsupported AE presets file: %s", path);
+		goto error_map;
+	}
+
+	if(header->presets_offset % sizeof(uint32_t) != 0 ||
+		header->presets_offset > (size_t) st.st_size ||
+		header->presets_count > ((size_t) st.st_size - header->presets_offset) / header->preset_size) {
+		ALOGE("Truncated AE presets file: %s", path);
+		goto error_map;
+	}
+
+	presets = (struct yamaha_mc1n2_audio_ae_preset *)
+		((unsigned char *) data + header->presets_offset);
+
+	// Names are compared as strings
+	for(i=0 ; i < (int) header->presets_count ; i++) {
+		if(memchr(presets[i].name, '\0', sizeof(presets[i].name)) == NULL) {
+			ALOGE("Unterminated AE preset name: %s", path);
+			goto error_map;
+		}
+	}
+
+	pdata->ae_presets_map = data;
+	pdata->ae_presets_map_size = st.st_size;
+
+	pdata->ae_presets = presets;
+	pdata->ae_presets_count = header->presets_count;
+
+	ALOGD("Loaded %d AE presets from file: %s", header->presets_count, path);
+
+	return 0;
+
+error_map:
+	munmap(data, st.st_size);
+
+	return -1;
+
+error_fd:
+	close(fd);
+
+	return -1;
+}
+
+void yamaha_mc1n2_audio_ae_presets_unload(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	memset(pdata->ae_presets_index, 0, sizeof(pdata->ae_presets_index));
+
+	pdata->ae_presets = NULL;
+	pdata->ae_presets_count = 0;
+
+	if(pdata->ae_presets_map == NULL)
+		return;
+
+	munmap(pdata->ae_presets_map, pdata->ae_presets_map_size);
+	pdata->ae_presets_map = NULL;
+	pdata->ae_presets_map_size = 0;
+}
+
+int yamaha_mc1n2_audio_ae_presets_apply(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	struct yamaha_mc1n2_audio_params_route *params;
+
+	if(!pdata->output_state && !pdata->input_state && !pdata->modem_state)
+		return 0;
+
+	params = yamaha_mc1n2_audio_route_cache_get(pdata);
+	if(params == NULL) {
+		ALOGE("Unable to build route params!");
+		return -1;
+	}
+
+	// Only the AE block differs, so this is a single delta ioctl at most
+	return yamaha_mc1n2_audio_ae_apply(pdata, params);
+}
+
+int yamaha_mc1n2_audio_ae_preset_set(struct yamaha_mc1n2_audio_pdata *pdata,
+	char *name)
+{
+	int rc;
+
+	ALOGD("%s(%s)", __func__, name);
+
+	if(pdata == NULL || pdata->ops == NULL || name == NULL)
+		return -1;
+
+	pthread_mutex_lock(&pdata->lock);
+
+	if(strcmp(name, "none") == 0)
+		name = "";
+
+	strncpy(pdata->ae_preset_name, name, sizeof(pdata->ae_preset_name) - 1);
+	pdata->ae_preset_name[sizeof(pdata->ae_preset_name) - 1] = '\0';
+
+	yamaha_mc1n2_audio_ae_presets_index(pdata);
+
+	rc = yamaha_mc1n2_audio_ae_presets_apply(pdata);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
+}
+
+int yamaha_mc1n2_audio_ae_presets_reload(struct yamaha_mc1n2_audio_pdata *pdata)
+{
+	int rc;
+
+	ALOGD("%s()", __func__);
+
+	if(pdata == NULL || pdata->ops == NULL)
+		return -1;
+
+	pthread_mutex_lock(&pdata->lock);
+
+	yamaha_mc1n2_audio_ae_presets_unload(pdata);
+	yamaha_mc1n2_audio_ae_presets_load(pdata);
+	yamaha_mc1n2_audio_ae_presets_index(pdata);
+
+	rc = yamaha_mc1n2_audio_ae_presets_apply(pdata);
+
+	pthread_mutex_unlock(&pdata->lock);
+
+	return rc;
+}
+
 /*
  * Init/Deinit
  */
@@ -646,6 +1868,9 @@ int yamaha_mc1n2_audio_start(struct yamaha_mc1n2_audio_pdata **pdata_p,
 	if(pdata_p == NULL || device_name == NULL)
 		return -1;
 
+	// Platform data is static, its locks are only initialized once
+	pthread_once(&yamaha_mc1n2_audio_platforms_once, yamaha_mc1n2_audio_platforms_init);
+
 	pdata = yamaha_mc1n2_audio_platform_get(device_name);
 	if(pdata == NULL || pdata->ops == NULL) {
 		ALOGE("Unable to find requested platform: %s", device_name);
@@ -653,6 +1878,27 @@ int yamaha_mc1n2_audio_start(struct yamaha_mc1n2_audio_pdata **pdata_p,
 	}
 
 	pdata->ops->hw_fd = -1;
+	pdata->modem_rate = YAMAHA_MC1N2_AUDIO_MODEM_RATE_NB;
+
+	// Host tools may have set another backend already
+	if(pdata->backend == NULL)
+		pdata->backend = &yamaha_mc1n2_audio_backend_hw;
+
+	// Built-in params are kept as fallback
+	if(pdata->params_map == NULL)
+		memcpy(&pdata->params_builtin, &pdata->ops->params, sizeof(pdata->params_builtin));
+
+	yamaha_mc1n2_audio_params_unload(pdata);
+	yamaha_mc1n2_audio_params_load(pdata);
+	yamaha_mc1n2_audio_params_route_index(pdata);
+
+	yamaha_mc1n2_audio_ae_presets_unload(pdata);
+	yamaha_mc1n2_audio_ae_presets_load(pdata);
+	yamaha_mc1n2_audio_ae_presets_index(pdata);
+
+	yamaha_mc1n2_audio_route_cache_invalidate(pdata);
+
+	yamaha_mc1n2_audio_worker_start(pdata);
 
 	*pdata_p = pdata;
 
@@ -666,9 +1912,14 @@ int yamaha_mc1n2_audio_stop(struct yamaha_mc1n2_audio_pdata *pdata)
 	if(pdata == NULL || pdata->ops == NULL)
 		return -1;
 
-	if(pdata->ops->hw_fd >= 0) {
-		close(pdata->ops->hw_fd);
-	}
+	yamaha_mc1n2_audio_worker_stop(pdata);
+
+	yamaha_mc1n2_audio_backend_close(pdata);
+
+	yamaha_mc1n2_audio_params_unload(pdata);
+	yamaha_mc1n2_audio_params_route_index(pdata);
+	yamaha_mc1n2_audio_ae_presets_unload(pdata);
+	yamaha_mc1n2_audio_route_cache_invalidate(pdata);
 
 	return 0;
 }